@@ -0,0 +1,617 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file HostPlatform.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the host platform of the trace replay.
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include "HostPlatform.h"
+#include "Time.h"
+#include "Mqtt.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Settings.h"
+
+/* Same GPIO as Door default */
+#define STRIKE_GPIO GPIO_NUM_13
+
+/* Size of the "allowlist" partition, see partitions.csv */
+#define ALLOWLIST_PARTITION_SIZE 0x80000
+
+/* Wall time before this is an unsynchronized clock, as in Time.cpp */
+#define WALL_TIME_VALID_AFTER 1704067200
+
+namespace host {
+
+FILE *out = stdout;
+bool verbose = false;
+
+static int64_t clock_us;
+static uint32_t wall_epoch;
+static int64_t wall_us;
+
+static uint8_t uart_data[255];
+static uint8_t uart_len;
+
+static uint32_t strikes;
+static int64_t last_strike_us;
+
+/* RAM partitions, allocated once: esp_partition_t pointers stay valid */
+struct partition_t {
+	esp_partition_t info;
+	std::vector<uint8_t> data;
+};
+static std::deque<partition_t> partitions;
+
+/* FreeRTOS queue: a FIFO of fixed size items */
+struct queue_t {
+	uint32_t length;
+	uint32_t item_size;
+	std::deque<std::vector<uint8_t>> items;
+};
+
+std::vector<std::string> replies;
+
+/* NVS values by "namespace/key", handles index the opened namespaces */
+static std::map<std::string, uint32_t> nvs;
+static std::map<std::string, std::vector<uint8_t>> nvs_blobs;
+static std::vector<std::string> nvs_handles;
+
+int64_t now_us(){
+	return clock_us;
+}
+
+const char *stamp(){
+
+	static char text[32];
+
+	snprintf(text, sizeof(text), "[%6lld.%06lld]", (long long)(clock_us / 1000000), (long long)(clock_us % 1000000));
+
+	return text;
+}
+
+void reset(int64_t us){
+	clock_us = us;
+	wall_epoch = 0;
+	wall_us = us;
+	uart_len = 0;
+	strikes = 0;
+	last_strike_us = 0;
+	nvs.clear();
+	nvs_blobs.clear();
+}
+
+void run_until(int64_t us){
+	if (us > clock_us)
+		clock_us = us;
+}
+
+void set_wall(uint32_t epoch, int64_t us){
+	wall_epoch = epoch;
+	wall_us = us;
+}
+
+void uart_feed(const uint8_t *data, uint8_t len){
+	memcpy(uart_data, data, len);
+	uart_len = len;
+}
+
+uint32_t strike_count(){
+	return strikes;
+}
+
+int64_t strike_us(){
+	return last_strike_us;
+}
+
+bool load_allowlist(const char *path){
+
+	FILE *f = fopen(path, "rb");
+	std::vector<uint8_t> image;
+
+	if (!f)
+		return false;
+
+	uint8_t buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		image.insert(image.end(), buffer, buffer + n);
+	fclose(f);
+
+	/* Image in slot A of an erased partition, as parttool.py writes it */
+	if (image.size() > ALLOWLIST_PARTITION_SIZE / 2){
+		fprintf(stderr, "%s: larger than an allowlist slot\n", path);
+		return false;
+	}
+
+	memcpy(add_partition("allowlist", 0x41, ALLOWLIST_PARTITION_SIZE), image.data(), image.size());
+
+	return true;
+}
+
+uint8_t *add_partition(const char *label, int subtype, uint32_t size){
+
+	/* Same label: a fresh erased partition in place of the old one */
+	for (partition_t &old : partitions){
+		if (!strcmp(old.info.label, label)){
+			old.info.subtype = subtype;
+			old.info.size = size;
+			old.data.assign(size, 0xff);
+			return old.data.data();
+		}
+	}
+
+	partition_t &p = partitions.emplace_back();
+
+	p.info.type = ESP_PARTITION_TYPE_DATA;
+	p.info.subtype = subtype;
+	p.info.size = size;
+	snprintf(p.info.label, sizeof(p.info.label), "%s", label);
+	p.data.assign(size, 0xff);
+
+	return p.data.data();
+}
+
+static partition_t *find_partition(const esp_partition_t *partition){
+
+	for (partition_t &p : partitions)
+		if (&p.info == partition)
+			return &p;
+
+	return NULL;
+}
+
+}
+
+/* Settings and metrics keep their defaults: no NVS, no export */
+#define SETTING_DEFAULT(id, key, def, min, max, apply) def,
+uint32_t settings_values[SETTING_COUNT] = { SETTINGS_TABLE(SETTING_DEFAULT) };
+#undef SETTING_DEFAULT
+
+uint32_t metrics_values[METRIC_COUNT];
+
+/* Deferred log records are printed at once */
+struct dlog_format_t {
+	const char *tag;
+	const char *fmt;
+};
+
+#define DLOG_TABLE(id, tag, fmt) {tag, fmt},
+static const dlog_format_t formats[] = {
+		DLOG_FORMATS(DLOG_TABLE)
+};
+#undef DLOG_TABLE
+
+extern "C" {
+
+int64_t esp_timer_get_time(void){
+	return host::clock_us;
+}
+
+TickType_t xTaskGetTickCount(void){
+	return (TickType_t)(host::clock_us / 1000);
+}
+
+void vTaskDelay(TickType_t ticks){
+	host::clock_us += (int64_t)ticks * 1000;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_size,
+		void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core){
+
+	/* Task loops are driven by the replay itself */
+	if (handle)
+		*handle = NULL;
+
+	return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void){
+
+	static int dummy;
+
+	return &dummy;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks){
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore){
+	return pdTRUE;
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, void *queue, int flags){
+	return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config){
+	return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts){
+	return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void *data, uint32_t length, TickType_t ticks){
+
+	uint32_t len = host::uart_len < length ? host::uart_len : length;
+
+	memcpy(data, host::uart_data, len);
+	host::uart_len = 0;
+
+	return len;
+}
+
+esp_err_t uart_flush(uart_port_t port){
+	/* Recorded reads already come after the flush */
+	return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio){
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode){
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level){
+
+	if (gpio == STRIKE_GPIO && level){
+		host::strikes++;
+		host::last_strike_us = host::clock_us;
+	}
+
+	return ESP_OK;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label){
+
+	for (host::partition_t &p : host::partitions)
+		if (p.info.type == type && p.info.subtype == subtype && !strcmp(p.info.label, label))
+			return &p.info;
+
+	return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+		esp_partition_mmap_memory_t memory, const void **out_ptr, esp_partition_mmap_handle_t *out_handle){
+
+	host::partition_t *p = host::find_partition(partition);
+
+	if (!p || offset + size > p->data.size())
+		return ESP_ERR_INVALID_ARG;
+
+	*out_ptr = p->data.data() + offset;
+	*out_handle = 1;
+
+	return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle){
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size){
+
+	host::partition_t *p = host::find_partition(partition);
+
+	if (!p || offset + size > p->data.size())
+		return ESP_ERR_INVALID_ARG;
+
+	memcpy(dst, p->data.data() + offset, size);
+
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size){
+
+	host::partition_t *p = host::find_partition(partition);
+
+	if (!p || offset + size > p->data.size())
+		return ESP_ERR_INVALID_ARG;
+
+	/* NOR flash: writes clear bits, only an erase sets them */
+	for (size_t i = 0; i < size; i++)
+		p->data[offset + i] &= ((const uint8_t *)src)[i];
+
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size){
+
+	host::partition_t *p = host::find_partition(partition);
+
+	if (!p || offset % 4096 || size % 4096 || offset + size > p->data.size())
+		return ESP_ERR_INVALID_ARG;
+
+	memset(p->data.data() + offset, 0xff, size);
+
+	return ESP_OK;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size){
+	return new host::queue_t{length, item_size, {}};
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *buffer, StaticQueue_t *storage){
+	return xQueueCreate(length, item_size);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks){
+
+	host::queue_t *q = (host::queue_t *)queue;
+
+	/* Nothing runs while waiting: a full queue stays full */
+	if (q->items.size() >= q->length)
+		return pdFALSE;
+
+	q->items.emplace_back((const uint8_t *)item, (const uint8_t *)item + q->item_size);
+
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks){
+
+	host::queue_t *q = (host::queue_t *)queue;
+
+	if (q->items.empty())
+		return pdFALSE;
+
+	memcpy(item, q->items.front().data(), q->item_size);
+	q->items.pop_front();
+
+	return pdTRUE;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle){
+
+	std::string prefix = std::string(name) + "/";
+	auto it = host::nvs.lower_bound(prefix);
+
+	auto blob = host::nvs_blobs.lower_bound(prefix);
+
+	/* As NVS: a namespace never written can't be opened read only */
+	if (mode == NVS_READONLY && (it == host::nvs.end() || it->first.compare(0, prefix.size(), prefix)) &&
+			(blob == host::nvs_blobs.end() || blob->first.compare(0, prefix.size(), prefix)))
+		return ESP_ERR_NVS_NOT_FOUND;
+
+	host::nvs_handles.push_back(prefix);
+	*handle = host::nvs_handles.size();
+
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value){
+
+	uint32_t v;
+	esp_err_t err = nvs_get_u32(handle, key, &v);
+
+	if (err == ESP_OK)
+		*value = (uint8_t)v;
+
+	return err;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value){
+
+	auto it = host::nvs.find(host::nvs_handles[handle - 1] + key);
+
+	if (it == host::nvs.end())
+		return ESP_ERR_NVS_NOT_FOUND;
+
+	*value = it->second;
+
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value){
+	return nvs_set_u32(handle, key, value);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value){
+
+	host::nvs[host::nvs_handles[handle - 1] + key] = value;
+
+	return ESP_OK;
+}
+
+/* As NVS: a NULL value asks for the length */
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length){
+
+	auto it = host::nvs_blobs.find(host::nvs_handles[handle - 1] + key);
+
+	if (it == host::nvs_blobs.end())
+		return ESP_ERR_NVS_NOT_FOUND;
+
+	if (value){
+		if (*length < it->second.size())
+			return ESP_ERR_NVS_INVALID_LENGTH;
+		memcpy(value, it->second.data(), it->second.size());
+	}
+	*length = it->second.size();
+
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length){
+
+	host::nvs_blobs[host::nvs_handles[handle - 1] + key].assign((const uint8_t *)value, (const uint8_t *)value + length);
+
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key){
+
+	std::string name = host::nvs_handles[handle - 1] + key;
+
+	if (!host::nvs.erase(name) && !host::nvs_blobs.erase(name))
+		return ESP_ERR_NVS_NOT_FOUND;
+
+	return ESP_OK;
+}
+
+/* Values are stored at once */
+esp_err_t nvs_commit(nvs_handle_t handle){
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle){
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len){
+
+	crc = ~crc;
+	while (len--){
+		crc ^= *buf++;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+uint16_t esp_rom_crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len){
+
+	crc = ~crc;
+	while (len--){
+		crc ^= *buf++;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0x8408 & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...){
+
+	va_list args;
+
+	if (!host::verbose)
+		return;
+
+	fprintf(host::out, "%s   log %s ", host::stamp(), tag);
+	va_start(args, format);
+	vfprintf(host::out, format, args);
+	va_end(args);
+	fputc('\n', host::out);
+}
+
+void dlog_record(uint16_t fmt, uint8_t level, uint32_t a0, uint32_t a1, uint32_t a2){
+
+	if (!host::verbose || fmt >= DLOG_FMT_COUNT)
+		return;
+
+	fprintf(host::out, "%s   log %s ", host::stamp(), formats[fmt].tag);
+	fprintf(host::out, formats[fmt].fmt, a0, a1, a2);
+	fputc('\n', host::out);
+}
+
+void mqtt5_publish(const char *topic, char *msg){
+	fprintf(host::out, "%s   publish %s %s\n", host::stamp(), topic, msg);
+}
+
+void mqtt5_reply(const char *topic, const char *correlation, uint8_t correlation_len, const char *msg){
+	host::replies.push_back(msg);
+}
+
+const char *mqtt5_device_id(void){
+	return "replay";
+}
+
+int get_tag_command(tag_cmd_t *cmd, uint32_t wait_ms){
+	/* Commands are applied by the replay, tags_task never runs */
+	return -1;
+}
+
+void tag_command_done(const tag_cmd_t *cmd){
+}
+
+int get_tags_replace(tags_replace_t *request){
+	/* Host tests call TagStore::replace */
+	return -1;
+}
+
+}
+
+/* Time on the virtual clock */
+Time::Time(){
+}
+
+uint32_t Time::GetTime(){
+	return xTaskGetTickCount();
+}
+
+void Time::Suspend(uint32_t ticks){
+	vTaskDelay(ticks);
+}
+
+void Time::Restore(){
+	setenv("TZ", CONFIG_LOCK_TIMEZONE, 1);
+	tzset();
+}
+
+void Time::SyncInit(){
+}
+
+/* Wall clock anchored by TRACE_WALL records, no drift */
+int64_t Time::WallUs(int64_t mono_us){
+
+	if (host::wall_epoch < WALL_TIME_VALID_AFTER)
+		return 0;
+
+	return (int64_t)host::wall_epoch * 1000000 + (mono_us - host::wall_us);
+}
+
+bool Time::WallTime(time_t *now, struct tm *local){
+
+	*now = WallUs(Now()) / 1000000;
+
+	if (*now < WALL_TIME_VALID_AFTER)
+		return false;
+
+	if (local)
+		localtime_r(now, local);
+
+	return true;
+}
+
+Time::Source Time::WallSource(){
+	return host::wall_epoch < WALL_TIME_VALID_AFTER ? UNSYNCED : SNTP;
+}
+
+int32_t Time::DriftPpb(){
+	return 0;
+}
+
+int64_t time_wall_ms(int64_t mono_us){
+	return Time::WallUs(mono_us) / 1000;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file HostPlatform.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the host platform of the trace replay.
+ *
+ * Firmware modules built for Linux run on a virtual clock: esp_timer,
+ * FreeRTOS ticks and wall time follow it, delays advance it instantly.
+ * UART reads return the bytes queued by the replay, strike output
+ * changes and MQTT publishes are reported back to it. Partitions are
+ * RAM with NOR flash writes: a write only clears bits. NVS is a RAM map
+ * of integers.
+ */
+
+#ifndef HOST_HOSTPLATFORM_H_
+#define HOST_HOSTPLATFORM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace host {
+
+/* Replay output: decisions, strike and publishes. Deterministic */
+extern FILE *out;
+/* Print firmware logs too */
+extern bool verbose;
+
+int64_t now_us();
+/* "[seconds.micros]" of the clock, for output lines */
+const char *stamp();
+/* Restart the clock at us, forget wall time, UART bytes, strikes and NVS */
+void reset(int64_t us);
+/* Move the clock forward to us. Never moves it back */
+void run_until(int64_t us);
+
+/* Wall time at us, epoch 0: not synchronized */
+void set_wall(uint32_t epoch, int64_t us);
+
+/* Bytes returned by the next UART read */
+void uart_feed(const uint8_t *data, uint8_t len);
+
+/* Strike openings and the clock of the last one */
+uint32_t strike_count();
+int64_t strike_us();
+
+/* Image returned as the "allowlist" partition. Empty: no partition */
+bool load_allowlist(const char *path);
+
+/* Erased RAM partition, found by label. Replaces a partition of the same
+ * label. Returns its bytes */
+uint8_t *add_partition(const char *label, int subtype, uint32_t size);
+
+/* Messages of mqtt5_reply, oldest first */
+extern std::vector<std::string> replies;
+
+}
+
+#endif /* HOST_HOSTPLATFORM_H_ */
@@ -0,0 +1,246 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file allowlist_bench.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Compare static allowlist lookups to the linear tag search.
+ *
+ * Usage: allowlist_bench [lookups]
+ *
+ * For 128, 1k, 10k and 50k random tags:
+ *  - build: tools/mphf_build.py run on a generated list, Python start
+ *    included.
+ *  - perfect hash: StaticAllowlist::find on the image, loaded in slot A of
+ *    a RAM "allowlist" partition.
+ *  - linear: LinearIndex::find, as TagStore::search, on a full table.
+ *
+ * Every stored tag must be found with its doors and no absent tag may be
+ * found, checked before timing. Lookups are half hits, half misses. Host
+ * numbers: they show the relative cost, not the ESP32 one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "HostPlatform.h"
+#include "StaticAllowlist.h"
+#include "TagIndex.h"
+
+/* Partition subtype of the "allowlist" partition, see partitions.csv */
+#define ALLOWLIST_SUBTYPE 0x41
+#define SECTOR_SIZE 4096
+
+/* Stored tags are odd, absent ones even */
+static std::vector<uint32_t> tags;
+static std::vector<uint8_t> doors;
+static StaticAllowlist *allowlist;
+
+static uint8_t mphf_find(uint32_t tag){
+
+	uint8_t mask = 0;
+
+	return allowlist->find(tag, &mask) ? mask : 0;
+}
+
+template <uint16_t N>
+static uint8_t linear_find(uint32_t tag){
+
+	static LinearIndex<N> index;
+	int32_t i = index.find(tags.data(), tag);
+
+	return i < 0 ? 0 : doors[i];
+}
+
+typedef uint8_t (*find_t)(uint32_t tag);
+
+/**
+ * @brief Time lookups of a list of tags.
+ *
+ * @param find Lookup.
+ * @param keys Tags to look up.
+ * @param count Keys used, from the start of keys.
+ * @return double ns per lookup.
+ */
+static double measure(find_t find, const std::vector<uint32_t> &keys, size_t count){
+
+	uint32_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+		sink += find(keys[i]);
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	/* Keep the lookups */
+	if (sink == 0xffffffff)
+		printf(" ");
+
+	return (double)ns / count;
+}
+
+/**
+ * @brief Build the image of the current tag list with tools/mphf_build.py.
+ *
+ * @param dir Scratch directory.
+ * @param image Built image.
+ * @param seconds Build time, Python start included.
+ * @return true Built.
+ */
+static bool build(const char *dir, std::vector<uint8_t> &image, double *seconds){
+
+	char csv[256], bin[256], cmd[768];
+	FILE *f;
+
+	snprintf(csv, sizeof(csv), "%s/allowlist.csv", dir);
+	snprintf(bin, sizeof(bin), "%s/allowlist.bin", dir);
+
+	if (!(f = fopen(csv, "w")))
+		return false;
+	for (size_t i = 0; i < tags.size(); i++)
+		fprintf(f, "%u,%u\n", tags[i], doors[i]);
+	fclose(f);
+
+	/* No slot size limit: 50k tags are larger than a slot of partitions.csv */
+	snprintf(cmd, sizeof(cmd), "python3 %s --size 0 %s %s > /dev/null", MPHF_BUILD, csv, bin);
+
+	auto start = std::chrono::steady_clock::now();
+	if (system(cmd) != 0)
+		return false;
+	*seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!(f = fopen(bin, "rb")))
+		return false;
+
+	uint8_t buffer[4096];
+	size_t n;
+	image.clear();
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		image.insert(image.end(), buffer, buffer + n);
+	fclose(f);
+
+	unlink(csv);
+	unlink(bin);
+
+	return !image.empty();
+}
+
+/**
+ * @brief Build, check and measure one list size.
+ *
+ * @param rng Random generator.
+ * @param dir Scratch directory.
+ * @param lookups Perfect hash lookups, linear ones are scaled down.
+ * @return int 0 or 1 on a build or check failure.
+ */
+template <uint16_t N>
+static int run(std::mt19937 &rng, const char *dir, long lookups){
+
+	std::set<uint32_t> unique;
+	std::vector<uint8_t> image;
+	double build_s = 0;
+
+	tags.clear();
+	doors.clear();
+	while (unique.size() < N){
+		uint32_t tag = rng() | 1;
+		if (unique.insert(tag).second){
+			tags.push_back(tag);
+			doors.push_back((uint8_t)(rng() | 1));
+		}
+	}
+
+	if (!build(dir, image, &build_s)){
+		fprintf(stderr, "%u tags: mphf_build.py failed\n", N);
+		return 1;
+	}
+
+	/* Image in slot A, slots rounded to sectors as StaticAllowlist maps them */
+	uint32_t slot = (image.size() + SECTOR_SIZE - 1) & ~(uint32_t)(SECTOR_SIZE - 1);
+	memcpy(host::add_partition("allowlist", ALLOWLIST_SUBTYPE, StaticAllowlist::SLOTS * slot), image.data(), image.size());
+
+	delete allowlist;
+	allowlist = new StaticAllowlist();
+
+	if (allowlist->count() != N){
+		fprintf(stderr, "%u tags: image not loaded\n", N);
+		return 1;
+	}
+
+	std::vector<uint32_t> keys;
+	for (long i = 0; i < lookups; i++)
+		keys.push_back(i & 1 ? tags[rng() % N] : rng() & ~1u);
+
+	for (uint16_t i = 0; i < N; i++){
+		if (mphf_find(tags[i]) != doors[i] || linear_find<N>(tags[i]) != doors[i]){
+			fprintf(stderr, "%u tags: tag %u not found\n", N, tags[i]);
+			return 1;
+		}
+	}
+
+	/* Linear cost grows with N: fewer keys for the same run time */
+	size_t linear_keys = lookups * 128 / N;
+	if (linear_keys < 1000)
+		linear_keys = 1000;
+	if (linear_keys > keys.size())
+		linear_keys = keys.size();
+
+	for (size_t i = 0; i < linear_keys; i++){
+		if (mphf_find(keys[i]) != linear_find<N>(keys[i])){
+			fprintf(stderr, "%u tags: lookups disagree on tag %u\n", N, keys[i]);
+			return 1;
+		}
+	}
+	/* Absent tags: the full tag compare never lets one through */
+	for (size_t i = 0; i < keys.size(); i += 2){
+		if (mphf_find(keys[i])){
+			fprintf(stderr, "%u tags: absent tag %u found\n", N, keys[i]);
+			return 1;
+		}
+	}
+
+	/* Warm up caches and branch predictors */
+	measure(mphf_find, keys, keys.size());
+
+	double t_mphf = measure(mphf_find, keys, keys.size());
+	double t_linear = measure(linear_find<N>, keys, linear_keys);
+
+	printf("%-8u %8.2f %10zu %8.2f %10.1f %10.1f\n", N, build_s, image.size(),
+			(double)image.size() / N, t_mphf, t_linear);
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	long lookups = argc > 1 ? atol(argv[1]) : 200000;
+	std::mt19937 rng(7);
+	char dir[] = "/tmp/allowlist_benchXXXXXX";
+
+	if (lookups < 1000)
+		lookups = 1000;
+
+	if (!mkdtemp(dir)){
+		perror("mkdtemp");
+		return 1;
+	}
+
+	printf("%-8s %8s %10s %8s %10s %10s\n", "entries", "build s", "image B", "B/tag", "mphf ns", "linear ns");
+
+	int failed = run<128>(rng, dir, lookups) || run<1000>(rng, dir, lookups) ||
+			run<10000>(rng, dir, lookups) || run<50000>(rng, dir, lookups);
+
+	rmdir(dir);
+
+	return failed;
+}
@@ -0,0 +1,291 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file allowlist_test.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief StaticAllowlist A/B updates on a RAM flash model and RAM NVS.
+ *
+ * Usage: allowlist_test
+ *
+ * Images are built by tools/mphf_build.py with a given generation and sent
+ * through the allowlist queue as MQTT would. Each case checks the replies,
+ * lookups and the slot chosen after a "reboot": a new StaticAllowlist over
+ * the same partition and NVS. Exits 1 on the first failed check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "esp_rom_crc.h"
+
+#include "HostPlatform.h"
+#include "StaticAllowlist.h"
+#include "Metrics.h"
+
+/* Partition subtype and size of the "allowlist" partition, see partitions.csv */
+#define ALLOWLIST_SUBTYPE 0x41
+#define PARTITION_SIZE 0x80000
+#define SLOT_SIZE (PARTITION_SIZE / StaticAllowlist::SLOTS)
+
+/* Offset of the generation in the image header */
+#define GENERATION_OFFSET 24
+
+#define CHECK(cond) do { if (!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); } } while (0)
+
+static char dir[] = "/tmp/allowlist_testXXXXXX";
+
+/**
+ * @brief Build an image of tags first to first + count - 1, all doors.
+ *
+ * @param first First tag.
+ * @param count Tags.
+ * @param generation Image generation.
+ * @return std::vector<uint8_t> Image.
+ */
+static std::vector<uint8_t> build(uint32_t first, uint32_t count, uint32_t generation){
+
+	char csv[256], bin[256], cmd[768];
+	std::vector<uint8_t> image;
+	FILE *f;
+
+	snprintf(csv, sizeof(csv), "%s/allowlist.csv", dir);
+	snprintf(bin, sizeof(bin), "%s/allowlist.bin", dir);
+
+	CHECK((f = fopen(csv, "w")) != NULL);
+	for (uint32_t i = 0; i < count; i++)
+		fprintf(f, "%u,255\n", first + i);
+	fclose(f);
+
+	snprintf(cmd, sizeof(cmd), "python3 %s --generation %u %s %s > /dev/null", MPHF_BUILD, generation, csv, bin);
+	CHECK(system(cmd) == 0);
+
+	CHECK((f = fopen(bin, "rb")) != NULL);
+	uint8_t buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		image.insert(image.end(), buffer, buffer + n);
+	fclose(f);
+
+	unlink(csv);
+	unlink(bin);
+
+	CHECK(image.size() > GENERATION_OFFSET + 4);
+
+	return image;
+}
+
+/**
+ * @brief Send one request and let the allowlist task answer it.
+ *
+ * @param allowlist Allowlist.
+ * @param request Request.
+ * @return std::string Reply.
+ */
+static std::string send(StaticAllowlist *allowlist, allowlist_request_t *request){
+
+	strcpy(request->response_topic, "test/reply");
+	request->correlation_len = 0;
+
+	host::replies.clear();
+	CHECK(allowlist_request(request));
+	allowlist->service(0);
+	CHECK(host::replies.size() == 1);
+
+	return host::replies[0];
+}
+
+/**
+ * @brief Upload an image: begin, chunks in order, then commit.
+ *
+ * @param allowlist Allowlist.
+ * @param image Image.
+ * @param crc CRC32 announced by begin.
+ * @return std::string Reply of the commit.
+ */
+static std::string upload(StaticAllowlist *allowlist, const std::vector<uint8_t> &image, uint32_t crc){
+
+	static allowlist_request_t request;
+
+	memset(&request, 0, sizeof(request));
+	request.op = ALLOWLIST_BEGIN;
+	request.offset = image.size();
+	request.crc = crc;
+	CHECK(send(allowlist, &request).find("error") == std::string::npos);
+
+	for (uint32_t offset = 0; offset < image.size(); offset += CONFIG_ALLOWLIST_CHUNK_BYTES){
+		request.op = ALLOWLIST_DATA;
+		request.offset = offset;
+		request.len = image.size() - offset < CONFIG_ALLOWLIST_CHUNK_BYTES ? image.size() - offset : CONFIG_ALLOWLIST_CHUNK_BYTES;
+		memcpy(request.data, image.data() + offset, request.len);
+		CHECK(send(allowlist, &request).find("error") == std::string::npos);
+	}
+
+	request.op = ALLOWLIST_COMMIT;
+
+	return send(allowlist, &request);
+}
+
+static std::string upload(StaticAllowlist *allowlist, const std::vector<uint8_t> &image){
+	return upload(allowlist, image, esp_rom_crc32_le(0, image.data(), image.size()));
+}
+
+static bool found(StaticAllowlist *allowlist, uint32_t tag){
+
+	uint8_t doors = 0;
+
+	return allowlist->find(tag, &doors) && doors == 0xff;
+}
+
+/**
+ * @brief Erased partition, NVS and metrics: a lock out of the factory.
+ *
+ * @return uint8_t* Partition bytes.
+ */
+static uint8_t *format(){
+
+	host::reset(0);
+	metric_set(METRIC_ALLOWLIST_ALARM, 0);
+
+	return host::add_partition("allowlist", ALLOWLIST_SUBTYPE, PARTITION_SIZE);
+}
+
+/* Upload to the inactive slot, swap, and the swap survives a reboot */
+static void test_swap(){
+
+	uint8_t *flash = format();
+	std::vector<uint8_t> a = build(1000, 50, 10);
+	std::vector<uint8_t> b = build(2000, 80, 20);
+
+	/* Slot A as parttool.py writes it */
+	memcpy(flash, a.data(), a.size());
+
+	StaticAllowlist *allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 50);
+	CHECK(found(allowlist, 1000));
+	CHECK(!found(allowlist, 2000));
+
+	CHECK(upload(allowlist, b) == "{\"active\":1,\"count\":80,\"generation\":20}");
+	CHECK(found(allowlist, 2079));
+	CHECK(!found(allowlist, 1000));
+
+	allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 80);
+	CHECK(found(allowlist, 2000));
+	CHECK(metric_get(METRIC_ALLOWLIST_ALARM) == 0);
+}
+
+/* Bad CRC, out of order chunks and images not newer are refused, the
+ * active image is kept */
+static void test_refused(){
+
+	static allowlist_request_t request;
+	uint8_t *flash = format();
+	std::vector<uint8_t> a = build(1000, 50, 10);
+	std::vector<uint8_t> b = build(2000, 80, 20);
+
+	memcpy(flash, a.data(), a.size());
+	StaticAllowlist *allowlist = new StaticAllowlist();
+
+	CHECK(upload(allowlist, b, 0x12345678) == "{\"active\":0,\"count\":50,\"generation\":10,\"error\":\"crc\"}");
+	CHECK(upload(allowlist, a) == "{\"active\":0,\"count\":50,\"generation\":10,\"error\":\"stale\"}");
+	CHECK(upload(allowlist, build(2000, 80, 9)).find("\"error\":\"stale\"") != std::string::npos);
+
+	/* Resent chunk: the reply tells where to resume */
+	memset(&request, 0, sizeof(request));
+	request.op = ALLOWLIST_BEGIN;
+	request.offset = b.size();
+	send(allowlist, &request);
+	request.op = ALLOWLIST_DATA;
+	request.offset = CONFIG_ALLOWLIST_CHUNK_BYTES;
+	request.len = 16;
+	CHECK(send(allowlist, &request) == "{\"active\":0,\"count\":50,\"generation\":10,\"slot\":1,\"written\":0,\"error\":\"offset\"}");
+	request.op = ALLOWLIST_ABORT;
+	CHECK(send(allowlist, &request) == "{\"active\":0,\"count\":50,\"generation\":10}");
+
+	CHECK(found(allowlist, 1000));
+	allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 50);
+}
+
+/* Active image corrupted: the other slot is used only when it is at least
+ * as new, otherwise the lock runs without allowlist and raises the alarm */
+static void test_fallback(){
+
+	uint8_t *flash = format();
+	std::vector<uint8_t> a = build(1000, 50, 10);
+	std::vector<uint8_t> b = build(2000, 80, 20);
+
+	/* Factory image corrupted, nothing stored in NVS: any valid image */
+	memcpy(flash, a.data(), a.size());
+	memcpy(flash + SLOT_SIZE, b.data(), b.size());
+	flash[a.size() - 1] ^= 0x01;
+
+	StaticAllowlist *allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 80);
+	CHECK(metric_get(METRIC_ALLOWLIST_ALARM) == 0);
+
+	/* B active at 20, then an upload of 30 to A lost before its commit */
+	flash = format();
+	memcpy(flash, a.data(), a.size());
+	allowlist = new StaticAllowlist();
+	CHECK(upload(allowlist, b).find("error") == std::string::npos);
+	std::vector<uint8_t> c = build(3000, 30, 30);
+	memcpy(flash, c.data(), c.size());
+	flash[SLOT_SIZE + b.size() - 1] ^= 0x01;
+
+	allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 30);
+	CHECK(found(allowlist, 3000));
+
+	/* Slot A back to 10, older than the stored 20 */
+	memset(flash, 0xff, SLOT_SIZE);
+	memcpy(flash, a.data(), a.size());
+
+	allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 0);
+	CHECK(!found(allowlist, 1000));
+	CHECK(!found(allowlist, 2000));
+	CHECK(metric_get(METRIC_ALLOWLIST_ALARM) == 1);
+
+	/* A flipped generation is caught by the CRC: no image made newer */
+	flash[GENERATION_OFFSET + 3] ^= 0x40;
+	allowlist = new StaticAllowlist();
+	CHECK(allowlist->count() == 0);
+
+	/* Older images stay refused, a newer upload clears the alarm */
+	CHECK(upload(allowlist, build(1000, 50, 15)).find("\"error\":\"stale\"") != std::string::npos);
+	CHECK(metric_get(METRIC_ALLOWLIST_ALARM) == 1);
+	CHECK(upload(allowlist, build(4000, 40, 40)) == "{\"active\":0,\"count\":40,\"generation\":40}");
+	CHECK(metric_get(METRIC_ALLOWLIST_ALARM) == 0);
+	CHECK(found(allowlist, 4039));
+}
+
+int main(int argc, char **argv){
+
+	if (!mkdtemp(dir)){
+		perror("mkdtemp");
+		return 1;
+	}
+
+	test_swap();
+	test_refused();
+	test_fallback();
+
+	rmdir(dir);
+
+	printf("allowlist_test: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file audit_test.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief AuditLog on a RAM flash model: reload, corrupted records and
+ * wraparound.
+ *
+ * Usage: audit_test
+ *
+ * Each case writes records through the firmware AuditLog, "reboots" by
+ * building a new AuditLog over the same partition and checks the sequence
+ * numbers and query results. Exits 1 on the first failed check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "HostPlatform.h"
+#include "AuditLog.h"
+#include "Mqtt.h"
+
+/* Partition subtype and size of the test: 8 sectors to wrap quickly */
+#define AUDIT_SUBTYPE 0x40
+#define AUDIT_SECTORS 8
+#define RECORD_SIZE 16
+#define RECORDS_PER_SECTOR ((AuditLog::SECTOR_SIZE - AuditLog::FOOTER_SIZE) / RECORD_SIZE)
+
+/* Wall time of record i: EPOCH + i seconds */
+#define EPOCH 1800000000u
+
+static audit_query_t pending;
+static bool has_pending;
+
+extern "C" int get_audit_query(audit_query_t *query, uint32_t wait_ms){
+
+	if (!has_pending)
+		return -1;
+
+	*query = pending;
+	has_pending = false;
+
+	return 0;
+}
+
+#define CHECK(cond) do { if (!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); } } while (0)
+
+/**
+ * @brief Record an access event and let the audit task write it.
+ *
+ * @param log Audit log.
+ * @param i Event number: time EPOCH + i.
+ * @param tag Tag number.
+ */
+static void record(AuditLog *log, uint32_t i, uint32_t tag){
+	log->record(tag, 1, AuditLog::GRANTED, (int64_t)i * 1000000);
+	log->service(0);
+}
+
+/**
+ * @brief Run a query through the audit task.
+ *
+ * @param log Audit log.
+ * @param from First time, offset from EPOCH.
+ * @param until Last time, offset from EPOCH.
+ * @param tag Tag, 0 for all.
+ * @param first_seq Sequence number of the first match, when any.
+ * @return uint32_t Matches reported by the final message.
+ */
+static uint32_t query(AuditLog *log, uint32_t from, uint32_t until, uint32_t tag, uint32_t *first_seq){
+
+	uint32_t done = 0;
+
+	memset(&pending, 0, sizeof(pending));
+	pending.from = EPOCH + from;
+	pending.until = EPOCH + until;
+	pending.tag = tag;
+	has_pending = true;
+
+	host::replies.clear();
+	log->service(0);
+
+	CHECK(!host::replies.empty());
+	CHECK(sscanf(host::replies.back().c_str(), "{\"done\":%u}", &done) == 1);
+	if (done && first_seq)
+		CHECK(sscanf(host::replies.front().c_str(), "{\"seq\":%u", first_seq) == 1);
+
+	return done;
+}
+
+/**
+ * @brief Erase the audit partition.
+ *
+ * @return uint8_t* Partition bytes.
+ */
+static uint8_t *format(){
+	return host::add_partition("audit", AUDIT_SUBTYPE, AUDIT_SECTORS * AuditLog::SECTOR_SIZE);
+}
+
+/* Records survive a reboot and numbering goes on */
+static void test_reload(){
+
+	uint32_t seq = 0;
+	uint32_t n = RECORDS_PER_SECTOR + 48;
+
+	format();
+
+	AuditLog *log = new AuditLog();
+	for (uint32_t i = 0; i < n; i++)
+		record(log, i, 100 + i % 10);
+
+	log = new AuditLog();
+	record(log, n, 555);
+
+	CHECK(query(log, 0, n, 0, &seq) == n + 1);
+	CHECK(seq == 0);
+	CHECK(query(log, n, n, 0, &seq) == 1);
+	CHECK(seq == n);
+	CHECK(query(log, 0, n, 103, &seq) == n / 10);
+	CHECK(seq == 3);
+}
+
+/* A failed CRC on the first record of the open sector must not shift the
+ * sequence numbers of the sector */
+static void test_corrupt_first(){
+
+	uint32_t seq = 0;
+	uint8_t *flash = format();
+
+	AuditLog *log = new AuditLog();
+	for (uint32_t i = 0; i < 10; i++)
+		record(log, i, 200 + i);
+
+	/* Torn write of slot 0: a set bit of the tag cleared */
+	flash[8] &= ~0x08;
+
+	log = new AuditLog();
+	record(log, 10, 555);
+
+	CHECK(query(log, 10, 10, 0, &seq) == 1);
+	CHECK(seq == 10);
+	CHECK(query(log, 0, 10, 0, &seq) == 10);
+	CHECK(seq == 1);
+
+	/* Every record of the sector corrupted: the log starts over */
+	flash = format();
+	log = new AuditLog();
+	for (uint32_t i = 0; i < 3; i++)
+		record(log, i, 300 + i);
+	for (uint32_t i = 0; i < 3; i++)
+		flash[i * RECORD_SIZE + 8] &= ~0x08;
+
+	log = new AuditLog();
+	record(log, 3, 555);
+	CHECK(query(log, 0, 3, 0, &seq) == 1);
+	CHECK(seq == 0);
+}
+
+/* Oldest sector is dropped when the log wraps, the index survives it */
+static void test_wrap(){
+
+	uint32_t seq = 0;
+	uint32_t n = 2500;
+	uint32_t closed = n / RECORDS_PER_SECTOR;
+	uint32_t kept = (AUDIT_SECTORS - 1) * RECORDS_PER_SECTOR + (n - closed * RECORDS_PER_SECTOR);
+	uint32_t oldest = n - kept;
+	uint32_t tagged = 0;
+
+	format();
+
+	AuditLog *log = new AuditLog();
+	for (uint32_t i = 0; i < n; i++)
+		record(log, i, 1000 + i % 50);
+
+	log = new AuditLog();
+	record(log, n, 555);
+
+	CHECK(query(log, 0, n, 0, &seq) == kept + 1);
+	CHECK(seq == oldest);
+	CHECK(query(log, n, n, 0, &seq) == 1);
+	CHECK(seq == n);
+
+	for (uint32_t i = oldest; i < n; i++)
+		tagged += i % 50 == 7;
+	CHECK(query(log, 0, n, 1007, &seq) == tagged);
+	CHECK(seq % 50 == 7);
+
+	/* Time range inside the retained records */
+	CHECK(query(log, oldest + 10, oldest + 19, 0, &seq) == 10);
+	CHECK(seq == oldest + 10);
+	CHECK(query(log, 0, oldest - 1, 0, NULL) == 0);
+}
+
+int main(int argc, char **argv){
+
+	host::reset(0);
+	host::set_wall(EPOCH, 0);
+
+	test_reload();
+	test_corrupt_first();
+	test_wrap();
+
+	printf("audit_test: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file codec_bench.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Measure the size and decode time of persisted tag blocks.
+ *
+ * Usage: codec_bench [repeats]
+ *
+ * Tables of 1k, 10k and 50k tags, 10% of them with a schedule and an
+ * expiry, are encoded in blocks of 32 (NvsTagBackend) and 255 (format
+ * limit) records:
+ *  - random: tag numbers spread over 32 bits, as mixed card batches.
+ *  - batch: close tag numbers enrolled in order, as cards of one batch.
+ *
+ * Raw is the size of the fields before block encoding: tag, expiry,
+ * schedule and door mask. Every table is decoded and compared before
+ * timing. Host numbers: they show the relative cost, not the ESP32 one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "TagBlock.h"
+
+enum {RAW_BYTES = sizeof(uint32_t) + sizeof(uint32_t) + 2 * sizeof(uint8_t)};
+
+/* Field by field: tag_record_t has padding */
+static bool same(const tag_record_t &a, const tag_record_t &b){
+	return a.tag == b.tag && a.expiry == b.expiry && a.schedule == b.schedule && a.doors == b.doors;
+}
+
+/**
+ * @brief Build a table of unique tags in slot order.
+ *
+ * @param rng Random generator.
+ * @param entries Number of tags.
+ * @param batch Close tag numbers instead of random ones.
+ * @return std::vector<tag_record_t> Records.
+ */
+static std::vector<tag_record_t> make_table(std::mt19937 &rng, uint32_t entries, bool batch){
+
+	std::set<uint32_t> tags;
+	std::vector<tag_record_t> table;
+	uint32_t base = rng() | 1;
+
+	while (tags.size() < entries){
+		uint32_t tag = batch ? base + tags.size() + rng() % 4 : rng();
+		if (tag)
+			tags.insert(tag);
+	}
+
+	for (uint32_t tag : tags)
+		table.push_back({tag, 0, 0, 0xff});
+
+	/* Slots follow enrollment order: a batch is enrolled in card order,
+	 * mixed cards in any order */
+	if (!batch)
+		std::shuffle(table.begin(), table.end(), rng);
+
+	for (uint32_t i = 0; i < entries; i += 10){
+		table[i].expiry = 1800000000 + i;
+		table[i].schedule = 3;
+	}
+
+	return table;
+}
+
+/**
+ * @brief Encode, check and time the decode of one table.
+ *
+ * @param table Records in slot order.
+ * @param block Records per block.
+ * @param repeats Decodes of the whole table to average.
+ * @param label Table name.
+ * @return int 0 or 1 when a decoded table differs.
+ */
+static int run(const std::vector<tag_record_t> &table, uint32_t block, int repeats, const char *label){
+
+	std::vector<std::vector<uint8_t>> blocks;
+	std::vector<tag_record_t> sorted;
+	std::vector<tag_record_t> decoded(block);
+	size_t total = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < table.size(); i += block){
+		uint8_t count = (uint8_t)std::min<size_t>(block, table.size() - i);
+		std::vector<tag_record_t> records(table.begin() + i, table.begin() + i + count);
+		std::vector<uint8_t> out(TAG_BLOCK_MAX_BYTES(count));
+
+		out.resize(tag_block_encode(records.data(), count, out.data()));
+		total += out.size();
+		blocks.push_back(out);
+		/* Encoding sorts the records of each block */
+		sorted.insert(sorted.end(), records.begin(), records.end());
+	}
+	double encode_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+	/* Round trip before timing */
+	size_t slot = 0;
+	for (const std::vector<uint8_t> &b : blocks){
+		int n = tag_block_decode(b.data(), b.size(), decoded.data(), (uint8_t)block);
+		if (n < 0 || !std::equal(decoded.begin(), decoded.begin() + n, sorted.begin() + slot, same)){
+			fprintf(stderr, "%s: block at slot %zu does not decode\n", label, slot);
+			return 1;
+		}
+		slot += n;
+	}
+	if (slot != table.size()){
+		fprintf(stderr, "%s: %zu of %zu records decoded\n", label, slot, table.size());
+		return 1;
+	}
+
+	int sink = 0;
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+		for (const std::vector<uint8_t> &b : blocks)
+			sink += tag_block_decode(b.data(), b.size(), decoded.data(), (uint8_t)block);
+	double decode_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+	/* Keep the decodes */
+	if (sink == -1)
+		printf(" ");
+
+	printf("%-8zu %-7s %5u %9zu %8.2f %8u %10.0f %10.0f\n", table.size(), label, block, total,
+			(double)total / table.size(), RAW_BYTES, encode_us, decode_us);
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	int repeats = argc > 1 ? atoi(argv[1]) : 20;
+	std::mt19937 rng(1);
+
+	if (repeats < 1)
+		repeats = 1;
+
+	printf("%-8s %-7s %5s %9s %8s %8s %10s %10s\n", "entries", "tags", "block", "bytes", "B/tag", "raw B", "encode us", "decode us");
+
+	for (uint32_t entries : {1000, 10000, 50000}){
+		for (int batch = 0; batch <= 1; batch++){
+			std::vector<tag_record_t> table = make_table(rng, entries, batch);
+
+			for (uint32_t block : {32, 255})
+				if (run(table, block, repeats, batch ? "batch" : "random"))
+					return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,183 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file json_bench.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Compare JsonWriter to snprintf on typical lock payloads.
+ *
+ * Usage: json_bench [iterations]
+ *
+ * Both sides produce the same bytes, checked before timing. Host numbers:
+ * they show the relative cost, not the ESP32 one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <chrono>
+
+#include "JsonWriter.h"
+
+/* Values change every iteration so nothing is folded at compile time */
+static volatile uint32_t seed = 12345678;
+
+static const char *metric_names[] = {
+		"grants", "denies", "rdm_checksum", "rdm_no_head", "in_dropped", "in_coalesced",
+		"nvs_errors", "mqtt_disc", "auth_timeouts", "unlocks", "audit_dropped"
+};
+enum {COUNTERS = sizeof(metric_names) / sizeof(metric_names[0])};
+
+static int tag_printf(char *buf, size_t size, uint32_t v){
+	return snprintf(buf, size, "{\"tag\":%" PRIu32 ",\"suppressed\":%" PRIu32 "}", v, v & 0xff);
+}
+
+static int tag_json(char *buf, size_t size, uint32_t v){
+
+	json_writer_t json;
+
+	json_init(&json, buf, size);
+	json_object_begin(&json);
+	json_kv_uint(&json, "tag", v);
+	json_kv_uint(&json, "suppressed", v & 0xff);
+	json_object_end(&json);
+
+	return json_finish(&json) ? json.len : -1;
+}
+
+static int unlock_printf(char *buf, size_t size, uint32_t v){
+
+	int64_t received = (int64_t)v * 1000, actuated = received + 1234;
+
+	return snprintf(buf, size, "{\"result\":\"%s\",\"received_us\":%" PRId64 ",\"actuated_us\":%" PRId64
+			",\"latency_us\":%" PRId64 "}", "opened", received, actuated, actuated - received);
+}
+
+static int unlock_json(char *buf, size_t size, uint32_t v){
+
+	int64_t received = (int64_t)v * 1000, actuated = received + 1234;
+	json_writer_t json;
+
+	json_init(&json, buf, size);
+	json_object_begin(&json);
+	json_kv_string(&json, "result", "opened");
+	json_kv_int(&json, "received_us", received);
+	json_kv_int(&json, "actuated_us", actuated);
+	json_kv_int(&json, "latency_us", actuated - received);
+	json_object_end(&json);
+
+	return json_finish(&json) ? json.len : -1;
+}
+
+static int metrics_printf(char *buf, size_t size, uint32_t v){
+
+	int len = snprintf(buf, size, "{\"up\":%" PRIu32 ",\"dt\":%" PRIu32, v, 300u);
+
+	for (int i = 0; i < COUNTERS && len < (int)size; i++)
+		len += snprintf(buf + len, size - len, ",\"%s\":[%" PRIu32 ",%" PRIu32 "]", metric_names[i], v + i, (v >> 4) + i);
+
+	if (len < (int)size)
+		len += snprintf(buf + len, size - len, ",\"tags\":%" PRIu32 ",\"heap\":%" PRIu32 "}", 128u, 150000 + (v & 0xfff));
+
+	return len;
+}
+
+static int metrics_json(char *buf, size_t size, uint32_t v){
+
+	json_writer_t json;
+
+	json_init(&json, buf, size);
+	json_object_begin(&json);
+	json_kv_uint(&json, "up", v);
+	json_kv_uint(&json, "dt", 300);
+
+	for (int i = 0; i < COUNTERS; i++){
+		json_key(&json, metric_names[i]);
+		json_array_begin(&json);
+		json_uint(&json, v + i);
+		json_uint(&json, (v >> 4) + i);
+		json_array_end(&json);
+	}
+
+	json_kv_uint(&json, "tags", 128);
+	json_kv_uint(&json, "heap", 150000 + (v & 0xfff));
+	json_object_end(&json);
+
+	return json_finish(&json) ? json.len : -1;
+}
+
+typedef int (*format_t)(char *buf, size_t size, uint32_t v);
+
+/**
+ * @brief Time a formatter.
+ *
+ * @param format Formatter.
+ * @param iterations Number of payloads.
+ * @return double ns per payload.
+ */
+static double measure(format_t format, long iterations){
+
+	char buf[640];
+	uint32_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++){
+		sink += format(buf, sizeof(buf), seed + i);
+		sink += buf[3];
+	}
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	seed = sink;
+
+	return (double)ns / iterations;
+}
+
+int main(int argc, char **argv){
+
+	long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+	struct {
+		const char *name;
+		format_t printf_format;
+		format_t json_format;
+	} payloads[] = {
+		{"tag event", tag_printf, tag_json},
+		{"unlock ack", unlock_printf, unlock_json},
+		{"metrics snapshot", metrics_printf, metrics_json},
+	};
+
+	printf("%-18s %6s %12s %12s %8s\n", "payload", "bytes", "snprintf ns", "writer ns", "speedup");
+
+	for (auto &p : payloads){
+		char a[640], b[640];
+		int len_a = p.printf_format(a, sizeof(a), 4242), len_b = p.json_format(b, sizeof(b), 4242);
+
+		if (len_a != len_b || memcmp(a, b, len_a)){
+			fprintf(stderr, "%s: outputs differ\n  %s\n  %s\n", p.name, a, b);
+			return 1;
+		}
+
+		/* Warm up caches and branch predictors */
+		measure(p.printf_format, iterations / 10);
+		measure(p.json_format, iterations / 10);
+
+		double t_printf = measure(p.printf_format, iterations);
+		double t_json = measure(p.json_format, iterations);
+
+		printf("%-18s %6d %12.1f %12.1f %7.2fx\n", p.name, len_b, t_printf, t_json, t_printf / t_json);
+	}
+
+	/* Bounds: a full buffer yields no payload at all */
+	char small[24];
+	if (metrics_json(small, sizeof(small), 1) != -1 || tag_json(small, 8, 1) != -1){
+		fprintf(stderr, "overflow not detected\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file layout_bench.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Compare the memory and lookup cost of tag table layouts.
+ *
+ * Usage: layout_bench [lookups]
+ *
+ * Layouts, all searched linearly as LinearIndex does:
+ *  - ids: tag, schedule and expiry arrays, no door mask (before the door
+ *    masks were added).
+ *  - AoS: one struct per tag with the same fields as TagStore.
+ *  - SoA: TagStore arrays, the scan only touches tag numbers and the mask
+ *    is read from the hit slot.
+ *
+ * All layouts answer the same lookups, checked before timing. Host
+ * numbers: they show the relative cost, not the ESP32 one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "TagIndex.h"
+
+enum {MAX_CAPACITY = 1024};
+
+/* Before door masks */
+struct ids_table_t {
+	uint32_t tags[MAX_CAPACITY];
+	uint8_t schedule[MAX_CAPACITY];
+	uint32_t expiry[MAX_CAPACITY];
+};
+
+/* Array of structs */
+struct aos_entry_t {
+	uint32_t tag;
+	uint32_t expiry;
+	uint8_t doors;
+	uint8_t flags;
+	uint8_t schedule;
+};
+
+/* Struct of arrays, as in TagStore */
+struct soa_table_t {
+	uint32_t tags[MAX_CAPACITY];
+	uint8_t doors[MAX_CAPACITY];
+	uint8_t flags[MAX_CAPACITY];
+	uint8_t schedule[MAX_CAPACITY];
+	uint32_t expiry[MAX_CAPACITY];
+};
+
+static ids_table_t ids;
+static aos_entry_t aos[MAX_CAPACITY];
+static soa_table_t soa;
+
+/* Lookups return the door mask, 0 when not found. ids has no mask: 0xff */
+template <uint16_t N>
+static uint8_t ids_find(uint32_t tag){
+
+	for (int32_t i = 0; i < N; i++)
+		if (ids.tags[i] == tag)
+			return 0xff;
+
+	return 0;
+}
+
+template <uint16_t N>
+static uint8_t aos_find(uint32_t tag){
+
+	for (int32_t i = 0; i < N; i++)
+		if (aos[i].tag == tag)
+			return aos[i].doors;
+
+	return 0;
+}
+
+/* TagStore::search: slot from the index, then the mask of the slot */
+template <uint16_t N>
+static uint8_t soa_find(uint32_t tag){
+
+	static LinearIndex<N> index;
+	int32_t i = index.find(soa.tags, tag);
+
+	return i < 0 ? 0 : soa.doors[i];
+}
+
+typedef uint8_t (*find_t)(uint32_t tag);
+
+/**
+ * @brief Time lookups of a list of tags.
+ *
+ * @param find Layout lookup.
+ * @param keys Tags to look up.
+ * @return double ns per lookup.
+ */
+static double measure(find_t find, const std::vector<uint32_t> &keys){
+
+	uint32_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t key : keys)
+		sink += find(key);
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	/* Keep the lookups */
+	if (sink == 0xffffffff)
+		printf(" ");
+
+	return (double)ns / keys.size();
+}
+
+/**
+ * @brief Fill all layouts with the same full table.
+ *
+ * @param rng Random generator.
+ * @param capacity Entries.
+ * @param stored Tags stored, in slot order.
+ */
+static void fill(std::mt19937 &rng, uint16_t capacity, std::vector<uint32_t> &stored){
+
+	stored.clear();
+	for (uint16_t i = 0; i < capacity; i++){
+		uint32_t tag = rng() | 1;
+		uint8_t doors = (uint8_t)(rng() | 1);
+		uint32_t expiry = i % 10 ? 0 : 1800000000 + i;
+		uint8_t schedule = i % 10 ? 0 : 1;
+
+		stored.push_back(tag);
+
+		ids.tags[i] = tag;
+		ids.schedule[i] = schedule;
+		ids.expiry[i] = expiry;
+
+		aos[i] = {tag, expiry, doors, (uint8_t)(schedule ? 1 : 0), schedule};
+
+		soa.tags[i] = tag;
+		soa.doors[i] = doors;
+		soa.flags[i] = schedule ? 1 : 0;
+		soa.schedule[i] = schedule;
+		soa.expiry[i] = expiry;
+	}
+}
+
+/**
+ * @brief Measure hits and misses of a table size.
+ *
+ * @param rng Random generator.
+ * @param lookups Lookups per measurement.
+ * @return int 0 or 1 when the layouts disagree.
+ */
+template <uint16_t N>
+static int run(std::mt19937 &rng, long lookups){
+
+	std::vector<uint32_t> stored;
+
+	fill(rng, N, stored);
+
+	for (int hits = 1; hits >= 0; hits--){
+		std::vector<uint32_t> keys;
+
+		/* Stored tags are odd, absent ones even */
+		for (long i = 0; i < lookups; i++)
+			keys.push_back(hits ? stored[rng() % stored.size()] : rng() & ~1u);
+
+		for (uint32_t key : keys){
+			uint8_t mask = soa_find<N>(key);
+			if (mask != aos_find<N>(key) || (mask != 0) != (ids_find<N>(key) != 0)){
+				fprintf(stderr, "layouts disagree on tag %u\n", key);
+				return 1;
+			}
+		}
+
+		/* Warm up caches and branch predictors */
+		measure(soa_find<N>, keys);
+
+		double t_ids = measure(ids_find<N>, keys);
+		double t_aos = measure(aos_find<N>, keys);
+		double t_soa = measure(soa_find<N>, keys);
+
+		printf("%-8u %-6s %10.1f %10.1f %10.1f\n", N, hits ? "hit" : "miss", t_ids, t_aos, t_soa);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	long lookups = argc > 1 ? atol(argv[1]) : 200000;
+	std::mt19937 rng(42);
+
+	printf("entry bytes: ids %zu (no mask), AoS %zu, SoA %zu\n\n",
+			sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t), sizeof(aos_entry_t),
+			sizeof(uint32_t) + 3 * sizeof(uint8_t) + sizeof(uint32_t));
+
+	printf("%-8s %-6s %10s %10s %10s\n", "entries", "keys", "ids ns", "AoS ns", "SoA ns");
+
+	return run<128>(rng, lookups) || run<1024>(rng, lookups);
+}
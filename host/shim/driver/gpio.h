@@ -0,0 +1,22 @@
+/* Host shim of driver/gpio.h: strike output is reported to the replay */
+
+#ifndef HOST_GPIO_H_
+#define HOST_GPIO_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {GPIO_NUM_13 = 13, GPIO_NUM_23 = 23} gpio_num_t;
+typedef enum {GPIO_MODE_INPUT, GPIO_MODE_OUTPUT} gpio_mode_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+esp_err_t gpio_reset_pin(gpio_num_t gpio);
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_GPIO_H_ */
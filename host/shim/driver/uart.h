@@ -0,0 +1,40 @@
+/* Host shim of driver/uart.h: reads return the recorded UART bytes */
+
+#ifndef HOST_UART_H_
+#define HOST_UART_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+typedef enum {UART_DATA_8_BITS = 3} uart_word_length_t;
+typedef enum {UART_PARITY_DISABLE} uart_parity_t;
+typedef enum {UART_STOP_BITS_1 = 1} uart_stop_bits_t;
+typedef enum {UART_HW_FLOWCTRL_DISABLE} uart_hw_flowcontrol_t;
+typedef enum {UART_SCLK_APB} uart_sclk_t;
+
+typedef struct {
+	int baud_rate;
+	uart_word_length_t data_bits;
+	uart_parity_t parity;
+	uart_stop_bits_t stop_bits;
+	uart_hw_flowcontrol_t flow_ctrl;
+	uint8_t rx_flow_ctrl_thresh;
+	uart_sclk_t source_clk;
+} uart_config_t;
+
+#define UART_PIN_NO_CHANGE		-1
+#define ESP_INTR_FLAG_IRAM		0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, void *queue, int flags);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+int uart_read_bytes(uart_port_t port, void *data, uint32_t length, TickType_t ticks);
+esp_err_t uart_flush(uart_port_t port);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_UART_H_ */
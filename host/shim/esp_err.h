@@ -0,0 +1,24 @@
+/* Host shim of esp_err.h */
+
+#ifndef HOST_ESP_ERR_H_
+#define HOST_ESP_ERR_H_
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_INVALID_SIZE		0x104
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_TIMEOUT				0x107
+#define ESP_ERR_INVALID_CRC			0x109
+#define ESP_ERR_NVS_NOT_FOUND		0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH	0x110c
+
+#define ESP_ERROR_CHECK(x)			((void)(x))
+
+#endif /* HOST_ESP_ERR_H_ */
@@ -0,0 +1,17 @@
+/* Host shim of esp_rom_crc.h */
+
+#ifndef HOST_ESP_ROM_CRC_H_
+#define HOST_ESP_ROM_CRC_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+uint16_t esp_rom_crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_ESP_ROM_CRC_H_ */
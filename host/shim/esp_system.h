@@ -0,0 +1,8 @@
+/* Host shim of esp_system.h */
+
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include "esp_err.h"
+
+#endif /* HOST_ESP_SYSTEM_H_ */
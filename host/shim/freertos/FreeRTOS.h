@@ -0,0 +1,26 @@
+/* Host shim of FreeRTOS.h: 1 ms ticks of the virtual replay clock */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint8_t StackType_t;
+typedef struct {void *dummy;} StaticTask_t, StaticQueue_t, StaticSemaphore_t;
+
+#define pdTRUE					1
+#define pdFALSE					0
+#define portMAX_DELAY			0xffffffffu
+#define portTICK_PERIOD_MS		1
+#define pdMS_TO_TICKS(ms)		((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks)	((uint32_t)(ticks))
+#define tskIDLE_PRIORITY		0
+#define tskNO_AFFINITY			0x7fffffff
+
+#endif /* HOST_FREERTOS_H_ */
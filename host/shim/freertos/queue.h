@@ -0,0 +1,21 @@
+/* Host shim of queue.h: FIFOs that never block, single threaded */
+
+#ifndef HOST_QUEUE_H_
+#define HOST_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *buffer, StaticQueue_t *storage);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_QUEUE_H_ */
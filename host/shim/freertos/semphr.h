@@ -0,0 +1,20 @@
+/* Host shim of semphr.h: replay is single threaded, mutexes always succeed */
+
+#ifndef HOST_SEMPHR_H_
+#define HOST_SEMPHR_H_
+
+#include "queue.h"
+
+typedef void *SemaphoreHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SEMPHR_H_ */
@@ -0,0 +1,39 @@
+/*
+ * Host replay configuration: Kconfig defaults of the modules built by
+ * host/CMakeLists.txt. Keep in step with main/Kconfig.projbuild.
+ */
+
+#ifndef HOST_SDKCONFIG_H_
+#define HOST_SDKCONFIG_H_
+
+#define CONFIG_DOOR_ID 0
+#define CONFIG_STRIKE_PULSE_MS 100
+#define CONFIG_BUTTON_POLL_MS 700
+#define CONFIG_BUTTON_GUARD_MS 10000
+#define CONFIG_RDM_IDLE_MS 2000
+#define CONFIG_UART_BUFFER_SIZE 1024
+#define CONFIG_LOCK_TIMEZONE "<-03>3"
+#define CONFIG_MQTT_INBOUND_QUEUE_SIZE 32
+#define CONFIG_TAGS_CAPACITY 128
+/* Allowlist image from --allowlist. Uploads are not replayed */
+#define CONFIG_STATIC_ALLOWLIST 1
+
+#define CONFIG_DENY_TABLE_SIZE 16
+#define CONFIG_DENY_TAG_BURST 3
+#define CONFIG_DENY_TAG_REFILL_MS 10000
+#define CONFIG_DENY_GLOBAL_BURST 20
+#define CONFIG_DENY_GLOBAL_REFILL_MS 3000
+#define CONFIG_DENY_LOCKOUT_MS 0
+
+/* Audit log on a RAM "audit" partition, host/audit_test.cpp */
+#define CONFIG_AUDIT_LOG 1
+#define CONFIG_AUDIT_QUEUE_SIZE 16
+#define CONFIG_AUDIT_CHUNK_RECORDS 16
+
+/* Every record reaches the host log */
+#define CONFIG_DLOG_LEVEL_MAIN 4
+#define CONFIG_DLOG_LEVEL_RDM6300 4
+#define CONFIG_DLOG_LEVEL_TAGS 4
+#define CONFIG_DLOG_LEVEL_MQTT 4
+
+#endif /* HOST_SDKCONFIG_H_ */
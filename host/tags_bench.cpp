@@ -0,0 +1,152 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file tags_bench.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Compare the TagStore index policies on the RAM backend.
+ *
+ * Usage: tags_bench [lookups]
+ *
+ * TagStore<Capacity, LinearIndex or HashIndex, RamTagBackend> filled to
+ * capacity with random tags, 128 and 1024 entries:
+ *  - hit, miss: TagStore::search of stored and absent tags.
+ *  - toggle: add_new of a stored tag then of the same tag again, a remove
+ *    and an insert with index upkeep.
+ *
+ * Both policies must answer the same slots, checked before timing. Host
+ * numbers: they show the relative cost, not the ESP32 one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "HostPlatform.h"
+#include "TagsImpl.h"
+#include "TagBackend.h"
+
+template <uint16_t N>
+using LinearTags = TagStore<N, LinearIndex<N>, RamTagBackend<N> >;
+
+template <uint16_t N>
+using HashTags = TagStore<N, HashIndex<N>, RamTagBackend<N> >;
+
+/**
+ * @brief Average ns of an operation over a list of tags.
+ *
+ * @param op Operation on one tag, returns a value kept from the optimizer.
+ * @param keys Tags.
+ * @return double ns per tag.
+ */
+template <class Op>
+static double measure(Op op, const std::vector<uint32_t> &keys){
+
+	int64_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t key : keys)
+		sink += op(key);
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	/* Keep the operations */
+	if (sink == 0x7fffffff)
+		printf(" ");
+
+	return (double)ns / keys.size();
+}
+
+/**
+ * @brief Fill both stores, check them and time each policy.
+ *
+ * @param rng Random generator.
+ * @param lookups Operations per measurement.
+ * @return int 0 or 1 when the policies disagree.
+ */
+template <uint16_t N>
+static int run(std::mt19937 &rng, long lookups){
+
+	/* Large stores: not on the stack */
+	static LinearTags<N> linear;
+	static HashTags<N> hash;
+	std::set<uint32_t> unique;
+	std::vector<uint32_t> stored;
+	std::vector<uint32_t> hits, misses;
+
+	/* Stored tags are odd, absent ones even */
+	while (stored.size() < N){
+		uint32_t tag = rng() | 1;
+		if (unique.insert(tag).second){
+			stored.push_back(tag);
+			if (linear.set(tag, 0, 0, 1) != ESP_OK || hash.set(tag, 0, 0, 1) != ESP_OK){
+				fprintf(stderr, "%u tags: store full\n", N);
+				return 1;
+			}
+		}
+	}
+
+	for (long i = 0; i < lookups; i++){
+		hits.push_back(stored[rng() % N]);
+		misses.push_back(rng() & ~1u);
+	}
+
+	for (uint32_t tag : stored){
+		int32_t slot = linear.search(tag);
+		if (slot < 0 || slot != hash.search(tag)){
+			fprintf(stderr, "%u tags: tag %u at slot %d and %d\n", N, tag, slot, hash.search(tag));
+			return 1;
+		}
+	}
+	for (uint32_t tag : misses){
+		if (linear.search(tag) != -1 || hash.search(tag) != -1){
+			fprintf(stderr, "%u tags: absent tag %u found\n", N, tag);
+			return 1;
+		}
+	}
+
+	/* Warm up caches and branch predictors */
+	measure([&](uint32_t tag){ return linear.search(tag); }, hits);
+
+	double linear_hit = measure([&](uint32_t tag){ return linear.search(tag); }, hits);
+	double hash_hit = measure([&](uint32_t tag){ return hash.search(tag); }, hits);
+	double linear_miss = measure([&](uint32_t tag){ return linear.search(tag); }, misses);
+	double hash_miss = measure([&](uint32_t tag){ return hash.search(tag); }, misses);
+
+	/* Removed then stored again: the stores end as they started */
+	std::vector<uint32_t> toggles(hits.begin(), hits.begin() + hits.size() / 10);
+	double linear_toggle = measure([&](uint32_t tag){ return linear.add_new(tag) + linear.add_new(tag); }, toggles) / 2;
+	double hash_toggle = measure([&](uint32_t tag){ return hash.add_new(tag) + hash.add_new(tag); }, toggles) / 2;
+
+	for (uint32_t tag : stored){
+		if (linear.search(tag) < 0 || hash.search(tag) < 0){
+			fprintf(stderr, "%u tags: tag %u lost by add_new\n", N, tag);
+			return 1;
+		}
+	}
+
+	printf("%-8u %-6s %8.1f %8.1f %8.1f\n", N, "linear", linear_hit, linear_miss, linear_toggle);
+	printf("%-8u %-6s %8.1f %8.1f %8.1f\n", N, "hash", hash_hit, hash_miss, hash_toggle);
+
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	long lookups = argc > 1 ? atol(argv[1]) : 200000;
+	std::mt19937 rng(1);
+
+	if (lookups < 10)
+		lookups = 10;
+
+	printf("%-8s %-6s %8s %8s %8s\n", "entries", "index", "hit ns", "miss ns", "toggle ns");
+
+	return run<128>(rng, lookups) || run<1024>(rng, lookups);
+}
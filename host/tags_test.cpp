@@ -0,0 +1,257 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file tags_test.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief TagStore whole table replacement on the NVS backend and RAM NVS.
+ *
+ * Usage: tags_test
+ *
+ * Tables are sent to TagStore::replace as tags_task receives them from
+ * MQTT. Each case checks the replies, lookups and the table loaded after a
+ * "reboot": a new TagStore over the same NVS. Exits 1 on the first failed
+ * check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "esp_rom_crc.h"
+
+#include "HostPlatform.h"
+#include "TagsImpl.h"
+#include "TagBackend.h"
+
+typedef TagStore<128, HashIndex<128>, NvsTagBackend> NvsTags;
+
+#define CHECK(cond) do { if (!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); } } while (0)
+
+/**
+ * @brief Build a table of tags first to first + count - 1. Every tenth tag
+ * has schedule 1 and an expiry, the others open all doors at any time.
+ *
+ * @param first First tag.
+ * @param count Tags.
+ * @return std::vector<uint8_t> Records as uploaded.
+ */
+static std::vector<uint8_t> build(uint32_t first, uint32_t count){
+
+	std::vector<uint8_t> table;
+
+	for (uint32_t i = 0; i < count; i++){
+		uint32_t tag = first + i;
+		uint32_t expiry = i % 10 ? 0 : 2000000000u;
+		uint8_t record[TAGS_REPLACE_RECORD_BYTES] = {
+			(uint8_t)tag, (uint8_t)(tag >> 8), (uint8_t)(tag >> 16), (uint8_t)(tag >> 24),
+			(uint8_t)expiry, (uint8_t)(expiry >> 8), (uint8_t)(expiry >> 16), (uint8_t)(expiry >> 24),
+			(uint8_t)(i % 10 ? 0 : 1), (uint8_t)(i % 10 ? 0xff : 0x01)};
+
+		table.insert(table.end(), record, record + sizeof(record));
+	}
+
+	return table;
+}
+
+/**
+ * @brief Send one request and return its reply.
+ *
+ * @param tags Tag store.
+ * @param request Request.
+ * @return std::string Reply.
+ */
+static std::string send(NvsTags *tags, tags_replace_t *request){
+
+	strcpy(request->response_topic, "test/reply");
+	request->correlation_len = 0;
+
+	host::replies.clear();
+	tags->replace(request);
+	CHECK(host::replies.size() == 1);
+
+	return host::replies[0];
+}
+
+/**
+ * @brief Upload a table: begin, chunks in order, then commit.
+ *
+ * @param tags Tag store.
+ * @param table Records.
+ * @param crc CRC32 announced by begin.
+ * @param commit Send the commit. Otherwise the reply of the last chunk.
+ * @return std::string Reply of the commit.
+ */
+static std::string upload(NvsTags *tags, const std::vector<uint8_t> &table, uint32_t crc, bool commit = true){
+
+	static tags_replace_t request;
+	std::string reply;
+
+	memset(&request, 0, sizeof(request));
+	request.op = TAGS_REPLACE_BEGIN;
+	request.offset = table.size();
+	request.crc = crc;
+	CHECK((reply = send(tags, &request)).find("error") == std::string::npos);
+
+	/* Whole records per chunk */
+	uint32_t chunk = CONFIG_TAGS_REPLACE_CHUNK_BYTES / TAGS_REPLACE_RECORD_BYTES * TAGS_REPLACE_RECORD_BYTES;
+
+	for (uint32_t offset = 0; offset < table.size(); offset += chunk){
+		request.op = TAGS_REPLACE_DATA;
+		request.offset = offset;
+		request.len = table.size() - offset < chunk ? table.size() - offset : chunk;
+		memcpy(request.data, table.data() + offset, request.len);
+		CHECK((reply = send(tags, &request)).find("error") == std::string::npos);
+	}
+
+	if (!commit)
+		return reply;
+
+	request.op = TAGS_REPLACE_COMMIT;
+
+	return send(tags, &request);
+}
+
+static std::string upload(NvsTags *tags, const std::vector<uint8_t> &table){
+	return upload(tags, table, esp_rom_crc32_le(0, table.data(), table.size()));
+}
+
+/**
+ * @brief Table state as replied to an empty request.
+ *
+ * @param tags Tag store.
+ * @return std::string Reply.
+ */
+static std::string state(NvsTags *tags){
+
+	static tags_replace_t request;
+
+	memset(&request, 0, sizeof(request));
+	request.op = TAGS_REPLACE_STATE;
+
+	return send(tags, &request);
+}
+
+static bool found(NvsTags *tags, uint32_t tag){
+	return tags->search(tag) >= 0;
+}
+
+/* Upload to the inactive set, swap, and the swap survives a reboot */
+static void test_swap(){
+
+	host::reset(0);
+
+	NvsTags *tags = new NvsTags();
+	CHECK(tags->set(1, 0, 0, 0xff) == ESP_OK);
+	CHECK(tags->set(2, 0, 0, 0xff) == ESP_OK);
+	CHECK(state(tags) == "{\"active\":0,\"count\":2}");
+
+	CHECK(upload(tags, build(1000, 100)) == "{\"active\":1,\"count\":100}");
+	CHECK(!found(tags, 1));
+	CHECK(found(tags, 1099));
+
+	/* Fields of the records, flags derived */
+	NvsTags::access_t access;
+	CHECK(tags->search(1010, &access) >= 0);
+	CHECK(access.doors == 0x01 && access.schedule == 1 && access.expiry == 2000000000u && access.flags != 0);
+	CHECK(tags->search(1011, &access) >= 0);
+	CHECK(access.doors == 0xff && access.flags == 0);
+
+	/* Commands after a swap change the new table and its set */
+	CHECK(tags->add_new(1000) == ESP_OK);
+	CHECK(tags->add_new(5) == ESP_OK);
+
+	tags = new NvsTags();
+	CHECK(state(tags) == "{\"active\":1,\"count\":100}");
+	CHECK(found(tags, 5));
+	CHECK(!found(tags, 1000));
+	CHECK(!found(tags, 1));
+
+	/* Back to set 0: no block of the first table is left */
+	CHECK(upload(tags, build(3000, 40)) == "{\"active\":0,\"count\":40}");
+	tags = new NvsTags();
+	CHECK(state(tags) == "{\"active\":0,\"count\":40}");
+	CHECK(found(tags, 3039));
+	CHECK(!found(tags, 1) && !found(tags, 5) && !found(tags, 1099));
+
+	/* Empty table: every tag revoked */
+	CHECK(upload(tags, std::vector<uint8_t>()) == "{\"active\":1,\"count\":0}");
+	tags = new NvsTags();
+	CHECK(state(tags) == "{\"active\":1,\"count\":0}");
+	CHECK(!found(tags, 3000));
+}
+
+/* Bad CRC, bad records, out of order chunks and uploads lost before their
+ * commit keep the active table */
+static void test_refused(){
+
+	static tags_replace_t request;
+	std::vector<uint8_t> table = build(1000, 100);
+
+	host::reset(0);
+
+	NvsTags *tags = new NvsTags();
+	CHECK(tags->set(1, 0, 0, 0xff) == ESP_OK);
+
+	CHECK(upload(tags, table, 0x12345678) == "{\"active\":0,\"count\":1,\"error\":\"crc\"}");
+
+	/* Duplicate tag */
+	std::vector<uint8_t> duplicate = build(1000, 10);
+	duplicate.insert(duplicate.end(), table.begin(), table.begin() + TAGS_REPLACE_RECORD_BYTES);
+	memset(&request, 0, sizeof(request));
+	request.op = TAGS_REPLACE_BEGIN;
+	request.offset = duplicate.size();
+	send(tags, &request);
+	request.op = TAGS_REPLACE_DATA;
+	request.offset = 0;
+	request.len = duplicate.size();
+	memcpy(request.data, duplicate.data(), request.len);
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1,\"error\":\"record\"}");
+
+	/* Larger than the store, partial record */
+	request.op = TAGS_REPLACE_BEGIN;
+	request.offset = 129 * TAGS_REPLACE_RECORD_BYTES;
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1,\"error\":\"size\"}");
+	request.offset = 15;
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1,\"error\":\"size\"}");
+
+	/* Resent chunk: the reply tells where to resume */
+	request.offset = table.size();
+	send(tags, &request);
+	request.op = TAGS_REPLACE_DATA;
+	request.offset = 100;
+	request.len = 100;
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1,\"written\":0,\"error\":\"offset\"}");
+	request.op = TAGS_REPLACE_COMMIT;
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1,\"written\":0,\"error\":\"incomplete\"}");
+	request.op = TAGS_REPLACE_ABORT;
+	CHECK(send(tags, &request) == "{\"active\":0,\"count\":1}");
+
+	/* Power lost with the whole table received but not committed */
+	CHECK(upload(tags, table, esp_rom_crc32_le(0, table.data(), table.size()), false) ==
+			"{\"active\":0,\"count\":1,\"written\":1000}");
+	CHECK(found(tags, 1) && !found(tags, 1000));
+
+	tags = new NvsTags();
+	CHECK(state(tags) == "{\"active\":0,\"count\":1}");
+	CHECK(found(tags, 1));
+}
+
+int main(int argc, char **argv){
+
+	test_swap();
+	test_refused();
+
+	printf("tags_test: ok\n");
+
+	return 0;
+}
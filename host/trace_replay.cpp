@@ -0,0 +1,487 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file trace_replay.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief Replay a field trace through the firmware access path on Linux.
+ *
+ * Usage: trace_replay [-v] [--allowlist image] [--tags file] [--repeat n] trace.trc
+ *
+ * Reader, tag store, door and deny limiter are the firmware modules built
+ * for the host platform. Recorded inputs are fed in order on a virtual
+ * clock, so a replay runs as fast as the host can and always prints the
+ * same decisions for the same trace. --tags preloads the store with
+ * "add_tag <payload>" or "schedule <payload>" lines, since a trace does
+ * not hold the tags stored before it started. Remote authorization and
+ * the audit log are not replayed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "HostPlatform.h"
+#include "Trace.h"
+#include "MqttRoutes.h"
+#include "Rdm6300.h"
+#include "TagsImpl.h"
+#include "TagBackend.h"
+#include "Door.h"
+#include "DenyLimiter.h"
+#include "Settings.h"
+#include "JsonWriter.h"
+
+/* RAM backend: the replay starts from an empty store */
+typedef TagStore<CONFIG_TAGS_CAPACITY, TAGS_INDEX, RamTagBackend<CONFIG_TAGS_CAPACITY> > ReplayTags;
+
+/* Record decoded from the trace */
+struct record_t {
+	uint8_t type;
+	uint8_t arg;
+	int64_t t_us;
+	std::vector<uint8_t> data;
+};
+
+/* Host time of the access decisions, for --repeat */
+struct timing_t {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static const char *route_names[] = {
+		"none", "add_tag", "schedule", "auth/response", "unlock", "audit", "metrics", "config", "trace",
+		"allowlist", "allowlist/data", "tags", "tags/data"
+};
+
+/**
+ * @brief Route name as used on the MQTT topic.
+ *
+ * @param route mqtt_route_t.
+ * @return const char* Name or "?".
+ */
+static const char *route_name(uint8_t route){
+	return route < sizeof(route_names) / sizeof(route_names[0]) ? route_names[route] : "?";
+}
+
+/**
+ * @brief Read a trace file.
+ *
+ * @param path File path.
+ * @param header Decoded header.
+ * @param records Decoded records, absolute times.
+ * @return true Valid trace.
+ * @return false Unreadable or malformed.
+ */
+static bool load_trace(const char *path, trace_header_t *header, std::vector<record_t> *records){
+
+	FILE *f = fopen(path, "rb");
+	std::vector<uint8_t> bytes;
+	uint8_t buffer[4096];
+	size_t n;
+
+	if (!f)
+		return false;
+
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + n);
+	fclose(f);
+
+	if (bytes.size() < sizeof(trace_header_t))
+		return false;
+
+	memcpy(header, bytes.data(), sizeof(trace_header_t));
+	if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION)
+		return false;
+
+	/* A download ended early still replays up to the last whole record */
+	size_t end = bytes.size();
+	if (end > sizeof(trace_header_t) + header->bytes)
+		end = sizeof(trace_header_t) + header->bytes;
+
+	size_t pos = sizeof(trace_header_t);
+	int64_t t = header->base_us;
+
+	while (pos + 3 < end){
+		record_t record;
+		uint8_t len;
+		uint64_t dt = 0;
+		int shift = 0;
+
+		record.type = bytes[pos++];
+		record.arg = bytes[pos++];
+		len = bytes[pos++];
+
+		while (pos < end && shift < 70){
+			uint8_t byte = bytes[pos++];
+			dt |= (uint64_t)(byte & 0x7f) << shift;
+			shift += 7;
+			if (!(byte & 0x80))
+				break;
+		}
+
+		if (pos + len > end)
+			break;
+
+		t += dt;
+		record.t_us = t;
+		record.data.assign(bytes.begin() + pos, bytes.begin() + pos + len);
+		pos += len;
+
+		records->push_back(record);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Apply a tag command as tags_task does.
+ *
+ * @param tags Tag store.
+ * @param route ROUTE_ADD_TAG or ROUTE_SCHEDULE.
+ * @param payload Null terminated payload.
+ * @return true Command applied.
+ * @return false Malformed or other route.
+ */
+static bool apply_tag_command(ReplayTags *tags, uint8_t route, const char *payload){
+
+	tag_cmd_t cmd;
+
+	if (route != ROUTE_ADD_TAG && route != ROUTE_SCHEDULE)
+		return false;
+
+	if (tag_command_parse((mqtt_route_t)route, payload, &cmd) != 0)
+		return false;
+
+	switch (cmd.type){
+	case TAG_CMD_TOGGLE:
+		tags->add_new(cmd.tag);
+		break;
+	case TAG_CMD_SET:
+		tags->set(cmd.tag, cmd.schedule_id, cmd.expiry, cmd.doors);
+		break;
+	case TAG_CMD_SCHEDULE:
+		tags->set_schedule(cmd.schedule_id, &cmd.schedule);
+		break;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Preload the tag store from "add_tag <payload>" and
+ * "schedule <payload>" lines.
+ *
+ * @param tags Tag store.
+ * @param path File path.
+ * @return true Loaded.
+ * @return false Unreadable file.
+ */
+static bool load_tags(ReplayTags *tags, const char *path){
+
+	FILE *f = fopen(path, "r");
+	char line[256];
+
+	if (!f)
+		return false;
+
+	while (fgets(line, sizeof(line), f)){
+		line[strcspn(line, "\r\n")] = 0;
+
+		char *payload = strchr(line, ' ');
+		if (line[0] == '#' || !payload)
+			continue;
+		*payload++ = 0;
+
+		uint8_t route = !strcmp(line, "add_tag") ? ROUTE_ADD_TAG : !strcmp(line, "schedule") ? ROUTE_SCHEDULE : ROUTE_NONE;
+		if (!apply_tag_command(tags, route, payload))
+			fprintf(stderr, "%s: ignored \"%s %s\"\n", path, line, payload);
+	}
+	fclose(f);
+
+	return true;
+}
+
+/**
+ * @brief Publish a tag event as app_main does.
+ *
+ * @param topic Topic name.
+ * @param tag Tag number.
+ * @param suppressed Reports suppressed by the deny limiter.
+ * @param event_us Time::Now() of the read.
+ */
+static void publish_tag(const char *topic, uint32_t tag, uint32_t suppressed, int64_t event_us){
+
+	char payload[72];
+	json_writer_t json;
+
+	json_init(&json, payload, sizeof(payload));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(event_us));
+	json_kv_uint(&json, "tag", tag);
+	if (suppressed)
+		json_kv_uint(&json, "suppressed", suppressed);
+	json_object_end(&json);
+
+	if (json_finish(&json))
+		mqtt5_publish(topic, payload);
+}
+
+/**
+ * @brief Access path of app_main for one reader read.
+ *
+ * @param tags Tag store.
+ * @param reader Reader.
+ * @param door Door.
+ * @param limiter Deny limiter.
+ * @param record TRACE_UART record.
+ */
+static void access(ReplayTags *tags, Rdm6300 *reader, Door *door, DenyLimiter *limiter, const record_t &record){
+
+	host::uart_feed(record.data.data(), record.data.size());
+
+	uint32_t tag = reader->WaitAndRead();
+	uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+
+	if (tag == 0 || tag == (uint32_t)-1){
+		fprintf(host::out, "%s uart %u bytes: no tag\n", host::stamp(), (unsigned)record.data.size());
+		return;
+	}
+
+	if (limiter->locked(now_ms)){
+		fprintf(host::out, "%s uart tag %u: reader locked\n", host::stamp(), tag);
+		return;
+	}
+
+	ReplayTags::access_t tag_access;
+	const char *reason = "unknown";
+	int32_t index = tags->search(tag, &tag_access);
+
+	if (index != -1){
+		if (!(tag_access.doors & door->mask()))
+			reason = "door";
+		else if (!tags->allowed_now(&tag_access))
+			reason = "schedule";
+		else
+			reason = NULL;
+	}
+
+	if (!reason){
+		fprintf(host::out, "%s uart tag %u: granted\n", host::stamp(), tag);
+		door->open();
+
+		publish_tag("v1/devices/me/telemetry", tag, 0, reader->ReadTime());
+		return;
+	}
+
+	fprintf(host::out, "%s uart tag %u: denied (%s)\n", host::stamp(), tag, reason);
+	DenyLimiter::Verdict verdict = limiter->denied(tag, now_ms);
+
+	if (verdict.evicted_tag)
+		publish_tag("lpae/tag_denied", verdict.evicted_tag, verdict.evicted_suppressed, reader->ReadTime());
+
+	if (verdict.report)
+		publish_tag("lpae/tag_denied", tag, verdict.suppressed, reader->ReadTime());
+
+	if (verdict.lockout){
+		char payload[56];
+		json_writer_t json;
+
+		json_init(&json, payload, sizeof(payload));
+		json_object_begin(&json);
+		json_kv_ts(&json, time_wall_ms(reader->ReadTime()));
+		json_kv_uint(&json, "lockout_ms", CONFIG_DENY_LOCKOUT_MS);
+		json_object_end(&json);
+		if (json_finish(&json))
+			mqtt5_publish("lpae/reader_lockout", payload);
+	}
+}
+
+/* Button task state: level sampled last and time of its check */
+struct button_t {
+	int level;
+	int64_t check_us;
+	uint32_t opened_ms;
+};
+
+/**
+ * @brief Run the button task checks due until t_us. The task samples the
+ * level, sleeps one poll period and then acts on the sample.
+ *
+ * @param button Button state.
+ * @param door Door.
+ * @param t_us Time of the next record.
+ */
+static void button_until(button_t *button, Door *door, int64_t t_us){
+
+	while (button->level && button->check_us <= t_us){
+		host::run_until(button->check_us);
+
+		uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+
+		if (now_ms > button->opened_ms + setting_get(SETTING_BUTTON_GUARD_MS)){
+			fprintf(host::out, "%s button: open\n", host::stamp());
+			door->open();
+			button->opened_ms = now_ms;
+
+			char payload[40];
+			json_writer_t json;
+
+			json_init(&json, payload, sizeof(payload));
+			json_object_begin(&json);
+			json_kv_ts(&json, time_wall_ms(host::now_us()));
+			json_kv_uint(&json, "open", 1);
+			json_object_end(&json);
+			if (json_finish(&json))
+				mqtt5_publish("v1/devices/me/telemetry", payload);
+		}
+
+		/* Next sample right away, next check one period later */
+		button->check_us = host::now_us() + (int64_t)setting_get(SETTING_BUTTON_POLL_MS) * 1000;
+	}
+}
+
+/**
+ * @brief Replay a trace once from a fresh state.
+ *
+ * @param header Trace header.
+ * @param records Trace records.
+ * @param tags_path Preloaded tags or NULL.
+ * @param timing Access decision host time.
+ */
+static void replay(const trace_header_t &header, const std::vector<record_t> &records,
+		const char *tags_path, timing_t *timing){
+
+	host::reset(header.base_us);
+	host::set_wall(header.wall_epoch, header.wall_us);
+	Time::Restore();
+	Time::SyncInit();
+
+	ReplayTags tags;
+	Rdm6300 reader(9600, UART_DATA_8_BITS, UART_PARITY_DISABLE, UART_STOP_BITS_1, UART_HW_FLOWCTRL_DISABLE);
+	Door door;
+	DenyLimiter limiter;
+	button_t button = {0, 0, 0};
+
+	if (tags_path)
+		load_tags(&tags, tags_path);
+
+	for (const record_t &record : records){
+		button_until(&button, &door, record.t_us);
+		host::run_until(record.t_us);
+		tags.expire();
+
+		switch (record.type){
+		case TRACE_UART: {
+			auto start = std::chrono::steady_clock::now();
+			access(&tags, &reader, &door, &limiter, record);
+			uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+			timing->count++;
+			timing->total_ns += ns;
+			if (ns > timing->max_ns)
+				timing->max_ns = ns;
+			break;
+		}
+		case TRACE_MQTT: {
+			std::string payload(record.data.begin(), record.data.end());
+
+			fprintf(host::out, "%s mqtt %s \"%s\"\n", host::stamp(), route_name(record.arg), payload.c_str());
+			if (apply_tag_command(&tags, record.arg, payload.c_str()))
+				fprintf(host::out, "%s   applied\n", host::stamp());
+			break;
+		}
+		case TRACE_BUTTON:
+			fprintf(host::out, "%s button: level %u\n", host::stamp(), record.arg);
+			button.level = record.arg;
+			if (button.level)
+				button.check_us = host::now_us() + (int64_t)setting_get(SETTING_BUTTON_POLL_MS) * 1000;
+			break;
+		case TRACE_WALL: {
+			uint32_t epoch = 0;
+
+			if (record.data.size() == sizeof(epoch))
+				memcpy(&epoch, record.data.data(), sizeof(epoch));
+			host::set_wall(epoch, record.t_us);
+			fprintf(host::out, "%s wall %u\n", host::stamp(), epoch);
+			break;
+		}
+		default:
+			fprintf(host::out, "%s unknown record %u\n", host::stamp(), record.type);
+			break;
+		}
+	}
+
+	fprintf(host::out, "%s end: %u strikes\n", host::stamp(), host::strike_count());
+}
+
+int main(int argc, char **argv){
+
+	const char *trace_path = NULL;
+	const char *tags_path = NULL;
+	int repeat = 1;
+
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-v"))
+			host::verbose = true;
+		else if (!strcmp(argv[i], "--allowlist") && i + 1 < argc){
+			if (!host::load_allowlist(argv[++i])){
+				fprintf(stderr, "%s: cannot read\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "--tags") && i + 1 < argc)
+			tags_path = argv[++i];
+		else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (argv[i][0] != '-' && !trace_path)
+			trace_path = argv[i];
+		else {
+			fprintf(stderr, "usage: %s [-v] [--allowlist image] [--tags file] [--repeat n] trace.trc\n", argv[0]);
+			return 1;
+		}
+	}
+
+	trace_header_t header;
+	std::vector<record_t> records;
+
+	if (!trace_path || !load_trace(trace_path, &header, &records)){
+		fprintf(stderr, "%s: not a trace file\n", trace_path ? trace_path : "(none)");
+		return 1;
+	}
+
+	if (header.flags & TRACE_FLAG_WRAPPED)
+		fprintf(host::out, "note: trace wrapped, inputs before the first record are lost\n");
+
+	timing_t timing = {0, 0, 0};
+	auto start = std::chrono::steady_clock::now();
+
+	/* Repeated runs only measure: their output is identical */
+	for (int i = 0; i < repeat; i++){
+		if (i == 1)
+			host::out = fopen("/dev/null", "w");
+		replay(header, records, tags_path, &timing);
+	}
+
+	if (repeat > 1){
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		double traced_s = records.empty() ? 0 : (records.back().t_us - header.base_us) / 1e6;
+
+		fprintf(stderr, "%d runs, %zu records, %.3f s traced: %.3f ms per run\n",
+				repeat, records.size(), traced_s, ns / 1e6 / repeat);
+		fprintf(stderr, "access decision (host): %llu reads, mean %llu ns, max %llu ns\n",
+				(unsigned long long)timing.count,
+				(unsigned long long)(timing.count ? timing.total_ns / timing.count : 0),
+				(unsigned long long)timing.max_ns);
+	}
+
+	return 0;
+}
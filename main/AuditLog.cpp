@@ -0,0 +1,411 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file AuditLog.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing AuditLog class implementation.
+ *
+ */
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+#include "AuditLog.h"
+#include "JsonWriter.h"
+#include "TaskPlan.h"
+#include "Metrics.h"
+#include "Time.h"
+
+static const char *TAG = "Audit::";
+
+/* Partition subtype of the "audit" data partition, see partitions.csv */
+#define AUDIT_PARTITION_SUBTYPE 0x40
+
+/**
+ * @brief Audit task. Appends queued records and answers queries.
+ *
+ * @param arg Pointer of the AuditLog instance.
+ */
+void AuditLog::audit_task(void *arg){
+
+	AuditLog *p = (AuditLog *)arg;
+
+	for (;;)
+		p->service(100);
+}
+
+/**
+ * @brief Append queued records, then answer a pending query. Flash writes
+ * are done here, never on the badge path. Called by the audit task and by
+ * host tests, which have no tasks.
+ *
+ * @param wait_ms Wait for each queued record, in ms.
+ */
+void AuditLog::service(uint32_t wait_ms){
+
+	record_t rec;
+	audit_query_t q;
+
+	if (sectors == 0)
+		return;
+
+	while (xQueueReceive(queue, &rec, pdMS_TO_TICKS(wait_ms)))
+		append(&rec);
+
+	if (get_audit_query(&q, 0) == 0)
+		query(&q);
+}
+
+/**
+ * @brief Construct a new AuditLog object. Rebuilds the sector index and
+ * starts the audit task. Records are ignored without AUDIT_LOG or without
+ * an "audit" partition.
+ *
+ */
+AuditLog::AuditLog(){
+
+	sectors = 0;
+	head = 0;
+	next_seq = 0;
+	memset(index, 0, sizeof(index));
+	partition = NULL;
+
+#ifndef CONFIG_AUDIT_LOG
+	return;
+#endif
+
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+			(esp_partition_subtype_t)AUDIT_PARTITION_SUBTYPE, "audit");
+
+	if (partition == NULL){
+		ESP_LOGE(TAG, "No audit partition: audit log disabled");
+		return;
+	}
+
+	sectors = partition->size / SECTOR_SIZE;
+	if (sectors > MAX_SECTORS)
+		sectors = MAX_SECTORS;
+
+	load();
+
+	queue = RTOS_QUEUE(CONFIG_AUDIT_QUEUE_SIZE, sizeof(record_t), queue_buffer, &queue_storage);
+	RTOS_TASK(audit_task, "audit_task", 4096, this, TASK_AUDIT_PRIORITY, NULL, TASK_AUDIT_CORE);
+}
+
+/**
+ * @brief Record an access event. Never blocks: the record is dropped and
+ * counted (METRIC_AUDIT_DROPPED) when the queue is full.
+ *
+ * @param tag Tag number, 0 when not applicable.
+ * @param door Door number.
+ * @param outcome Access outcome.
+ * @param event_us Time::Now() of the event.
+ */
+void AuditLog::record(uint32_t tag, uint8_t door, Outcome outcome, int64_t event_us){
+
+	record_t rec;
+	int64_t wall_us;
+
+	if (sectors == 0)
+		return;
+
+	/* Wall time not known yet: seconds of system time since boot */
+	wall_us = Time::WallUs(event_us);
+	rec.time = wall_us ? (uint32_t)(wall_us / 1000000) : (uint32_t)time(NULL);
+	rec.tag = tag;
+	rec.door = door;
+	rec.outcome = outcome;
+
+	if (xQueueSend(queue, &rec, 0) != pdTRUE)
+		metric_inc(METRIC_AUDIT_DROPPED);
+}
+
+/**
+ * @brief CRC of a record.
+ *
+ * @param rec Record.
+ * @return uint16_t CRC16 of all fields but crc.
+ */
+uint16_t AuditLog::crc(const record_t *rec){
+	return esp_rom_crc16_le(0, (const uint8_t *)rec, offsetof(record_t, crc));
+}
+
+/**
+ * @brief Bloom filter bit of a tag.
+ *
+ * @param tag Tag number.
+ * @param k Hash function, 0 to 2.
+ * @return uint16_t Bit number.
+ */
+uint16_t AuditLog::bloom_bit(uint32_t tag, int k){
+
+	static const uint32_t mult[3] = {2654435761u, 2246822519u, 3266489917u};
+
+	return ((tag * mult[k]) >> 16) % BLOOM_BITS;
+}
+
+/**
+ * @brief Rebuild the RAM index. Full sectors are summarized by their
+ * footer; only sectors without footer are scanned.
+ *
+ */
+void AuditLog::load(){
+
+	uint32_t last_seq = 0;
+	bool found = false;
+
+	for (uint16_t s = 0; s < sectors; s++){
+		footer_t *f = &index[s].summary;
+
+		esp_partition_read(partition, s * SECTOR_SIZE + SECTOR_SIZE - FOOTER_SIZE, f, sizeof(footer_t));
+
+		if (f->magic == FOOTER_MAGIC)
+			index[s].count = RECORDS_PER_SECTOR;
+		else
+			scan_sector(s);
+
+		/* Empty, or no record passed its CRC: nothing to order it by */
+		if (index[s].count == 0 || f->magic != FOOTER_MAGIC)
+			continue;
+
+		/* Head is the sector holding the newest record */
+		uint32_t sector_last = f->first_seq + index[s].count - 1;
+		if (!found || (int32_t)(sector_last - last_seq) > 0){
+			last_seq = sector_last;
+			head = s;
+			found = true;
+		}
+	}
+
+	if (!found){
+		open_sector(0);
+		ESP_LOGI(TAG, "Empty audit log: %u sectors", sectors);
+		return;
+	}
+
+	next_seq = last_seq + 1;
+
+	/* Power lost before the footer of a full sector */
+	if (index[head].count >= RECORDS_PER_SECTOR)
+		close_sector();
+
+	ESP_LOGI(TAG, "Audit log: %u sectors, head %u, next record %" PRIu32, sectors, head, next_seq);
+}
+
+/**
+ * @brief Index a sector without footer reading its records.
+ *
+ * @param sector Sector number.
+ */
+void AuditLog::scan_sector(uint16_t sector){
+
+	record_t rec;
+	sector_index_t *entry = &index[sector];
+
+	memset(entry, 0, sizeof(sector_index_t));
+
+	for (uint16_t i = 0; i < RECORDS_PER_SECTOR; i++){
+		esp_partition_read(partition, sector * SECTOR_SIZE + i * sizeof(record_t), &rec, sizeof(rec));
+
+		if (rec.seq == ERASED)
+			break;
+
+		/* Torn or corrupted records keep their slot but are not indexed */
+		if (rec.crc == crc(&rec))
+			index_record(sector, i, &rec);
+
+		entry->count = i + 1;
+	}
+}
+
+/**
+ * @brief Add a record to the summary of its sector.
+ *
+ * @param sector Sector number.
+ * @param slot Record slot in the sector.
+ * @param rec Record.
+ */
+void AuditLog::index_record(uint16_t sector, uint16_t slot, const record_t *rec){
+
+	footer_t *f = &index[sector].summary;
+
+	if (f->magic != FOOTER_MAGIC){
+		/* First valid record: earlier slots may have failed their CRC,
+		 * sequence numbers follow the slots */
+		f->magic = FOOTER_MAGIC;
+		f->first_seq = rec->seq - slot;
+		f->min_time = rec->time;
+		f->max_time = rec->time;
+	}
+
+	if (rec->time < f->min_time)
+		f->min_time = rec->time;
+	if (rec->time > f->max_time)
+		f->max_time = rec->time;
+
+	for (int k = 0; k < 3; k++){
+		uint16_t bit = bloom_bit(rec->tag, k);
+		f->bloom[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+/**
+ * @brief Check the bloom filter of a sector.
+ *
+ * @param sector Sector number.
+ * @param tag Tag number.
+ * @return true Tag may be in the sector.
+ * @return false Tag is not in the sector.
+ */
+bool AuditLog::bloom_has(uint16_t sector, uint32_t tag){
+
+	const footer_t *f = &index[sector].summary;
+
+	for (int k = 0; k < 3; k++){
+		uint16_t bit = bloom_bit(tag, k);
+		if (!(f->bloom[bit / 8] & (1 << (bit % 8))))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Erase a sector and make it the head. Oldest records are lost.
+ *
+ * @param sector Sector number.
+ */
+void AuditLog::open_sector(uint16_t sector){
+
+	esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE);
+	memset(&index[sector], 0, sizeof(sector_index_t));
+	head = sector;
+}
+
+/**
+ * @brief Write the footer of the full head sector and open the next one.
+ *
+ */
+void AuditLog::close_sector(){
+
+	esp_partition_write(partition, head * SECTOR_SIZE + SECTOR_SIZE - FOOTER_SIZE,
+			&index[head].summary, sizeof(footer_t));
+
+	open_sector((head + 1) % sectors);
+}
+
+/**
+ * @brief Append a record to the head sector.
+ *
+ * @param rec Record. Sequence and CRC are set here.
+ */
+void AuditLog::append(record_t *rec){
+
+	sector_index_t *entry = &index[head];
+
+	rec->seq = next_seq++;
+	rec->crc = crc(rec);
+
+	if (esp_partition_write(partition, head * SECTOR_SIZE + entry->count * sizeof(record_t),
+			rec, sizeof(record_t)) != ESP_OK)
+		ESP_LOGE(TAG, "Write error at sector %u", head);
+
+	index_record(head, entry->count, rec);
+	entry->count++;
+
+	if (entry->count >= RECORDS_PER_SECTOR)
+		close_sector();
+}
+
+/**
+ * @brief Stream records matching a query, oldest first, in chunks of
+ * AUDIT_CHUNK_RECORDS. Sectors are skipped using their time range and tag
+ * bloom filter. A last message reports the number of matches.
+ *
+ * @param q Query.
+ */
+void AuditLog::query(const audit_query_t *q){
+
+	record_t batch[16];
+	uint32_t matches = 0;
+	int in_chunk = 0;
+	json_writer_t json;
+
+	for (uint16_t n = 1; n <= sectors; n++){
+		uint16_t s = (head + n) % sectors;
+		const sector_index_t *entry = &index[s];
+
+		if (entry->count == 0 || entry->summary.max_time < q->from || entry->summary.min_time > q->until)
+			continue;
+
+		if (q->tag && !bloom_has(s, q->tag))
+			continue;
+
+		for (uint16_t i = 0; i < entry->count; i += 16){
+			uint16_t read = entry->count - i < 16 ? entry->count - i : 16;
+
+			esp_partition_read(partition, s * SECTOR_SIZE + i * sizeof(record_t), batch, read * sizeof(record_t));
+
+			for (uint16_t r = 0; r < read; r++){
+				const record_t *rec = &batch[r];
+
+				if (rec->crc != crc(rec) || rec->time < q->from || rec->time > q->until ||
+						(q->tag && rec->tag != q->tag))
+					continue;
+
+				if (in_chunk == 0){
+					json_init(&json, chunk, sizeof(chunk));
+					json_object_begin(&json);
+					json_kv_uint(&json, "seq", rec->seq);
+					json_key(&json, "records");
+					json_array_begin(&json);
+				}
+
+				json_array_begin(&json);
+				json_uint(&json, rec->time);
+				json_uint(&json, rec->tag);
+				json_uint(&json, rec->door);
+				json_uint(&json, rec->outcome);
+				json_array_end(&json);
+				in_chunk++;
+				matches++;
+
+				if (in_chunk == CONFIG_AUDIT_CHUNK_RECORDS){
+					json_array_end(&json);
+					json_object_end(&json);
+					if (json_finish(&json))
+						mqtt5_reply(q->response_topic, q->correlation, q->correlation_len, chunk);
+					in_chunk = 0;
+					/* Let the MQTT client drain the socket */
+					vTaskDelay(1);
+				}
+			}
+		}
+	}
+
+	if (in_chunk){
+		json_array_end(&json);
+		json_object_end(&json);
+		if (json_finish(&json))
+			mqtt5_reply(q->response_topic, q->correlation, q->correlation_len, chunk);
+	}
+
+	json_init(&json, chunk, sizeof(chunk));
+	json_object_begin(&json);
+	json_kv_uint(&json, "done", matches);
+	json_object_end(&json);
+	if (json_finish(&json))
+		mqtt5_reply(q->response_topic, q->correlation, q->correlation_len, chunk);
+}
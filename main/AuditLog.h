@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file AuditLog.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing AuditLog class definition.
+ *
+ * Access events are appended as fixed 16 byte records to the "audit" flash
+ * partition, used as a circular log of 4 KB sectors. When a sector is full
+ * a footer with its time range and a bloom filter of its tags is written,
+ * so the RAM index is rebuilt at boot reading only footers and queries by
+ * time or tag skip sectors that cannot match.
+ */
+
+#ifndef MAIN_AUDITLOG_H_
+#define MAIN_AUDITLOG_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_partition.h"
+
+#include "Mqtt.h"
+#include "StaticAlloc.h"
+
+class AuditLog {
+public:
+	/* Outcome of an access event */
+	enum Outcome : uint8_t {
+		GRANTED,			/* Stored tag opened the door */
+		DENIED,				/* Unknown tag */
+		DENIED_DOOR,		/* Tag not allowed on this door */
+		DENIED_SCHEDULE,	/* Tag outside its schedule */
+		REMOTE_GRANTED,		/* Backend granted an unknown tag */
+		UNLOCK,				/* Remote unlock command */
+		BUTTON,				/* Door button */
+	};
+
+	AuditLog();
+
+	void record(uint32_t tag, uint8_t door, Outcome outcome, int64_t event_us);
+	void service(uint32_t wait_ms);
+
+	enum {SECTOR_SIZE = 4096, FOOTER_SIZE = 64, MAX_SECTORS = 64};
+
+private:
+	struct record_t {
+		uint32_t seq;			/* 0xffffffff: erased slot */
+		uint32_t time;			/* Epoch seconds */
+		uint32_t tag;
+		uint8_t door;
+		uint8_t outcome;
+		uint16_t crc;			/* CRC16 of the fields above */
+	};
+
+	enum {RECORDS_PER_SECTOR = (SECTOR_SIZE - FOOTER_SIZE) / sizeof(record_t)};
+	enum {BLOOM_BYTES = FOOTER_SIZE - 16, BLOOM_BITS = BLOOM_BYTES * 8};
+	enum : uint32_t {FOOTER_MAGIC = 0x31445541, ERASED = 0xffffffff};
+
+	/* Sector footer and RAM index entry */
+	struct footer_t {
+		uint32_t magic;
+		uint32_t first_seq;
+		uint32_t min_time;
+		uint32_t max_time;
+		uint8_t bloom[BLOOM_BYTES];
+	};
+
+	struct sector_index_t {
+		footer_t summary;
+		uint16_t count;			/* Used record slots */
+	};
+
+	static_assert(sizeof(record_t) == 16, "Audit record must be 16 bytes");
+	static_assert(sizeof(footer_t) == FOOTER_SIZE, "Audit footer size mismatch");
+
+	const esp_partition_t *partition;
+	uint16_t sectors;
+	uint16_t head;				/* Sector being written */
+	uint32_t next_seq;
+
+	sector_index_t index[MAX_SECTORS];
+
+	QueueHandle_t queue;
+	STATIC_ONLY(StaticQueue_t queue_storage;)
+	STATIC_ONLY(record_t queue_buffer[CONFIG_AUDIT_QUEUE_SIZE];)
+
+	char chunk[48 + 40 * CONFIG_AUDIT_CHUNK_RECORDS];
+
+	static void audit_task(void *arg);
+	static uint16_t crc(const record_t *rec);
+	static uint16_t bloom_bit(uint32_t tag, int k);
+
+	void load();
+	void scan_sector(uint16_t sector);
+	void index_record(uint16_t sector, uint16_t slot, const record_t *rec);
+	bool bloom_has(uint16_t sector, uint32_t tag);
+	void open_sector(uint16_t sector);
+	void close_sector();
+	void append(record_t *rec);
+	void query(const audit_query_t *q);
+};
+
+#endif /* MAIN_AUDITLOG_H_ */
@@ -0,0 +1,68 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file AuthCache.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing AuthCache class implementation.
+ *
+ */
+
+#include "AuthCache.h"
+
+#ifdef CONFIG_REMOTE_AUTH
+
+/**
+ * @brief Construct a new empty AuthCache object.
+ *
+ */
+AuthCache::AuthCache(){
+}
+
+/**
+ * @brief Get a cached answer.
+ *
+ * @param tag Tag number.
+ * @param now_ms Current time in ms.
+ * @param doors Granted door mask, 0 when the tag was denied.
+ * @return true Valid cached answer.
+ * @return false Not cached or expired.
+ */
+bool AuthCache::get(uint32_t tag, uint32_t now_ms, uint8_t *doors){
+
+	answer_t *answer = answers.find(tag);
+
+	if (answer == NULL)
+		return false;
+
+	if ((int32_t)(now_ms - answer->expires_ms) >= 0)
+		return false;
+
+	answers.touch(answer);
+
+	*doors = answer->doors;
+
+	return true;
+}
+
+/**
+ * @brief Store an answer. Evicts the least recently used entry when full.
+ *
+ * @param tag Tag number.
+ * @param doors Granted door mask, 0: denied.
+ * @param ttl_ms Time to keep the answer.
+ * @param now_ms Current time in ms.
+ */
+void AuthCache::put(uint32_t tag, uint8_t doors, uint32_t ttl_ms, uint32_t now_ms){
+
+	bool created;
+	answer_t *answer = answers.put(tag, &created);
+
+	answer->doors = doors;
+	answer->expires_ms = now_ms + ttl_ms;
+}
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file AuthCache.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing AuthCache class definition.
+ *
+ * Bounded LRU cache of remote authorization answers. Each entry keeps the
+ * granted door mask (0: denied) until its TTL elapses, so repeated reads
+ * of a tag not stored in Tags are answered locally. Only built with
+ * REMOTE_AUTH.
+ */
+
+#ifndef MAIN_AUTHCACHE_H_
+#define MAIN_AUTHCACHE_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#include "LruMap.h"
+
+#ifdef CONFIG_REMOTE_AUTH
+class AuthCache {
+public:
+	AuthCache();
+
+	bool get(uint32_t tag, uint32_t now_ms, uint8_t *doors);
+	void put(uint32_t tag, uint8_t doors, uint32_t ttl_ms, uint32_t now_ms);
+
+	enum {CACHE_SIZE = CONFIG_REMOTE_AUTH_CACHE_SIZE};
+
+private:
+	struct answer_t {
+		uint32_t expires_ms;
+		uint8_t doors;
+	};
+
+	/* Answers by tag */
+	LruMap<CACHE_SIZE, answer_t> answers;
+};
+#endif
+
+#endif /* MAIN_AUTHCACHE_H_ */
@@ -0,0 +1,126 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file DenyLimiter.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing DenyLimiter class implementation.
+ *
+ */
+
+#include "DenyLimiter.h"
+
+/**
+ * @brief Construct a new DenyLimiter object. All buckets start full.
+ *
+ */
+DenyLimiter::DenyLimiter(){
+
+	global_refill_ms = 0;
+	global_tokens = CONFIG_DENY_GLOBAL_BURST;
+	locked_until_ms = 0;
+	lock_active = false;
+}
+
+/**
+ * @brief Register a denied read and decide if it should be reported.
+ * O(1): one hash probe and a few list updates.
+ *
+ * @param tag Denied tag.
+ * @param now_ms Current time in ms.
+ * @return Verdict What to report.
+ */
+DenyLimiter::Verdict DenyLimiter::denied(uint32_t tag, uint32_t now_ms){
+
+	Verdict v = {false, 0, 0, 0, false};
+
+	/* Global bucket: too many denies of any tag locks the reader */
+	global_tokens = refill(global_tokens, &global_refill_ms, now_ms,
+			CONFIG_DENY_GLOBAL_REFILL_MS, CONFIG_DENY_GLOBAL_BURST);
+	if (global_tokens > 0)
+		global_tokens--;
+	else if (CONFIG_DENY_LOCKOUT_MS > 0 && !lock_active){
+		locked_until_ms = now_ms + CONFIG_DENY_LOCKOUT_MS;
+		lock_active = true;
+		v.lockout = true;
+	}
+
+	/* Evicts the least recently denied tag when full */
+	bool created;
+	entry_t evicted = {0, 0, 0};
+	uint32_t evicted_tag = 0;
+	entry_t *e = recent.put(tag, &created, &evicted, &evicted_tag);
+
+	if (evicted.suppressed){
+		v.evicted_tag = evicted_tag;
+		v.evicted_suppressed = evicted.suppressed;
+	}
+
+	if (created){
+		e->refill_ms = now_ms;
+		e->tokens = CONFIG_DENY_TAG_BURST;
+		e->suppressed = 0;
+	}
+
+	e->tokens = refill(e->tokens, &e->refill_ms, now_ms,
+			CONFIG_DENY_TAG_REFILL_MS, CONFIG_DENY_TAG_BURST);
+
+	if (e->tokens > 0){
+		e->tokens--;
+		v.report = true;
+		v.suppressed = e->suppressed;
+		e->suppressed = 0;
+	}
+	else if (e->suppressed < UINT16_MAX)
+		e->suppressed++;
+
+	return v;
+}
+
+/**
+ * @brief Check reader lockout.
+ *
+ * @param now_ms Current time in ms.
+ * @return true Reader is locked: reads should be ignored.
+ * @return false Reader is not locked.
+ */
+bool DenyLimiter::locked(uint32_t now_ms){
+
+	if (lock_active && (int32_t)(now_ms - locked_until_ms) >= 0){
+		lock_active = false;
+		/* Start over with a full global bucket */
+		global_tokens = CONFIG_DENY_GLOBAL_BURST;
+		global_refill_ms = now_ms;
+	}
+
+	return lock_active;
+}
+
+/**
+ * @brief Add tokens elapsed since last refill.
+ *
+ * @param tokens Current tokens.
+ * @param last_ms Time of last refill. Updated.
+ * @param now_ms Current time.
+ * @param period_ms Time to earn one token.
+ * @param burst Bucket size.
+ * @return uint16_t New token count.
+ */
+uint16_t DenyLimiter::refill(uint16_t tokens, uint32_t *last_ms, uint32_t now_ms,
+		uint32_t period_ms, uint16_t burst){
+
+	uint32_t earned = (now_ms - *last_ms) / period_ms;
+
+	if (tokens + earned >= burst){
+		*last_ms = now_ms;
+		return burst;
+	}
+
+	*last_ms += earned * period_ms;
+
+	return tokens + earned;
+}
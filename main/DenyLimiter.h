@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file DenyLimiter.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing DenyLimiter class definition.
+ *
+ * Rate limits denied reads. A fixed table of recently denied tags keeps a
+ * token bucket per tag and evicts the least recently denied tag when full.
+ * A global bucket catches many different tags (brute force) and may lock
+ * the reader for a while.
+ */
+
+#ifndef MAIN_DENYLIMITER_H_
+#define MAIN_DENYLIMITER_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#include "LruMap.h"
+
+class DenyLimiter {
+public:
+	/* What to do with a denied read */
+	struct Verdict {
+		bool report;			/* Publish this deny */
+		uint32_t suppressed;	/* Denies of this tag suppressed since the last report */
+		uint32_t evicted_tag;	/* Tag evicted with pending suppressed denies, 0: none */
+		uint32_t evicted_suppressed;
+		bool lockout;			/* Reader was locked by this deny */
+	};
+
+	DenyLimiter();
+
+	Verdict denied(uint32_t tag, uint32_t now_ms);
+	bool locked(uint32_t now_ms);
+
+	enum {TABLE_SIZE = CONFIG_DENY_TABLE_SIZE};
+
+private:
+	struct entry_t {
+		uint32_t refill_ms;		/* Time of last token refill */
+		uint16_t tokens;
+		uint16_t suppressed;
+	};
+
+	/* Recently denied tags, the least recently denied is evicted */
+	LruMap<TABLE_SIZE, entry_t> recent;
+
+	/* Global bucket for all denies */
+	uint32_t global_refill_ms;
+	uint16_t global_tokens;
+	uint32_t locked_until_ms;
+	bool lock_active;
+
+	static uint16_t refill(uint16_t tokens, uint32_t *last_ms, uint32_t now_ms,
+			uint32_t period_ms, uint16_t burst);
+};
+
+#endif /* MAIN_DENYLIMITER_H_ */
@@ -10,16 +10,25 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "driver/gpio.h"
+#include "esp_timer.h"
 
+#include "Settings.h"
 
-Door::Door() {
+
+/**
+ * @brief Construct a new Door object.
+ *
+ * @param id Door number. Bit id of tag permission masks opens this door.
+ * @param gpio Strike output.
+ */
+Door::Door(uint8_t id, gpio_num_t gpio) : door_id(id), door_GPIO(gpio) {
 	gpio_reset_pin(door_GPIO);
 	/* Set the GPIO as a push/pull output */
 	gpio_set_direction(door_GPIO, GPIO_MODE_OUTPUT);
 	/* Force level */
 	gpio_set_level(door_GPIO, 0);
 
-	xSemaphore_door = xSemaphoreCreateMutex();
+	xSemaphore_door = RTOS_MUTEX(&door_mutex_storage);
 }
 
 Door::~Door() {
@@ -27,10 +36,18 @@ Door::~Door() {
 }
 
 
-void Door::open(){
+/**
+ * @brief Pulse the strike output.
+ *
+ * @return int64_t esp_timer time (us) the strike was energized.
+ */
+int64_t Door::open(){
 	xSemaphoreTake(xSemaphore_door, portMAX_DELAY);
 	gpio_set_level(door_GPIO, 1);
-	vTaskDelay(100 /  portTICK_PERIOD_MS);
+	int64_t actuated_us = esp_timer_get_time();
+	vTaskDelay(pdMS_TO_TICKS(setting_get(SETTING_STRIKE_MS)));
 	gpio_set_level(door_GPIO, 0);
 	xSemaphoreGive(xSemaphore_door);
+
+	return actuated_us;
 }
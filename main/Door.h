@@ -14,17 +14,24 @@
 
 #include "driver/gpio.h"
 
+#include "StaticAlloc.h"
+
 class Door {
 public:
-	Door();
+	Door(uint8_t id = CONFIG_DOOR_ID, gpio_num_t gpio = GPIO_NUM_13);
 	~Door();
 
-	void open();
+	int64_t open();
+
+	/* Bit of this door in tag permission masks */
+	uint8_t mask() const { return 1 << door_id; }
 
 private:
-	const gpio_num_t door_GPIO = GPIO_NUM_13;
+	const uint8_t door_id;
+	const gpio_num_t door_GPIO;
 
 	SemaphoreHandle_t xSemaphore_door;
+	STATIC_ONLY(StaticSemaphore_t door_mutex_storage;)
 };
 
 #endif /* MAIN_DOOR_H_ */
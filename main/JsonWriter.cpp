@@ -0,0 +1,248 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file JsonWriter.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the streaming JSON writer implementation.
+ *
+ */
+
+#include <string.h>
+
+#include "JsonWriter.h"
+
+static_assert(JSON_MAX_DEPTH <= 16, "has_members holds one bit per depth");
+
+/**
+ * @brief Append bytes, or mark the writer overflowed when they do not fit.
+ *
+ * @param w Writer.
+ * @param data Bytes.
+ * @param len Number of bytes.
+ */
+static void put(json_writer_t *w, const char *data, size_t len){
+
+	if (w->overflow)
+		return;
+
+	if (len >= (size_t)(w->size - w->len)){
+		w->overflow = true;
+		return;
+	}
+
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+static void put_char(json_writer_t *w, char c){
+
+	if (w->overflow)
+		return;
+
+	if (w->len + 1 >= w->size){
+		w->overflow = true;
+		return;
+	}
+
+	w->buf[w->len++] = c;
+}
+
+/**
+ * @brief Comma before a member or element that is not the first one.
+ *
+ * @param w Writer.
+ */
+static void separator(json_writer_t *w){
+
+	uint16_t bit = 1 << w->depth;
+
+	if (w->after_key){
+		w->after_key = false;
+		return;
+	}
+
+	if (w->has_members & bit)
+		put_char(w, ',');
+	w->has_members |= bit;
+}
+
+static void begin(json_writer_t *w, char open){
+
+	separator(w);
+
+	if (w->depth + 1 >= JSON_MAX_DEPTH){
+		w->overflow = true;
+		return;
+	}
+
+	put_char(w, open);
+	w->depth++;
+	w->has_members &= ~(1 << w->depth);
+}
+
+static void end(json_writer_t *w, char close){
+
+	if (w->depth == 0 || w->after_key){
+		w->overflow = true;
+		return;
+	}
+
+	w->depth--;
+	put_char(w, close);
+}
+
+/**
+ * @brief Start writing into a buffer.
+ *
+ * @param w Writer.
+ * @param buf Output buffer. Null terminated by json_finish().
+ * @param size Buffer size, up to 65535 bytes.
+ */
+void json_init(json_writer_t *w, char *buf, size_t size){
+
+	w->buf = buf;
+	w->size = size > 0xffff ? 0xffff : size;
+	w->len = 0;
+	w->depth = 0;
+	w->after_key = false;
+	w->overflow = size == 0;
+	w->has_members = 0;
+}
+
+void json_object_begin(json_writer_t *w){
+	begin(w, '{');
+}
+
+void json_object_end(json_writer_t *w){
+	end(w, '}');
+}
+
+void json_array_begin(json_writer_t *w){
+	begin(w, '[');
+}
+
+void json_array_end(json_writer_t *w){
+	end(w, ']');
+}
+
+/**
+ * @brief Write an object key. Keys are not escaped: callers use
+ * identifiers.
+ *
+ * @param w Writer.
+ * @param key Null terminated key.
+ */
+void json_key(json_writer_t *w, const char *key){
+
+	separator(w);
+	put_char(w, '"');
+	put(w, key, strlen(key));
+	put(w, "\":", 2);
+	w->after_key = true;
+}
+
+void json_uint(json_writer_t *w, uint64_t value){
+
+	char digits[20];
+	int n = sizeof(digits);
+
+	do {
+		digits[--n] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	separator(w);
+	put(w, digits + n, sizeof(digits) - n);
+}
+
+void json_int(json_writer_t *w, int64_t value){
+
+	if (value >= 0){
+		json_uint(w, value);
+		return;
+	}
+
+	separator(w);
+	put_char(w, '-');
+	/* Already separated: write the magnitude as a key value */
+	w->after_key = true;
+	json_uint(w, 0 - (uint64_t)value);
+}
+
+void json_bool(json_writer_t *w, bool value){
+
+	separator(w);
+	if (value)
+		put(w, "true", 4);
+	else
+		put(w, "false", 5);
+}
+
+/**
+ * @brief Write a string value, escaping quotes, backslashes and control
+ * characters.
+ *
+ * @param w Writer.
+ * @param value String.
+ * @param len String length.
+ */
+void json_string_len(json_writer_t *w, const char *value, size_t len){
+
+	static const char hex[] = "0123456789abcdef";
+	size_t start = 0;
+
+	separator(w);
+	put_char(w, '"');
+
+	for (size_t i = 0; i < len; i++){
+		uint8_t c = value[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		/* Copy the plain run, then the escape */
+		put(w, value + start, i - start);
+		start = i + 1;
+
+		switch (c){
+		case '"':  put(w, "\\\"", 2); break;
+		case '\\': put(w, "\\\\", 2); break;
+		case '\n': put(w, "\\n", 2); break;
+		case '\r': put(w, "\\r", 2); break;
+		case '\t': put(w, "\\t", 2); break;
+		default: {
+			char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+			put(w, escape, sizeof(escape));
+		}
+		}
+	}
+
+	put(w, value + start, len - start);
+	put_char(w, '"');
+}
+
+void json_string(json_writer_t *w, const char *value){
+	json_string_len(w, value, strlen(value));
+}
+
+/**
+ * @brief Terminate the output.
+ *
+ * @param w Writer.
+ * @return const char* Null terminated JSON, NULL when it did not fit or
+ * containers are left open.
+ */
+const char *json_finish(json_writer_t *w){
+
+	if (w->overflow || w->depth || w->after_key || w->size == 0)
+		return NULL;
+
+	w->buf[w->len] = 0;
+
+	return w->buf;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file JsonWriter.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the streaming JSON writer definitions.
+ *
+ * Writes compact JSON straight into a caller buffer, usually the payload
+ * passed to mqtt5_publish. No allocation and no printf: numbers are
+ * converted by hand. Commas are inserted automatically. Once the buffer
+ * is full every later call is ignored and json_finish() returns NULL, so
+ * a payload is either complete and valid or not published at all.
+ *
+ *   json_writer_t w;
+ *   json_init(&w, buffer, sizeof(buffer));
+ *   json_object_begin(&w);
+ *   json_kv_uint(&w, "tag", tag);
+ *   json_object_end(&w);
+ *   if (json_finish(&w)) mqtt5_publish(topic, buffer);
+ */
+
+#ifndef MAIN_JSONWRITER_H_
+#define MAIN_JSONWRITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+/* Deepest object/array nesting */
+#define JSON_MAX_DEPTH	16
+
+typedef struct {
+	char *buf;
+	uint16_t size;			/* Buffer size, one byte is kept for the terminator */
+	uint16_t len;
+	uint8_t depth;
+	bool after_key;			/* Next value belongs to a key: no comma */
+	bool overflow;			/* Buffer full or nesting error: output invalid */
+	uint16_t has_members;	/* Bit n: container at depth n already has a member */
+} json_writer_t;
+
+EXPORT_C void json_init(json_writer_t *w, char *buf, size_t size);
+EXPORT_C void json_object_begin(json_writer_t *w);
+EXPORT_C void json_object_end(json_writer_t *w);
+EXPORT_C void json_array_begin(json_writer_t *w);
+EXPORT_C void json_array_end(json_writer_t *w);
+EXPORT_C void json_key(json_writer_t *w, const char *key);
+EXPORT_C void json_uint(json_writer_t *w, uint64_t value);
+EXPORT_C void json_int(json_writer_t *w, int64_t value);
+EXPORT_C void json_bool(json_writer_t *w, bool value);
+EXPORT_C void json_string(json_writer_t *w, const char *value);
+EXPORT_C void json_string_len(json_writer_t *w, const char *value, size_t len);
+EXPORT_C const char *json_finish(json_writer_t *w);
+
+/* Key and value of an object member */
+static inline void json_kv_uint(json_writer_t *w, const char *key, uint64_t value){
+	json_key(w, key);
+	json_uint(w, value);
+}
+
+static inline void json_kv_int(json_writer_t *w, const char *key, int64_t value){
+	json_key(w, key);
+	json_int(w, value);
+}
+
+static inline void json_kv_bool(json_writer_t *w, const char *key, bool value){
+	json_key(w, key);
+	json_bool(w, value);
+}
+
+static inline void json_kv_string(json_writer_t *w, const char *key, const char *value){
+	json_key(w, key);
+	json_string(w, value);
+}
+
+/* Event time "ts" in epoch ms, omitted while wall time is unknown (0) */
+static inline void json_kv_ts(json_writer_t *w, int64_t wall_ms){
+	if (wall_ms > 0)
+		json_kv_int(w, "ts", wall_ms);
+}
+
+#endif /* MAIN_JSONWRITER_H_ */
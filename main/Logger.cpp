@@ -0,0 +1,171 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Logger.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing deferred binary logger implementation.
+ *
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "Logger.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+
+static_assert((CONFIG_DLOG_RING_SIZE & (CONFIG_DLOG_RING_SIZE - 1)) == 0,
+		"DLOG_RING_SIZE must be a power of two");
+
+/* Format table built from DLOG_FORMATS */
+struct dlog_format_t {
+	const char *tag;
+	const char *fmt;
+};
+
+#define DLOG_TABLE(id, tag, fmt) {tag, fmt},
+static const dlog_format_t formats[] = {
+		DLOG_FORMATS(DLOG_TABLE)
+};
+#undef DLOG_TABLE
+
+/* One ring cell. seq tells producers and consumer who owns the cell */
+struct dlog_cell_t {
+	std::atomic<uint32_t> seq;
+	uint32_t ticks;
+	uint16_t fmt;
+	uint8_t level;
+	uint32_t args[3];
+};
+
+enum {RING_SIZE = CONFIG_DLOG_RING_SIZE, RING_MASK = CONFIG_DLOG_RING_SIZE - 1};
+
+static dlog_cell_t ring[RING_SIZE];
+static std::atomic<uint32_t> enqueue_pos;
+static uint32_t dequeue_pos;
+static std::atomic<uint32_t> dropped;
+
+static TaskHandle_t dlog_task_handle;
+
+static const char level_letter[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+/**
+ * @brief Logger task. Formats and prints pending records with low priority.
+ *
+ * @param param Not used.
+ */
+static void dlog_task(void *param){
+
+	char line[128];
+
+	while (1){
+		/* Wake up on notification or periodically */
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_DLOG_FLUSH_PERIOD_MS));
+
+		while (1){
+			dlog_cell_t *cell = &ring[dequeue_pos & RING_MASK];
+			uint32_t seq = cell->seq.load(std::memory_order_acquire);
+
+			if (seq != dequeue_pos + 1)
+				break;
+
+			uint32_t ticks = cell->ticks;
+			uint16_t fmt = cell->fmt;
+			esp_log_level_t level = (esp_log_level_t)cell->level;
+			uint32_t a0 = cell->args[0];
+			uint32_t a1 = cell->args[1];
+			uint32_t a2 = cell->args[2];
+
+			/* Release cell to producers */
+			cell->seq.store(dequeue_pos + RING_SIZE, std::memory_order_release);
+			dequeue_pos++;
+
+			if (fmt >= DLOG_FMT_COUNT || level > ESP_LOG_VERBOSE)
+				continue;
+
+			snprintf(line, sizeof(line), formats[fmt].fmt, a0, a1, a2);
+			esp_log_write(level, formats[fmt].tag, "%c (%lu) %s: %s\n", level_letter[level],
+					(uint32_t)pdTICKS_TO_MS(ticks), formats[fmt].tag, line);
+		}
+
+		uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+		if (lost){
+			snprintf(line, sizeof(line), formats[DLOG_DROPPED].fmt, lost);
+			esp_log_write(ESP_LOG_WARN, formats[DLOG_DROPPED].tag, "W (%lu) %s: %s\n",
+					esp_log_timestamp(), formats[DLOG_DROPPED].tag, line);
+		}
+	}
+}
+
+/**
+ * @brief Initialize ring and start the formatting task. Must be called
+ * before any DLOG record.
+ *
+ */
+void dlog_init(void){
+
+	if (dlog_task_handle)
+		return;
+
+	for (uint32_t i=0; i < RING_SIZE; i++)
+		ring[i].seq.store(i, std::memory_order_relaxed);
+
+	enqueue_pos.store(0, std::memory_order_relaxed);
+	dequeue_pos = 0;
+
+	RTOS_TASK(dlog_task, "dlog_task", 3072, NULL, TASK_DLOG_PRIORITY, &dlog_task_handle, TASK_DLOG_CORE);
+}
+
+/**
+ * @brief Record a log entry. Lock-free and safe for multiple producers.
+ * The record is dropped (and counted) when the ring is full.
+ *
+ * @param fmt Format id. See DLOG_FORMATS.
+ * @param level esp_log_level_t of the record.
+ * @param a0 First argument.
+ * @param a1 Second argument.
+ * @param a2 Third argument.
+ */
+void dlog_record(uint16_t fmt, uint8_t level, uint32_t a0, uint32_t a1, uint32_t a2){
+
+	uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	dlog_cell_t *cell;
+
+	while (1){
+		cell = &ring[pos & RING_MASK];
+		uint32_t seq = cell->seq.load(std::memory_order_acquire);
+		int32_t dif = (int32_t)(seq - pos);
+
+		if (dif == 0){
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (dif < 0){
+			/* Ring full */
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+	}
+
+	cell->ticks = xTaskGetTickCount();
+	cell->fmt = fmt;
+	cell->level = level;
+	cell->args[0] = a0;
+	cell->args[1] = a1;
+	cell->args[2] = a2;
+	cell->seq.store(pos + 1, std::memory_order_release);
+
+	/* Errors and warnings are printed as soon as possible */
+	if (level <= ESP_LOG_WARN && dlog_task_handle)
+		xTaskNotifyGive(dlog_task_handle);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Logger.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing deferred binary logger definitions.
+ *
+ * Hot paths record a format id and up to three raw 32 bit arguments into a
+ * lock-free RAM ring. A low priority task formats and prints them later.
+ * Each module has a compile-time level: disabled logs compile to nothing.
+ */
+
+#ifndef MAIN_LOGGER_H_
+#define MAIN_LOGGER_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+/* Compile-time level of each module (see Kconfig). 0: none ... 5: verbose */
+#define DLOG_LEVEL_MAIN     CONFIG_DLOG_LEVEL_MAIN
+#define DLOG_LEVEL_RDM6300  CONFIG_DLOG_LEVEL_RDM6300
+#define DLOG_LEVEL_TAGS     CONFIG_DLOG_LEVEL_TAGS
+#define DLOG_LEVEL_MQTT     CONFIG_DLOG_LEVEL_MQTT
+
+/* Format table: id, log tag and printf format. Arguments are uint32_t. */
+#define DLOG_FORMATS(X) \
+	X(DLOG_MAIN_OPEN,        "Main::",    "Open door for: %lu") \
+	X(DLOG_MAIN_DENIED,      "Main::",    "Denied tag: %lu") \
+	X(DLOG_MAIN_SCHEDULE,    "Main::",    "Tag %lu denied by schedule") \
+	X(DLOG_MAIN_DOOR,        "Main::",    "Tag %lu not allowed at this door") \
+	X(DLOG_MAIN_LOCKOUT,     "Main::",    "Too many denied reads, reader locked for %lu ms") \
+	X(DLOG_MAIN_AUTH_CACHED, "Main::",    "Tag %lu cached remote answer: doors %lx") \
+	X(DLOG_MAIN_AUTH_REMOTE, "Main::",    "Tag %lu remote answer: doors %lx") \
+	X(DLOG_MAIN_AUTH_TIMEOUT,"Main::",    "Tag %lu remote authorization timeout") \
+	X(DLOG_RDM_TAG,          "Rdm6300::", "tag = %lu  msg_checksum = %lx  cal_checksum = %lx") \
+	X(DLOG_RDM_NO_HEAD,      "Rdm6300::", "No frame head in %lu bytes") \
+	X(DLOG_RDM_BAD_CHECKSUM, "Rdm6300::", "Checksum error: msg = %lx cal = %lx") \
+	X(DLOG_TAGS_RECEIVED,    "Tags::",    "MQTT received new tag: %lu") \
+	X(DLOG_TAGS_ADD,         "Tags::",    "Add new tag to index: %ld") \
+	X(DLOG_TAGS_REMOVE,      "Tags::",    "Remove tag from index: %ld") \
+	X(DLOG_TAGS_FULL,        "Tags::",    "No tag space left") \
+	X(DLOG_TAGS_NVS_OPEN,    "Tags::",    "NVS open error: %lx") \
+	X(DLOG_TAGS_NVS_WRITE,   "Tags::",    "NVS write error: %lx") \
+	X(DLOG_TAGS_STORED,      "Tags::",    "Stored tag: %lu at index: %ld") \
+	X(DLOG_TAGS_COUNT,       "Tags::",    "Stored tags: %lu of %lu") \
+	X(DLOG_TAGS_SCHEDULE,    "Tags::",    "Schedule %lu updated") \
+	X(DLOG_TAGS_EXPIRED,     "Tags::",    "Tag %lu expired") \
+	X(DLOG_MQTT_QUEUE_FULL,  "MQTT5",     "Inbound queue full, tag %lu dropped") \
+	X(DLOG_MQTT_COALESCED,   "MQTT5",     "Inbound queue full, tag %lu coalesced") \
+	X(DLOG_MQTT_SEQ_GAP,     "MQTT5",     "Inbound sequence %lu refused, last accepted %lu") \
+	X(DLOG_MQTT_UNLOCK_REJECTED,"MQTT5",  "Remote unlock rejected, reason %lu") \
+	X(DLOG_MQTT_UNKNOWN_COMMAND,"MQTT5",  "Unknown or not allowed command, length %lu") \
+	X(DLOG_MQTT_FOREIGN_TOPIC,"MQTT5",    "Rejected topic not addressed to this lock, length %lu") \
+	X(DLOG_DROPPED,          "Logger::",  "%lu log records dropped")
+
+#define DLOG_ENUM(id, tag, fmt) id,
+
+typedef enum {
+	DLOG_FORMATS(DLOG_ENUM)
+	DLOG_FMT_COUNT
+} dlog_fmt_t;
+
+#undef DLOG_ENUM
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+EXPORT_C void dlog_init(void);
+EXPORT_C void dlog_record(uint16_t fmt, uint8_t level, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/* Pad missing arguments with zeros. First argument is a placeholder. */
+#define DLOG_ARGS(dummy, a0, a1, a2, ...) (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)
+
+#define DLOG(module, level, fmt, ...) do { \
+		if ((level) <= DLOG_LEVEL_##module) \
+			dlog_record((fmt), (level), DLOG_ARGS(0, ##__VA_ARGS__, 0, 0, 0)); \
+	} while (0)
+
+#define DLOGE(module, fmt, ...) DLOG(module, ESP_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define DLOGW(module, fmt, ...) DLOG(module, ESP_LOG_WARN, fmt, ##__VA_ARGS__)
+#define DLOGI(module, fmt, ...) DLOG(module, ESP_LOG_INFO, fmt, ##__VA_ARGS__)
+#define DLOGD(module, fmt, ...) DLOG(module, ESP_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif /* MAIN_LOGGER_H_ */
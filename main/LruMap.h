@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file LruMap.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing fixed capacity LRU map definition.
+ *
+ * Map of tag numbers to values with at most Size entries. A hash table of
+ * 2 * Size bucket chains finds an entry and a doubly linked list keeps the
+ * use order, so lookups, inserts and the eviction of the least recently
+ * used entry are O(1) and no memory is allocated. Links are entry numbers:
+ * Size is 1 to 128.
+ */
+
+#ifndef MAIN_LRUMAP_H_
+#define MAIN_LRUMAP_H_
+
+#include <stdint.h>
+#include <string.h>
+
+template <uint8_t Size, class Value>
+class LruMap {
+public:
+	static_assert(Size > 0 && Size <= 128, "LruMap size must be 1 to 128");
+
+	LruMap(){
+		memset(keys, 0, sizeof(keys));
+		memset(values, 0, sizeof(values));
+		memset(buckets, NONE, sizeof(buckets));
+		head = NONE;
+		tail = NONE;
+		used = 0;
+	}
+
+	/**
+	 * @brief Find the value of a key. The use order is not changed.
+	 *
+	 * @param key Key.
+	 * @return Value* Value or NULL when the key is not stored.
+	 */
+	Value *find(uint32_t key){
+
+		for (uint8_t i = buckets[hash(key)]; i != NONE; i = hash_next[i])
+			if (keys[i] == key)
+				return &values[i];
+
+		return NULL;
+	}
+
+	/**
+	 * @brief Make a stored value the most recently used.
+	 *
+	 * @param value Value returned by find or put.
+	 */
+	void touch(Value *value){
+
+		uint8_t index = value - values;
+
+		unlink(index);
+		push(index);
+	}
+
+	/**
+	 * @brief Get the value of a key as the most recently used, adding the
+	 * key when not stored. When full, the least recently used entry is
+	 * evicted to make room.
+	 *
+	 * @param key Key.
+	 * @param created Set when the key was added: its value must be initialized.
+	 * @param evicted Copy of the evicted value. Untouched when none. May be NULL.
+	 * @param evicted_key Key of the evicted value. May be NULL.
+	 * @return Value* Value of the key.
+	 */
+	Value *put(uint32_t key, bool *created, Value *evicted = NULL, uint32_t *evicted_key = NULL){
+
+		Value *value = find(key);
+
+		*created = value == NULL;
+
+		if (value){
+			touch(value);
+			return value;
+		}
+
+		uint8_t index;
+
+		if (used < Size)
+			index = used++;
+		else {
+			index = tail;
+			if (evicted)
+				*evicted = values[index];
+			if (evicted_key)
+				*evicted_key = keys[index];
+			unlink(index);
+			hash_unlink(index);
+		}
+
+		uint8_t b = hash(key);
+
+		keys[index] = key;
+		hash_next[index] = buckets[b];
+		buckets[b] = index;
+		push(index);
+
+		return &values[index];
+	}
+
+private:
+	enum {BUCKETS = 2 * Size, NONE = 0xff};
+
+	uint32_t keys[Size];
+	Value values[Size];
+	uint8_t prev[Size];			/* Use list, head is the most recent */
+	uint8_t next[Size];
+	uint8_t hash_next[Size];	/* Hash bucket chain */
+	uint8_t buckets[BUCKETS];
+	uint8_t head;
+	uint8_t tail;
+	uint8_t used;
+
+	/**
+	 * @brief Hash bucket of a key.
+	 *
+	 * @param key Key.
+	 * @return uint8_t Bucket index.
+	 */
+	static uint8_t hash(uint32_t key){
+		return (uint8_t)(((key * 2654435761u) >> 16) % BUCKETS);
+	}
+
+	/**
+	 * @brief Remove an entry from the use list.
+	 *
+	 * @param index Entry index.
+	 */
+	void unlink(uint8_t index){
+
+		if (prev[index] != NONE)
+			next[prev[index]] = next[index];
+		else
+			head = next[index];
+
+		if (next[index] != NONE)
+			prev[next[index]] = prev[index];
+		else
+			tail = prev[index];
+	}
+
+	/**
+	 * @brief Insert an entry as the most recently used.
+	 *
+	 * @param index Entry index.
+	 */
+	void push(uint8_t index){
+
+		prev[index] = NONE;
+		next[index] = head;
+		if (head != NONE)
+			prev[head] = index;
+		else
+			tail = index;
+		head = index;
+	}
+
+	/**
+	 * @brief Remove an entry from its hash bucket chain.
+	 *
+	 * @param index Entry index.
+	 */
+	void hash_unlink(uint8_t index){
+
+		uint8_t *link = &buckets[hash(keys[index])];
+
+		while (*link != NONE){
+			if (*link == index){
+				*link = hash_next[index];
+				return;
+			}
+			link = &hash_next[*link];
+		}
+	}
+};
+
+#endif /* MAIN_LRUMAP_H_ */
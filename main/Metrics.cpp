@@ -0,0 +1,181 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Metrics.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing metrics snapshot export.
+ *
+ */
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+
+#include "Metrics.h"
+#include "JsonWriter.h"
+#include "Mqtt.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+#include "Time.h"
+
+uint32_t metrics_values[METRIC_COUNT];
+
+enum metric_kind_t {COUNTER, GAUGE};
+
+#define METRIC_NAME(id, name, kind) name,
+#define METRIC_KIND(id, name, kind) kind,
+
+static const char *const names[METRIC_COUNT] = { METRICS_TABLE(METRIC_NAME) };
+static const metric_kind_t kinds[METRIC_COUNT] = { METRICS_TABLE(METRIC_KIND) };
+
+#undef METRIC_NAME
+#undef METRIC_KIND
+
+static TaskHandle_t metrics_task_handle;
+
+/* Previous snapshot, only used by metrics_task */
+static uint32_t previous[METRIC_COUNT];
+static TickType_t previous_tick;
+
+/* Snapshot text: name, total and rate of each metric */
+static char snapshot[112 + 40 * METRIC_COUNT];
+
+#ifdef CONFIG_METRICS_TASK_STACKS
+/* Task states of the stacks report, only used by metrics_task */
+enum {MAX_TASKS = 32};
+static TaskStatus_t tasks[MAX_TASKS];
+static char stacks[40 + 32 * MAX_TASKS];
+
+/**
+ * @brief Publish the stack high water mark (free bytes) of every task and
+ * keep the smallest one as the stack_min gauge.
+ *
+ */
+static void stacks_publish(void){
+
+	char topic[64];
+	UBaseType_t count = uxTaskGetSystemState(tasks, MAX_TASKS, NULL);
+	uint32_t min = UINT32_MAX;
+	json_writer_t json;
+
+	json_init(&json, stacks, sizeof(stacks));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(Time::Now()));
+
+	for (UBaseType_t i = 0; i < count; i++){
+		uint32_t free_bytes = tasks[i].usStackHighWaterMark;
+
+		if (free_bytes < min)
+			min = free_bytes;
+		json_kv_uint(&json, tasks[i].pcTaskName, free_bytes);
+	}
+
+	json_object_end(&json);
+
+	metric_set(METRIC_MIN_STACK, count ? min : 0);
+
+	snprintf(topic, sizeof(topic), "lpae/dev/%s/stacks", mqtt5_device_id());
+	if (json_finish(&json))
+		mqtt5_publish(topic, stacks);
+}
+#endif
+
+/**
+ * @brief Publish a snapshot. Counters are exported as [total, per minute]
+ * since the previous snapshot, gauges as their value. "clock" is the wall
+ * clock source (Time::Source) and "drift_ppb" its measured drift.
+ *
+ */
+static void metrics_publish(void){
+
+	char topic[64];
+	TickType_t now = xTaskGetTickCount();
+	uint32_t dt_ms = pdTICKS_TO_MS(now - previous_tick);
+	json_writer_t json;
+
+	metric_set(METRIC_FREE_HEAP, esp_get_free_heap_size());
+	metric_set(METRIC_MIN_FREE_HEAP, esp_get_minimum_free_heap_size());
+#ifdef CONFIG_METRICS_TASK_STACKS
+	stacks_publish();
+#endif
+
+	json_init(&json, snapshot, sizeof(snapshot));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(Time::Now()));
+	json_kv_uint(&json, "up", (uint32_t)pdTICKS_TO_MS(now) / 1000);
+	json_kv_uint(&json, "dt", dt_ms / 1000);
+	json_kv_uint(&json, "clock", Time::WallSource());
+	json_kv_int(&json, "drift_ppb", Time::DriftPpb());
+
+	for (int i = 0; i < METRIC_COUNT; i++){
+		uint32_t value = metric_get((metric_t)i);
+
+		if (kinds[i] == GAUGE)
+			json_kv_uint(&json, names[i], value);
+		else {
+			uint32_t per_min = dt_ms ? (uint32_t)((uint64_t)(value - previous[i]) * 60000 / dt_ms) : 0;
+
+			json_key(&json, names[i]);
+			json_array_begin(&json);
+			json_uint(&json, value);
+			json_uint(&json, per_min);
+			json_array_end(&json);
+		}
+
+		previous[i] = value;
+	}
+
+	json_object_end(&json);
+
+	previous_tick = now;
+
+	snprintf(topic, sizeof(topic), "lpae/dev/%s/metrics", mqtt5_device_id());
+	if (json_finish(&json))
+		mqtt5_publish(topic, snapshot);
+}
+
+/**
+ * @brief Metrics task. Publishes a snapshot every METRICS_PERIOD_S or when
+ * requested.
+ *
+ * @param arg Not used.
+ */
+static void metrics_task(void *arg){
+
+	TickType_t period = CONFIG_METRICS_PERIOD_S ? pdMS_TO_TICKS(CONFIG_METRICS_PERIOD_S * 1000) : portMAX_DELAY;
+
+	previous_tick = xTaskGetTickCount();
+
+	for (;;){
+		ulTaskNotifyTake(pdTRUE, period);
+		metrics_publish();
+	}
+}
+
+/**
+ * @brief Start the metrics export task.
+ *
+ */
+void metrics_init(void){
+
+	if (metrics_task_handle)
+		return;
+
+	RTOS_TASK(metrics_task, "metrics_task", 3072, NULL, TASK_METRICS_PRIORITY, &metrics_task_handle, TASK_METRICS_CORE);
+}
+
+/**
+ * @brief Request a snapshot now. Never blocks.
+ *
+ */
+void metrics_request(void){
+
+	if (metrics_task_handle)
+		xTaskNotifyGive(metrics_task_handle);
+}
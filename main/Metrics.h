@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Metrics.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing operational metrics definitions.
+ *
+ * Counters and gauges are 32-bit words updated with relaxed atomics, so
+ * any task (C or C++) may bump them without locks. A low priority task
+ * publishes a snapshot every METRICS_PERIOD_S seconds and on request, with
+ * the rate of each counter since the previous snapshot.
+ */
+
+#ifndef MAIN_METRICS_H_
+#define MAIN_METRICS_H_
+
+#include <stdint.h>
+
+/* Metric table: id, exported name and kind (COUNTER or GAUGE) */
+#define METRICS_TABLE(X) \
+	X(METRIC_GRANTS,            "grants",        COUNTER) \
+	X(METRIC_DENIES,            "denies",        COUNTER) \
+	X(METRIC_RDM_BAD_CHECKSUM,  "rdm_checksum",  COUNTER) \
+	X(METRIC_RDM_NO_HEAD,       "rdm_no_head",   COUNTER) \
+	X(METRIC_INBOUND_DROPPED,   "in_dropped",    COUNTER) \
+	X(METRIC_INBOUND_COALESCED, "in_coalesced",  COUNTER) \
+	X(METRIC_INBOUND_MALFORMED, "in_malformed",  COUNTER) \
+	X(METRIC_NVS_WRITE_ERRORS,  "nvs_errors",    COUNTER) \
+	X(METRIC_MQTT_DISCONNECTS,  "mqtt_disc",     COUNTER) \
+	X(METRIC_AUTH_TIMEOUTS,     "auth_timeouts", COUNTER) \
+	X(METRIC_UNLOCKS,           "unlocks",       COUNTER) \
+	X(METRIC_AUDIT_DROPPED,     "audit_dropped", COUNTER) \
+	X(METRIC_TAGS_STORED,       "tags",          GAUGE) \
+	X(METRIC_STATIC_TAGS,       "static_tags",   GAUGE) \
+	X(METRIC_ALLOWLIST_ALARM,   "allowlist_alarm", GAUGE) \
+	X(METRIC_FREE_HEAP,         "heap",          GAUGE) \
+	X(METRIC_MIN_FREE_HEAP,     "heap_min",      GAUGE) \
+	X(METRIC_MIN_STACK,         "stack_min",     GAUGE)
+
+#define METRIC_ENUM(id, name, kind) id,
+
+typedef enum {
+	METRICS_TABLE(METRIC_ENUM)
+	METRIC_COUNT
+} metric_t;
+
+#undef METRIC_ENUM
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+/* Metric words, shared by C and C++ modules */
+#ifdef __cplusplus
+extern "C" uint32_t metrics_values[METRIC_COUNT];
+#else
+extern uint32_t metrics_values[METRIC_COUNT];
+#endif
+
+/**
+ * @brief Increment a counter. Lock-free, safe from any task.
+ *
+ * @param id Metric.
+ */
+static inline void metric_inc(metric_t id){
+	__atomic_fetch_add(&metrics_values[id], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Set a gauge. Lock-free, safe from any task.
+ *
+ * @param id Metric.
+ * @param value New value.
+ */
+static inline void metric_set(metric_t id, uint32_t value){
+	__atomic_store_n(&metrics_values[id], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Read a metric.
+ *
+ * @param id Metric.
+ * @return uint32_t Current value.
+ */
+static inline uint32_t metric_get(metric_t id){
+	return __atomic_load_n(&metrics_values[id], __ATOMIC_RELAXED);
+}
+
+EXPORT_C void metrics_init(void);
+EXPORT_C void metrics_request(void);
+
+#endif /* MAIN_METRICS_H_ */
@@ -16,49 +16,1243 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "mqtt_client.h"
+#ifdef CONFIG_REMOTE_UNLOCK
+#include "esp_attr.h"
+#include "mbedtls/md.h"
+#endif
+#ifdef CONFIG_BROKER_TLS
+#include "esp_transport_ssl.h"
+#endif
+#ifdef CONFIG_BROKER_CERT_BUNDLE
+#include "esp_crt_bundle.h"
+#endif
 
 #include "Mqtt.h"
+#include "MqttRoutes.h"
+#include "StaticAlloc.h"
+#include "Metrics.h"
+#include "Settings.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "JsonWriter.h"
+#include "Time.h"
+#include "StaticAllowlist.h"
 
 static const char *TAG = "MQTT5";
 
-/* Queue to stored received tasg */
-static QueueHandle_t subscribe_queue;
+#ifdef CONFIG_BROKER_CERT_EMBEDDED
+/* CA of a private broker, embedded from main/certs/broker_ca.pem */
+extern const char broker_ca_pem_start[] asm("_binary_broker_ca_pem_start");
+#endif
+
+#ifdef CONFIG_BROKER_TLS
+/* Own TLS transport: the client's built-in one does not keep session tickets */
+static esp_transport_handle_t tls_transport;
+#endif
+
+/* Commands are addressed to "lpae/dev/<device id>/<command>" or
+ * "lpae/grp/<group id>/<command>". */
+#define DEVICE_TOPIC_PREFIX "lpae/dev/"
+#define GROUP_TOPIC_PREFIX  "lpae/grp/"
+
+/* Command names are routed by MqttRoutes.cpp */
+#define AUTH_RESPONSE_CMD  "auth/response"
+#define UNLOCK_ACK_CMD     "unlock/ack"
+#define AUDIT_DATA_CMD     "audit/data"
+#define CONFIG_STATE_CMD   "config/state"
+#define TRACE_DATA_CMD     "trace/data"
+#define ALLOWLIST_STATE_CMD "allowlist/state"
+#define TAGS_STATE_CMD     "tags/state"
+
+#define AUTH_REQUEST_TOPIC  "lpae/auth/request"
+
+/* Device identity provisioned in NVS */
+#define IDENTITY_NAMESPACE "lock_id"
+
+/* Inbound command pipeline: ring of received commands waiting for tags_task */
+static tag_cmd_t inbound[CONFIG_MQTT_INBOUND_QUEUE_SIZE];
+static uint16_t inbound_head;
+static uint16_t inbound_count;
+static SemaphoreHandle_t inbound_mutex;
+static SemaphoreHandle_t inbound_ready;		/* Given when a command is queued */
+STATIC_ONLY(static StaticSemaphore_t inbound_mutex_storage;)
+STATIC_ONLY(static StaticSemaphore_t inbound_ready_storage;)
+
+/* Inbound drops already reported, see METRIC_INBOUND_DROPPED */
+static uint32_t inbound_reported;
+static volatile bool inbound_report_due;	/* Report the sequence on a new connection */
+
+/* Last sequence number accepted in the ring. Starts from the last applied
+ * one, stored in NVS by tag_command_done */
+static uint32_t inbound_seq;
+#define INBOUND_NAMESPACE "inbound"
+#define INBOUND_SEQ_KEY   "seq"
 
 /* Publish mutex */
 static SemaphoreHandle_t xSemaphore_publish;
+STATIC_ONLY(static StaticSemaphore_t publish_mutex_storage;)
 
 /* Mqtt client information */
 static esp_mqtt_client_handle_t client;
+static volatile bool connected;
+
+/* Remote authorization answer */
+typedef struct {
+	uint32_t correlation;
+	uint8_t doors;
+	uint32_t ttl_s;
+} auth_answer_t;
+
+/* Queue to store remote authorization answers */
+static QueueHandle_t auth_queue;
+static uint32_t auth_correlation;
+STATIC_ONLY(static StaticQueue_t auth_queue_storage;)
+STATIC_ONLY(static auth_answer_t auth_queue_buffer[2];)
+
+/* Accepted remote unlock commands */
+static QueueHandle_t unlock_queue;
+STATIC_ONLY(static StaticQueue_t unlock_queue_storage;)
+STATIC_ONLY(static unlock_cmd_t unlock_queue_buffer[2];)
+
+#ifdef CONFIG_TAGS_REPLACE
+/* Accepted tag table replacement requests, consumed by tags_task */
+static QueueHandle_t tags_replace_queue;
+STATIC_ONLY(static StaticQueue_t tags_replace_storage;)
+STATIC_ONLY(static tags_replace_t tags_replace_buffer[2];)
+#endif
+
+/* Accepted audit log queries */
+static QueueHandle_t audit_query_queue;
+STATIC_ONLY(static StaticQueue_t audit_query_storage;)
+STATIC_ONLY(static audit_query_t audit_query_buffer[2];)
+
+/* Device identity and derived topics */
+static char unlock_token[48];		/* HMAC key of remote unlocks. Empty: disabled */
+static char device_id[24];
+static char group_id[24];
+static char device_prefix[48];
+static char group_prefix[48];
+static char auth_response_topic[72];
+
+/* Outbound topic aliases of the current connection. Slot i is alias i + 1 */
+typedef struct {
+	char topic[64];
+	bool sent;			/* Broker already knows this alias */
+} topic_alias_t;
+
+static topic_alias_t topic_aliases[CONFIG_MQTT_TOPIC_ALIAS_MAX > 0 ? CONFIG_MQTT_TOPIC_ALIAS_MAX : 1];
+static uint8_t topic_aliases_used;
+static bool topic_aliases_enabled;
+
+/* Publish properties last set on the client in this connection. The client
+ * keeps them for every publish: set again only when they change */
+typedef struct {
+	bool valid;
+	uint8_t payload_format_indicator;
+	uint32_t message_expiry_interval;
+	uint16_t topic_alias;
+	char response_topic[72];			/* Empty: none */
+	char correlation[16];
+	uint8_t correlation_len;
+} publish_property_set_t;
+
+static publish_property_set_t property_set;
+
+static esp_mqtt5_publish_property_config_t publish_property;
+static int publish_aliased(const char *topic, const char *msg, esp_mqtt5_publish_property_config_t *property, bool may_alias);
+
+/**
+ * @brief Drop the pending command at position n of the ring. Must be called
+ * holding inbound_mutex.
+ * 
+ * @param n Position from the oldest pending command.
+ */
+static void inbound_remove(int n){
+
+	for (; n < inbound_count - 1; n++)
+		inbound[(inbound_head + n) % CONFIG_MQTT_INBOUND_QUEUE_SIZE] =
+				inbound[(inbound_head + n + 1) % CONFIG_MQTT_INBOUND_QUEUE_SIZE];
+	inbound_count--;
+}
+
+/**
+ * @brief Make room for a command by merging it with the pending commands of
+ * the same tag or schedule. Must be called holding inbound_mutex.
+ *
+ * A schedule definition replaces every pending one of its id. A set is
+ * absolute, so it replaces every pending command of its tag. A toggle
+ * cancels a pending toggle of its tag, and makes every command before the
+ * last pending set of the tag redundant.
+ * 
+ * @param cmd New command.
+ * @return true Command absorbed or room made for it.
+ */
+static bool inbound_coalesce(const tag_cmd_t *cmd){
+
+	uint16_t count = inbound_count;
+	int last = -1;
+
+	for (int n = inbound_count - 1; n >= 0; n--){
+		tag_cmd_t *pending = &inbound[(inbound_head + n) % CONFIG_MQTT_INBOUND_QUEUE_SIZE];
+
+		if (cmd->type == TAG_CMD_SCHEDULE){
+			if (pending->type == TAG_CMD_SCHEDULE && pending->schedule_id == cmd->schedule_id)
+				inbound_remove(n);
+			continue;
+		}
+
+		if (pending->type == TAG_CMD_SCHEDULE || pending->tag != cmd->tag)
+			continue;
+
+		if (cmd->type == TAG_CMD_SET){
+			inbound_remove(n);
+			continue;
+		}
+
+		/* Toggle: the newest pending command of the tag decides */
+		if (last < 0){
+			last = n;
+			if (pending->type == TAG_CMD_TOGGLE){
+				/* Add then remove (two toggles) cancel out */
+				inbound_remove(n);
+				return true;
+			}
+			continue;
+		}
+
+		/* Older than the last pending set of the tag */
+		inbound_remove(n);
+	}
+
+	if (inbound_count == count)
+		return false;
+
+	inbound[(inbound_head + inbound_count) % CONFIG_MQTT_INBOUND_QUEUE_SIZE] = *cmd;
+	inbound_count++;
+
+	return true;
+}
+
+/**
+ * @brief Queue a received command. Never blocks: the MQTT task also
+ * delivers authorization answers and unlocks, and the client acknowledges
+ * the message when the handler returns. When full, the command is
+ * coalesced with pending ones of the same tag or dropped.
+ *
+ * A sequenced command is only accepted as the one after inbound_seq, so a
+ * dropped command stops the sequence until the backend resends it: the
+ * refusal and the inbound report tell the last accepted number. A number
+ * already accepted is a resend and is ignored.
+ * 
+ * @param cmd Received command.
+ * @return true Queued, coalesced or already accepted.
+ * @return false Dropped: the backend must resend it.
+ */
+static bool inbound_push(const tag_cmd_t *cmd){
+
+	xSemaphoreTake(inbound_mutex, portMAX_DELAY);
+
+	if (cmd->seq && (int32_t)(cmd->seq - inbound_seq) <= 0){
+		xSemaphoreGive(inbound_mutex);
+		return true;
+	}
+
+	if (cmd->seq && cmd->seq != inbound_seq + 1){
+		xSemaphoreGive(inbound_mutex);
+		metric_inc(METRIC_INBOUND_DROPPED);
+		DLOGW(MQTT, DLOG_MQTT_SEQ_GAP, cmd->seq, inbound_seq);
+		return false;
+	}
+
+	/* Depth is a runtime setting up to the ring size */
+	if (inbound_count < setting_get(SETTING_INBOUND_DEPTH)){
+		inbound[(inbound_head + inbound_count) % CONFIG_MQTT_INBOUND_QUEUE_SIZE] = *cmd;
+		inbound_count++;
+		if (cmd->seq)
+			inbound_seq = cmd->seq;
+		xSemaphoreGive(inbound_mutex);
+		xSemaphoreGive(inbound_ready);
+		return true;
+	}
+
+	if (inbound_coalesce(cmd)){
+		metric_inc(METRIC_INBOUND_COALESCED);
+		if (cmd->seq)
+			inbound_seq = cmd->seq;
+		xSemaphoreGive(inbound_mutex);
+		xSemaphoreGive(inbound_ready);
+		DLOGD(MQTT, DLOG_MQTT_COALESCED, cmd->tag);
+		return true;
+	}
+
+	xSemaphoreGive(inbound_mutex);
+
+	metric_inc(METRIC_INBOUND_DROPPED);
+	DLOGW(MQTT, DLOG_MQTT_QUEUE_FULL, cmd->tag);
+
+	return false;
+}
+
+/**
+ * @brief Publish the inbound counters and the last accepted sequence number
+ * to "lpae/dev/<device id>/inbound" after drops and on each new connection,
+ * so the backend resends every sequenced command after "seq".
+ * 
+ */
+static void inbound_report(void){
+
+	uint32_t dropped = metric_get(METRIC_INBOUND_DROPPED);
+
+	if (!connected || (dropped == inbound_reported && !inbound_report_due))
+		return;
+
+	xSemaphoreTake(inbound_mutex, portMAX_DELAY);
+	uint32_t seq = inbound_seq;
+	xSemaphoreGive(inbound_mutex);
+
+	char topic[64];
+	char msg[96];
+	json_writer_t json;
+
+	json_init(&json, msg, sizeof(msg));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(esp_timer_get_time()));
+	json_kv_uint(&json, "dropped", dropped);
+	json_kv_uint(&json, "coalesced", metric_get(METRIC_INBOUND_COALESCED));
+	json_kv_uint(&json, "seq", seq);
+	json_object_end(&json);
+
+	snprintf(topic, sizeof(topic), "%sinbound", device_prefix);
+	if (json_finish(&json))
+		mqtt5_publish(topic, msg);
+
+	inbound_reported = dropped;
+	inbound_report_due = false;
+}
+
+/**
+ * @brief Get a tag command received from MQTT. Blocks until a new command is received.
+ * Pending inbound reports are published here, out of the MQTT task.
+ * 
+ * @param cmd Received command.
+ * @param wait_ms Maximum time to wait.
+ * @return int 0 on success or -1 on timeout or when a table replacement
+ * request is waiting, see get_tags_replace.
+ */
+int get_tag_command(tag_cmd_t *cmd, uint32_t wait_ms){
+
+	TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(wait_ms);
+	int ret = -1;
+
+	for (;;){
+		xSemaphoreTake(inbound_mutex, portMAX_DELAY);
+		if (inbound_count > 0){
+			*cmd = inbound[inbound_head];
+			inbound_head = (inbound_head + 1) % CONFIG_MQTT_INBOUND_QUEUE_SIZE;
+			inbound_count--;
+			xSemaphoreGive(inbound_mutex);
+			ret = 0;
+			break;
+		}
+		xSemaphoreGive(inbound_mutex);
+
+#ifdef CONFIG_TAGS_REPLACE
+		if (uxQueueMessagesWaiting(tags_replace_queue))
+			break;
+#endif
+
+		TickType_t now = xTaskGetTickCount();
+		if ((int32_t)(deadline - now) <= 0 || !xSemaphoreTake(inbound_ready, deadline - now))
+			break;
+	}
+
+	inbound_report();
+
+	return ret;
+}
+
+/**
+ * @brief Get a tag table replacement request. Never blocks: tags_task is
+ * woken by get_tag_command.
+ * 
+ * @param request Received request.
+ * @return int 0 on success or -1 when none is waiting.
+ */
+int get_tags_replace(tags_replace_t *request){
+
+#ifdef CONFIG_TAGS_REPLACE
+	if (xQueueReceive(tags_replace_queue, request, 0))
+		return 0;
+#endif
+
+	return -1;
+}
+
+/**
+ * @brief Store the sequence number of an applied command, the starting point
+ * of inbound_seq after a reboot. Commands still queued at a reboot are lost
+ * and resent by the backend. The last one may be applied twice if the lock
+ * resets before this write: sequenced tags should be sent as sets.
+ * 
+ * @param cmd Command applied by tags_task.
+ */
+void tag_command_done(const tag_cmd_t *cmd){
+
+	nvs_handle_t handle;
+
+	if (cmd->seq == 0 || nvs_open(INBOUND_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+		return;
+
+	if (nvs_set_u32(handle, INBOUND_SEQ_KEY, cmd->seq) == ESP_OK)
+		nvs_commit(handle);
+	nvs_close(handle);
+}
+
+/**
+ * @brief Load the last applied sequence number.
+ * 
+ */
+static void load_inbound_seq(void){
+
+	nvs_handle_t handle;
+
+	inbound_seq = 0;
+
+	if (nvs_open(INBOUND_NAMESPACE, NVS_READONLY, &handle) == ESP_OK){
+		if (nvs_get_u32(handle, INBOUND_SEQ_KEY, &inbound_seq) != ESP_OK)
+			inbound_seq = 0;
+		nvs_close(handle);
+	}
+}
+
+/**
+ * @brief Check if an identity can be used in topic names.
+ * 
+ * @param id Null terminated identity.
+ * @return true Not empty and without topic separators or wildcards.
+ */
+static bool valid_identity(const char *id){
+
+	if (id[0] == 0)
+		return false;
+
+	return strpbrk(id, "/+#") == NULL;
+}
+
+/**
+ * @brief Load device and group identities and build the command topics.
+ * Identities come from NVS ("lock_id" namespace, "device_id" and
+ * "group_id" strings). Default device id is the Wi-Fi MAC address and
+ * default group is LOCK_GROUP.
+ * 
+ */
+static void load_identity(void){
+
+	nvs_handle_t handle;
+	size_t len;
+
+	device_id[0] = 0;
+	group_id[0] = 0;
+
+	if (nvs_open(IDENTITY_NAMESPACE, NVS_READONLY, &handle) == ESP_OK){
+		len = sizeof(device_id);
+		if (nvs_get_str(handle, "device_id", device_id, &len) != ESP_OK)
+			device_id[0] = 0;
+		len = sizeof(group_id);
+		if (nvs_get_str(handle, "group_id", group_id, &len) != ESP_OK)
+			group_id[0] = 0;
+		len = sizeof(unlock_token);
+		if (nvs_get_str(handle, "unlock_token", unlock_token, &len) != ESP_OK)
+			unlock_token[0] = 0;
+		nvs_close(handle);
+	}
+
+	if (!valid_identity(device_id)){
+		uint8_t mac[6];
+		esp_read_mac(mac, ESP_MAC_WIFI_STA);
+		snprintf(device_id, sizeof(device_id), "%02x%02x%02x%02x%02x%02x",
+				mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	}
+
+	if (!valid_identity(group_id))
+		snprintf(group_id, sizeof(group_id), "%s", CONFIG_LOCK_GROUP);
+
+	snprintf(device_prefix, sizeof(device_prefix), DEVICE_TOPIC_PREFIX "%s/", device_id);
+	snprintf(group_prefix, sizeof(group_prefix), GROUP_TOPIC_PREFIX "%s/", group_id);
+	snprintf(auth_response_topic, sizeof(auth_response_topic), "%s" AUTH_RESPONSE_CMD, device_prefix);
+
+	ESP_LOGI(TAG, "device id: %s group: %s", device_id, group_id);
+}
+
+/**
+ * @brief Filter received topics. Only this device and its group are
+ * accepted: anything else is rejected before any payload parsing.
+ * 
+ * @param topic Received topic. Not null terminated.
+ * @param topic_len Topic length.
+ * @param cmd_len Length of the returned command.
+ * @param group Set when addressed to the group instead of this device.
+ * @return const char* Command part of the topic or NULL when not addressed to this lock.
+ */
+static const char *topic_command(const char *topic, int topic_len, int *cmd_len, bool *group){
+
+	int len = strlen(device_prefix);
+
+	if (topic == NULL)
+		return NULL;
+
+	if (topic_len > len && !strncmp(topic, device_prefix, len)){
+		*cmd_len = topic_len - len;
+		*group = false;
+		return topic + len;
+	}
+
+	len = strlen(group_prefix);
+	if (topic_len > len && !strncmp(topic, group_prefix, len)){
+		*cmd_len = topic_len - len;
+		*group = true;
+		return topic + len;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Get this lock device id.
+ * 
+ * @return const char* Device id.
+ */
+const char *mqtt5_device_id(void){
+	return device_id;
+}
+
+/**
+ * @brief Copy correlation data and response topic of a request. Default
+ * response topic is the device prefix followed by a command.
+ * 
+ * @param event MQTT data event of the request.
+ * @param correlation Correlation buffer, 16 bytes.
+ * @param correlation_len Copied correlation length, 0 when absent or too long.
+ * @param topic Response topic buffer, 64 bytes.
+ * @param default_cmd Command of the default response topic.
+ */
+static void copy_reply_route(esp_mqtt_event_handle_t event, char *correlation, uint8_t *correlation_len,
+		char *topic, const char *default_cmd){
+
+	*correlation_len = 0;
+	if (event->property->correlation_data_len > 0 && event->property->correlation_data_len <= 16){
+		memcpy(correlation, event->property->correlation_data, event->property->correlation_data_len);
+		*correlation_len = event->property->correlation_data_len;
+	}
+
+	if (event->property->response_topic_len > 0 && event->property->response_topic_len < 64){
+		memcpy(topic, event->property->response_topic, event->property->response_topic_len);
+		topic[event->property->response_topic_len] = 0;
+	}
+	else
+		snprintf(topic, 64, "%s%s", device_prefix, default_cmd);
+}
+
+/**
+ * @brief Publish a reply to a request, echoing its correlation data.
+ * Response topics come from the requester, so they never take a topic
+ * alias.
+ * 
+ * @param topic Response topic.
+ * @param correlation Correlation data of the request, NULL: none.
+ * @param correlation_len Correlation length.
+ * @param msg Null terminated message.
+ */
+void mqtt5_reply(const char *topic, const char *correlation, uint8_t correlation_len, const char *msg){
+
+	esp_mqtt5_publish_property_config_t property = {
+			.payload_format_indicator = 1,
+			.correlation_data = correlation_len ? correlation : NULL,
+			.correlation_data_len = correlation_len,
+	};
+
+	xSemaphoreTake(xSemaphore_publish, portMAX_DELAY);
+	publish_aliased(topic, msg, &property, false);
+	xSemaphoreGive(xSemaphore_publish);
+}
+
+/**
+ * @brief Parse a tag or schedule command payload and enqueue it to tags_task.
+ * A request with a response topic is answered {"busy":1,"seq":<last
+ * accepted>} when refused, so the sender can resend it later.
+ * 
+ * @param route ROUTE_ADD_TAG or ROUTE_SCHEDULE.
+ * @param event MQTT data event.
+ */
+static void enqueue_tag_command(mqtt_route_t route, esp_mqtt_event_handle_t event){
+
+	char payload[128];
+	tag_cmd_t cmd;
+
+	if (event->data_len <= 0 || event->data_len >= sizeof(payload))
+		return;
+
+	memcpy(payload, event->data, event->data_len);
+	payload[event->data_len] = 0;
+
+	if (tag_command_parse(route, payload, &cmd) != 0){
+		metric_inc(METRIC_INBOUND_MALFORMED);
+		return;
+	}
+
+	if (!inbound_push(&cmd) && event->property->response_topic_len > 0){
+		char correlation[16];
+		uint8_t correlation_len;
+		char topic[64];
+		char msg[32];
+
+		copy_reply_route(event, correlation, &correlation_len, topic, "");
+		snprintf(msg, sizeof(msg), "{\"busy\":1,\"seq\":%" PRIu32 "}", inbound_seq);
+		mqtt5_reply(topic, correlation, correlation_len, msg);
+	}
+}
+
+#ifdef CONFIG_REMOTE_UNLOCK
+/* Remote unlock rejection reasons, logged with DLOG_MQTT_UNLOCK_REJECTED */
+enum {
+	UNLOCK_DISABLED = 1,		/* No token provisioned */
+	UNLOCK_RETAINED,			/* Retained or redelivered message */
+	UNLOCK_FORMAT,
+	UNLOCK_CLOCK,				/* Wall time not known */
+	UNLOCK_EXPIRED,				/* Outside REMOTE_UNLOCK_WINDOW_S */
+	UNLOCK_REPLAYED,			/* Not newer than the last accepted one */
+	UNLOCK_FORGED				/* HMAC mismatch */
+};
+
+/* Timestamp of the last accepted unlock. In RTC memory, so a software
+ * reset does not make an already used command valid again */
+static RTC_NOINIT_ATTR uint32_t unlock_last_ts;
+static RTC_NOINIT_ATTR uint32_t unlock_last_check;	/* ~unlock_last_ts when valid */
+
+/**
+ * @brief Authenticate a remote unlock payload "<epoch s>,<hmac>". hmac is
+ * the hex HMAC-SHA256 of "<device id>,<epoch s>" keyed with the provisioned
+ * token. The timestamp must be within REMOTE_UNLOCK_WINDOW_S of the wall
+ * clock and newer than the last accepted one, so a captured command is
+ * never accepted twice. The HMAC is compared in constant time.
+ * 
+ * @param data Received payload. Not null terminated.
+ * @param data_len Payload length.
+ * @return int 0 when authentic or UNLOCK_* rejection reason.
+ */
+static int unlock_authenticate(const char *data, int data_len){
+
+	static const char hex[] = "0123456789abcdef";
+	char payload[12 + 64 + 1];
+	char message[sizeof(device_id) + 12];
+	uint8_t mac[32];
+	uint8_t diff = 0;
+	char *end;
+
+	if (unlock_token[0] == 0)
+		return UNLOCK_DISABLED;
+
+	if (data_len <= 0 || data_len >= sizeof(payload))
+		return UNLOCK_FORMAT;
+
+	memcpy(payload, data, data_len);
+	payload[data_len] = 0;
+
+	uint32_t ts = strtoul(payload, &end, 10);
+	if (end == payload || *end != ',' || strlen(end + 1) != 2 * sizeof(mac))
+		return UNLOCK_FORMAT;
+
+	int64_t now = time_wall_ms(esp_timer_get_time()) / 1000;
+	if (now == 0)
+		return UNLOCK_CLOCK;
+
+	if (now - ts > CONFIG_REMOTE_UNLOCK_WINDOW_S || ts - now > CONFIG_REMOTE_UNLOCK_WINDOW_S)
+		return UNLOCK_EXPIRED;
+
+	if (unlock_last_check == ~unlock_last_ts && ts <= unlock_last_ts)
+		return UNLOCK_REPLAYED;
+
+	int len = snprintf(message, sizeof(message), "%s,%lu", device_id, ts);
+	if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const unsigned char *)unlock_token,
+			strlen(unlock_token), (const unsigned char *)message, len, mac) != 0)
+		return UNLOCK_FORGED;
+
+	/* Hex digits in either case: 0x20 only lowers letters */
+	for (int i = 0; i < sizeof(mac); i++){
+		diff |= (end[1 + 2 * i] | 0x20) ^ hex[mac[i] >> 4];
+		diff |= (end[2 + 2 * i] | 0x20) ^ hex[mac[i] & 0xf];
+	}
+	if (diff)
+		return UNLOCK_FORGED;
+
+	unlock_last_ts = ts;
+	unlock_last_check = ~ts;
+
+	return 0;
+}
+
+/**
+ * @brief Handle a remote unlock, see unlock_authenticate. Retained and
+ * redelivered messages are refused: a command is only valid when it is
+ * first sent. Accepted commands go straight to the unlock task, rejected
+ * ones are acknowledged here.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_unlock(esp_mqtt_event_handle_t event){
+
+	unlock_cmd_t cmd;
+	int reason;
+
+	cmd.received_us = esp_timer_get_time();
+	copy_reply_route(event, cmd.correlation, &cmd.correlation_len, cmd.response_topic, UNLOCK_ACK_CMD);
+
+	if (event->retain || event->dup)
+		reason = UNLOCK_RETAINED;
+	else
+		reason = unlock_authenticate(event->data, event->data_len);
+
+	if (reason){
+		DLOGW(MQTT, DLOG_MQTT_UNLOCK_REJECTED, reason);
+		mqtt5_unlock_ack(&cmd, -1);
+		return;
+	}
+
+	if (xQueueSend(unlock_queue, &cmd, 0) != pdTRUE)
+		mqtt5_unlock_ack(&cmd, -1);
+}
+#endif
+
+/**
+ * @brief Get a remote unlock command. Blocks until a command is received.
+ * 
+ * @param cmd Received command.
+ * @param wait_ms Maximum time to wait.
+ * @return int 0 on success or -1 on timeout.
+ */
+int get_unlock_command(unlock_cmd_t *cmd, uint32_t wait_ms){
+
+	if (!xQueueReceive(unlock_queue, cmd, pdMS_TO_TICKS(wait_ms)))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Acknowledge a remote unlock with its timestamps. The acknowledge
+ * carries the request correlation data and, in "ts", the wall time of the
+ * actuation.
+ * 
+ * @param cmd Unlock command.
+ * @param actuated_us esp_timer time the strike was energized, negative: rejected.
+ */
+void mqtt5_unlock_ack(const unlock_cmd_t *cmd, int64_t actuated_us){
+
+	char msg[128];
+	json_writer_t json;
+
+	json_init(&json, msg, sizeof(msg));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(actuated_us < 0 ? cmd->received_us : actuated_us));
+	json_kv_string(&json, "result", actuated_us < 0 ? "rejected" : "opened");
+	json_kv_int(&json, "received_us", cmd->received_us);
+	if (actuated_us >= 0){
+		json_kv_int(&json, "actuated_us", actuated_us);
+		json_kv_int(&json, "latency_us", actuated_us - cmd->received_us);
+	}
+	json_object_end(&json);
+
+	if (json_finish(&json))
+		mqtt5_reply(cmd->response_topic, cmd->correlation, cmd->correlation_len, msg);
+}
+
+#ifdef CONFIG_AUDIT_LOG
+/**
+ * @brief Handle an audit log query: "from,until[,tag]" in epoch seconds.
+ * The audit task streams matching records back in chunks.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_audit_query(esp_mqtt_event_handle_t event){
+
+	char buffer[40];
+	audit_query_t query;
+	char *end;
+
+	if (event->data_len <= 0 || event->data_len >= sizeof(buffer))
+		return;
+
+	memcpy(buffer, event->data, event->data_len);
+	buffer[event->data_len] = 0;
+
+	query.from = strtoul(buffer, &end, 10);
+	if (*end != ',')
+		return;
+	query.until = strtoul(end + 1, &end, 10);
+	query.tag = (*end == ',') ? strtoul(end + 1, NULL, 10) : 0;
+
+	copy_reply_route(event, query.correlation, &query.correlation_len, query.response_topic, AUDIT_DATA_CMD);
 
+	if (xQueueSend(audit_query_queue, &query, 0) != pdTRUE)
+		mqtt5_reply(query.response_topic, query.correlation, query.correlation_len, "{\"busy\":1}");
+}
+#endif
+
+/**
+ * @brief Handle a settings request: "key=value[,key=value]", empty to read.
+ * The settings task validates, applies and answers it.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_config(esp_mqtt_event_handle_t event){
+
+	settings_request_t request;
+
+	copy_reply_route(event, request.correlation, &request.correlation_len, request.response_topic, CONFIG_STATE_CMD);
+
+	if (event->data_len < 0 || event->data_len >= sizeof(request.payload)){
+		mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"error\":\"too long\"}");
+		return;
+	}
+
+	memcpy(request.payload, event->data, event->data_len);
+	request.payload[event->data_len] = 0;
+
+	if (!settings_request(&request))
+		mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"busy\":1}");
+}
+
+#ifdef CONFIG_TRACE
 /**
- * @brief Get the tag received from MQTT. Blocks until a new tag is received.
+ * @brief Handle a field trace request: "dump" (or empty) or "clear".
+ * The trace task streams the trace back in chunks.
  * 
- * @return uint32_t Tag number.
+ * @param event MQTT data event.
  */
-uint32_t get_added_tag(){
+static void handle_trace(esp_mqtt_event_handle_t event){
+
+	trace_request_t request;
+
+	copy_reply_route(event, request.correlation, &request.correlation_len, request.response_topic, TRACE_DATA_CMD);
+
+	if (event->data_len < 0 || event->data_len >= sizeof(request.payload)){
+		mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"error\":\"too long\"}");
+		return;
+	}
+
+	memcpy(request.payload, event->data, event->data_len);
+	request.payload[event->data_len] = 0;
+
+	if (!trace_request(&request))
+		mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"busy\":1}");
+}
+#endif
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+/* Only used by the MQTT task, too large for its stack */
+static allowlist_request_t allowlist_req;
+
+/**
+ * @brief Handle a static allowlist command: "begin <size> <crc32 hex>",
+ * "commit", "abort" or empty for the state. The allowlist task writes the
+ * flash and answers.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_allowlist(esp_mqtt_event_handle_t event){
+
+	char buffer[40];
+	char *end;
+
+	copy_reply_route(event, allowlist_req.correlation, &allowlist_req.correlation_len,
+			allowlist_req.response_topic, ALLOWLIST_STATE_CMD);
 
-	uint32_t tag = -1;
+	if (event->data_len < 0 || event->data_len >= sizeof(buffer)){
+		mqtt5_reply(allowlist_req.response_topic, allowlist_req.correlation, allowlist_req.correlation_len, "{\"error\":\"too long\"}");
+		return;
+	}
+
+	memcpy(buffer, event->data, event->data_len);
+	buffer[event->data_len] = 0;
+
+	allowlist_req.len = 0;
+	if (buffer[0] == 0)
+		allowlist_req.op = ALLOWLIST_STATE;
+	else if (!strncmp(buffer, "begin ", 6)){
+		allowlist_req.op = ALLOWLIST_BEGIN;
+		allowlist_req.offset = strtoul(buffer + 6, &end, 10);
+		allowlist_req.crc = strtoul(end, NULL, 16);
+	}
+	else if (!strcmp(buffer, "commit"))
+		allowlist_req.op = ALLOWLIST_COMMIT;
+	else if (!strcmp(buffer, "abort"))
+		allowlist_req.op = ALLOWLIST_ABORT;
+	else {
+		mqtt5_reply(allowlist_req.response_topic, allowlist_req.correlation, allowlist_req.correlation_len, "{\"error\":\"unknown\"}");
+		return;
+	}
+
+	if (!allowlist_request(&allowlist_req))
+		mqtt5_reply(allowlist_req.response_topic, allowlist_req.correlation, allowlist_req.correlation_len, "{\"busy\":1}");
+}
+
+/**
+ * @brief Handle a static allowlist image chunk: 4 byte little endian
+ * offset followed by up to ALLOWLIST_CHUNK_BYTES image bytes.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_allowlist_data(esp_mqtt_event_handle_t event){
+
+	copy_reply_route(event, allowlist_req.correlation, &allowlist_req.correlation_len,
+			allowlist_req.response_topic, ALLOWLIST_STATE_CMD);
+
+	/* Fragmented messages are larger than the MQTT buffer: refuse them whole */
+	if (event->total_data_len != event->data_len || event->data_len <= 4 ||
+			event->data_len - 4 > CONFIG_ALLOWLIST_CHUNK_BYTES){
+		mqtt5_reply(allowlist_req.response_topic, allowlist_req.correlation, allowlist_req.correlation_len, "{\"error\":\"chunk\"}");
+		return;
+	}
+
+	allowlist_req.op = ALLOWLIST_DATA;
+	allowlist_req.offset = (uint8_t)event->data[0] | (uint8_t)event->data[1] << 8 |
+			(uint8_t)event->data[2] << 16 | (uint32_t)(uint8_t)event->data[3] << 24;
+	allowlist_req.len = event->data_len - 4;
+	memcpy(allowlist_req.data, event->data + 4, allowlist_req.len);
+
+	if (!allowlist_request(&allowlist_req))
+		mqtt5_reply(allowlist_req.response_topic, allowlist_req.correlation, allowlist_req.correlation_len, "{\"busy\":1}");
+}
+#endif
+
+#ifdef CONFIG_TAGS_REPLACE
+/* Only used by the MQTT task, too large for its stack */
+static tags_replace_t tags_req;
+
+/**
+ * @brief Queue a tag table replacement request and wake tags_task.
+ * 
+ */
+static void tags_replace_push(void){
+
+	if (xQueueSend(tags_replace_queue, &tags_req, 0) != pdTRUE){
+		mqtt5_reply(tags_req.response_topic, tags_req.correlation, tags_req.correlation_len, "{\"busy\":1}");
+		return;
+	}
+
+	xSemaphoreGive(inbound_ready);
+}
+
+/**
+ * @brief Handle a tag table command: "begin <size> <crc32 hex>", "commit",
+ * "abort" or empty for the state. tags_task stages the table and answers.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_tags_replace(esp_mqtt_event_handle_t event){
+
+	char buffer[40];
+	char *end;
+
+	copy_reply_route(event, tags_req.correlation, &tags_req.correlation_len,
+			tags_req.response_topic, TAGS_STATE_CMD);
+
+	if (event->data_len < 0 || event->data_len >= sizeof(buffer)){
+		mqtt5_reply(tags_req.response_topic, tags_req.correlation, tags_req.correlation_len, "{\"error\":\"too long\"}");
+		return;
+	}
+
+	memcpy(buffer, event->data, event->data_len);
+	buffer[event->data_len] = 0;
+
+	tags_req.len = 0;
+	if (buffer[0] == 0)
+		tags_req.op = TAGS_REPLACE_STATE;
+	else if (!strncmp(buffer, "begin ", 6)){
+		tags_req.op = TAGS_REPLACE_BEGIN;
+		tags_req.offset = strtoul(buffer + 6, &end, 10);
+		tags_req.crc = strtoul(end, NULL, 16);
+	}
+	else if (!strcmp(buffer, "commit"))
+		tags_req.op = TAGS_REPLACE_COMMIT;
+	else if (!strcmp(buffer, "abort"))
+		tags_req.op = TAGS_REPLACE_ABORT;
+	else {
+		mqtt5_reply(tags_req.response_topic, tags_req.correlation, tags_req.correlation_len, "{\"error\":\"unknown\"}");
+		return;
+	}
+
+	tags_replace_push();
+}
+
+/**
+ * @brief Handle tag table records: 4 byte little endian offset followed by
+ * up to TAGS_REPLACE_CHUNK_BYTES of whole records.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_tags_data(esp_mqtt_event_handle_t event){
+
+	copy_reply_route(event, tags_req.correlation, &tags_req.correlation_len,
+			tags_req.response_topic, TAGS_STATE_CMD);
+
+	/* Fragmented messages are larger than the MQTT buffer: refuse them whole */
+	if (event->total_data_len != event->data_len || event->data_len <= 4 ||
+			event->data_len - 4 > CONFIG_TAGS_REPLACE_CHUNK_BYTES){
+		mqtt5_reply(tags_req.response_topic, tags_req.correlation, tags_req.correlation_len, "{\"error\":\"chunk\"}");
+		return;
+	}
+
+	tags_req.op = TAGS_REPLACE_DATA;
+	tags_req.offset = (uint8_t)event->data[0] | (uint8_t)event->data[1] << 8 |
+			(uint8_t)event->data[2] << 16 | (uint32_t)(uint8_t)event->data[3] << 24;
+	tags_req.len = event->data_len - 4;
+	memcpy(tags_req.data, event->data + 4, tags_req.len);
+
+	tags_replace_push();
+}
+#endif
+
+/**
+ * @brief Get an audit log query. Blocks until a query is received.
+ * 
+ * @param query Received query.
+ * @param wait_ms Maximum time to wait.
+ * @return int 0 on success or -1 on timeout.
+ */
+int get_audit_query(audit_query_t *query, uint32_t wait_ms){
 
-	if( !xQueueReceive( subscribe_queue, &(tag), portMAX_DELAY / portTICK_PERIOD_MS) )
-	{
+	if (!xQueueReceive(audit_query_queue, query, pdMS_TO_TICKS(wait_ms)))
 		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Handle a remote authorization answer: "doors[,ttl_s]". Answers
+ * are matched to requests by MQTT5 correlation data.
+ * 
+ * @param event MQTT data event.
+ */
+static void handle_auth_response(esp_mqtt_event_handle_t event){
+
+	char buffer[16];
+	auth_answer_t answer;
+	char *end;
+
+	if (event->property->correlation_data_len <= 0 || event->property->correlation_data_len >= sizeof(buffer) ||
+			event->data_len <= 0 || event->data_len >= sizeof(buffer))
+		return;
+
+	memcpy(buffer, event->property->correlation_data, event->property->correlation_data_len);
+	buffer[event->property->correlation_data_len] = 0;
+	answer.correlation = strtoul(buffer, NULL, 10);
+
+	memcpy(buffer, event->data, event->data_len);
+	buffer[event->data_len] = 0;
+	answer.doors = strtoul(buffer, &end, 0);
+	answer.ttl_s = (*end == ',') ? strtoul(end + 1, NULL, 10) : 0;
+
+	xQueueSend(auth_queue, &answer, 0);
+}
+
+/**
+ * @brief Forget all topic aliases. Aliases are only valid in one connection.
+ * 
+ */
+static void topic_alias_reset(void){
+	topic_aliases_used = 0;
+	topic_aliases_enabled = CONFIG_MQTT_TOPIC_ALIAS_MAX > 0;
+	property_set.valid = false;
+}
+
+/**
+ * @brief Set the publish properties on the client unless they are the ones
+ * already set in this connection. Must be called holding xSemaphore_publish.
+ * 
+ * @param property Message properties.
+ * @return esp_err_t ESP_OK or the error of esp_mqtt5_client_set_publish_property.
+ */
+static esp_err_t publish_property_apply(const esp_mqtt5_publish_property_config_t *property){
+
+	const char *response_topic = property->response_topic ? property->response_topic : "";
+	int correlation_len = property->correlation_data ? property->correlation_data_len : 0;
+
+	if (property_set.valid &&
+			property_set.payload_format_indicator == property->payload_format_indicator &&
+			property_set.message_expiry_interval == property->message_expiry_interval &&
+			property_set.topic_alias == property->topic_alias &&
+			property_set.correlation_len == correlation_len &&
+			(correlation_len == 0 || !memcmp(property_set.correlation, property->correlation_data, correlation_len)) &&
+			!strcmp(property_set.response_topic, response_topic))
+		return ESP_OK;
+
+	property_set.valid = false;
+
+	esp_err_t err = esp_mqtt5_client_set_publish_property(client, property);
+
+	/* Only properties that fit are remembered, others are set every time */
+	if (err == ESP_OK && property->user_property == NULL && property->content_type == NULL &&
+			strlen(response_topic) < sizeof(property_set.response_topic) &&
+			correlation_len <= (int)sizeof(property_set.correlation)){
+		property_set.payload_format_indicator = property->payload_format_indicator;
+		property_set.message_expiry_interval = property->message_expiry_interval;
+		property_set.topic_alias = property->topic_alias;
+		strcpy(property_set.response_topic, response_topic);
+		if (correlation_len)
+			memcpy(property_set.correlation, property->correlation_data, correlation_len);
+		property_set.correlation_len = correlation_len;
+		property_set.valid = true;
 	}
 
-	return tag;
+	return err;
 }
 
+/**
+ * @brief Get the alias of a topic, assigning a free one on first use.
+ * 
+ * @param topic Topic name.
+ * @return uint16_t Alias number or 0 when topics are not aliased.
+ */
+static uint16_t topic_alias_of(const char *topic){
 
-void mqtt5_publish(const char *topic, char *msg){
+	if (!topic_aliases_enabled || strlen(topic) >= sizeof(topic_aliases[0].topic))
+		return 0;
+
+	for (int i = 0; i < topic_aliases_used; i++)
+		if (!strcmp(topic_aliases[i].topic, topic))
+			return i + 1;
+
+	if (topic_aliases_used >= CONFIG_MQTT_TOPIC_ALIAS_MAX)
+		return 0;
+
+	strcpy(topic_aliases[topic_aliases_used].topic, topic);
+	topic_aliases[topic_aliases_used].sent = false;
+
+	return ++topic_aliases_used;
+}
+
+/**
+ * @brief Publish a message using a topic alias when available. First use of
+ * an alias sends the full topic, next ones an empty topic. Must be called
+ * holding xSemaphore_publish.
+ * 
+ * @param topic Topic name.
+ * @param msg Null terminated message.
+ * @param property Message properties. topic_alias is set here.
+ * @param may_alias Topic may take a free alias. Only for topics of this lock.
+ * @return int Message id or -1 on error.
+ */
+static int publish_aliased(const char *topic, const char *msg, esp_mqtt5_publish_property_config_t *property, bool may_alias){
+
+	uint16_t alias = may_alias ? topic_alias_of(topic) : 0;
+	const char *wire_topic = topic;
+
+	property->topic_alias = alias;
+
+	if (publish_property_apply(property) != ESP_OK){
+		/* Broker accepts fewer aliases than configured: stop aliasing */
+		topic_aliases_enabled = false;
+		alias = 0;
+		property->topic_alias = 0;
+		publish_property_apply(property);
+	}
+
+	if (alias && topic_aliases[alias - 1].sent)
+		wire_topic = "";
+
+	int msg_id = esp_mqtt_client_publish(client, wire_topic, msg, 0, 0, 0);
+
+	if (alias && msg_id >= 0)
+		topic_aliases[alias - 1].sent = true;
+
+	return msg_id;
+}
+
+/**
+ * @brief Ask the backend whether a tag not stored locally may open a door.
+ * Uses a MQTT5 request/response: the answer is published on the response
+ * topic with the same correlation data. Blocks until answer or timeout.
+ * 
+ * @param tag Tag number.
+ * @param door Door number.
+ * @param timeout_ms Maximum time to wait for the answer.
+ * @param doors Granted door mask, 0 when denied.
+ * @param ttl_s Time the answer may be cached, 0: backend default.
+ * @return int 0 on answer or -1 on timeout or disconnected client.
+ */
+int mqtt5_auth_request(uint32_t tag, uint8_t door, uint32_t timeout_ms, uint8_t *doors, uint32_t *ttl_s){
+
+	char correlation[12];
+	char payload[24];
+	auth_answer_t answer;
 	int msg_id;
 
+	if (!connected)
+		return -1;
+
+	uint32_t id = ++auth_correlation;
+	snprintf(correlation, sizeof(correlation), "%lu", id);
+	snprintf(payload, sizeof(payload), "%lu,%u", tag, door);
+
+	/* Only requests carry response topic, correlation and expiry */
+	esp_mqtt5_publish_property_config_t property = {
+			.payload_format_indicator = 1,
+			.message_expiry_interval = 1 + timeout_ms / 1000,
+			.response_topic = auth_response_topic,
+			.correlation_data = correlation,
+			.correlation_data_len = strlen(correlation),
+	};
+
+	/* Discard late answers of previous requests */
+	xQueueReset(auth_queue);
+
 	xSemaphoreTake(xSemaphore_publish, portMAX_DELAY);
-	msg_id = esp_mqtt_client_publish(client, topic, msg, 0, 0, 0);
+	msg_id = publish_aliased(AUTH_REQUEST_TOPIC, payload, &property, true);
+	xSemaphoreGive(xSemaphore_publish);
+
+	if (msg_id < 0)
+		return -1;
+
+	TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+
+	do {
+		TickType_t now = xTaskGetTickCount();
+		if ((int32_t)(deadline - now) <= 0)
+			return -1;
+		if (!xQueueReceive(auth_queue, &answer, deadline - now))
+			return -1;
+	} while (answer.correlation != id);
+
+	*doors = answer.doors;
+	*ttl_s = answer.ttl_s;
+
+	return 0;
+}
+
+/**
+ * @brief Publish a message to a topic. Telemetry carries no properties
+ * other than the payload format and the topic alias.
+ * 
+ * @param topic Topic name.
+ * @param msg Null terminated message.
+ */
+void mqtt5_publish(const char *topic, char *msg){
+	esp_mqtt5_publish_property_config_t property = publish_property;
+
+	xSemaphoreTake(xSemaphore_publish, portMAX_DELAY);
+	publish_aliased(topic, msg, &property, true);
 	xSemaphoreGive(xSemaphore_publish);
 }
 
@@ -78,47 +1272,39 @@ static esp_mqtt5_user_property_item_t user_property_arr[] = {
 
 #define USE_PROPERTY_ARR_SIZE   sizeof(user_property_arr)/sizeof(esp_mqtt5_user_property_item_t)
 
+/* Default publish properties: no response topic, correlation or user properties */
 static esp_mqtt5_publish_property_config_t publish_property = {
 		.payload_format_indicator = 1,
-		.message_expiry_interval = 1000,
-		.topic_alias = 0,
-		.response_topic = "/topic/test/response",
-		.correlation_data = "123456",
-		.correlation_data_len = 6,
 };
 
 static esp_mqtt5_subscribe_property_config_t subscribe_property = {
-		.subscribe_id = 25555,
-		.no_local_flag = false,
-		.retain_as_published_flag = false,
-		.retain_handle = 0,
-		.is_share_subscribe = true,
-		.share_name = "group1",
-};
-
-static esp_mqtt5_subscribe_property_config_t subscribe1_property = {
 		.subscribe_id = 25555,
 		.no_local_flag = true,
 		.retain_as_published_flag = false,
 		.retain_handle = 0,
 };
 
-static esp_mqtt5_unsubscribe_property_config_t unsubscribe_property = {
-		.is_share_subscribe = true,
-		.share_name = "group1",
-};
-
 static esp_mqtt5_disconnect_property_config_t disconnect_property = {
 		.session_expiry_interval = 60,
 		.disconnect_reason = 0,
 };
 
+/**
+ * @brief Log received user properties. Only with MQTT_VERBOSE_LOG: the SDK
+ * copies every key and value to the heap.
+ * 
+ * @param user_property Received user properties.
+ */
 static void print_user_property(mqtt5_user_property_handle_t user_property)
 {
+#ifdef CONFIG_MQTT_VERBOSE_LOG
+	esp_mqtt5_user_property_item_t item[USE_PROPERTY_ARR_SIZE];
+
 	if (user_property) {
 		uint8_t count = esp_mqtt5_client_get_user_property_count(user_property);
+		if (count > USE_PROPERTY_ARR_SIZE)
+			count = USE_PROPERTY_ARR_SIZE;
 		if (count) {
-			esp_mqtt5_user_property_item_t *item = (esp_mqtt5_user_property_item_t *)malloc(count * sizeof(esp_mqtt5_user_property_item_t));
 			if (esp_mqtt5_client_get_user_property(user_property, item, &count) == ESP_OK) {
 				for (int i = 0; i < count; i ++) {
 					esp_mqtt5_user_property_item_t *t = &item[i];
@@ -127,9 +1313,9 @@ static void print_user_property(mqtt5_user_property_handle_t user_property)
 					free((char *)t->value);
 				}
 			}
-			free(item);
 		}
 	}
+#endif
 }
 
 /*
@@ -151,17 +1337,40 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32
 
 	ESP_LOGD(TAG, "free heap size is %" PRIu32 ", minimum %" PRIu32, esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
 	switch ((esp_mqtt_event_id_t)event_id) {
+	case MQTT_EVENT_BEFORE_CONNECT:
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+		/* Offer the ticket of the last connection, if any */
+		esp_transport_ssl_session_ticket_operation(tls_transport, ESP_TRANSPORT_SESSION_TICKET_USE);
+#endif
+		break;
+
 	case MQTT_EVENT_CONNECTED:
 		ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-
 		print_user_property(event->property->user_property);
-		esp_mqtt5_client_set_user_property(&publish_property.user_property, user_property_arr, USE_PROPERTY_ARR_SIZE);
-		esp_mqtt5_client_set_publish_property(client, &publish_property);
 
-			/* Subscribe to broker topic to add or remove permissible tags */
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+		/* Keep the ticket the broker sent for the next reconnect */
+		esp_transport_ssl_session_ticket_operation(tls_transport, ESP_TRANSPORT_SESSION_TICKET_SAVE);
+#endif
+
+		/* New connection: broker forgot previous aliases */
+		xSemaphoreTake(xSemaphore_publish, portMAX_DELAY);
+		topic_alias_reset();
+		xSemaphoreGive(xSemaphore_publish);
+		inbound_report_due = true;
+		connected = true;
+
+		/* Subscribe to commands of this device and of its group only */
+		char topic[64];
 		esp_mqtt5_client_set_user_property(&subscribe_property.user_property, user_property_arr, USE_PROPERTY_ARR_SIZE);
 		esp_mqtt5_client_set_subscribe_property(client, &subscribe_property);
-		msg_id = esp_mqtt_client_subscribe(client, "/lpae/add_tag", 0);
+		snprintf(topic, sizeof(topic), "%s#", device_prefix);
+		msg_id = esp_mqtt_client_subscribe(client, topic, 1);
+		ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+		esp_mqtt5_client_set_subscribe_property(client, &subscribe_property);
+		snprintf(topic, sizeof(topic), "%s#", group_prefix);
+		msg_id = esp_mqtt_client_subscribe(client, topic, 1);
 		esp_mqtt5_client_delete_user_property(subscribe_property.user_property);
 		subscribe_property.user_property = NULL;
 		ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
@@ -172,6 +1381,8 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32
 
 	case MQTT_EVENT_DISCONNECTED:
 		ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+		connected = false;
+		metric_inc(METRIC_MQTT_DISCONNECTS);
 		print_user_property(event->property->user_property);
 		break;
 	case MQTT_EVENT_SUBSCRIBED:
@@ -208,12 +1419,78 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32
 		//ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
 		//ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
 
-		/* Convert a tag to int and enqueue it  */
-		uint32_t tag = atoi(event->data);
-		xQueueSend( subscribe_queue, (void *) &tag, ( TickType_t ) 0 );
-		/* Reset string buffer to avoid string overlapping */
-		memset(event->data, 0, event->data_len);
+		{
+			int cmd_len;
+			bool group;
+			const char *cmd = topic_command(event->topic, event->topic_len, &cmd_len, &group);
 
+			/* Not addressed to this lock */
+			if (cmd == NULL){
+				DLOGD(MQTT, DLOG_MQTT_FOREIGN_TOPIC, event->topic_len);
+				break;
+			}
+
+			/* Handlers run in the MQTT task: they only parse and queue, slow
+			 * work (NVS, strike) is done by the task consuming the queue */
+			mqtt_route_t route = mqtt_route(cmd, cmd_len, group);
+
+			/* Field trace: unlock tokens, allowlist images and tag tables are never recorded */
+			trace_record(TRACE_MQTT, route, event->data,
+					route == ROUTE_UNLOCK || route == ROUTE_ALLOWLIST_DATA || route == ROUTE_TAGS_DATA ||
+					event->data_len < 0 ? 0 :
+					(event->data_len > 255 ? 255 : event->data_len));
+
+			switch (route){
+			case ROUTE_ADD_TAG:
+			case ROUTE_SCHEDULE:
+				/* Convert a tag or schedule command and enqueue it  */
+				enqueue_tag_command(route, event);
+				break;
+			case ROUTE_AUTH_RESPONSE:
+				handle_auth_response(event);
+				break;
+#ifdef CONFIG_REMOTE_UNLOCK
+			case ROUTE_UNLOCK:
+				handle_unlock(event);
+				break;
+#endif
+#ifdef CONFIG_AUDIT_LOG
+			case ROUTE_AUDIT:
+				handle_audit_query(event);
+				break;
+#endif
+			case ROUTE_METRICS:
+				metrics_request();
+				break;
+			case ROUTE_CONFIG:
+				handle_config(event);
+				break;
+#ifdef CONFIG_TRACE
+			case ROUTE_TRACE:
+				handle_trace(event);
+				break;
+#endif
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+			case ROUTE_ALLOWLIST:
+				handle_allowlist(event);
+				break;
+			case ROUTE_ALLOWLIST_DATA:
+				handle_allowlist_data(event);
+				break;
+#endif
+#ifdef CONFIG_TAGS_REPLACE
+			case ROUTE_TAGS:
+				handle_tags_replace(event);
+				break;
+			case ROUTE_TAGS_DATA:
+				handle_tags_data(event);
+				break;
+#endif
+			default:
+				DLOGD(MQTT, DLOG_MQTT_UNKNOWN_COMMAND, cmd_len);
+				break;
+			}
+		}
 		break;
 
 	case MQTT_EVENT_ERROR:
@@ -242,24 +1519,23 @@ static void mqtt5_app_start(void)
 	esp_mqtt5_connection_property_config_t connect_property = {
 			.session_expiry_interval = 10,
 			.maximum_packet_size = 1024,
-			.receive_maximum = 65535,
+			.receive_maximum = CONFIG_MQTT_RECEIVE_MAXIMUM,
 			.topic_alias_maximum = 2,
 			.request_resp_info = true,
 			.request_problem_info = true,
 			.will_delay_interval = 10,
 			.message_expiry_interval = 10,
 			.payload_format_indicator = true,
-			.response_topic = "/test/response",
-			.correlation_data = "123456",
-			.correlation_data_len = 6,
 	};
 
 	esp_mqtt_client_config_t mqtt5_cfg = {
 			.broker.address.uri = CONFIG_BROKER_URL,
-			//.broker.address.port = 8883,
-			.broker.address.port = 1883,
+			.broker.address.port = CONFIG_BROKER_PORT,
 			.session.protocol_ver = MQTT_PROTOCOL_V_5,
-			.network.disable_auto_reconnect = true,
+			.session.keepalive = CONFIG_MQTT_KEEPALIVE_S,
+			/* Persistent client: the SDK reconnects by itself after a link loss */
+			.network.disable_auto_reconnect = false,
+			.network.reconnect_timeout_ms = CONFIG_MQTT_RECONNECT_MS,
 			.credentials.username = CONFIG_BROKER_USER,
 			.credentials.authentication.password = CONFIG_BROKER_PASSWORD,
 			.session.last_will.topic = "/topic/will",
@@ -269,6 +1545,30 @@ static void mqtt5_app_start(void)
 			.session.last_will.retain = true,
 	};
 
+	/* The scheme does not select TLS here, BROKER_TLS does */
+#ifdef CONFIG_BROKER_TLS
+	bool tls = true;
+#else
+	bool tls = false;
+#endif
+	if ((strncmp(CONFIG_BROKER_URL, "mqtts://", 8) == 0) != tls)
+		ESP_LOGW(TAG, "Broker URL scheme does not match BROKER_TLS: %s", CONFIG_BROKER_URL);
+
+#ifdef CONFIG_BROKER_TLS
+	/* An external transport ignores broker.verification: set it here */
+	tls_transport = esp_transport_ssl_init();
+	ESP_ERROR_CHECK(tls_transport ? ESP_OK : ESP_ERR_NO_MEM);
+#if defined(CONFIG_BROKER_CERT_BUNDLE)
+	esp_transport_ssl_crt_bundle_attach(tls_transport, esp_crt_bundle_attach);
+#elif defined(CONFIG_BROKER_CERT_EMBEDDED)
+	esp_transport_ssl_set_cert_data(tls_transport, broker_ca_pem_start, strlen(broker_ca_pem_start) + 1);
+#endif
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+	esp_transport_ssl_session_ticket_operation(tls_transport, ESP_TRANSPORT_SESSION_TICKET_INIT);
+#endif
+	mqtt5_cfg.network.transport = tls_transport;
+#endif
+
 	client = esp_mqtt_client_init(&mqtt5_cfg);
 
 	/* Set connection properties and user properties */
@@ -299,17 +1599,38 @@ void mqtt5_init(void)
 	ESP_LOGI(TAG, "[APP] IDF version: %s", esp_get_idf_version());
 
 	esp_log_level_set("*", ESP_LOG_INFO);
+#ifdef CONFIG_MQTT_VERBOSE_LOG
 	esp_log_level_set("MQTT_CLIENT", ESP_LOG_VERBOSE);
 	esp_log_level_set("MQTT_EXAMPLE", ESP_LOG_VERBOSE);
 	esp_log_level_set("TRANSPORT_BASE", ESP_LOG_VERBOSE);
 	esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
 	esp_log_level_set("TRANSPORT", ESP_LOG_VERBOSE);
 	esp_log_level_set("OUTBOX", ESP_LOG_VERBOSE);
+#endif
+
+	/* Device and group topics */
+	load_identity();
+
+	/* Inbound command pipeline */
+	inbound_mutex = RTOS_MUTEX(&inbound_mutex_storage);
+	inbound_ready = RTOS_BINARY(&inbound_ready_storage);
+	load_inbound_seq();
+
+	/* Remote authorization answers */
+	auth_queue = RTOS_QUEUE(2, sizeof( auth_answer_t ), auth_queue_buffer, &auth_queue_storage);
+
+	/* Remote unlock commands */
+	unlock_queue = RTOS_QUEUE(2, sizeof( unlock_cmd_t ), unlock_queue_buffer, &unlock_queue_storage);
+
+	#ifdef CONFIG_TAGS_REPLACE
+	/* Tag table replacements */
+	tags_replace_queue = RTOS_QUEUE(2, sizeof( tags_replace_t ), tags_replace_buffer, &tags_replace_storage);
+#endif
 
-	/* Create a Queue to store received tag number */
-	subscribe_queue = xQueueCreate(10, sizeof( uint32_t ));
+	/* Audit log queries */
+	audit_query_queue = RTOS_QUEUE(2, sizeof( audit_query_t ), audit_query_buffer, &audit_query_storage);
 
-	xSemaphore_publish = xSemaphoreCreateMutex();
+	xSemaphore_publish = RTOS_MUTEX(&publish_mutex_storage);
 
 	//ESP_ERROR_CHECK(nvs_flash_init());
 	//ESP_ERROR_CHECK(esp_netif_init());
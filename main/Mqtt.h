@@ -16,6 +16,10 @@
 #ifndef MAIN_MQTT_H_
 #define MAIN_MQTT_H_
 
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "Schedule.h"
+
 #ifdef __cplusplus // only actually define the class if this is C++
 
 
@@ -27,8 +31,78 @@
     #define EXPORT_C
 #endif
 
-EXPORT_C uint32_t get_added_tag();
+/* Commands received from MQTT and consumed by tags_task */
+typedef enum {
+	TAG_CMD_TOGGLE,		/* "tag": add or remove a tag */
+	TAG_CMD_SET,		/* "tag,schedule[,expiry[,doors]]": add or update a tag */
+	TAG_CMD_SCHEDULE,	/* Define or clear a schedule. See schedule_parse */
+} tag_cmd_type_t;
+
+typedef struct {
+	tag_cmd_type_t type;
+	uint32_t seq;		/* Backend sequence number, 0: none. See "seq:" prefix */
+	uint32_t tag;
+	uint8_t schedule_id;
+	uint32_t expiry;	/* Epoch seconds, 0: never expires */
+	uint8_t doors;		/* Door permission bitmask, bit n: door n */
+	schedule_t schedule;
+} tag_cmd_t;
+
+/* Remote unlock accepted from MQTT and consumed by the unlock task */
+typedef struct {
+	int64_t received_us;		/* esp_timer time of the MQTT data event */
+	char correlation[16];		/* Request correlation data, echoed in the acknowledge */
+	uint8_t correlation_len;
+	char response_topic[64];	/* Acknowledge topic */
+} unlock_cmd_t;
+
+/* Audit log query accepted from MQTT and consumed by the audit task */
+typedef struct {
+	uint32_t from;				/* Epoch seconds, inclusive */
+	uint32_t until;				/* Epoch seconds, inclusive */
+	uint32_t tag;				/* 0: any tag */
+	char correlation[16];		/* Request correlation data, echoed in every chunk */
+	uint8_t correlation_len;
+	char response_topic[64];	/* Chunk topic */
+} audit_query_t;
+
+/* Whole tag table replacement commands, consumed by tags_task. See TagStore::replace */
+typedef enum {
+	TAGS_REPLACE_STATE,			/* Empty payload: report the table */
+	TAGS_REPLACE_BEGIN,			/* "begin <size> <crc32 hex>": start a new table */
+	TAGS_REPLACE_DATA,			/* Records at offset, in order */
+	TAGS_REPLACE_COMMIT,		/* "commit": verify, store and activate */
+	TAGS_REPLACE_ABORT,			/* "abort": drop the upload */
+} tags_replace_op_t;
+
+#ifndef CONFIG_TAGS_REPLACE_CHUNK_BYTES
+	#define CONFIG_TAGS_REPLACE_CHUNK_BYTES 500
+#endif
+
+/* Uploaded record: tag u32, expiry u32, schedule u8, doors u8, little endian */
+#define TAGS_REPLACE_RECORD_BYTES 10
+
+typedef struct {
+	uint8_t op;					/* tags_replace_op_t */
+	uint16_t len;				/* DATA: bytes in data, whole records */
+	uint32_t offset;			/* DATA: table offset. BEGIN: table size */
+	uint32_t crc;				/* BEGIN: CRC32 of the whole table */
+	uint8_t data[CONFIG_TAGS_REPLACE_CHUNK_BYTES];
+	char correlation[16];
+	uint8_t correlation_len;
+	char response_topic[64];
+} tags_replace_t;
+
+EXPORT_C int get_tag_command(tag_cmd_t *cmd, uint32_t wait_ms);
+EXPORT_C int get_tags_replace(tags_replace_t *request);
+EXPORT_C void tag_command_done(const tag_cmd_t *cmd);
+EXPORT_C int get_audit_query(audit_query_t *query, uint32_t wait_ms);
+EXPORT_C void mqtt5_reply(const char *topic, const char *correlation, uint8_t correlation_len, const char *msg);
+EXPORT_C int get_unlock_command(unlock_cmd_t *cmd, uint32_t wait_ms);
+EXPORT_C void mqtt5_unlock_ack(const unlock_cmd_t *cmd, int64_t actuated_us);
+EXPORT_C int mqtt5_auth_request(uint32_t tag, uint8_t door, uint32_t timeout_ms, uint8_t *doors, uint32_t *ttl_s);
 EXPORT_C void mqtt5_init(void);
+EXPORT_C const char *mqtt5_device_id(void);
 EXPORT_C void mqtt5_publish(const char *topic, char *msg);
 
 
@@ -0,0 +1,211 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file MqttRoutes.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing MQTT command routing table and tag command parsing.
+ *
+ * To add a command: add a mqtt_route_t value, a line in routes[] and a
+ * case in the MQTT_EVENT_DATA handler.
+ *
+ * No ESP-IDF dependency: also built by the host trace replay.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MqttRoutes.h"
+
+namespace {
+
+/* Topic scope where a command is accepted */
+enum : uint8_t {
+	SCOPE_DEVICE = 1,
+	SCOPE_GROUP = 2,
+};
+
+struct route_entry_t {
+	uint32_t hash;
+	const char *name;
+	uint8_t len;
+	uint8_t scope;
+	mqtt_route_t route;
+};
+
+/**
+ * @brief 32-bit FNV-1a hash.
+ *
+ * @param s String, not null terminated.
+ * @param len String length.
+ * @return uint32_t Hash.
+ */
+constexpr uint32_t fnv1a(const char *s, int len){
+
+	uint32_t h = 2166136261u;
+
+	for (int i = 0; i < len; i++)
+		h = (h ^ (uint8_t)s[i]) * 16777619u;
+
+	return h;
+}
+
+/**
+ * @brief Build a routing table entry at compile time.
+ *
+ * @param name Null terminated command name.
+ * @param scope Topics where it is accepted.
+ * @param route Route identifier.
+ * @return constexpr route_entry_t Table entry.
+ */
+template <int N>
+constexpr route_entry_t entry(const char (&name)[N], uint8_t scope, mqtt_route_t route){
+	return {fnv1a(name, N - 1), name, N - 1, scope, route};
+}
+
+constexpr route_entry_t routes[] = {
+	entry("add_tag",        SCOPE_DEVICE | SCOPE_GROUP, ROUTE_ADD_TAG),
+	entry("schedule",       SCOPE_DEVICE | SCOPE_GROUP, ROUTE_SCHEDULE),
+	entry("auth/response",  SCOPE_DEVICE,               ROUTE_AUTH_RESPONSE),
+	entry("unlock",         SCOPE_DEVICE,               ROUTE_UNLOCK),
+	entry("audit",          SCOPE_DEVICE,               ROUTE_AUDIT),
+	entry("metrics",        SCOPE_DEVICE | SCOPE_GROUP, ROUTE_METRICS),
+	entry("config",         SCOPE_DEVICE | SCOPE_GROUP, ROUTE_CONFIG),
+	entry("trace",          SCOPE_DEVICE,               ROUTE_TRACE),
+	entry("allowlist",      SCOPE_DEVICE,               ROUTE_ALLOWLIST),
+	entry("allowlist/data", SCOPE_DEVICE,               ROUTE_ALLOWLIST_DATA),
+	entry("tags",           SCOPE_DEVICE,               ROUTE_TAGS),
+	entry("tags/data",      SCOPE_DEVICE,               ROUTE_TAGS_DATA),
+};
+
+/**
+ * @brief Check that no two commands share a hash.
+ *
+ * @return true All hashes are unique.
+ */
+constexpr bool unique_hashes(){
+
+	for (const route_entry_t &a : routes)
+		for (const route_entry_t &b : routes)
+			if (&a != &b && a.hash == b.hash)
+				return false;
+
+	return true;
+}
+
+static_assert(unique_hashes(), "MQTT command hashes collide: rename a command");
+
+/**
+ * @brief Parse one number field of a tag command.
+ *
+ * @param str Field start.
+ * @param end First character after the field.
+ * @param base Number base, 0 also accepts hexadecimal.
+ * @param max Largest valid value.
+ * @param value Parsed value.
+ * @return true Digits in range, followed by ',' or the end of the payload.
+ */
+bool parse_field(const char *str, char **end, int base, uint32_t max, uint32_t *value){
+
+	/* strtoull also takes blanks and signs: "-1" would wrap */
+	if (*str < '0' || *str > '9')
+		return false;
+
+	unsigned long long v = strtoull(str, end, base);
+
+	if (v > max || (**end != ',' && **end != 0))
+		return false;
+
+	*value = (uint32_t)v;
+
+	return true;
+}
+
+}
+
+/**
+ * @brief Find the route of a command.
+ *
+ * @param cmd Command part of the topic. Not null terminated.
+ * @param cmd_len Command length.
+ * @param group Received on the group topic instead of the device topic.
+ * @return mqtt_route_t Route or ROUTE_NONE.
+ */
+mqtt_route_t mqtt_route(const char *cmd, int cmd_len, bool group){
+
+	uint32_t hash = fnv1a(cmd, cmd_len);
+	uint8_t scope = group ? SCOPE_GROUP : SCOPE_DEVICE;
+
+	for (const route_entry_t &r : routes)
+		if (r.hash == hash && r.len == cmd_len && !memcmp(r.name, cmd, cmd_len))
+			return (r.scope & scope) ? r.route : ROUTE_NONE;
+
+	return ROUTE_NONE;
+}
+
+/**
+ * @brief Convert a tag or schedule command payload.
+ *
+ * @param route ROUTE_ADD_TAG or ROUTE_SCHEDULE.
+ * @param payload Null terminated payload.
+ * @param cmd Converted command.
+ * @return int 0 on success or -1 on invalid payload: a field out of range,
+ * extra fields or characters after a number.
+ */
+int tag_command_parse(mqtt_route_t route, const char *payload, tag_cmd_t *cmd){
+
+	memset(cmd, 0, sizeof(*cmd));
+
+	/* Optional "seq:" prefix, 1 to UINT32_MAX: sequenced commands are
+	 * applied in order and resent by the backend when refused */
+	const char *colon = strchr(payload, ':');
+	if (colon){
+		char *end;
+
+		if (*payload < '0' || *payload > '9')
+			return -1;
+		unsigned long long seq = strtoull(payload, &end, 10);
+		if (end != colon || seq == 0 || seq > UINT32_MAX)
+			return -1;
+		cmd->seq = (uint32_t)seq;
+		payload = colon + 1;
+	}
+
+	if (route == ROUTE_SCHEDULE){
+		if (schedule_parse(payload, &cmd->schedule_id, &cmd->schedule) != 0)
+			return -1;
+		cmd->type = TAG_CMD_SCHEDULE;
+		return 0;
+	}
+
+	/* "tag" toggles, "tag,schedule[,expiry[,doors]]" sets. Default: all
+	 * doors. Fields out of range are refused, not truncated: schedule 256
+	 * would become 0, no time restriction, and doors 0x100 a revoke */
+	char *end;
+	uint32_t value;
+
+	if (!parse_field(payload, &end, 10, UINT32_MAX, &cmd->tag))
+		return -1;
+	cmd->type = TAG_CMD_TOGGLE;
+	cmd->doors = 0xff;
+	if (*end == ','){
+		cmd->type = TAG_CMD_SET;
+		if (!parse_field(end + 1, &end, 10, SCHEDULE_MAX_IDS - 1, &value))
+			return -1;
+		cmd->schedule_id = value;
+		if (*end == ',' && !parse_field(end + 1, &end, 10, UINT32_MAX, &cmd->expiry))
+			return -1;
+		if (*end == ','){
+			if (!parse_field(end + 1, &end, 0, 0xff, &value) || *end != 0)
+				return -1;
+			cmd->doors = value;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file MqttRoutes.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing MQTT command routing definitions.
+ *
+ * Commands are the topic part after "lpae/dev/<device id>/" or
+ * "lpae/grp/<group id>/". The routing table is built at compile time with
+ * FNV-1a hashes of the command names, so matching a topic costs one hash
+ * pass and one compare.
+ */
+
+#ifndef MAIN_MQTTROUTES_H_
+#define MAIN_MQTTROUTES_H_
+
+#include <stdbool.h>
+
+#include "Mqtt.h"
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+/* Known commands */
+typedef enum {
+	ROUTE_NONE,				/* Unknown command or not allowed on this topic */
+	ROUTE_ADD_TAG,			/* Tag toggle or set, see tag_cmd_t */
+	ROUTE_SCHEDULE,			/* Access schedule definition */
+	ROUTE_AUTH_RESPONSE,	/* Remote authorization answer */
+	ROUTE_UNLOCK,			/* Remote unlock, device topic only */
+	ROUTE_AUDIT,			/* Audit log query, device topic only */
+	ROUTE_METRICS,			/* Metrics snapshot request */
+	ROUTE_CONFIG,			/* Runtime settings, see Settings.h */
+	ROUTE_TRACE,			/* Field trace download, device topic only */
+	ROUTE_ALLOWLIST,		/* Static allowlist update command, device topic only */
+	ROUTE_ALLOWLIST_DATA,	/* Static allowlist image chunk, device topic only */
+	ROUTE_TAGS,				/* Tag table replacement command, device topic only */
+	ROUTE_TAGS_DATA,		/* Tag table records, device topic only */
+} mqtt_route_t;
+
+EXPORT_C mqtt_route_t mqtt_route(const char *cmd, int cmd_len, bool group);
+EXPORT_C int tag_command_parse(mqtt_route_t route, const char *payload, tag_cmd_t *cmd);
+
+#endif /* MAIN_MQTTROUTES_H_ */
@@ -12,9 +12,14 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
 #include "Rdm6300.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Settings.h"
+#include "Trace.h"
 
 /*
  * @brief	Construct a new Rdm6300::Rdm6300 object Rdm6300.
@@ -30,6 +35,7 @@ Rdm6300::Rdm6300(int baud_rate, uart_word_length_t data_bits,
 	memset(Rdm6300::data,0,sizeof(Rdm6300::data));
 
 	tag = 0;
+	read_us = 0;
 	checksum = 0;
 	msg_checkum = 0;
 }
@@ -44,12 +50,14 @@ uint32_t Rdm6300::WaitAndRead(void){
 
 	int len = 0;
 	int head_index = 0;
-	uint32_t my_time = 0;
 
 	Uart::flush();
 	/* Read, search and flush serial data */
 	len = Rdm6300::ReadBytes(data, 64);
-	for (head_index=0; head_index < (sizeof(data) - 14); head_index++){
+	read_us = Time::Now();
+	if (len > 0)
+		trace_record(TRACE_UART, 0, data, len);
+	for (head_index=0; head_index < (int)(sizeof(data) - 14); head_index++){
 		if (data[head_index] == 0x02)
 			break;
 	}
@@ -59,10 +67,16 @@ uint32_t Rdm6300::WaitAndRead(void){
 #endif
 
 	/* Invalid head */
-	if (data[head_index] != 0x02)
+	if (data[head_index] != 0x02){
+		DLOGD(RDM6300, DLOG_RDM_NO_HEAD, len);
+		metric_inc(METRIC_RDM_NO_HEAD);
 		return -1;
-	else if (check_checksum(head_index) == false)
+	}
+	else if (check_checksum(head_index) == false){
+		DLOGW(RDM6300, DLOG_RDM_BAD_CHECKSUM, msg_checkum, checksum);
+		metric_inc(METRIC_RDM_BAD_CHECKSUM);
 		return -1;
+	}
 
 	/* Add string termination character */
 	Rdm6300::data[head_index + 11] = 0x00;
@@ -70,10 +84,10 @@ uint32_t Rdm6300::WaitAndRead(void){
 	/* Convert tag. Ignore version: 2 chars after head */
 	Rdm6300::tag  = strtol((char *)data + head_index + 3, NULL, 16);
 
-	ESP_LOGI("Rdm6300::", "tag = %lu  msg_checksum = %x  cal_checksum = %x  time: %lu", tag, msg_checkum, checksum, my_time);
+	DLOGI(RDM6300, DLOG_RDM_TAG, tag, msg_checkum, checksum);
 
 	/* Should suspend since Rdm6300 keep sending data while a tag is next to it */
-	Time::Suspend(idle_ticks);
+	Time::Suspend(pdMS_TO_TICKS(setting_get(SETTING_RDM_IDLE_MS)));
 
 	return Rdm6300::tag;
 }
@@ -84,7 +98,7 @@ uint32_t Rdm6300::WaitAndRead(void){
  * 
  */
 void Rdm6300::Print(void){
-	for (int i=0; i < sizeof(data);i++)
+	for (int i=0; i < (int)sizeof(data);i++)
 		ESP_LOGI("Rdm6300::", "data[%d] = %d", i, Rdm6300::data[i]);
 }
 
@@ -109,7 +123,7 @@ bool Rdm6300::check_checksum(int index){
 	for (int i=1; i < 11; i+=2){
 		byte[0] = data[index + i];
 		byte[1] = data[index + 1 + i];
-		byte[3] = 0;
+		byte[2] = 0;
 
 		uint8_t val = strtol((char *)byte, NULL, 16);
 
@@ -26,13 +26,14 @@ public:
 			uart_hw_flowcontrol_t flow_cotrol);
 
 	uint32_t WaitAndRead();
+	/* Time::Now() of the last frame, stamped before the idle suspend */
+	int64_t ReadTime() const { return read_us; }
 
 	void Print();
 
 private:
-	const uint32_t idle_ticks = 200;
-
 	uint32_t tag;
+	int64_t read_us;
 	uint8_t checksum;
 	uint8_t msg_checkum;
 
@@ -0,0 +1,142 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Schedule.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing access schedule implementation.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Schedule.h"
+
+enum {SLOTS_PER_DAY = 24 * 60 / SCHEDULE_SLOT_MINUTES};
+
+/**
+ * @brief Bitmap with slots [first, last) set.
+ *
+ * @param first First slot.
+ * @param last Slot after the last one.
+ * @return uint64_t Slot bitmap.
+ */
+static uint64_t slot_range(uint32_t first, uint32_t last){
+
+	uint64_t bits = 0;
+
+	for (uint32_t i = first; i < last && i < SLOTS_PER_DAY; i++)
+		bits |= (uint64_t)1 << i;
+
+	return bits;
+}
+
+/**
+ * @brief Convert a HHMM number to a slot number.
+ *
+ * @param hhmm Time of the day, 0 to 2400.
+ * @return int32_t Slot or -1 on invalid time.
+ */
+static int32_t hhmm_to_slot(uint32_t hhmm){
+
+	uint32_t minutes = (hhmm / 100) * 60 + (hhmm % 100);
+
+	if ((hhmm % 100) >= 60 || minutes > 24 * 60)
+		return -1;
+
+	return minutes / SCHEDULE_SLOT_MINUTES;
+}
+
+/**
+ * @brief Parse a schedule command and precompute its day bitmaps.
+ * Format: "id,from,until,days,start,end[,days,start,end]...".
+ * from/until are epoch seconds (0: unbounded), days is a bitmask
+ * (bit 0: Sunday) and start/end are HHMM local times. A window with
+ * end before start runs over midnight into the next day.
+ * Only "id" clears the schedule.
+ *
+ * @param str Null terminated command string.
+ * @param id Parsed schedule id.
+ * @param schedule Parsed schedule.
+ * @return int 0 on success or -1 on a malformed command.
+ */
+int schedule_parse(const char *str, uint8_t *id, schedule_t *schedule){
+
+	uint32_t fields[3 + 3 * SCHEDULE_MAX_WINDOWS];
+	int count = 0;
+	char *end;
+
+	memset(schedule, 0, sizeof(schedule_t));
+
+	while (count < (int)(sizeof(fields) / sizeof(fields[0]))){
+		fields[count] = strtoul(str, &end, 10);
+		if (end == str)
+			return -1;
+		count++;
+
+		if (*end != ',')
+			break;
+		str = end + 1;
+	}
+
+	*id = fields[0];
+
+	if (count == 1)
+		return 0;
+
+	if (count < 6 || (count - 3) % 3)
+		return -1;
+
+	schedule->valid_from = fields[1];
+	schedule->valid_until = fields[2];
+
+	for (int i = 3; i < count; i += 3){
+		uint32_t days = fields[i];
+		int32_t start = hhmm_to_slot(fields[i + 1]);
+		int32_t stop = hhmm_to_slot(fields[i + 2]);
+
+		if (start < 0 || stop < 0)
+			return -1;
+
+		for (int d = 0; d < 7; d++){
+			if (!(days & (1 << d)))
+				continue;
+
+			if (start <= stop)
+				schedule->day_slots[d] |= slot_range(start, stop);
+			else {
+				schedule->day_slots[d] |= slot_range(start, SLOTS_PER_DAY);
+				schedule->day_slots[(d + 1) % 7] |= slot_range(0, stop);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Check if a schedule allows access now.
+ *
+ * @param schedule Schedule to test.
+ * @param now Epoch seconds.
+ * @param local Broken down local time of now.
+ * @return true Access allowed.
+ * @return false Access denied.
+ */
+bool schedule_allows(const schedule_t *schedule, time_t now, const struct tm *local){
+
+	if (schedule->valid_from && now < (time_t)schedule->valid_from)
+		return false;
+
+	if (schedule->valid_until && now >= (time_t)schedule->valid_until)
+		return false;
+
+	uint32_t slot = (local->tm_hour * 60 + local->tm_min) / SCHEDULE_SLOT_MINUTES;
+
+	return (schedule->day_slots[local->tm_wday] >> slot) & 1;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Schedule.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing access schedule definitions.
+ *
+ * A schedule is a precomputed bitmap per week day: bit n allows the
+ * n-th 30 minute slot of the day. Evaluation is a single bit test.
+ */
+
+#ifndef MAIN_SCHEDULE_H_
+#define MAIN_SCHEDULE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define SCHEDULE_SLOT_MINUTES  30
+#define SCHEDULE_MAX_WINDOWS   4
+/* Schedule ids of a tag table, id 0 is "always" */
+#define SCHEDULE_MAX_IDS       16
+
+typedef struct {
+	uint64_t day_slots[7];	/* Index is tm_wday: 0 is Sunday */
+	uint32_t valid_from;	/* Epoch seconds, 0: unbounded */
+	uint32_t valid_until;	/* Epoch seconds, 0: unbounded */
+} schedule_t;
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+EXPORT_C int schedule_parse(const char *str, uint8_t *id, schedule_t *schedule);
+EXPORT_C bool schedule_allows(const schedule_t *schedule, time_t now, const struct tm *local);
+
+#endif /* MAIN_SCHEDULE_H_ */
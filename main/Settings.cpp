@@ -0,0 +1,252 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Settings.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the runtime settings registry implementation.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "Settings.h"
+#include "Mqtt.h"
+#include "Metrics.h"
+#include "JsonWriter.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+
+static const char *TAG = "Settings::";
+
+#define SETTINGS_NAMESPACE "lock_cfg"
+
+enum setting_apply_t {LIVE, BOOT};
+
+struct setting_info_t {
+	const char *key;
+	uint32_t min;
+	uint32_t max;
+	setting_apply_t apply;
+};
+
+#define SETTING_DEFAULT(id, key, def, min, max, apply) def,
+#define SETTING_INFO(id, key, def, min, max, apply) {key, min, max, apply},
+#define SETTING_CHECK(id, key, def, min, max, apply) \
+	static_assert((def) >= (min) && (def) <= (max), "Default of " key " out of range");
+
+/* Kconfig defaults until settings_init loads NVS */
+uint32_t settings_values[SETTING_COUNT] = { SETTINGS_TABLE(SETTING_DEFAULT) };
+
+static const setting_info_t info[SETTING_COUNT] = { SETTINGS_TABLE(SETTING_INFO) };
+
+SETTINGS_TABLE(SETTING_CHECK)
+
+#undef SETTING_DEFAULT
+#undef SETTING_INFO
+#undef SETTING_CHECK
+
+static QueueHandle_t settings_queue;
+STATIC_ONLY(static StaticQueue_t settings_queue_storage;)
+STATIC_ONLY(static uint8_t settings_queue_buffer[2 * sizeof(settings_request_t)];)
+
+/* Reply text, only used by settings_task */
+static char reply[32 + 32 * SETTING_COUNT];
+
+/**
+ * @brief Find a setting by key.
+ *
+ * @param key Key, not null terminated.
+ * @param len Key length.
+ * @return int Setting index or -1.
+ */
+static int setting_find(const char *key, size_t len){
+
+	for (int i = 0; i < SETTING_COUNT; i++)
+		if (strlen(info[i].key) == len && memcmp(info[i].key, key, len) == 0)
+			return i;
+
+	return -1;
+}
+
+/**
+ * @brief Format all current values.
+ *
+ * @param reboot Report that a BOOT setting changed.
+ * @return true Reply formatted.
+ * @return false Reply does not fit.
+ */
+static bool settings_format(bool reboot){
+
+	json_writer_t json;
+
+	json_init(&json, reply, sizeof(reply));
+	json_object_begin(&json);
+
+	for (int i = 0; i < SETTING_COUNT; i++)
+		json_kv_uint(&json, info[i].key, setting_get((setting_t)i));
+
+	if (reboot)
+		json_kv_uint(&json, "reboot", 1);
+	json_object_end(&json);
+
+	return json_finish(&json) != NULL;
+}
+
+/**
+ * @brief Validate, apply and store a request. Nothing is changed when any
+ * pair is unknown or out of range. Replies with all current values or the
+ * rejected key.
+ *
+ * @param request Configuration request.
+ */
+static void settings_apply(settings_request_t *request){
+
+	uint32_t staged[SETTING_COUNT];
+	uint32_t changed = 0;
+	bool reboot = false;
+	char *save = NULL;
+
+	static_assert(SETTING_COUNT <= 32, "Changed mask is 32 bits");
+
+	for (int i = 0; i < SETTING_COUNT; i++)
+		staged[i] = setting_get((setting_t)i);
+
+	for (char *pair = strtok_r(request->payload, ",", &save); pair; pair = strtok_r(NULL, ",", &save)){
+		char *value = strchr(pair, '=');
+		char *end;
+		int id;
+
+		while (*pair == ' ')
+			pair++;
+
+		if (value == NULL || (id = setting_find(pair, value - pair)) < 0){
+			mqtt5_reply(request->response_topic, request->correlation, request->correlation_len,
+					"{\"error\":\"unknown key\"}");
+			return;
+		}
+
+		uint32_t v = strtoul(value + 1, &end, 10);
+		if (end == value + 1 || *end != 0 || v < info[id].min || v > info[id].max){
+			json_writer_t json;
+
+			json_init(&json, reply, sizeof(reply));
+			json_object_begin(&json);
+			json_kv_string(&json, "error", info[id].key);
+			json_kv_uint(&json, "min", info[id].min);
+			json_kv_uint(&json, "max", info[id].max);
+			json_object_end(&json);
+			if (json_finish(&json))
+				mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, reply);
+			return;
+		}
+
+		staged[id] = v;
+	}
+
+	for (int i = 0; i < SETTING_COUNT; i++){
+		if (staged[i] == setting_get((setting_t)i))
+			continue;
+
+		__atomic_store_n(&settings_values[i], staged[i], __ATOMIC_RELAXED);
+		changed |= 1u << i;
+		if (info[i].apply == BOOT)
+			reboot = true;
+		ESP_LOGI(TAG, "%s = %lu", info[i].key, staged[i]);
+	}
+
+	if (changed){
+		nvs_handle_t handle;
+		esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &handle);
+
+		if (err == ESP_OK){
+			for (int i = 0; err == ESP_OK && i < SETTING_COUNT; i++)
+				if (changed & (1u << i))
+					err = nvs_set_u32(handle, info[i].key, staged[i]);
+			if (err == ESP_OK)
+				err = nvs_commit(handle);
+			nvs_close(handle);
+		}
+
+		/* Values stay applied until reboot */
+		if (err != ESP_OK){
+			ESP_LOGE(TAG, "NVS write error: %x", err);
+			metric_inc(METRIC_NVS_WRITE_ERRORS);
+		}
+	}
+
+	if (settings_format(reboot))
+		mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, reply);
+}
+
+/**
+ * @brief Settings task. Validates and stores configuration requests out of
+ * the MQTT task.
+ *
+ * @param arg Not used.
+ */
+static void settings_task(void *arg){
+
+	settings_request_t request;
+
+	for (;;)
+		if (xQueueReceive(settings_queue, &request, portMAX_DELAY))
+			settings_apply(&request);
+}
+
+/**
+ * @brief Load stored settings and start the settings task. Must run after
+ * NVS initialization and before the modules reading BOOT settings. Stored
+ * values out of range are ignored.
+ *
+ */
+void settings_init(void){
+
+	nvs_handle_t handle;
+
+	if (settings_queue)
+		return;
+
+	if (nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK){
+		for (int i = 0; i < SETTING_COUNT; i++){
+			uint32_t v;
+
+			if (nvs_get_u32(handle, info[i].key, &v) != ESP_OK)
+				continue;
+
+			if (v < info[i].min || v > info[i].max){
+				ESP_LOGW(TAG, "Stored %s = %lu out of range", info[i].key, v);
+				continue;
+			}
+
+			settings_values[i] = v;
+		}
+		nvs_close(handle);
+	}
+
+	settings_queue = RTOS_QUEUE(2, sizeof(settings_request_t), settings_queue_buffer, &settings_queue_storage);
+	RTOS_TASK(settings_task, "settings_task", 3072, NULL, TASK_SETTINGS_PRIORITY, NULL, TASK_SETTINGS_CORE);
+}
+
+/**
+ * @brief Queue a configuration request. Never blocks.
+ *
+ * @param request Request, copied.
+ * @return true Queued.
+ * @return false Busy or settings not started.
+ */
+bool settings_request(const settings_request_t *request){
+
+	return settings_queue && xQueueSend(settings_queue, request, 0) == pdTRUE;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Settings.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the runtime settings registry.
+ *
+ * Timing parameters default to their Kconfig values, may be changed with
+ * "key=value[,key=value]" on lpae/dev/<device id>/config or
+ * lpae/grp/<group>/config and are kept in NVS. LIVE settings are read by
+ * their users on every use, BOOT settings apply at next start.
+ */
+
+#ifndef MAIN_SETTINGS_H_
+#define MAIN_SETTINGS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+/* Settings table: id, NVS and MQTT key (up to 15 chars), default, min, max, apply */
+#define SETTINGS_TABLE(X) \
+	X(SETTING_RDM_IDLE_MS,     "rdm_idle_ms",     CONFIG_RDM_IDLE_MS,             0,   60000,  LIVE) \
+	X(SETTING_STRIKE_MS,       "strike_ms",       CONFIG_STRIKE_PULSE_MS,         20,  10000,  LIVE) \
+	X(SETTING_BUTTON_POLL_MS,  "button_poll_ms",  CONFIG_BUTTON_POLL_MS,          20,  5000,   LIVE) \
+	X(SETTING_BUTTON_GUARD_MS, "button_guard_ms", CONFIG_BUTTON_GUARD_MS,         0,   600000, LIVE) \
+	X(SETTING_INBOUND_DEPTH,   "inbound_depth",   CONFIG_MQTT_INBOUND_QUEUE_SIZE, 1,   CONFIG_MQTT_INBOUND_QUEUE_SIZE, LIVE) \
+	X(SETTING_UART_BUFFER,     "uart_buffer",     CONFIG_UART_BUFFER_SIZE,        256, 8192,   BOOT)
+
+#define SETTING_ENUM(id, key, def, min, max, apply) id,
+
+typedef enum {
+	SETTINGS_TABLE(SETTING_ENUM)
+	SETTING_COUNT
+} setting_t;
+
+#undef SETTING_ENUM
+
+/* Configuration request received from MQTT */
+typedef struct {
+	char payload[128];			/* Null terminated, empty: read only */
+	char correlation[16];
+	uint8_t correlation_len;
+	char response_topic[64];
+} settings_request_t;
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+/* Current values, shared by C and C++ modules */
+#ifdef __cplusplus
+extern "C" uint32_t settings_values[SETTING_COUNT];
+#else
+extern uint32_t settings_values[SETTING_COUNT];
+#endif
+
+/**
+ * @brief Read a setting. A single load: safe on hot paths and from any task.
+ *
+ * @param id Setting.
+ * @return uint32_t Current value.
+ */
+static inline uint32_t setting_get(setting_t id){
+	return __atomic_load_n(&settings_values[id], __ATOMIC_RELAXED);
+}
+
+EXPORT_C void settings_init(void);
+EXPORT_C bool settings_request(const settings_request_t *request);
+
+#endif /* MAIN_SETTINGS_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file StaticAlloc.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing RTOS object creation macros.
+ *
+ * With STATIC_ALLOCATION every task, queue and semaphore of the
+ * application is created on storage reserved at link time, so the
+ * footprint is reported by "idf.py size" and tools/map_report.py and the
+ * heap is not fragmented by them. Without it the same calls use the
+ * FreeRTOS heap.
+ *
+ * Storage is declared with STATIC_ONLY() and passed by address:
+ *
+ *   STATIC_ONLY(static StaticSemaphore_t mutex_storage;)
+ *   mutex = RTOS_MUTEX(&mutex_storage);
+ */
+
+#ifndef MAIN_STATICALLOC_H_
+#define MAIN_STATICALLOC_H_
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#ifdef CONFIG_STATIC_ALLOCATION
+
+	#define STATIC_ONLY(decl) decl
+
+	#define RTOS_MUTEX(storage) xSemaphoreCreateMutexStatic(storage)
+	#define RTOS_BINARY(storage) xSemaphoreCreateBinaryStatic(storage)
+	#define RTOS_QUEUE(length, item_size, buffer, storage) \
+		xQueueCreateStatic(length, item_size, (uint8_t *)(buffer), storage)
+	/* Callers include freertos/event_groups.h */
+	#define RTOS_EVENT_GROUP(storage) xEventGroupCreateStatic(storage)
+
+	/* Stack and TCB are reserved once per call site */
+	#define RTOS_TASK(function, name, stack_size, arg, priority, handle, core) \
+		do { \
+			static StackType_t task_stack_[stack_size]; \
+			static StaticTask_t task_tcb_; \
+			TaskHandle_t *task_handle_ = (handle); \
+			TaskHandle_t task_created_ = xTaskCreateStaticPinnedToCore(function, name, stack_size, \
+					arg, priority, task_stack_, &task_tcb_, core); \
+			if (task_handle_) \
+				*task_handle_ = task_created_; \
+		} while (0)
+
+#else
+
+	#define STATIC_ONLY(decl)
+
+	#define RTOS_MUTEX(storage) xSemaphoreCreateMutex()
+	#define RTOS_BINARY(storage) xSemaphoreCreateBinary()
+	#define RTOS_QUEUE(length, item_size, buffer, storage) xQueueCreate(length, item_size)
+	#define RTOS_EVENT_GROUP(storage) xEventGroupCreate()
+
+	#define RTOS_TASK(function, name, stack_size, arg, priority, handle, core) \
+		xTaskCreatePinnedToCore(function, name, stack_size, arg, priority, handle, core)
+
+#endif
+
+#endif /* MAIN_STATICALLOC_H_ */
@@ -0,0 +1,556 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file StaticAllowlist.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing StaticAllowlist class implementation.
+ *
+ */
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include "StaticAllowlist.h"
+#include "Metrics.h"
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "Mqtt.h"
+#include "JsonWriter.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+#endif
+
+static const char *TAG = "Allowlist::";
+
+/* Partition subtype of the "allowlist" data partition, see partitions.csv */
+#define ALLOWLIST_PARTITION_SUBTYPE 0x41
+
+/* NVS namespace, keys of the active slot and of the generation of its image */
+#define ALLOWLIST_NVS_NAMESPACE "allowlist"
+#define ALLOWLIST_NVS_ACTIVE "active"
+#define ALLOWLIST_NVS_GENERATION "generation"
+
+/* Flash erase unit: slots are erased one sector at a time */
+enum {SECTOR_SIZE = 4096};
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+enum {QUEUE_LENGTH = 2};
+
+static QueueHandle_t allowlist_queue;
+STATIC_ONLY(static StaticQueue_t allowlist_queue_storage;)
+STATIC_ONLY(static allowlist_request_t allowlist_queue_buffer[QUEUE_LENGTH];)
+#endif
+
+/**
+ * @brief Construct a new StaticAllowlist object. Maps the "allowlist"
+ * partition and verifies the image of the active slot, falling back to
+ * the other one when it is at least as new as the last activated image.
+ * The allowlist is empty without STATIC_ALLOWLIST, without partition or
+ * when no image may be used; the alarm metric is set when an image was
+ * expected.
+ *
+ */
+StaticAllowlist::StaticAllowlist(){
+
+	memset(views, 0, sizeof(views));
+	active = NULL;
+	partition = NULL;
+	base = NULL;
+	slot_size = 0;
+	mmap_handle = 0;
+
+#ifndef CONFIG_STATIC_ALLOWLIST
+	return;
+#endif
+
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+			(esp_partition_subtype_t)ALLOWLIST_PARTITION_SUBTYPE, "allowlist");
+
+	if (partition == NULL){
+		ESP_LOGI(TAG, "No allowlist partition");
+		return;
+	}
+
+	if (!map(partition))
+		return;
+
+	uint8_t slot;
+	uint32_t generation;
+	bool stored = stored_state(&slot, &generation);
+
+	if (check(slot, &views[slot]))
+		active = &views[slot];
+	else if (check(slot ^ 1, &views[slot ^ 1])){
+		/* Older than the activated image: it may grant revoked tags */
+		if (views[slot ^ 1].header->generation >= generation){
+			ESP_LOGW(TAG, "Slot %c has no valid image, using %c", 'A' + slot, 'A' + (slot ^ 1));
+			slot ^= 1;
+			active = &views[slot];
+		}
+		else
+			ESP_LOGE(TAG, "Slot %c has no valid image, slot %c is older: %" PRIu32 " < %" PRIu32,
+					'A' + slot, 'A' + (slot ^ 1), views[slot ^ 1].header->generation, generation);
+	}
+
+	if (active)
+		ESP_LOGI(TAG, "Static allowlist: slot %c, generation %" PRIu32 ", %" PRIu32 " tags, %" PRIu32 " slots",
+				'A' + slot, active->header->generation, active->header->count, active->header->slots);
+	else if (stored || !erased(0) || !erased(1)){
+		ESP_LOGE(TAG, "No usable allowlist image: running without allowlist");
+		metric_set(METRIC_ALLOWLIST_ALARM, 1);
+	}
+	else
+		ESP_LOGI(TAG, "No allowlist image");
+
+	metric_set(METRIC_STATIC_TAGS, count());
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+	upload.open = false;
+	allowlist_queue = RTOS_QUEUE(QUEUE_LENGTH, sizeof(allowlist_request_t), allowlist_queue_buffer, &allowlist_queue_storage);
+	RTOS_TASK(allowlist_task, "allowlist_task", 3072, this, TASK_ALLOWLIST_PRIORITY, NULL, TASK_ALLOWLIST_CORE);
+#endif
+}
+
+/**
+ * @brief Map the whole partition. Both slots stay mapped, so swapping
+ * images never remaps.
+ *
+ * @param partition Allowlist partition.
+ * @return true Mapped.
+ * @return false Mapping failed or partition too small.
+ */
+bool StaticAllowlist::map(const esp_partition_t *partition){
+
+	const void *ptr;
+
+	slot_size = (partition->size / SLOTS) & ~(uint32_t)(SECTOR_SIZE - 1);
+	if (slot_size == 0){
+		ESP_LOGE(TAG, "Partition too small");
+		return false;
+	}
+
+	if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle) != ESP_OK){
+		ESP_LOGE(TAG, "Partition mmap failed");
+		return false;
+	}
+
+	base = (const uint8_t *)ptr;
+
+	return true;
+}
+
+/**
+ * @brief Check the image of a slot and locate its tables.
+ *
+ * @param slot Slot number.
+ * @param view Tables of the image, set when valid.
+ * @return true Valid image.
+ * @return false Erased slot or invalid image.
+ */
+bool StaticAllowlist::check(uint32_t slot, view_t *view){
+
+	const uint8_t *image = base + slot * slot_size;
+	const header_t *h = (const header_t *)image;
+
+	/* Erased slot: nothing was written yet */
+	if (h->magic != MAGIC || h->version != VERSION || h->buckets == 0 || h->slots == 0 ||
+			h->buckets > slot_size || h->slots > slot_size)
+		return false;
+
+	size_t pilots_end = sizeof(header_t) + h->buckets * sizeof(uint16_t);
+	size_t tags_offset = (pilots_end + 3) & ~(size_t)3;
+	size_t size = tags_offset + h->slots * (sizeof(uint32_t) + sizeof(uint8_t));
+
+	/* The header is covered too: a flipped generation must not pass */
+	if (size > slot_size || h->crc != esp_rom_crc32_le(esp_rom_crc32_le(0, image, offsetof(header_t, crc)),
+			(const uint8_t *)(h + 1), size - sizeof(header_t))){
+		ESP_LOGE(TAG, "Slot %c image corrupted", 'A' + slot);
+		return false;
+	}
+
+	view->pilots = (const uint16_t *)(h + 1);
+	view->tags = (const uint32_t *)(image + tags_offset);
+	view->doors_of = (const uint8_t *)(view->tags + h->slots);
+	view->header = h;
+
+	return true;
+}
+
+/**
+ * @brief Check if a slot was never written.
+ *
+ * @param slot Slot number.
+ * @return true First word of the slot is erased.
+ */
+bool StaticAllowlist::erased(uint32_t slot){
+	return ((const header_t *)(base + slot * slot_size))->magic == ERASED;
+}
+
+/**
+ * @brief Active slot and generation of its image stored in NVS. Slot A
+ * and generation 0 when never swapped.
+ *
+ * @param slot Slot number.
+ * @param generation Generation of the image activated last.
+ * @return true A swap was stored.
+ */
+bool StaticAllowlist::stored_state(uint8_t *slot, uint32_t *generation){
+
+	nvs_handle_t handle;
+	bool stored = false;
+
+	*slot = 0;
+	*generation = 0;
+
+	if (nvs_open(ALLOWLIST_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK){
+		stored = nvs_get_u8(handle, ALLOWLIST_NVS_ACTIVE, slot) == ESP_OK;
+		nvs_get_u32(handle, ALLOWLIST_NVS_GENERATION, generation);
+		nvs_close(handle);
+	}
+
+	if (*slot >= SLOTS)
+		*slot = 0;
+
+	return stored;
+}
+
+/**
+ * @brief 32 bit hash finalizer. Must match mix32 of tools/mphf_build.py.
+ *
+ * @param x Value.
+ * @return uint32_t Hash.
+ */
+uint32_t StaticAllowlist::mix32(uint32_t x){
+
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+
+	return x;
+}
+
+/**
+ * @brief Take the active image for a lookup. The update task does not
+ * erase an image while it has readers: a reader that loaded the pointer
+ * just before a swap is counted, or sees the swap on the second load and
+ * retries with the new image.
+ *
+ * @return view_t* Active image, NULL without image.
+ */
+StaticAllowlist::view_t *StaticAllowlist::pin(){
+
+	for (;;){
+		view_t *view = __atomic_load_n(&active, __ATOMIC_SEQ_CST);
+
+		if (view == NULL)
+			return NULL;
+
+		__atomic_add_fetch(&view->readers, 1, __ATOMIC_SEQ_CST);
+		if (view == __atomic_load_n(&active, __ATOMIC_SEQ_CST))
+			return view;
+
+		unpin(view);
+	}
+}
+
+void StaticAllowlist::unpin(view_t *view){
+	__atomic_sub_fetch(&view->readers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Look up a tag: reads the bucket pilot and the tag of its slot.
+ * Lock free: the image is read only and never waits for an update.
+ *
+ * @param tag Tag number.
+ * @param doors Door permission bitmask of the found tag.
+ * @return true Tag is in the allowlist.
+ * @return false Tag not found or no allowlist.
+ */
+bool StaticAllowlist::find(uint32_t tag, uint8_t *doors){
+
+	if (tag == 0)
+		return false;
+
+	view_t *view = pin();
+
+	if (view == NULL)
+		return false;
+
+	const header_t *header = view->header;
+	uint32_t h1 = mix32(tag ^ header->seed);
+	uint32_t h2 = mix32(h1 ^ 0x9e3779b9);
+	uint32_t slot = (h2 ^ mix32(view->pilots[h1 % header->buckets])) % header->slots;
+	bool found = view->tags[slot] == tag;
+
+	if (found && doors)
+		*doors = view->doors_of[slot];
+
+	unpin(view);
+
+	return found;
+}
+
+/**
+ * @brief Number of tags of the active image.
+ *
+ * @return uint32_t Tags, 0 without image.
+ */
+uint32_t StaticAllowlist::count(){
+
+	view_t *view = pin();
+	uint32_t n = 0;
+
+	if (view){
+		n = view->header->count;
+		unpin(view);
+	}
+
+	return n;
+}
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+/**
+ * @brief Answer a request with the slot state:
+ * {"active":0,"count":n,"generation":g[,"slot":1,"written":n][,"error":"..."]}.
+ * "active" is -1 without image.
+ *
+ * @param request Request.
+ * @param error Error of the request, NULL on success.
+ */
+void StaticAllowlist::reply_state(const allowlist_request_t *request, const char *error){
+
+	char msg[136];
+	json_writer_t json;
+	const view_t *view = active;
+
+	json_init(&json, msg, sizeof(msg));
+	json_object_begin(&json);
+	json_kv_int(&json, "active", view ? view - views : -1);
+	json_kv_uint(&json, "count", view ? view->header->count : 0);
+	json_kv_uint(&json, "generation", view ? view->header->generation : 0);
+	if (upload.open){
+		json_kv_uint(&json, "slot", upload.slot);
+		json_kv_uint(&json, "written", upload.written);
+	}
+	if (error)
+		json_kv_string(&json, "error", error);
+	json_object_end(&json);
+
+	if (json_finish(&json))
+		mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, msg);
+}
+
+/**
+ * @brief Start an upload to the inactive slot. Restarts a pending one.
+ *
+ * @param request BEGIN request.
+ * @return const char* Error or NULL.
+ */
+const char *StaticAllowlist::begin(const allowlist_request_t *request){
+
+	if (request->offset < sizeof(header_t) || request->offset > slot_size)
+		return "size";
+
+	upload.open = true;
+	upload.slot = active ? (active - views) ^ 1 : 0;
+	upload.size = request->offset;
+	upload.crc = request->crc;
+	upload.written = 0;
+	upload.erased = 0;
+
+	/* Lookups that started before the last swap may still read this slot */
+	while (__atomic_load_n(&views[upload.slot].readers, __ATOMIC_SEQ_CST))
+		vTaskDelay(1);
+
+	ESP_LOGI(TAG, "Upload of %" PRIu32 " bytes to slot %c", upload.size, 'A' + upload.slot);
+
+	return NULL;
+}
+
+/**
+ * @brief Write the next chunk of the image. Sectors are erased as the
+ * image grows: each erase or write stalls flash reads (and so lookups
+ * running from flash) for one sector at most, never for the whole slot.
+ *
+ * @param request DATA request.
+ * @return const char* Error or NULL.
+ */
+const char *StaticAllowlist::write(const allowlist_request_t *request){
+
+	if (!upload.open)
+		return "not started";
+
+	/* Resent or out of order chunk: the reply tells where to resume */
+	if (request->offset != upload.written)
+		return "offset";
+
+	if (request->len == 0 || request->len > upload.size - upload.written)
+		return "size";
+
+	uint32_t slot_offset = upload.slot * slot_size;
+	uint32_t end = upload.written + request->len;
+
+	while (upload.erased < end){
+		if (esp_partition_erase_range(partition, slot_offset + upload.erased, SECTOR_SIZE) != ESP_OK){
+			upload.open = false;
+			return "erase";
+		}
+		upload.erased += SECTOR_SIZE;
+	}
+
+	if (esp_partition_write(partition, slot_offset + upload.written, request->data, request->len) != ESP_OK){
+		upload.open = false;
+		return "write";
+	}
+
+	upload.written = end;
+
+	return NULL;
+}
+
+/**
+ * @brief Verify the uploaded image and make it the active one. The NVS
+ * key is the commit point: before it the old image is used after a reboot,
+ * after it the new one. Lookups switch with one pointer store. Images not
+ * newer than the active one are refused.
+ *
+ * @return const char* Error or NULL.
+ */
+const char *StaticAllowlist::commit(){
+
+	nvs_handle_t handle;
+	view_t view;
+	esp_err_t err;
+
+	if (!upload.open)
+		return "not started";
+
+	if (upload.written != upload.size)
+		return "incomplete";
+
+	upload.open = false;
+
+	if (esp_rom_crc32_le(0, base + upload.slot * slot_size, upload.size) != upload.crc)
+		return "crc";
+
+	if (!check(upload.slot, &view))
+		return "image";
+
+	/* Not older than the image activated last either, even if that one
+	 * is no longer usable */
+	uint8_t stored_slot;
+	uint32_t stored_generation;
+	stored_state(&stored_slot, &stored_generation);
+	if (view.header->generation < stored_generation ||
+			(active && view.header->generation <= active->header->generation))
+		return "stale";
+
+	/* Generation first: if power is lost before the slot key, the old
+	 * slot is still active and the stored generation only makes the
+	 * fallback stricter */
+	err = nvs_open(ALLOWLIST_NVS_NAMESPACE, NVS_READWRITE, &handle);
+	if (err == ESP_OK){
+		err = nvs_set_u32(handle, ALLOWLIST_NVS_GENERATION, view.header->generation);
+		if (err == ESP_OK)
+			err = nvs_set_u8(handle, ALLOWLIST_NVS_ACTIVE, upload.slot);
+		if (err == ESP_OK)
+			err = nvs_commit(handle);
+		nvs_close(handle);
+	}
+	if (err != ESP_OK){
+		ESP_LOGE(TAG, "Active slot not stored: %x", err);
+		metric_inc(METRIC_NVS_WRITE_ERRORS);
+		return "nvs";
+	}
+
+	/* Inactive view: no lookup reads it until the pointer is published */
+	views[upload.slot].header = view.header;
+	views[upload.slot].pilots = view.pilots;
+	views[upload.slot].tags = view.tags;
+	views[upload.slot].doors_of = view.doors_of;
+	__atomic_store_n(&active, &views[upload.slot], __ATOMIC_SEQ_CST);
+
+	metric_set(METRIC_STATIC_TAGS, view.header->count);
+	metric_set(METRIC_ALLOWLIST_ALARM, 0);
+	ESP_LOGI(TAG, "Swapped to slot %c: generation %" PRIu32 ", %" PRIu32 " tags", 'A' + upload.slot,
+			view.header->generation, view.header->count);
+
+	return NULL;
+}
+
+/**
+ * @brief Allowlist task. Writes uploads to flash and answers every request
+ * with the slot state.
+ *
+ * @param param Pointer of the StaticAllowlist instance.
+ */
+void StaticAllowlist::allowlist_task(void *param){
+
+	StaticAllowlist *p = (StaticAllowlist *)param;
+
+	for (;;)
+		p->service(portMAX_DELAY);
+}
+
+/**
+ * @brief Handle queued requests, each answered with the slot state.
+ * Called by the allowlist task and by host tests, which have no tasks.
+ *
+ * @param ticks Wait for each request, in ticks.
+ */
+void StaticAllowlist::service(TickType_t ticks){
+
+	/* Too large for the stack */
+	static allowlist_request_t request;
+
+	while (xQueueReceive(allowlist_queue, &request, ticks)){
+		const char *error = NULL;
+
+		switch (request.op){
+		case ALLOWLIST_BEGIN:
+			error = begin(&request);
+			break;
+		case ALLOWLIST_DATA:
+			error = write(&request);
+			break;
+		case ALLOWLIST_COMMIT:
+			error = commit();
+			break;
+		case ALLOWLIST_ABORT:
+			upload.open = false;
+			break;
+		default:
+			break;
+		}
+
+		reply_state(&request, error);
+	}
+}
+
+/**
+ * @brief Queue an update request. Never blocks.
+ *
+ * @param request Request.
+ * @return true Queued.
+ * @return false Queue full or no allowlist partition.
+ */
+bool allowlist_request(const allowlist_request_t *request){
+
+	return allowlist_queue && xQueueSend(allowlist_queue, request, 0) == pdTRUE;
+}
+#endif
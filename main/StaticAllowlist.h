@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file StaticAllowlist.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing StaticAllowlist class definition.
+ *
+ * Read only allowlist compiled on the server by tools/mphf_build.py and
+ * written to the "allowlist" partition. The partition is memory mapped and
+ * holds a perfect hash table: the pilot of the tag bucket gives its slot and
+ * the slot tag verifies the match, so a lookup is two probes without
+ * collision chains. Image layout, little endian:
+ *
+ *   header_t | pilots:u16[buckets] | pad to 4 | tags:u32[slots] | doors:u8[slots]
+ *
+ * Empty slots hold tag 0.
+ *
+ * The partition is split in two image slots, A at offset 0 (where
+ * parttool.py writes) and B at half of the partition. The NVS key
+ * "allowlist"/"active" selects one. A whole list is replaced by writing the
+ * other slot in the background (tools/allowlist_push.py over MQTT), checking
+ * its CRC and flipping the key: a power loss at any point leaves the old or
+ * the new list, never a mix. Lookups read the active image through one
+ * pointer and never wait for the update.
+ *
+ * Each image has a generation, the build time by default. An upload must be
+ * newer than the active image, and the generation of the active image is
+ * stored with the key. When the active image is corrupted, the other slot
+ * is only used if it is at least that new: an older list could revive
+ * revoked tags. Otherwise the allowlist is empty and the
+ * "allowlist_alarm" metric is set.
+ */
+
+#ifndef MAIN_STATICALLOWLIST_H_
+#define MAIN_STATICALLOWLIST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_partition.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+#include "freertos/FreeRTOS.h"
+#endif
+
+/* Allowlist update commands received from MQTT */
+typedef enum {
+	ALLOWLIST_STATE,			/* Empty payload: report slots */
+	ALLOWLIST_BEGIN,			/* "begin <size> <crc32 hex>": start writing the inactive slot */
+	ALLOWLIST_DATA,				/* Image bytes at offset, in order */
+	ALLOWLIST_COMMIT,			/* "commit": verify and activate */
+	ALLOWLIST_ABORT,			/* "abort": drop the upload */
+} allowlist_op_t;
+
+#ifndef CONFIG_ALLOWLIST_CHUNK_BYTES
+	#define CONFIG_ALLOWLIST_CHUNK_BYTES 512
+#endif
+
+typedef struct {
+	uint8_t op;					/* allowlist_op_t */
+	uint16_t len;				/* DATA: bytes in data */
+	uint32_t offset;			/* DATA: image offset. BEGIN: image size */
+	uint32_t crc;				/* BEGIN: CRC32 of the whole image */
+	uint8_t data[CONFIG_ALLOWLIST_CHUNK_BYTES];
+	char correlation[16];
+	uint8_t correlation_len;
+	char response_topic[64];
+} allowlist_request_t;
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+EXPORT_C bool allowlist_request(const allowlist_request_t *request);
+#else
+static inline bool allowlist_request(const allowlist_request_t *request) { return false; }
+#endif
+
+#ifdef __cplusplus
+class StaticAllowlist {
+public:
+	StaticAllowlist();
+
+	bool find(uint32_t tag, uint8_t *doors);
+	uint32_t count();
+
+	enum {SLOTS = 2};
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+	void service(TickType_t ticks);
+#endif
+
+private:
+	struct header_t {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t reserved;
+		uint32_t count;			/* Stored tags */
+		uint32_t buckets;
+		uint32_t slots;
+		uint32_t seed;
+		uint32_t generation;	/* Newer images have larger numbers */
+		uint32_t crc;			/* CRC32 of the header up to crc, then of all bytes after it */
+	};
+
+	static_assert(sizeof(header_t) == 32, "Allowlist header must match tools/mphf_build.py");
+
+	enum : uint32_t {MAGIC = 0x4648504d, VERSION = 2, ERASED = 0xffffffff};
+
+	/* Tables of one mapped image */
+	struct view_t {
+		const header_t *header;
+		const uint16_t *pilots;
+		const uint32_t *tags;
+		const uint8_t *doors_of;
+		uint32_t readers;		/* Lookups in progress */
+	};
+
+	view_t views[SLOTS];
+	/* Image used by lookups, NULL: none. Written only by the update task */
+	view_t *active;
+
+	const esp_partition_t *partition;
+	const uint8_t *base;
+	uint32_t slot_size;
+	esp_partition_mmap_handle_t mmap_handle;
+
+	static uint32_t mix32(uint32_t x);
+
+	bool map(const esp_partition_t *partition);
+	bool check(uint32_t slot, view_t *view);
+	bool erased(uint32_t slot);
+	bool stored_state(uint8_t *slot, uint32_t *generation);
+	view_t *pin();
+	void unpin(view_t *view);
+
+#ifdef CONFIG_STATIC_ALLOWLIST_UPDATE
+	/* Upload in progress, only used by allowlist_task */
+	struct {
+		bool open;
+		uint8_t slot;
+		uint32_t size;
+		uint32_t crc;
+		uint32_t written;
+		uint32_t erased;		/* Slot bytes erased so far */
+	} upload;
+
+	void reply_state(const allowlist_request_t *request, const char *error);
+	const char *begin(const allowlist_request_t *request);
+	const char *write(const allowlist_request_t *request);
+	const char *commit();
+
+	static void allowlist_task(void *param);
+#endif
+};
+#endif
+
+#endif /* MAIN_STATICALLOWLIST_H_ */
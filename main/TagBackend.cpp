@@ -0,0 +1,247 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagBackend.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the NVS tag backend implementation.
+ *
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_log.h"
+
+#include "TagBackend.h"
+
+#define STORAGE_NAMESPACE "taqs_storage"
+#define ACTIVE_SET_KEY "tset"
+
+/* Block key prefix of each set */
+static const char *const block_prefix[2] = {"tblk", "tblb"};
+
+/**
+ * @brief Read a blob from NVS. Missing blobs leave data untouched.
+ *
+ * @param handle Opened NVS handle.
+ * @param key Blob key.
+ * @param data Destination.
+ * @param size Destination size. Larger blobs are truncated.
+ * @return esp_err_t NVS error code, ESP_ERR_NVS_NOT_FOUND when missing.
+ */
+static esp_err_t load(nvs_handle_t handle, const char *key, void *data, size_t size){
+
+	// Read the size of memory space required for blob
+	size_t required_size = 0;  // value will default to 0, if not set yet in NVS
+	esp_err_t err = nvs_get_blob(handle, key, NULL, &required_size);
+	if (err != ESP_OK)
+		return err;
+
+	ESP_LOGI("Tags::", "NVS blob %s size: %u", key, (unsigned)required_size);
+
+	if (required_size > size)
+		required_size = size;
+
+	return nvs_get_blob(handle, key, data, &required_size);
+}
+
+/**
+ * @brief Construct a new NvsTagBackend object.
+ *
+ */
+NvsTagBackend::NvsTagBackend(){
+
+	handle = 0;
+	write = false;
+	set = 0;
+}
+
+/**
+ * @brief Open the namespace.
+ *
+ * @param write Open for writing.
+ * @return esp_err_t NVS error code. The namespace does not exist until
+ * the first write.
+ */
+esp_err_t NvsTagBackend::begin(bool write){
+
+	this->write = write;
+
+	return nvs_open(STORAGE_NAMESPACE, write ? NVS_READWRITE : NVS_READONLY, &handle);
+}
+
+/**
+ * @brief Commit writes and close the namespace.
+ *
+ * @return esp_err_t NVS commit error code.
+ */
+esp_err_t NvsTagBackend::end(){
+
+	esp_err_t err = write ? nvs_commit(handle) : ESP_OK;
+
+	nvs_close(handle);
+
+	return err;
+}
+
+/**
+ * @brief Select the block set of the next loads and stores.
+ *
+ * @param set Block set, 0 or 1.
+ */
+void NvsTagBackend::select(uint8_t set){
+
+	this->set = set & 1;
+}
+
+/**
+ * @brief Read the active block set.
+ *
+ * @param set Active set, 0 when never stored: tables written before sets.
+ * @return esp_err_t NVS error code.
+ */
+esp_err_t NvsTagBackend::load_active(uint8_t *set){
+
+	esp_err_t err = nvs_get_u8(handle, ACTIVE_SET_KEY, set);
+
+	if (err == ESP_ERR_NVS_NOT_FOUND){
+		*set = 0;
+		return ESP_OK;
+	}
+
+	*set &= 1;
+
+	return err;
+}
+
+/**
+ * @brief Make a block set the one loaded at boot. Namespace opened for
+ * writing. A single key: after the commit of end() a reboot loads either
+ * set whole.
+ *
+ * @param set Block set, 0 or 1.
+ * @return esp_err_t NVS error code.
+ */
+esp_err_t NvsTagBackend::store_active(uint8_t set){
+
+	return nvs_set_u8(handle, ACTIVE_SET_KEY, set & 1);
+}
+
+/**
+ * @brief Read and decode a block of the selected set.
+ *
+ * @param block Block number.
+ * @param records Decoded records.
+ * @param max Capacity of records.
+ * @param count Number of records, -1 when the block was never stored.
+ * @return esp_err_t NVS error code, ESP_ERR_INVALID_CRC when corrupted.
+ */
+esp_err_t NvsTagBackend::load_block(uint32_t block, tag_record_t *records, uint8_t max, int *count){
+
+	size_t size = sizeof(buffer);
+	char key[16];
+
+	*count = -1;
+
+	snprintf(key, sizeof(key), "%s%" PRIu32, block_prefix[set], block);
+	esp_err_t err = nvs_get_blob(handle, key, buffer, &size);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+		return ESP_OK;
+	if (err != ESP_OK)
+		return err;
+
+	*count = tag_block_decode(buffer, size, records, max);
+	if (*count < 0){
+		ESP_LOGE("Tags::", "Tag block %s%" PRIu32 " corrupted", block_prefix[set], block);
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Encode and write a block of the selected set.
+ *
+ * @param block Block number.
+ * @param records Records, sorted here.
+ * @param count Number of records.
+ * @return esp_err_t NVS error code.
+ */
+esp_err_t NvsTagBackend::store_block(uint32_t block, tag_record_t *records, uint8_t count){
+
+	char key[16];
+	size_t size = tag_block_encode(records, count, buffer);
+
+	snprintf(key, sizeof(key), "%s%" PRIu32, block_prefix[set], block);
+
+	return nvs_set_blob(handle, key, buffer, size);
+}
+
+/**
+ * @brief Read the schedule table.
+ *
+ * @param data Destination.
+ * @param size Table size.
+ * @return esp_err_t NVS error code.
+ */
+esp_err_t NvsTagBackend::load_schedules(void *data, size_t size){
+
+	esp_err_t err = load(handle, "schedules", data, size);
+
+	return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+/**
+ * @brief Write the schedule table.
+ *
+ * @param data Table.
+ * @param size Table size.
+ * @return esp_err_t NVS error code.
+ */
+esp_err_t NvsTagBackend::store_schedules(const void *data, size_t size){
+
+	return nvs_set_blob(handle, "schedules", data, size);
+}
+
+/**
+ * @brief Read the raw arrays written before the block format.
+ *
+ * @param tags Tag numbers.
+ * @param schedule Schedule indexes.
+ * @param expiry Expiry times.
+ * @param doors Door masks.
+ * @param capacity Size of the arrays.
+ * @return esp_err_t NVS error code, ESP_ERR_NOT_FOUND without raw arrays.
+ */
+esp_err_t NvsTagBackend::load_legacy(uint32_t *tags, uint8_t *schedule, uint32_t *expiry, uint8_t *doors, uint16_t capacity){
+
+	esp_err_t err = load(handle, "tags", tags, capacity * sizeof(uint32_t));
+
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+		return ESP_ERR_NOT_FOUND;
+
+	if (err == ESP_OK && (err = load(handle, "tag_sched", schedule, capacity)) == ESP_ERR_NVS_NOT_FOUND)
+		err = ESP_OK;
+	if (err == ESP_OK && (err = load(handle, "tag_exp", expiry, capacity * sizeof(uint32_t))) == ESP_ERR_NVS_NOT_FOUND)
+		err = ESP_OK;
+	if (err == ESP_OK && (err = load(handle, "tag_doors", doors, capacity)) == ESP_ERR_NVS_NOT_FOUND)
+		err = ESP_OK;
+
+	return err;
+}
+
+/**
+ * @brief Erase the raw arrays. Namespace opened for writing.
+ *
+ */
+void NvsTagBackend::drop_legacy(){
+
+	nvs_erase_key(handle, "tags");
+	nvs_erase_key(handle, "tag_sched");
+	nvs_erase_key(handle, "tag_exp");
+	nvs_erase_key(handle, "tag_doors");
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagBackend.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the persistence backends of TagStore.
+ *
+ * TagStore persists its tags as blocks of up to 255 records (see
+ * TagBlock.h) and its schedule table as one blob. Blocks are kept in two
+ * sets: a whole table is replaced by writing all blocks of the inactive set
+ * and then storing its number, so a reboot loads either the old or the new
+ * table, never a mix. All backends have the same members and are selected
+ * at compile time:
+ *
+ *   begin(write)                           start a load or a store
+ *   end()                                  finish, stores are committed
+ *   select(set)                            block set of the next loads and stores, 0 or 1
+ *   load_active(&set)                      set to load at boot, 0 when never stored
+ *   store_active(set)
+ *   load_block(block, records, max, &n)    n: records, -1 when absent
+ *   store_block(block, records, n)         records may be reordered
+ *   load_schedules(data, size)             absent leaves data untouched
+ *   store_schedules(data, size)
+ *   load_legacy(...)                       tables of older firmware,
+ *                                          ESP_ERR_NOT_FOUND when absent
+ *   drop_legacy()
+ */
+
+#ifndef MAIN_TAGBACKEND_H_
+#define MAIN_TAGBACKEND_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+#include "nvs.h"
+
+#include "TagBlock.h"
+#include "Schedule.h"
+
+/* NVS namespace "taqs_storage": one blob per block and the schedule table.
+ * Blocks of set 0 are "tblk<n>", as before sets, of set 1 "tblb<n>". The
+ * active set is the u8 "tset" */
+class NvsTagBackend {
+public:
+	NvsTagBackend();
+
+	esp_err_t begin(bool write);
+	esp_err_t end();
+	void select(uint8_t set);
+	esp_err_t load_active(uint8_t *set);
+	esp_err_t store_active(uint8_t set);
+	esp_err_t load_block(uint32_t block, tag_record_t *records, uint8_t max, int *count);
+	esp_err_t store_block(uint32_t block, tag_record_t *records, uint8_t count);
+	esp_err_t load_schedules(void *data, size_t size);
+	esp_err_t store_schedules(const void *data, size_t size);
+	esp_err_t load_legacy(uint32_t *tags, uint8_t *schedule, uint32_t *expiry, uint8_t *doors, uint16_t capacity);
+	void drop_legacy();
+
+	enum {MAX_BLOCK_RECORDS = 32};
+
+private:
+	nvs_handle_t handle;
+	bool write;
+	uint8_t set;
+	uint8_t buffer[TAG_BLOCK_MAX_BYTES(MAX_BLOCK_RECORDS)];
+};
+
+/* Records kept in RAM: nothing survives a reboot. Host builds and benchmarks */
+template <uint16_t Capacity>
+class RamTagBackend {
+public:
+	RamTagBackend() {
+		memset(counts, 0xff, sizeof(counts));
+		memset(schedules, 0, sizeof(schedules));
+		set = 0;
+		active = 0;
+	}
+
+	esp_err_t begin(bool write) { return ESP_OK; }
+	esp_err_t end() { return ESP_OK; }
+
+	void select(uint8_t set) { this->set = set & 1; }
+
+	esp_err_t load_active(uint8_t *set) {
+		*set = active;
+		return ESP_OK;
+	}
+
+	esp_err_t store_active(uint8_t set) {
+		active = set & 1;
+		return ESP_OK;
+	}
+
+	esp_err_t load_block(uint32_t block, tag_record_t *records, uint8_t max, int *count) {
+		*count = counts[set][block] == 0xff ? -1 : counts[set][block];
+		if (*count > max)
+			return ESP_ERR_INVALID_SIZE;
+		if (*count > 0)
+			memcpy(records, &stored[set][block * MAX_BLOCK_RECORDS], *count * sizeof(tag_record_t));
+		return ESP_OK;
+	}
+
+	esp_err_t store_block(uint32_t block, tag_record_t *records, uint8_t count) {
+		memcpy(&stored[set][block * MAX_BLOCK_RECORDS], records, count * sizeof(tag_record_t));
+		counts[set][block] = count;
+		return ESP_OK;
+	}
+
+	esp_err_t load_schedules(void *data, size_t size) {
+		memcpy(data, schedules, size < sizeof(schedules) ? size : sizeof(schedules));
+		return ESP_OK;
+	}
+
+	esp_err_t store_schedules(const void *data, size_t size) {
+		memcpy(schedules, data, size < sizeof(schedules) ? size : sizeof(schedules));
+		return ESP_OK;
+	}
+
+	esp_err_t load_legacy(uint32_t *tags, uint8_t *schedule, uint32_t *expiry, uint8_t *doors, uint16_t capacity) {
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	void drop_legacy() {}
+
+	enum {MAX_BLOCK_RECORDS = 32};
+
+private:
+	enum {BLOCKS = (Capacity + MAX_BLOCK_RECORDS - 1) / MAX_BLOCK_RECORDS};
+
+	tag_record_t stored[2][BLOCKS * (uint32_t)MAX_BLOCK_RECORDS];
+	uint8_t counts[2][BLOCKS];		/* 0xff: block never stored */
+	schedule_t schedules[SCHEDULE_MAX_IDS];
+	uint8_t set;
+	uint8_t active;
+};
+
+#endif /* MAIN_TAGBACKEND_H_ */
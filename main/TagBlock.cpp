@@ -0,0 +1,191 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagBlock.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the persisted tag block encoder and decoder.
+ *
+ */
+
+#include <string.h>
+#include "esp_rom_crc.h"
+
+#include "TagBlock.h"
+
+enum {ATTR_SCHEDULE = 1, ATTR_EXPIRY = 2, ATTR_DOORS = 4};
+
+enum {DOORS_ALL = 0xff};
+
+/**
+ * @brief Write a LEB128 varint.
+ *
+ * @param out Destination.
+ * @param value Value.
+ * @return size_t Bytes written, 1 to 5.
+ */
+static size_t put_varint(uint8_t *out, uint32_t value){
+
+	size_t n = 0;
+
+	while (value >= 0x80){
+		out[n++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[n++] = (uint8_t)value;
+
+	return n;
+}
+
+/**
+ * @brief Read a LEB128 varint.
+ *
+ * @param in Source. Advanced past the varint.
+ * @param end End of source.
+ * @param value Decoded value.
+ * @return true Valid varint.
+ * @return false Truncated or longer than 32 bits.
+ */
+static bool get_varint(const uint8_t **in, const uint8_t *end, uint32_t *value){
+
+	uint32_t v = 0;
+
+	for (int shift = 0; shift < 35; shift += 7){
+		if (*in >= end)
+			return false;
+
+		uint8_t b = *(*in)++;
+		v |= (uint32_t)(b & 0x7f) << shift;
+
+		if (!(b & 0x80)){
+			*value = v;
+			return shift < 28 || b < 0x10;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Encode a block. Records are sorted by tag in place.
+ *
+ * @param records Records with unique, non zero tags.
+ * @param count Number of records.
+ * @param out Destination of at least TAG_BLOCK_MAX_BYTES(count) bytes.
+ * @return size_t Encoded size.
+ */
+size_t tag_block_encode(tag_record_t *records, uint8_t count, uint8_t *out){
+
+	uint32_t prev = 0;
+	size_t n = 0;
+
+	/* Blocks are small: insertion sort */
+	for (int i = 1; i < count; i++){
+		tag_record_t r = records[i];
+		int j = i - 1;
+		for (; j >= 0 && records[j].tag > r.tag; j--)
+			records[j + 1] = records[j];
+		records[j + 1] = r;
+	}
+
+	out[n++] = TAG_BLOCK_VERSION;
+	out[n++] = count;
+
+	for (int i = 0; i < count; i++){
+		const tag_record_t *r = &records[i];
+		uint8_t attr = 0;
+
+		if (r->schedule)
+			attr |= ATTR_SCHEDULE;
+		if (r->expiry)
+			attr |= ATTR_EXPIRY;
+		if (r->doors != DOORS_ALL)
+			attr |= ATTR_DOORS;
+
+		n += put_varint(out + n, r->tag - prev);
+		out[n++] = attr;
+		if (attr & ATTR_SCHEDULE)
+			out[n++] = r->schedule;
+		if (attr & ATTR_EXPIRY)
+			n += put_varint(out + n, r->expiry);
+		if (attr & ATTR_DOORS)
+			out[n++] = r->doors;
+
+		prev = r->tag;
+	}
+
+	uint32_t crc = esp_rom_crc32_le(0, out, n);
+	memcpy(out + n, &crc, sizeof(crc));
+
+	return n + sizeof(crc);
+}
+
+/**
+ * @brief Decode and verify a block.
+ *
+ * @param in Encoded block.
+ * @param len Encoded size.
+ * @param records Decoded records, sorted by tag.
+ * @param max Capacity of records.
+ * @return int Number of records or -1 when the block is corrupted,
+ * of an unknown version or larger than max.
+ */
+int tag_block_decode(const uint8_t *in, size_t len, tag_record_t *records, uint8_t max){
+
+	uint32_t crc;
+	uint32_t prev = 0;
+
+	if (len < 2 + sizeof(crc))
+		return -1;
+
+	len -= sizeof(crc);
+	memcpy(&crc, in + len, sizeof(crc));
+	if (crc != esp_rom_crc32_le(0, in, len))
+		return -1;
+
+	const uint8_t *p = in + 2;
+	const uint8_t *end = in + len;
+	uint8_t count = in[1];
+
+	if (in[0] != TAG_BLOCK_VERSION || count > max)
+		return -1;
+
+	for (int i = 0; i < count; i++){
+		tag_record_t *r = &records[i];
+		uint32_t delta;
+		uint8_t attr;
+
+		if (!get_varint(&p, end, &delta) || p >= end)
+			return -1;
+
+		/* Tags are unique, increasing and not zero */
+		if (delta == 0 || prev + delta < prev)
+			return -1;
+
+		r->tag = prev + delta;
+		r->schedule = 0;
+		r->expiry = 0;
+		r->doors = DOORS_ALL;
+		prev = r->tag;
+
+		attr = *p++;
+		if (attr & ATTR_SCHEDULE){
+			if (p >= end)
+				return -1;
+			r->schedule = *p++;
+		}
+		if ((attr & ATTR_EXPIRY) && !get_varint(&p, end, &r->expiry))
+			return -1;
+		if (attr & ATTR_DOORS){
+			if (p >= end)
+				return -1;
+			r->doors = *p++;
+		}
+	}
+
+	return p == end ? count : -1;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagBlock.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the persisted tag block format.
+ *
+ * Tags are stored in NVS as blocks of up to 255 entries. Entries of a block
+ * are sorted by tag number and each one is written as the varint of its
+ * distance to the previous tag, followed by an attribute byte and only the
+ * attributes that differ from the defaults:
+ *
+ *   version:u8 count:u8 { delta:varint attr:u8 [schedule:u8] [expiry:varint] [doors:u8] } crc32:u32
+ *
+ * A tag without schedule, expiry or door restriction costs its delta plus
+ * one byte. The CRC32 covers all previous bytes.
+ */
+
+#ifndef MAIN_TAGBLOCK_H_
+#define MAIN_TAGBLOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TAG_BLOCK_VERSION	1
+
+/* Worst case encoded size of a block of n entries */
+#define TAG_BLOCK_MAX_BYTES(n)	(2 + (n) * (5 + 1 + 1 + 5 + 1) + 4)
+
+typedef struct {
+	uint32_t tag;
+	uint32_t expiry;	/* 0: never expires */
+	uint8_t schedule;	/* 0: no time restriction */
+	uint8_t doors;		/* 0xff: all doors */
+} tag_record_t;
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+EXPORT_C size_t tag_block_encode(tag_record_t *records, uint8_t count, uint8_t *out);
+EXPORT_C int tag_block_decode(const uint8_t *in, size_t len, tag_record_t *records, uint8_t max);
+
+#endif /* MAIN_TAGBLOCK_H_ */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagIndex.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the tag index policies of TagStore.
+ *
+ * An index maps a tag number to its slot in the TagStore arrays. All
+ * policies have the same members and are selected at compile time:
+ *
+ *   clear()                    forget all tags
+ *   insert(tag, slot)          tag stored at slot
+ *   remove(tag, slot)          tag removed from slot
+ *   find(tags, tag)            slot of tag or -1, tags is the slot array
+ *
+ * Callers hold the TagStore mutex.
+ */
+
+#ifndef MAIN_TAGINDEX_H_
+#define MAIN_TAGINDEX_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* No extra memory: find walks the dense tag array */
+template <uint16_t Capacity>
+class LinearIndex {
+public:
+	void clear() {}
+	void insert(uint32_t tag, uint16_t slot) {}
+	void remove(uint32_t tag, uint16_t slot) {}
+
+	int32_t find(const uint32_t *tags, uint32_t tag) const {
+		for (int32_t i = 0; i < Capacity; i++)
+			if (tags[i] == tag)
+				return i;
+		return -1;
+	}
+};
+
+/* Hash chains over slot numbers: 4 bytes per slot, O(1) find */
+template <uint16_t Capacity>
+class HashIndex {
+public:
+	HashIndex() { clear(); }
+
+	void clear() {
+		memset(buckets, 0xff, sizeof(buckets));
+	}
+
+	void insert(uint32_t tag, uint16_t slot) {
+		uint16_t b = hash(tag);
+		next[slot] = buckets[b];
+		buckets[b] = slot;
+	}
+
+	void remove(uint32_t tag, uint16_t slot) {
+		uint16_t *link = &buckets[hash(tag)];
+
+		while (*link != NONE){
+			if (*link == slot){
+				*link = next[slot];
+				return;
+			}
+			link = &next[*link];
+		}
+	}
+
+	int32_t find(const uint32_t *tags, uint32_t tag) const {
+		for (uint16_t i = buckets[hash(tag)]; i != NONE; i = next[i])
+			if (tags[i] == tag)
+				return i;
+		return -1;
+	}
+
+private:
+	enum : uint16_t {BUCKETS = Capacity, NONE = 0xffff};
+
+	static_assert(Capacity < NONE, "HashIndex capacity must be below 65535");
+
+	uint16_t buckets[BUCKETS];
+	uint16_t next[Capacity];
+
+	static uint16_t hash(uint32_t tag) {
+		return (uint16_t)(((tag * 2654435761u) >> 16) % BUCKETS);
+	}
+};
+
+#endif /* MAIN_TAGINDEX_H_ */
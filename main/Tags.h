@@ -6,11 +6,19 @@
  */
 
 /**
- * @file Uart.h
+ * @file Tags.h
  * @author Renan Augusto Starke
  * @date 18 Dec 2023
- * @brief File containing Tags class definiton.
+ * @brief File containing TagStore class definiton.
  *
+ * TagStore is a template over its capacity, its index (TagIndex.h) and
+ * its persistence backend (TagBackend.h), so each build only carries the
+ * code path it uses and lookups have no virtual calls. Member definitions
+ * are in TagsImpl.h; Tags.cpp instantiates the Tags of the firmware.
+ *
+ * With TAGS_REPLACE a whole table is uploaded into a second copy of the
+ * arrays and the inactive backend block set while lookups keep using the
+ * active ones, then both are switched at once (see replace).
  */
 
 #ifndef MAIN_TAGS_H_
@@ -20,42 +28,178 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "esp_system.h"
+#include "sdkconfig.h"
+
+#include "Schedule.h"
+#include "TagBlock.h"
+#include "TagIndex.h"
+#include "TagBackend.h"
+#include "TimerWheel.h"
+#include "StaticAllowlist.h"
+#include "StaticAlloc.h"
+#include "Mqtt.h"
 
 
 #ifdef __cplusplus // only actually define the class if this is C++
 
-class Tags{
+template <uint16_t Capacity, class Index, class Backend>
+class TagStore {
 public:
-	Tags();
+	/* Access fields of a found tag, copied by search in one locked probe:
+	 * the slot may be reused by tags_task right after */
+	struct access_t {
+		uint8_t doors;			/* Door permission bitmask */
+		uint8_t flags;			/* TAG_FLAG_*, 0: no time check */
+		uint8_t schedule;		/* Schedule index */
+		uint32_t expiry;		/* Epoch seconds, 0: never expires */
+	};
+
+	TagStore();
 	int add_new(uint32_t tag);
-	int32_t search(uint32_t tag);
+	int set(uint32_t tag, uint8_t schedule_id, uint32_t expiry, uint8_t doors);
+	int set_schedule(uint8_t id, const schedule_t *schedule);
+	int32_t search(uint32_t tag, access_t *access = NULL);
+	bool allowed_now(const access_t *access);
+	void expire();
 	void print();
+#ifdef CONFIG_TAGS_REPLACE
+	void replace(const tags_replace_t *request);
+#endif
+
+	enum {MAX_TAGS = Capacity, MAX_SCHEDULES = SCHEDULE_MAX_IDS};
+
+	/* Schedule index of tags without time restriction */
+	enum {SCHEDULE_ALWAYS = 0};
 
-	enum {MAX_TAGS = 128};
+	/* Door permission mask of tags allowed everywhere */
+	enum {DOORS_ALL = 0xff};
+
+	/* Search result of tags found in the static allowlist */
+	enum {STATIC_INDEX = MAX_TAGS};
 
 
 private:
-	uint32_t tags_memory[MAX_TAGS];
-	int32_t tags_top_index;
+	/* Struct of arrays: lookups only touch the dense tag number array */
+	struct table_t {
+		uint32_t tags[MAX_TAGS];
+		/* Door permission bitmask of each tag: bit n opens door n */
+		uint8_t doors[MAX_TAGS];
+		/* TAG_FLAG_* of each tag. Tags without flags skip time checks */
+		uint8_t flags[MAX_TAGS];
+		/* Schedule index of each tag. Shared schedules are stored once */
+		uint8_t schedule[MAX_TAGS];
+		/* Expiry time of each tag, 0: never expires */
+		uint32_t expiry[MAX_TAGS];
+		/* Tag number to slot, kept in step with tags */
+		Index index;
+	};
+
+#ifdef CONFIG_TAGS_REPLACE
+	enum {TABLES = 2};
+#else
+	enum {TABLES = 1};
+#endif
+
+	/* The active table and, with TAGS_REPLACE, the one a replacement is
+	 * uploaded to. Only tags_task writes the inactive one */
+	table_t tables[TABLES];
+	table_t *table;
+
+	/* Arrays of the active table, switched by bind under the mutex */
+	uint32_t *tags_memory;
+	uint8_t *tags_doors;
+	uint8_t *tags_flags;
+	uint8_t *tags_schedule;
+	uint32_t *tags_expiry;
+	Index *tag_index;
+
+	schedule_t schedules[MAX_SCHEDULES];
 	esp_err_t nvs_err;
 
+	Backend backend;
+	/* Backend block set of the active table */
+	uint8_t active_set;
+
+	/* Read only table flashed by tools/mphf_build.py, searched after RAM tags */
+	StaticAllowlist allowlist;
+
+	/* Purges temporary tags. Only used by tags_task */
+	TimerWheel<MAX_TAGS> expiry_wheel;
+	bool expiry_synced;
+	/* Indexes, then tag numbers, of the tags purged by expire */
+	uint32_t expired[MAX_TAGS];
+
+	/* Wall time steps larger than this rebuild the wheel instead of ticking */
+	enum {EXPIRY_MAX_CATCH_UP = 3600};
+
+	enum {STORE_TAGS = 1, STORE_SCHEDULES = 2};
+
+	/* Tags are persisted in blocks of BLOCK_SLOTS slots, see TagBlock.h.
+	 * Only blocks changed since the last commit are written */
+	enum {BLOCK_SLOTS = Backend::MAX_BLOCK_RECORDS, BLOCKS = (Capacity + Backend::MAX_BLOCK_RECORDS - 1) / Backend::MAX_BLOCK_RECORDS};
+
+	/* Bit n: block n changed since the last commit */
+	uint32_t dirty_blocks[(BLOCKS + 31) / 32];
+	/* Copies written to the backend outside the mutex. Only used by commit */
+	tag_record_t staged[BLOCK_SLOTS];
+	schedule_t staged_schedules[MAX_SCHEDULES];
+
+	enum {TAG_FLAG_SCHEDULED = 1, TAG_FLAG_EXPIRES = 2};
+
+#ifdef CONFIG_TAGS_REPLACE
+	/* Table upload in progress, see replace */
+	struct {
+		bool open;
+		uint32_t size;			/* Announced bytes */
+		uint32_t crc;			/* Announced CRC32 */
+		uint32_t written;		/* Bytes received in order */
+		uint32_t received_crc;	/* CRC32 of the received bytes */
+	} upload;
+#endif
+
 	int32_t find_space();
+	void clear_entry(int32_t index);
+	void update_flags(int32_t index);
+	void update_count();
+	void mark_dirty(int32_t index);
+	int commit(uint32_t what);
+	esp_err_t load_blocks(table_t *table, bool *found);
+	uint8_t stage_block(const table_t *table, uint32_t block);
+	void bind(table_t *table);
+
+	static void clear_table(table_t *table);
+	static void index_table(table_t *table);
+	static uint32_t count_table(const table_t *table);
+	static uint8_t flags_of(uint8_t schedule, uint32_t expiry);
+
+#ifdef CONFIG_TAGS_REPLACE
+	const char *replace_begin(const tags_replace_t *request);
+	const char *replace_write(const tags_replace_t *request);
+	const char *replace_commit();
+	void reply_replace(const tags_replace_t *request, const char *error);
+#endif
+
+	static void tags_task(void *param);
 
 	SemaphoreHandle_t xSemaphore_tags;
+	STATIC_ONLY(StaticSemaphore_t tags_mutex_storage;)
 
 protected:
 
 
 };
 
-#endif
-
-#ifdef __cplusplus
-    #define EXPORT_C extern "C"
+#ifdef CONFIG_TAGS_INDEX_HASH
+	#define TAGS_INDEX	HashIndex<CONFIG_TAGS_CAPACITY>
 #else
-    #define EXPORT_C
+	#define TAGS_INDEX	LinearIndex<CONFIG_TAGS_CAPACITY>
 #endif
 
-EXPORT_C void tags_task(void *param);
+/* Tags of the firmware, instantiated in Tags.cpp */
+typedef TagStore<CONFIG_TAGS_CAPACITY, TAGS_INDEX, NvsTagBackend> Tags;
+
+extern template class TagStore<CONFIG_TAGS_CAPACITY, TAGS_INDEX, NvsTagBackend>;
+
+#endif
 
 #endif /* MAIN_TAGS_H_ */
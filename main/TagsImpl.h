@@ -0,0 +1,963 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TagsImpl.h
+ * @author Renan Augusto Starke
+ * @date 18 Dec 2023
+ * @brief File containing TagStore class implementation.
+ *
+ * Only included where a TagStore is instantiated: Tags.cpp for the
+ * firmware, host benchmarks for other index and backend policies.
+ */
+
+#ifndef MAIN_TAGSIMPL_H_
+#define MAIN_TAGSIMPL_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+#include "Tags.h"
+#include "Mqtt.h"
+#include "Logger.h"
+#include "Time.h"
+#include "TaskPlan.h"
+#include "Metrics.h"
+#include "JsonWriter.h"
+
+/**
+ * @brief Tags task. Waits until MQTT receives a tag or schedule configuration.
+ *
+ * @param param Pointer of a instance of TagStore.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::tags_task(void *param) {
+
+	/* Get class pointer */
+	TagStore *p = (TagStore *)param;
+	tag_cmd_t cmd;
+#ifdef CONFIG_TAGS_REPLACE
+	/* Too large for the stack */
+	static tags_replace_t request;
+#endif
+
+	/* Debug: print stored permissive tags */
+	p->print();
+
+	while (1){
+		/* Purge expired tags once a second */
+		p->expire();
+
+#ifdef CONFIG_TAGS_REPLACE
+		while (get_tags_replace(&request) == 0)
+			p->replace(&request);
+#endif
+
+		/* Block until a new command is received from mqtt */
+		if (get_tag_command(&cmd, 1000) != 0)
+			continue;
+
+		switch (cmd.type){
+		case TAG_CMD_TOGGLE:
+			/* Add or delete from NVS storage */
+			p->add_new(cmd.tag);
+			break;
+		case TAG_CMD_SET:
+			p->set(cmd.tag, cmd.schedule_id, cmd.expiry, cmd.doors);
+			break;
+		case TAG_CMD_SCHEDULE:
+			p->set_schedule(cmd.schedule_id, &cmd.schedule);
+			break;
+		}
+		tag_command_done(&cmd);
+		DLOGI(TAGS, DLOG_TAGS_RECEIVED, cmd.tag);
+	}
+}
+
+/**
+ * @brief Construct a new TagStore object. Read the stored tags and schedules
+ * from the backend.
+ *
+ */
+template <uint16_t Capacity, class Index, class Backend>
+TagStore<Capacity, Index, Backend>::TagStore() : expiry_wheel(&tables[0].expiry[0]) {
+
+	esp_err_t err;
+	bool found = false;
+	bool legacy = false;
+
+	for (int t=0; t < TABLES; t++)
+		clear_table(&tables[t]);
+	bind(&tables[0]);
+	memset(schedules, 0, sizeof(schedules));
+	memset(dirty_blocks, 0, sizeof(dirty_blocks));
+	nvs_err = ESP_OK;
+	active_set = 0;
+	expiry_synced = false;
+#ifdef CONFIG_TAGS_REPLACE
+	memset(&upload, 0, sizeof(upload));
+#endif
+
+	xSemaphore_tags = RTOS_MUTEX(&tags_mutex_storage);
+
+	err = backend.begin(false);
+	if (err == ESP_OK){
+		if ((err = backend.load_active(&active_set)) == ESP_OK)
+			backend.select(active_set);
+		if (err == ESP_OK && (err = load_blocks(table, &found)) == ESP_OK && !found){
+			/* Raw arrays written before the block format */
+			err = backend.load_legacy(tags_memory, tags_schedule, tags_expiry, tags_doors, MAX_TAGS);
+			if (err == ESP_OK)
+				legacy = true;
+			else if (err == ESP_ERR_NOT_FOUND)
+				err = ESP_OK;
+		}
+		if (err == ESP_OK)
+			err = backend.load_schedules(schedules, sizeof(schedules));
+		if (err != ESP_OK){
+			ESP_LOGI("Tags::", "Backend load error: %d", err);
+			nvs_err = err;
+		}
+		backend.end();
+	}
+	else {
+		/* Namespace does not exist until the first tag is stored */
+		ESP_LOGI("Tags::", "Backend open error: %x", err);
+		nvs_err = err;
+	}
+
+	/* Flags are derived from schedules and expiries */
+	index_table(table);
+
+	/* Rewrite raw arrays as blocks and drop them */
+	if (legacy){
+		for (int b=0; b < BLOCKS; b++)
+			mark_dirty(b * BLOCK_SLOTS);
+		if (commit(STORE_TAGS) == ESP_OK && backend.begin(true) == ESP_OK){
+			backend.drop_legacy();
+			backend.end();
+			ESP_LOGI("Tags::", "Tags converted to block format");
+		}
+	}
+
+	update_count();
+
+	/* Create and send class instace to RTOS task */
+	TagStore *p = this;
+	RTOS_TASK(tags_task, "tags_task", 4096, p, TASK_TAGS_PRIORITY, NULL, TASK_TAGS_CORE);
+}
+
+/**
+ * @brief Add or delete a tag. Remove a tag if it already exists.
+ * New tags have no time restriction.
+ *
+ * @param tag Tag number.
+ * @return int ESP_FAIL on error or ESP_OK on success
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int TagStore<Capacity, Index, Backend>::add_new(uint32_t tag){
+
+	if (tag == 0)
+		return ESP_FAIL;
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	int32_t found_idex = tag_index->find(tags_memory, tag);
+
+	/* Add new */
+	if (found_idex == -1){
+		/* First space to store new tag */
+		int32_t new_index = find_space();
+
+		if (new_index < 0){
+			xSemaphoreGive(xSemaphore_tags);
+			DLOGW(TAGS, DLOG_TAGS_FULL);
+			return ESP_FAIL;
+		}
+
+		DLOGI(TAGS, DLOG_TAGS_ADD, new_index);
+		clear_entry(new_index);
+		tags_memory[new_index] = tag;
+		tag_index->insert(tag, new_index);
+	}
+	else {
+		/* Remove a tag when added a found one */
+		DLOGI(TAGS, DLOG_TAGS_REMOVE, found_idex);
+		clear_entry(found_idex);
+		expiry_wheel.remove(found_idex);
+	}
+	xSemaphoreGive(xSemaphore_tags);
+
+	return commit(STORE_TAGS);
+}
+
+/**
+ * @brief Add a tag or update the doors, schedule and expiry of a stored one.
+ *
+ * @param tag Tag number.
+ * @param schedule_id Schedule index or SCHEDULE_ALWAYS.
+ * @param expiry Epoch seconds when the tag is purged, 0: never.
+ * @param doors Door permission bitmask.
+ * @return int ESP_FAIL on error or ESP_OK on success
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int TagStore<Capacity, Index, Backend>::set(uint32_t tag, uint8_t schedule_id, uint32_t expiry, uint8_t doors){
+
+	if (tag == 0 || schedule_id >= MAX_SCHEDULES)
+		return ESP_FAIL;
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	int32_t index = tag_index->find(tags_memory, tag);
+
+	if (index == -1){
+		index = find_space();
+		if (index < 0){
+			xSemaphoreGive(xSemaphore_tags);
+			DLOGW(TAGS, DLOG_TAGS_FULL);
+			return ESP_FAIL;
+		}
+		DLOGI(TAGS, DLOG_TAGS_ADD, index);
+		tags_memory[index] = tag;
+		tag_index->insert(tag, index);
+	}
+	tags_doors[index] = doors;
+	tags_schedule[index] = schedule_id;
+	tags_expiry[index] = expiry;
+	update_flags(index);
+	mark_dirty(index);
+	xSemaphoreGive(xSemaphore_tags);
+
+	/* Wheel is filled at first wall time synchronization */
+	if (expiry == 0)
+		expiry_wheel.remove(index);
+	else if (expiry_synced)
+		expiry_wheel.add(index);
+
+	return commit(STORE_TAGS);
+}
+
+/**
+ * @brief Define or clear a schedule. Tags referencing a cleared
+ * schedule are denied until it is defined again.
+ *
+ * @param id Schedule index. SCHEDULE_ALWAYS can not be changed.
+ * @param schedule New schedule.
+ * @return int ESP_FAIL on error or ESP_OK on success
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int TagStore<Capacity, Index, Backend>::set_schedule(uint8_t id, const schedule_t *schedule){
+
+	if (id == SCHEDULE_ALWAYS || id >= MAX_SCHEDULES)
+		return ESP_FAIL;
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	schedules[id] = *schedule;
+	xSemaphoreGive(xSemaphore_tags);
+
+	DLOGI(TAGS, DLOG_TAGS_SCHEDULE, id);
+
+	return commit(STORE_SCHEDULES);
+}
+
+/**
+ * @brief Check if a found tag may open the door now. Evaluates the copy
+ * made by search, never the slot, which may hold another tag by now.
+ *
+ * @param access Access fields returned by search.
+ * @return true Tag schedule allows access now.
+ * @return false Denied by schedule or wall time not synchronized.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+bool TagStore<Capacity, Index, Backend>::allowed_now(const access_t *access){
+
+	time_t now;
+	struct tm local;
+	bool ret;
+
+	/* No time restriction, static allowlist included: no need of wall time */
+	if (access->flags == 0)
+		return true;
+
+	uint8_t id = access->schedule;
+	uint32_t expiry = access->expiry;
+
+	if (!Time::WallTime(&now, &local)){
+#ifdef CONFIG_SCHEDULE_ALLOW_UNSYNCED
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/* Expired but not purged yet */
+	if (expiry && now >= (time_t)expiry)
+		return false;
+
+	if (id == SCHEDULE_ALWAYS || id >= MAX_SCHEDULES)
+		return id == SCHEDULE_ALWAYS;
+
+	/* Schedules are shared by id: the current definition applies */
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	ret = schedule_allows(&schedules[id], now, &local);
+	xSemaphoreGive(xSemaphore_tags);
+
+	return ret;
+}
+
+/**
+ * @brief Advance the expiry wheel to wall time and purge expired tags.
+ * All purges of a call are written in a single commit and each one is
+ * reported on telemetry.
+ *
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::expire(){
+
+	time_t now;
+	uint32_t count = 0;
+	char payload[48];
+	json_writer_t json;
+
+	if (!Time::WallTime(&now, NULL))
+		return;
+
+	/* First synchronization or clock step: rebuild from table */
+	if (!expiry_synced || (uint32_t)now < expiry_wheel.now() ||
+			(uint32_t)now - expiry_wheel.now() > EXPIRY_MAX_CATCH_UP){
+		expiry_wheel.clear(now);
+		for (int i=0; i < MAX_TAGS; i++)
+			if (tags_memory[i] != 0 && tags_expiry[i] != 0)
+				expiry_wheel.add(i);
+		expiry_synced = true;
+	}
+
+	while (expiry_wheel.now() < (uint32_t)now)
+		expiry_wheel.tick([&](uint16_t index){ expired[count++] = index; });
+
+	if (count == 0)
+		return;
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	for (uint32_t i=0; i < count; i++){
+		uint32_t index = expired[i];
+		/* Keep tag number for telemetry */
+		expired[i] = tags_memory[index];
+		clear_entry(index);
+	}
+	xSemaphoreGive(xSemaphore_tags);
+
+	commit(STORE_TAGS);
+
+	for (uint32_t i=0; i < count; i++){
+		DLOGI(TAGS, DLOG_TAGS_EXPIRED, expired[i]);
+
+		json_init(&json, payload, sizeof(payload));
+		json_object_begin(&json);
+		json_kv_ts(&json, (int64_t)now * 1000);
+		json_kv_uint(&json, "tag", expired[i]);
+		json_object_end(&json);
+		if (json_finish(&json))
+			mqtt5_publish("lpae/tag_expired", payload);
+	}
+}
+
+/**
+ * @brief Update the stored tags gauge.
+ *
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::update_count(){
+
+	metric_set(METRIC_TAGS_STORED, count_table(table));
+}
+
+/**
+ * @brief Write changed blocks and tables to the backend in a single commit.
+ * Each block is copied to the staging buffer under the mutex and written
+ * without it, so searches never wait for flash. Only tags_task commits.
+ *
+ * @param what STORE_* flags of the tables to write.
+ * @return int ESP_FAIL on error or ESP_OK on success
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int TagStore<Capacity, Index, Backend>::commit(uint32_t what){
+
+	esp_err_t err = backend.begin(true);
+
+	if (err != ESP_OK){
+		DLOGE(TAGS, DLOG_TAGS_NVS_OPEN, err);
+		nvs_err = err;
+		return ESP_FAIL;
+	}
+
+	backend.select(active_set);
+
+	if (what & STORE_TAGS){
+		for (uint32_t b=0; err == ESP_OK && b < BLOCKS; b++){
+			uint32_t mask = 1u << (b % 32);
+
+			xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+			if (!(dirty_blocks[b / 32] & mask)){
+				xSemaphoreGive(xSemaphore_tags);
+				continue;
+			}
+			/* Changes made while writing mark the block again */
+			dirty_blocks[b / 32] &= ~mask;
+			uint8_t count = stage_block(table, b);
+			xSemaphoreGive(xSemaphore_tags);
+
+			err = backend.store_block(b, staged, count);
+			if (err != ESP_OK){
+				/* Failed blocks stay dirty and are retried on next commit */
+				xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+				dirty_blocks[b / 32] |= mask;
+				xSemaphoreGive(xSemaphore_tags);
+			}
+		}
+		xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+		update_count();
+		xSemaphoreGive(xSemaphore_tags);
+	}
+
+	if (err == ESP_OK && (what & STORE_SCHEDULES)){
+		xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+		memcpy(staged_schedules, schedules, sizeof(schedules));
+		xSemaphoreGive(xSemaphore_tags);
+
+		err = backend.store_schedules(staged_schedules, sizeof(staged_schedules));
+	}
+
+	if (err != ESP_OK){
+		DLOGE(TAGS, DLOG_TAGS_NVS_WRITE, err);
+		metric_inc(METRIC_NVS_WRITE_ERRORS);
+		nvs_err = err;
+		backend.end();
+		return ESP_FAIL;
+	}
+
+	backend.end();
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Load all tag blocks of the selected backend set into a table.
+ * Entries of a block are placed in its slot range in tag order. Corrupted
+ * blocks are skipped. Flags and index are not updated.
+ *
+ * @param table Cleared table, not searched yet.
+ * @param found Set when at least one block exists.
+ * @return esp_err_t Backend error code, ESP_ERR_INVALID_CRC on corrupted blocks.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+esp_err_t TagStore<Capacity, Index, Backend>::load_blocks(table_t *table, bool *found){
+
+	tag_record_t records[BLOCK_SLOTS];
+	esp_err_t ret = ESP_OK;
+	uint32_t count = 0;
+	int64_t start = esp_timer_get_time();
+
+	for (uint32_t b=0; b < BLOCKS; b++){
+		int n;
+		uint32_t left = MAX_TAGS - b * BLOCK_SLOTS;
+		uint8_t max = left < (uint32_t)BLOCK_SLOTS ? left : (uint32_t)BLOCK_SLOTS;
+
+		esp_err_t err = backend.load_block(b, records, max, &n);
+		if (err != ESP_OK){
+			*found = true;
+			ret = err;
+			continue;
+		}
+		if (n < 0)
+			continue;
+		*found = true;
+
+		for (int i=0; i < n; i++){
+			uint32_t index = b * BLOCK_SLOTS + i;
+			table->tags[index] = records[i].tag;
+			table->expiry[index] = records[i].expiry;
+			table->schedule[index] = records[i].schedule < MAX_SCHEDULES ? records[i].schedule : (uint8_t)SCHEDULE_ALWAYS;
+			table->doors[index] = records[i].doors;
+		}
+		count += n;
+	}
+
+	if (*found)
+		ESP_LOGI("Tags::", "Loaded %" PRIu32 " tags in %" PRId64 " us", count, esp_timer_get_time() - start);
+
+	return ret;
+}
+
+/**
+ * @brief Copy the entries of a block to the staging buffer. Caller holds
+ * the mutex when the table is the active one.
+ *
+ * @param table Table.
+ * @param block Block number.
+ * @return uint8_t Number of staged records.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+uint8_t TagStore<Capacity, Index, Backend>::stage_block(const table_t *table, uint32_t block){
+
+	uint8_t count = 0;
+
+	for (uint32_t i = block * BLOCK_SLOTS; i < (block + 1) * BLOCK_SLOTS && i < MAX_TAGS; i++){
+		if (table->tags[i] == 0)
+			continue;
+		staged[count].tag = table->tags[i];
+		staged[count].expiry = table->expiry[i];
+		staged[count].schedule = table->schedule[i];
+		staged[count].doors = table->doors[i];
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * @brief Make a table the one searched and changed by commands. Caller
+ * holds the mutex, except in the constructor.
+ *
+ * @param table Table.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::bind(table_t *table){
+
+	this->table = table;
+	tags_memory = table->tags;
+	tags_doors = table->doors;
+	tags_flags = table->flags;
+	tags_schedule = table->schedule;
+	tags_expiry = table->expiry;
+	tag_index = &table->index;
+}
+
+/**
+ * @brief Empty all entries of a table.
+ *
+ * @param table Table.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::clear_table(table_t *table){
+
+	memset(table->tags, 0, sizeof(table->tags));
+	memset(table->doors, DOORS_ALL, sizeof(table->doors));
+	memset(table->flags, 0, sizeof(table->flags));
+	memset(table->schedule, SCHEDULE_ALWAYS, sizeof(table->schedule));
+	memset(table->expiry, 0, sizeof(table->expiry));
+	table->index.clear();
+}
+
+/**
+ * @brief Rebuild the index and flags of a loaded table. Caller holds the
+ * mutex when the table is the active one.
+ *
+ * @param table Table.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::index_table(table_t *table){
+
+	table->index.clear();
+	for (int i=0; i < MAX_TAGS; i++){
+		if (table->tags[i])
+			table->index.insert(table->tags[i], i);
+		table->flags[i] = flags_of(table->schedule[i], table->expiry[i]);
+	}
+}
+
+/**
+ * @brief Count the entries of a table.
+ *
+ * @param table Table.
+ * @return uint32_t Stored tags.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+uint32_t TagStore<Capacity, Index, Backend>::count_table(const table_t *table){
+
+	uint32_t count = 0;
+
+	for (int i=0; i < MAX_TAGS; i++)
+		if (table->tags[i])
+			count++;
+
+	return count;
+}
+
+/**
+ * @brief Returns a free storage space for a new tag.
+ *
+ * @return int32_t Array index of the available storage.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int32_t TagStore<Capacity, Index, Backend>::find_space(){
+
+	for (int i=0;i < MAX_TAGS; i++)
+		if (tags_memory[i] == 0)
+			return i;
+
+	return -1;
+}
+
+/**
+ * @brief Mark the block of an entry for the next commit. Caller holds the mutex.
+ *
+ * @param index Array index.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::mark_dirty(int32_t index){
+
+	uint32_t block = index / BLOCK_SLOTS;
+
+	dirty_blocks[block / 32] |= 1u << (block % 32);
+}
+
+/**
+ * @brief Reset all arrays of an entry, drop it from the index and mark its
+ * block for the next commit. Caller holds the mutex.
+ *
+ * @param index Array index.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::clear_entry(int32_t index){
+
+	if (tags_memory[index])
+		tag_index->remove(tags_memory[index], index);
+	mark_dirty(index);
+
+	tags_memory[index] = 0;
+	tags_doors[index] = DOORS_ALL;
+	tags_flags[index] = 0;
+	tags_schedule[index] = SCHEDULE_ALWAYS;
+	tags_expiry[index] = 0;
+}
+
+/**
+ * @brief Flags of an entry with a schedule and an expiry.
+ *
+ * @param schedule Schedule index.
+ * @param expiry Expiry time, 0: never.
+ * @return uint8_t TAG_FLAG_* flags.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+uint8_t TagStore<Capacity, Index, Backend>::flags_of(uint8_t schedule, uint32_t expiry){
+
+	uint8_t flags = 0;
+
+	if (schedule != SCHEDULE_ALWAYS)
+		flags |= TAG_FLAG_SCHEDULED;
+	if (expiry != 0)
+		flags |= TAG_FLAG_EXPIRES;
+
+	return flags;
+}
+
+/**
+ * @brief Derive the flags of an entry from its schedule and expiry.
+ *
+ * @param index Array index.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::update_flags(int32_t index){
+
+	tags_flags[index] = flags_of(tags_schedule[index], tags_expiry[index]);
+}
+
+/**
+ * @brief Search for a tag. Tags not stored in RAM are looked up in the
+ * static allowlist, which has no time restriction.
+ *
+ * @param tag Tag to search for.
+ * @param access Access fields of the found tag, for allowed_now. May be NULL.
+ * @return int32_t Array index of the searched tag, STATIC_INDEX when found
+ * in the static allowlist or -1 when not found.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+int32_t TagStore<Capacity, Index, Backend>::search(uint32_t tag, access_t *access){
+
+	int32_t ret;
+
+	/* 0 marks empty entries */
+	if (tag == 0)
+		return -1;
+
+	if (access)
+		memset(access, 0, sizeof(*access));
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	ret = tag_index->find(tags_memory, tag);
+	if (ret != -1 && access){
+		access->doors = tags_doors[ret];
+		access->flags = tags_flags[ret];
+		access->schedule = tags_schedule[ret];
+		access->expiry = tags_expiry[ret];
+	}
+	xSemaphoreGive(xSemaphore_tags);
+
+	if (ret == -1 && allowlist.find(tag, access ? &access->doors : NULL))
+		ret = STATIC_INDEX;
+
+	return ret;
+}
+
+/**
+ * @brief Print all stored permissive tags. Empty entries are skipped and
+ * each entry is only recorded at debug level.
+ *
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::print(){
+
+	uint32_t count = 0;
+
+	for (int i=0; i < MAX_TAGS; i++)
+	{
+		if (tags_memory[i] == 0)
+			continue;
+
+		DLOGD(TAGS, DLOG_TAGS_STORED, tags_memory[i], i);
+		count++;
+	}
+
+	DLOGI(TAGS, DLOG_TAGS_COUNT, count, MAX_TAGS);
+}
+
+#ifdef CONFIG_TAGS_REPLACE
+/**
+ * @brief Handle a whole table replacement request and answer it with the
+ * table state. Called by tags_task and by host tests, which have no tasks.
+ *
+ * Records are uploaded in order into the inactive table, which lookups never
+ * read. Commit writes every block of the inactive backend set, reads them
+ * back and stores the set number: the single commit point, a reboot before
+ * it loads the old table and after it the new one. The arrays are then
+ * switched by pointer under the mutex. Commands applied during an upload
+ * change the old table and are superseded by the new one.
+ *
+ * @param request Request.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::replace(const tags_replace_t *request){
+
+	const char *error = NULL;
+
+	switch (request->op){
+	case TAGS_REPLACE_BEGIN:
+		error = replace_begin(request);
+		break;
+	case TAGS_REPLACE_DATA:
+		error = replace_write(request);
+		break;
+	case TAGS_REPLACE_COMMIT:
+		error = replace_commit();
+		break;
+	case TAGS_REPLACE_ABORT:
+		upload.open = false;
+		break;
+	default:
+		break;
+	}
+
+	reply_replace(request, error);
+}
+
+/**
+ * @brief Answer a request with the table state:
+ * {"active":set,"count":n[,"written":n][,"error":"..."]}.
+ *
+ * @param request Request.
+ * @param error Error of the request, NULL on success.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+void TagStore<Capacity, Index, Backend>::reply_replace(const tags_replace_t *request, const char *error){
+
+	char msg[96];
+	json_writer_t json;
+
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	uint32_t count = count_table(table);
+	xSemaphoreGive(xSemaphore_tags);
+
+	json_init(&json, msg, sizeof(msg));
+	json_object_begin(&json);
+	json_kv_uint(&json, "active", active_set);
+	json_kv_uint(&json, "count", count);
+	if (upload.open)
+		json_kv_uint(&json, "written", upload.written);
+	if (error)
+		json_kv_string(&json, "error", error);
+	json_object_end(&json);
+
+	if (json_finish(&json))
+		mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, msg);
+}
+
+/**
+ * @brief Start an upload to the inactive table. Restarts a pending one.
+ *
+ * @param request BEGIN request.
+ * @return const char* Error or NULL.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+const char *TagStore<Capacity, Index, Backend>::replace_begin(const tags_replace_t *request){
+
+	if (request->offset % TAGS_REPLACE_RECORD_BYTES || request->offset > MAX_TAGS * TAGS_REPLACE_RECORD_BYTES)
+		return "size";
+
+	upload.open = true;
+	upload.size = request->offset;
+	upload.crc = request->crc;
+	upload.written = 0;
+	upload.received_crc = 0;
+
+	clear_table(&tables[(table - tables) ^ 1]);
+
+	ESP_LOGI("Tags::", "Table upload of %" PRIu32 " tags to set %u", upload.size / TAGS_REPLACE_RECORD_BYTES,
+			active_set ^ 1);
+
+	return NULL;
+}
+
+/**
+ * @brief Add the next records to the inactive table. A record with tag 0,
+ * an unknown schedule or a tag already uploaded ends the upload.
+ *
+ * @param request DATA request.
+ * @return const char* Error or NULL.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+const char *TagStore<Capacity, Index, Backend>::replace_write(const tags_replace_t *request){
+
+	table_t *next = &tables[(table - tables) ^ 1];
+
+	if (!upload.open)
+		return "not started";
+
+	/* Resent or out of order chunk: the reply tells where to resume */
+	if (request->offset != upload.written)
+		return "offset";
+
+	if (request->len == 0 || request->len % TAGS_REPLACE_RECORD_BYTES || request->len > upload.size - upload.written)
+		return "size";
+
+	for (uint32_t pos = 0; pos < request->len; pos += TAGS_REPLACE_RECORD_BYTES){
+		const uint8_t *record = request->data + pos;
+		uint32_t slot = (upload.written + pos) / TAGS_REPLACE_RECORD_BYTES;
+		uint32_t tag = record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24;
+		uint32_t expiry = record[4] | record[5] << 8 | record[6] << 16 | (uint32_t)record[7] << 24;
+
+		if (tag == 0 || record[8] >= MAX_SCHEDULES || next->index.find(next->tags, tag) != -1){
+			upload.open = false;
+			return "record";
+		}
+
+		next->tags[slot] = tag;
+		next->expiry[slot] = expiry;
+		next->schedule[slot] = record[8];
+		next->doors[slot] = record[9];
+		next->flags[slot] = flags_of(record[8], expiry);
+		next->index.insert(tag, slot);
+	}
+
+	upload.received_crc = esp_rom_crc32_le(upload.received_crc, request->data, request->len);
+	upload.written += request->len;
+
+	return NULL;
+}
+
+/**
+ * @brief Verify the uploaded table, store it in the inactive backend set
+ * and make it the active one.
+ *
+ * @return const char* Error or NULL.
+ */
+template <uint16_t Capacity, class Index, class Backend>
+const char *TagStore<Capacity, Index, Backend>::replace_commit(){
+
+	table_t *next = &tables[(table - tables) ^ 1];
+	uint8_t set = active_set ^ 1;
+	bool found = false;
+	esp_err_t err;
+
+	if (!upload.open)
+		return "not started";
+
+	if (upload.written != upload.size)
+		return "incomplete";
+
+	upload.open = false;
+
+	if (upload.received_crc != upload.crc)
+		return "crc";
+
+	/* Every block: none of an older table may be left in the set */
+	uint32_t count = count_table(next);
+	err = backend.begin(true);
+	if (err == ESP_OK){
+		backend.select(set);
+		for (uint32_t b=0; err == ESP_OK && b < BLOCKS; b++)
+			err = backend.store_block(b, staged, stage_block(next, b));
+		esp_err_t end_err = backend.end();
+		if (err == ESP_OK)
+			err = end_err;
+	}
+
+	/* Read back: the table activated is the one a reboot loads */
+	if (err == ESP_OK){
+		clear_table(next);
+		err = backend.begin(false);
+		if (err == ESP_OK){
+			backend.select(set);
+			err = load_blocks(next, &found);
+			backend.end();
+		}
+		index_table(next);
+		if (err != ESP_OK || count_table(next) != count){
+			ESP_LOGE("Tags::", "Table set %u read back failed: %x", set, err);
+			return "verify";
+		}
+	}
+
+	/* Commit point */
+	if (err == ESP_OK && (err = backend.begin(true)) == ESP_OK){
+		err = backend.store_active(set);
+		esp_err_t end_err = backend.end();
+		if (err == ESP_OK)
+			err = end_err;
+	}
+
+	if (err != ESP_OK){
+		DLOGE(TAGS, DLOG_TAGS_NVS_WRITE, err);
+		metric_inc(METRIC_NVS_WRITE_ERRORS);
+		nvs_err = err;
+		return "nvs";
+	}
+
+	/* Blocks of the old table still dirty are superseded */
+	xSemaphoreTake(xSemaphore_tags, portMAX_DELAY);
+	bind(next);
+	active_set = set;
+	memset(dirty_blocks, 0, sizeof(dirty_blocks));
+	update_count();
+	xSemaphoreGive(xSemaphore_tags);
+
+	/* Wheel is filled again from the new table at the next expire */
+	expiry_wheel.attach(tags_expiry);
+	expiry_synced = false;
+
+	ESP_LOGI("Tags::", "Swapped to table set %u: %" PRIu32 " tags", set, count);
+
+	return NULL;
+}
+#endif
+
+#endif /* MAIN_TAGSIMPL_H_ */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TaskPlan.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing core affinity and priority of every task.
+ *
+ * The access path (RFID parse, tag lookup, strike) runs on the access core
+ * above everything else there. Networking (Wi-Fi, lwIP, MQTT client and
+ * tags_task consuming MQTT commands) runs on the other core. Wi-Fi, lwIP
+ * and MQTT client cores are SDK options set in sdkconfig.defaults.
+ *
+ * Priorities of all application tasks are defined here and nowhere else.
+ */
+
+#ifndef MAIN_TASKPLAN_H_
+#define MAIN_TASKPLAN_H_
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_TASK_PLAN_PINNED
+	#define TASK_ACCESS_CORE	CONFIG_TASK_ACCESS_CORE
+	#define TASK_NETWORK_CORE	(1 - CONFIG_TASK_ACCESS_CORE)
+
+	/* app_main runs the RFID loop: its core comes from the SDK */
+	#if CONFIG_ESP_MAIN_TASK_AFFINITY != CONFIG_TASK_ACCESS_CORE
+		#error "Main task affinity (ESP_MAIN_TASK_AFFINITY) must match TASK_ACCESS_CORE"
+	#endif
+#else
+	#define TASK_ACCESS_CORE	tskNO_AFFINITY
+	#define TASK_NETWORK_CORE	tskNO_AFFINITY
+#endif
+
+/* Access path: app_main RFID loop, remote unlock and door button */
+#define TASK_MAIN_PRIORITY		15
+#define TASK_UNLOCK_PRIORITY	16
+#define TASK_BUTTON_PRIORITY	14
+
+#define TASK_MAIN_CORE			TASK_ACCESS_CORE
+#define TASK_UNLOCK_CORE		TASK_ACCESS_CORE
+#define TASK_BUTTON_CORE		TASK_ACCESS_CORE
+
+/* Network side: below the MQTT client (5) so commands are received first */
+#define TASK_TAGS_PRIORITY		4
+#define TASK_TAGS_CORE			TASK_NETWORK_CORE
+
+/* Audit log flash writes and queries */
+#define TASK_AUDIT_PRIORITY		3
+#define TASK_AUDIT_CORE			TASK_NETWORK_CORE
+
+/* Runtime settings validation and NVS writes */
+#define TASK_SETTINGS_PRIORITY	3
+#define TASK_SETTINGS_CORE		TASK_NETWORK_CORE
+
+/* Static allowlist uploads: flash erase and write */
+#define TASK_ALLOWLIST_PRIORITY	2
+#define TASK_ALLOWLIST_CORE		TASK_NETWORK_CORE
+
+/* Field trace downloads */
+#define TASK_TRACE_PRIORITY		2
+#define TASK_TRACE_CORE			TASK_NETWORK_CORE
+
+/* Metrics snapshots */
+#define TASK_METRICS_PRIORITY	2
+#define TASK_METRICS_CORE		TASK_NETWORK_CORE
+
+/* Deferred log formatting: whatever time is left on any core */
+#define TASK_DLOG_PRIORITY		(tskIDLE_PRIORITY + 1)
+#define TASK_DLOG_CORE			tskNO_AFFINITY
+
+#endif /* MAIN_TASKPLAN_H_ */
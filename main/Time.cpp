@@ -1,7 +1,7 @@
 /* Copyright (c) 2023 Renan Augusto Starke
  *
  * This file is part of project "IoT Lock".
- * 
+ *
  */
 
 /**
@@ -12,14 +12,158 @@
  *
  */
 
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_sntp.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_rtc_time.h"
+#include "esp_rom_crc.h"
 
 #include "Time.h"
 
+/* Any wall time before this is an unsynchronized clock (1 Jan 2024) */
+#define WALL_TIME_VALID_AFTER 1704067200
+
+/* Drift is learned between SNTP answers at least this far apart */
+#define DRIFT_MIN_INTERVAL_US	(600 * 1000000LL)
+/* A larger correction is a step (server change, bad answer), not drift */
+#define DRIFT_MAX_ERROR_US		1000000
+/* Crystal tolerance bound: also keeps conversions within int64 for a year */
+#define DRIFT_MAX_PPB			200000
+/* Weight of a new drift measurement: 1 / DRIFT_FILTER */
+#define DRIFT_FILTER			4
+
+#define RTC_CLOCK_MAGIC			0x4b4c4352	/* "RCLK" */
+
+/* Wall clock: wall_us + (mono - mono_us) * (1 + drift_ppb / 1e9) */
+typedef struct {
+	int64_t mono_us;
+	int64_t wall_us;
+	int32_t drift_ppb;
+	Time::Source source;
+} anchor_t;
+
+/* Anchor in RTC memory: RTC timer keeps counting in deep sleep and resets */
+typedef struct {
+	uint32_t magic;
+	int32_t drift_ppb;
+	int64_t rtc_us;
+	int64_t wall_us;
+	uint32_t crc;
+} rtc_clock_t;
+
+static anchor_t anchor;
+/* Written by the SNTP callback, read by any task on both cores */
+static portMUX_TYPE anchor_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static RTC_NOINIT_ATTR rtc_clock_t rtc_clock;
+
+static const char *TAG = "Time::";
+
+static anchor_t anchor_get(){
+
+	anchor_t a;
+
+	portENTER_CRITICAL(&anchor_lock);
+	a = anchor;
+	portEXIT_CRITICAL(&anchor_lock);
+
+	return a;
+}
+
+static void anchor_set(const anchor_t *a){
+
+	portENTER_CRITICAL(&anchor_lock);
+	anchor = *a;
+	portEXIT_CRITICAL(&anchor_lock);
+}
+
+/**
+ * @brief Wall time of a monotonic stamp through an anchor.
+ *
+ * @param a Anchor.
+ * @param mono_us Monotonic stamp, before or after the anchor.
+ * @return int64_t Epoch microseconds.
+ */
+static int64_t anchor_convert(const anchor_t *a, int64_t mono_us){
+
+	int64_t elapsed = mono_us - a->mono_us;
+
+	return a->wall_us + elapsed + elapsed * a->drift_ppb / 1000000000;
+}
+
+static uint32_t rtc_clock_crc(const rtc_clock_t *clock){
+	return esp_rom_crc32_le(0, (const uint8_t *)clock, offsetof(rtc_clock_t, crc));
+}
+
+/**
+ * @brief Keep a wall time / RTC time pair and the drift in RTC memory.
+ *
+ * @param a Anchor just set.
+ */
+static void rtc_clock_save(const anchor_t *a){
+
+	rtc_clock.magic = RTC_CLOCK_MAGIC;
+	rtc_clock.drift_ppb = a->drift_ppb;
+	rtc_clock.rtc_us = esp_rtc_get_time_us();
+	rtc_clock.wall_us = anchor_convert(a, esp_timer_get_time());
+	rtc_clock.crc = rtc_clock_crc(&rtc_clock);
+}
+
+/**
+ * @brief SNTP answer: new anchor and drift update. The system time was
+ * just set to tv.
+ *
+ * Between two answers the expected wall time is the old anchor projected
+ * with the current drift. Its error over the elapsed monotonic time is the
+ * residual drift, low pass filtered against network jitter.
+ *
+ * @param tv Server time.
+ */
+static void sntp_synced(struct timeval *tv){
+
+	int64_t mono_us = esp_timer_get_time();
+	int64_t wall_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+	anchor_t a = anchor_get();
+	int32_t drift_ppb = a.drift_ppb;
+
+	if (a.source == Time::SNTP){
+		int64_t elapsed = mono_us - a.mono_us;
+		int64_t error = wall_us - anchor_convert(&a, mono_us);
+
+		if (elapsed >= DRIFT_MIN_INTERVAL_US && llabs(error) < DRIFT_MAX_ERROR_US){
+			int64_t measured = drift_ppb + error * 1000000000 / elapsed;
+
+			drift_ppb += (measured - drift_ppb) / DRIFT_FILTER;
+			if (drift_ppb > DRIFT_MAX_PPB)
+				drift_ppb = DRIFT_MAX_PPB;
+			else if (drift_ppb < -DRIFT_MAX_PPB)
+				drift_ppb = -DRIFT_MAX_PPB;
+		}
+
+		ESP_LOGI(TAG, "SNTP: corrected %lld us after %lld s, drift %ld ppb",
+				error, elapsed / 1000000, (long)drift_ppb);
+	}
+	else
+		ESP_LOGI(TAG, "SNTP: synchronized");
+
+	a.mono_us = mono_us;
+	a.wall_us = wall_us;
+	a.drift_ppb = drift_ppb;
+	a.source = Time::SNTP;
+
+	anchor_set(&a);
+	rtc_clock_save(&a);
+}
+
 /**
  * @brief Construct a new Time:: Time object
- * 
+ *
  */
 
 Time::Time() {
@@ -28,7 +172,7 @@ Time::Time() {
 
 /**
  * @brief Return ticks from FreeRTOS. Calls SDK "get ticks" function.
- * 
+ *
  * @return uint32_t Ticks.
  */
 uint32_t Time::GetTime(){
@@ -40,9 +184,138 @@ uint32_t Time::GetTime(){
 
 /**
  * @brief Suspend task. Calls SDK delay function.
- * 
- * @param ticks 
+ *
+ * @param ticks
  */
 void Time::Suspend(uint32_t ticks){
 	vTaskDelay(ticks);
 }
+
+/**
+ * @brief Set local time zone and restore wall time from RTC memory. Call
+ * at boot, before any event is stamped.
+ *
+ * RTC memory and the RTC timer survive deep sleep, software resets,
+ * panics and watchdogs. Any other reset, or a corrupt record, leaves the
+ * clock unsynchronized until SNTP answers.
+ */
+void Time::Restore(){
+
+	setenv("TZ", CONFIG_LOCK_TIMEZONE, 1);
+	tzset();
+
+	switch (esp_reset_reason()){
+	case ESP_RST_DEEPSLEEP:
+	case ESP_RST_SW:
+	case ESP_RST_PANIC:
+	case ESP_RST_INT_WDT:
+	case ESP_RST_TASK_WDT:
+	case ESP_RST_WDT:
+		break;
+	default:
+		return;
+	}
+
+	int64_t rtc_us = esp_rtc_get_time_us();
+
+	if (rtc_clock.magic != RTC_CLOCK_MAGIC || rtc_clock.crc != rtc_clock_crc(&rtc_clock)
+			|| rtc_us < rtc_clock.rtc_us)
+		return;
+
+	anchor_t a = {
+		.mono_us = esp_timer_get_time(),
+		.wall_us = rtc_clock.wall_us + (rtc_us - rtc_clock.rtc_us),
+		.drift_ppb = rtc_clock.drift_ppb,
+		.source = RTC
+	};
+
+	if (a.wall_us / 1000000 < WALL_TIME_VALID_AFTER)
+		return;
+
+	anchor_set(&a);
+
+	/* time() and localtime() users agree with the restored clock */
+	struct timeval tv = {(time_t)(a.wall_us / 1000000), (suseconds_t)(a.wall_us % 1000000)};
+	settimeofday(&tv, NULL);
+
+	ESP_LOGI(TAG, "Restored from RTC, drift %ld ppb", (long)a.drift_ppb);
+}
+
+/**
+ * @brief Start SNTP synchronization. Every server answer re-anchors the
+ * wall clock and updates the drift.
+ *
+ */
+void Time::SyncInit(){
+
+	esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+	esp_sntp_setservername(0, CONFIG_SNTP_SERVER);
+	sntp_set_time_sync_notification_cb(sntp_synced);
+	esp_sntp_init();
+}
+
+/**
+ * @brief Wall time of a monotonic stamp.
+ *
+ * @param mono_us Stamp from Time::Now().
+ * @return int64_t Epoch microseconds, 0 when wall time is not known.
+ */
+int64_t Time::WallUs(int64_t mono_us){
+
+	anchor_t a = anchor_get();
+
+	if (a.source != UNSYNCED)
+		return anchor_convert(&a, mono_us);
+
+	/* No anchor: system time may still be valid, e.g. set by a debugger */
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	if (tv.tv_sec < WALL_TIME_VALID_AFTER)
+		return 0;
+
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (esp_timer_get_time() - mono_us);
+}
+
+/**
+ * @brief Get wall time now.
+ *
+ * @param now Epoch seconds, 0 when not known.
+ * @param local Broken down local time. May be NULL.
+ * @return true Wall time is synchronized.
+ * @return false Wall time is not known yet.
+ */
+bool Time::WallTime(time_t *now, struct tm *local){
+
+	*now = WallUs(Now()) / 1000000;
+
+	if (*now < WALL_TIME_VALID_AFTER)
+		return false;
+
+	if (local)
+		localtime_r(now, local);
+
+	return true;
+}
+
+Time::Source Time::WallSource(){
+	return anchor_get().source;
+}
+
+/**
+ * @brief Measured drift of the monotonic clock.
+ *
+ * @return int32_t Parts per billion, positive when it runs slow.
+ */
+int32_t Time::DriftPpb(){
+	return anchor_get().drift_ppb;
+}
+
+/**
+ * @brief Epoch milliseconds of a monotonic stamp, C interface.
+ *
+ * @param mono_us Stamp from esp_timer_get_time().
+ * @return int64_t Epoch milliseconds, 0 when wall time is not known.
+ */
+int64_t time_wall_ms(int64_t mono_us){
+	return Time::WallUs(mono_us) / 1000;
+}
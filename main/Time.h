@@ -2,7 +2,7 @@
  * Copyright (c) 2023 Renan Augusto Starke
  *
  * This file is part of project "IoT Lock".
- * 
+ *
  */
 
 /**
@@ -11,13 +11,38 @@
  * @date 16 Aug 2022
  * @brief File containing Time class definiton.
  *
+ * Two clocks:
+ *  - Monotonic: esp_timer microseconds since boot. Never steps and costs a
+ *    register read, so events are stamped with it on the hot path.
+ *  - Wall: monotonic time converted through the last SNTP anchor and the
+ *    measured drift of the crystal. The anchor is kept in RTC memory, so
+ *    wall time stays valid across deep sleep and software resets before
+ *    the network is up.
+ *
+ * Convert a stamp when publishing, not when taking it:
+ *
+ *   int64_t event_us = Time::Now();
+ *   ...
+ *   int64_t ts = time_wall_ms(event_us);	// 0: wall time not known
  */
 
 #ifndef MAIN_TIME_H_
 #define MAIN_TIME_H_
 
 #include <stdint.h>
+#include <time.h>
+
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
 
+EXPORT_C int64_t time_wall_ms(int64_t mono_us);
+
+#ifdef __cplusplus
 class Time {
 public:
 	Time();
@@ -25,6 +50,30 @@ public:
 	uint32_t GetTime();
 	void Suspend(uint32_t ticks);
 
+	/* Origin of the wall clock anchor */
+	enum Source : uint8_t {
+		UNSYNCED,		/* System time only, if valid at all */
+		RTC,			/* Restored from RTC memory at boot */
+		SNTP			/* Server response */
+	};
+
+	/**
+	 * @brief Monotonic time: microseconds since boot.
+	 *
+	 * @return int64_t Timestamp for Wall*() conversion.
+	 */
+	static inline int64_t Now(){
+		return esp_timer_get_time();
+	}
+
+	static void Restore();
+	static void SyncInit();
+	static bool WallTime(time_t *now, struct tm *local);
+	static int64_t WallUs(int64_t mono_us);
+	static Source WallSource();
+	static int32_t DriftPpb();
+
 };
+#endif
 
 #endif /* MAIN_TIME_H_ */
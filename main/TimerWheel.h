@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file TimerWheel.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing hierarchical timer wheel definition.
+ *
+ * Four levels of 64 slots with one second resolution at level 0. Timers
+ * are intrusive lists indexed by node number, so add, remove and tick are
+ * O(1) and no memory is allocated. Timers farther than 64^4 seconds
+ * (about 194 days) are parked in the last level and cascaded again.
+ */
+
+#ifndef MAIN_TIMERWHEEL_H_
+#define MAIN_TIMERWHEEL_H_
+
+#include <stdint.h>
+#include <string.h>
+
+template <uint16_t N>
+class TimerWheel {
+public:
+	/**
+	 * @brief Construct a new Timer Wheel object.
+	 *
+	 * @param expiry Expiry time (seconds) of each node. Owned by the caller.
+	 */
+	TimerWheel(const uint32_t *expiry) : expiry(expiry) {
+		clear(0);
+	}
+
+	/**
+	 * @brief Read the expiry times from another array. All timers are removed.
+	 *
+	 * @param expiry Expiry time (seconds) of each node. Owned by the caller.
+	 */
+	void attach(const uint32_t *expiry){
+		this->expiry = expiry;
+		clear(current);
+	}
+
+	/**
+	 * @brief Remove all timers and restart the wheel.
+	 *
+	 * @param now Current time in seconds.
+	 */
+	void clear(uint32_t now){
+		memset(head, 0xff, sizeof(head));
+		memset(slot_of, 0xff, sizeof(slot_of));
+		current = now;
+	}
+
+	/**
+	 * @brief Add or move a node timer. Time already elapsed expires at next tick.
+	 *
+	 * @param node Node number.
+	 */
+	void add(uint16_t node){
+
+		if (node >= N)
+			return;
+
+		if (slot_of[node] != NONE)
+			remove(node);
+
+		place(node, current + 1);
+	}
+
+	/**
+	 * @brief Remove a node timer. No effect when not pending.
+	 *
+	 * @param node Node number.
+	 */
+	void remove(uint16_t node){
+
+		if (node >= N || slot_of[node] == NONE)
+			return;
+
+		if (prev[node] != NONE)
+			next[prev[node]] = next[node];
+		else
+			head[slot_of[node]] = next[node];
+
+		if (next[node] != NONE)
+			prev[next[node]] = prev[node];
+
+		slot_of[node] = NONE;
+	}
+
+	/**
+	 * @brief Advance one second and call expired(node) for each due timer.
+	 * Expired timers are removed before the callback.
+	 *
+	 * @param expired Callback receiving the node number.
+	 */
+	template <class F>
+	void tick(F &&expired){
+
+		current++;
+
+		/* Cascade upper levels when lower ones wrap */
+		for (int level = 1; level < LEVELS; level++){
+			if ((current >> ((level - 1) * SLOT_BITS)) & SLOT_MASK)
+				break;
+			cascade(level * SLOTS + ((current >> (level * SLOT_BITS)) & SLOT_MASK));
+		}
+
+		uint16_t slot = current & SLOT_MASK;
+		while (head[slot] != NONE){
+			uint16_t node = head[slot];
+			remove(node);
+			expired(node);
+		}
+	}
+
+	/**
+	 * @brief Wheel time.
+	 *
+	 * @return uint32_t Time of the last tick in seconds.
+	 */
+	uint32_t now() const {
+		return current;
+	}
+
+private:
+	enum {LEVELS = 4, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS, SLOT_MASK = SLOTS - 1};
+	enum {NONE = 0xffff};
+
+	const uint32_t *expiry;
+	uint32_t current;
+
+	uint16_t head[LEVELS * SLOTS];
+	uint16_t next[N];
+	uint16_t prev[N];
+	uint16_t slot_of[N];
+
+	/**
+	 * @brief Link a node in the slot of its expiry time.
+	 *
+	 * @param node Node number.
+	 * @param first Earliest time it may expire: elapsed timers expire then.
+	 */
+	void place(uint16_t node, uint32_t first){
+
+		uint32_t t = expiry[node];
+		if ((int32_t)(t - first) < 0)
+			t = first;
+
+		uint32_t delta = t - current;
+		uint16_t slot;
+
+		if (delta < (1u << SLOT_BITS))
+			slot = t & SLOT_MASK;
+		else if (delta < (1u << (2 * SLOT_BITS)))
+			slot = SLOTS + ((t >> SLOT_BITS) & SLOT_MASK);
+		else if (delta < (1u << (3 * SLOT_BITS)))
+			slot = 2 * SLOTS + ((t >> (2 * SLOT_BITS)) & SLOT_MASK);
+		else {
+			/* Park too far timers at the farthest slot */
+			if (delta >= (1u << (4 * SLOT_BITS)))
+				t = current + (1u << (4 * SLOT_BITS)) - 1;
+			slot = 3 * SLOTS + ((t >> (3 * SLOT_BITS)) & SLOT_MASK);
+		}
+
+		prev[node] = NONE;
+		next[node] = head[slot];
+		if (next[node] != NONE)
+			prev[next[node]] = node;
+		head[slot] = node;
+		slot_of[node] = slot;
+	}
+
+	/**
+	 * @brief Move all timers of a slot to lower levels.
+	 *
+	 * @param slot Slot number.
+	 */
+	void cascade(uint16_t slot){
+
+		uint16_t node = head[slot];
+		head[slot] = NONE;
+
+		while (node != NONE){
+			uint16_t n = next[node];
+			/* Timers due now land in the slot processed by this tick */
+			place(node, current);
+			node = n;
+		}
+	}
+};
+
+#endif /* MAIN_TIMERWHEEL_H_ */
@@ -0,0 +1,354 @@
+/* Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Trace.cpp
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the field trace recorder implementation.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "Trace.h"
+#include "Mqtt.h"
+#include "Time.h"
+#include "JsonWriter.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+
+#ifdef CONFIG_TRACE
+
+static_assert((CONFIG_TRACE_RING_SIZE & (CONFIG_TRACE_RING_SIZE - 1)) == 0,
+		"TRACE_RING_SIZE must be a power of two");
+static_assert(sizeof(trace_header_t) == 32, "Trace header size mismatch");
+
+enum {RING_SIZE = CONFIG_TRACE_RING_SIZE, RING_MASK = CONFIG_TRACE_RING_SIZE - 1};
+
+/* Record bytes before data: type, arg, len and up to 10 bytes of dt */
+enum {RECORD_HEAD_MAX = 13};
+
+/* Byte ring. head and tail are free running byte counters */
+static uint8_t ring[RING_SIZE];
+static uint32_t head;
+static uint32_t tail;
+
+/* Time of the record before tail and of the newest record */
+static int64_t base_us;
+static int64_t last_us;
+static uint16_t flags;
+
+/* Wall time known at base_us, kept for the file header */
+static uint32_t base_wall_epoch;
+static int64_t base_wall_us;
+
+/* Wall time of the newest TRACE_WALL record */
+static uint32_t wall_epoch;
+static int64_t wall_us;
+
+static SemaphoreHandle_t trace_mutex;
+STATIC_ONLY(static StaticSemaphore_t trace_mutex_storage;)
+
+static QueueHandle_t trace_queue;
+STATIC_ONLY(static StaticQueue_t trace_queue_storage;)
+STATIC_ONLY(static trace_request_t trace_queue_buffer[1];)
+
+/* Download buffers, only used by trace_task */
+static uint8_t raw[CONFIG_TRACE_CHUNK_BYTES];
+static char text[1 + 4 * ((CONFIG_TRACE_CHUNK_BYTES + 2) / 3)];
+static char chunk[32 + sizeof(text)];
+
+/**
+ * @brief Forget all records. Caller holds the mutex.
+ *
+ */
+static void reset(void){
+
+	head = 0;
+	tail = 0;
+	flags = 0;
+	base_us = esp_timer_get_time();
+	last_us = base_us;
+	base_wall_epoch = 0;
+	base_wall_us = base_us;
+	wall_epoch = 0;
+	wall_us = base_us;
+}
+
+/**
+ * @brief Read a varint from the ring.
+ *
+ * @param pos Ring position, advanced past the varint.
+ * @return uint64_t Value.
+ */
+static uint64_t ring_varint(uint32_t *pos){
+
+	uint64_t value = 0;
+	uint8_t byte;
+	int shift = 0;
+
+	do {
+		byte = ring[(*pos)++ & RING_MASK];
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while ((byte & 0x80) && shift < 70);
+
+	return value;
+}
+
+/**
+ * @brief Drop the oldest record. Its time becomes the base of the next one.
+ * Caller holds the mutex.
+ *
+ */
+static void evict(void){
+
+	uint32_t pos = tail;
+	uint8_t type = ring[pos++ & RING_MASK];
+	pos++;
+	uint8_t len = ring[pos++ & RING_MASK];
+
+	base_us += ring_varint(&pos);
+
+	/* Keep the wall time of dropped TRACE_WALL records in the header */
+	if (type == TRACE_WALL && len == sizeof(uint32_t)){
+		base_wall_epoch = 0;
+		for (int i = 0; i < 4; i++)
+			base_wall_epoch |= (uint32_t)ring[(pos + i) & RING_MASK] << (8 * i);
+		base_wall_us = base_us;
+	}
+
+	tail = pos + len;
+	flags |= TRACE_FLAG_WRAPPED;
+}
+
+/**
+ * @brief Append a record, dropping the oldest ones to make room.
+ * Caller holds the mutex.
+ *
+ * @param type trace_type_t.
+ * @param arg Type argument.
+ * @param data Record data.
+ * @param len Data length.
+ * @param now esp_timer time of the record.
+ */
+static void append(uint8_t type, uint8_t arg, const void *data, uint8_t len, int64_t now){
+
+	uint8_t record[RECORD_HEAD_MAX];
+	uint64_t dt = now > last_us ? now - last_us : 0;
+	uint32_t size = 3;
+
+	record[0] = type;
+	record[1] = arg;
+	record[2] = len;
+	do {
+		record[size++] = (dt & 0x7f) | (dt > 0x7f ? 0x80 : 0);
+		dt >>= 7;
+	} while (dt);
+
+	while (RING_SIZE - (head - tail) < size + len)
+		evict();
+
+	for (uint32_t i = 0; i < size; i++)
+		ring[head++ & RING_MASK] = record[i];
+	for (uint32_t i = 0; i < len; i++)
+		ring[head++ & RING_MASK] = ((const uint8_t *)data)[i];
+
+	last_us = now;
+}
+
+/**
+ * @brief Record a TRACE_WALL before a record when wall time was set or
+ * stepped since the previous one. Caller holds the mutex.
+ *
+ * @param now esp_timer time of the record.
+ */
+static void wall_check(int64_t now){
+
+	time_t epoch;
+	uint32_t current = Time::WallTime(&epoch, NULL) ? (uint32_t)epoch : 0;
+	uint32_t expected = wall_epoch ? wall_epoch + (uint32_t)((now - wall_us) / 1000000) : 0;
+
+	/* One second of slack for rounding */
+	if (current == expected || (current && expected && current - expected + 1 <= 2))
+		return;
+
+	append(TRACE_WALL, 0, &current, sizeof(current), now);
+	wall_epoch = current;
+	wall_us = now;
+}
+
+/**
+ * @brief Encode bytes in base64.
+ *
+ * @param src Bytes.
+ * @param len Number of bytes.
+ * @param dst Null terminated text, 4 * ((len + 2) / 3) + 1 bytes.
+ */
+static void base64(const uint8_t *src, uint32_t len, char *dst){
+
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	for (uint32_t i = 0; i < len; i += 3){
+		uint32_t v = src[i] << 16 | (i + 1 < len ? src[i + 1] << 8 : 0) | (i + 2 < len ? src[i + 2] : 0);
+
+		*dst++ = alphabet[(v >> 18) & 0x3f];
+		*dst++ = alphabet[(v >> 12) & 0x3f];
+		*dst++ = i + 1 < len ? alphabet[(v >> 6) & 0x3f] : '=';
+		*dst++ = i + 2 < len ? alphabet[v & 0x3f] : '=';
+	}
+	*dst = 0;
+}
+
+/**
+ * @brief Stream the ring as a trace file. Recording goes on meanwhile:
+ * the stream ends early if records not sent yet are overwritten.
+ *
+ * @param request Download request.
+ */
+static void dump(const trace_request_t *request){
+
+	trace_header_t header;
+	uint32_t pos, end, sent = 0, seq = 0, fill;
+	bool truncated = false;
+	json_writer_t json;
+
+	xSemaphoreTake(trace_mutex, portMAX_DELAY);
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.flags = flags;
+	header.base_us = base_us;
+	header.wall_us = base_wall_us;
+	header.wall_epoch = base_wall_epoch;
+	header.bytes = head - tail;
+	pos = tail;
+	end = head;
+	xSemaphoreGive(trace_mutex);
+
+	memcpy(raw, &header, sizeof(header));
+	fill = sizeof(header);
+
+	while (fill || pos != end){
+		xSemaphoreTake(trace_mutex, portMAX_DELAY);
+		if ((int32_t)(pos - tail) < 0)
+			truncated = true;
+		else
+			while (pos != end && fill < sizeof(raw))
+				raw[fill++] = ring[pos++ & RING_MASK];
+		xSemaphoreGive(trace_mutex);
+
+		if (truncated)
+			break;
+
+		base64(raw, fill, text);
+		json_init(&json, chunk, sizeof(chunk));
+		json_object_begin(&json);
+		json_kv_uint(&json, "seq", seq++);
+		json_kv_string(&json, "data", text);
+		json_object_end(&json);
+		if (json_finish(&json))
+			mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, chunk);
+
+		sent += fill;
+		fill = 0;
+		/* Let the MQTT client drain the socket */
+		vTaskDelay(1);
+	}
+
+	json_init(&json, chunk, sizeof(chunk));
+	json_object_begin(&json);
+	json_kv_uint(&json, "done", sent);
+	json_kv_bool(&json, "truncated", truncated);
+	json_object_end(&json);
+	if (json_finish(&json))
+		mqtt5_reply(request->response_topic, request->correlation, request->correlation_len, chunk);
+}
+
+/**
+ * @brief Trace task. Serves download and clear requests.
+ *
+ * @param arg Not used.
+ */
+static void trace_task(void *arg){
+
+	trace_request_t request;
+
+	for (;;){
+		if (!xQueueReceive(trace_queue, &request, portMAX_DELAY))
+			continue;
+
+		if (!strcmp(request.payload, "clear")){
+			xSemaphoreTake(trace_mutex, portMAX_DELAY);
+			reset();
+			xSemaphoreGive(trace_mutex);
+			mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"cleared\":1}");
+		}
+		else if (request.payload[0] == 0 || !strcmp(request.payload, "dump"))
+			dump(&request);
+		else
+			mqtt5_reply(request.response_topic, request.correlation, request.correlation_len, "{\"error\":\"unknown\"}");
+	}
+}
+
+/**
+ * @brief Start recording and the download task. Must be called before
+ * any record.
+ *
+ */
+void trace_init(void){
+
+	if (trace_mutex)
+		return;
+
+	reset();
+
+	trace_mutex = RTOS_MUTEX(&trace_mutex_storage);
+	trace_queue = RTOS_QUEUE(1, sizeof(trace_request_t), trace_queue_buffer, &trace_queue_storage);
+	RTOS_TASK(trace_task, "trace_task", 3072, NULL, TASK_TRACE_PRIORITY, NULL, TASK_TRACE_CORE);
+}
+
+/**
+ * @brief Record an input of the access path. Oldest records are
+ * overwritten when the ring is full.
+ *
+ * @param type trace_type_t.
+ * @param arg Type argument.
+ * @param data Record data, may be NULL when len is 0.
+ * @param len Data length.
+ */
+void trace_record(uint8_t type, uint8_t arg, const void *data, uint8_t len){
+
+	int64_t now = esp_timer_get_time();
+
+	if (!trace_mutex)
+		return;
+
+	xSemaphoreTake(trace_mutex, portMAX_DELAY);
+	wall_check(now);
+	append(type, arg, data, len, now);
+	xSemaphoreGive(trace_mutex);
+}
+
+/**
+ * @brief Queue a download or clear request. Never blocks.
+ *
+ * @param request Request.
+ * @return true Queued.
+ * @return false A request is already pending.
+ */
+bool trace_request(const trace_request_t *request){
+
+	return trace_queue && xQueueSend(trace_queue, request, 0) == pdTRUE;
+}
+
+#endif
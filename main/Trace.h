@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2023 Renan Augusto Starke
+ *
+ * This file is part of project "IoT Lock".
+ *
+ */
+
+/**
+ * @file Trace.h
+ * @author Renan Augusto Starke
+ * @date 19 Oct 2026
+ * @brief File containing the field trace recorder definitions.
+ *
+ * Inputs of the access path (reader UART bytes, MQTT payloads, button
+ * edges and wall time steps) are appended to a RAM byte ring, oldest
+ * records being overwritten. "dump" on lpae/dev/<device id>/trace streams
+ * the ring back as base64 chunks of a trace file, replayed on a host by
+ * host/trace_replay.
+ *
+ * Trace file: trace_header_t followed by the records. Record layout:
+ *
+ *   type (1) | arg (1) | len (1) | dt varint (1..10) | data (len)
+ *
+ * dt is the time in us since the previous record, the first one counts
+ * from trace_header_t.base_us.
+ */
+
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+/* Record types */
+typedef enum {
+	TRACE_UART = 1,		/* Bytes returned by a reader UART read */
+	TRACE_MQTT = 2,		/* arg: mqtt_route_t, data: payload (unlock token omitted) */
+	TRACE_BUTTON = 3,	/* arg: new button level */
+	TRACE_WALL = 4,		/* data: epoch seconds (uint32_t) at this record */
+} trace_type_t;
+
+#define TRACE_MAGIC		0x31435254		/* "TRC1" */
+#define TRACE_VERSION	1
+
+/* Trace file header, little endian */
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;			/* TRACE_FLAG_* */
+	int64_t base_us;		/* esp_timer time the first dt counts from */
+	int64_t wall_us;		/* esp_timer time of wall_epoch */
+	uint32_t wall_epoch;	/* Wall time before the first TRACE_WALL record, 0: not synchronized */
+	uint32_t bytes;			/* Record bytes following the header */
+} trace_header_t;
+
+/* Records were overwritten since boot or last clear */
+#define TRACE_FLAG_WRAPPED	1
+
+/* Trace request received from MQTT */
+typedef struct {
+	char payload[16];			/* "dump" (or empty) or "clear" */
+	char correlation[16];
+	uint8_t correlation_len;
+	char response_topic[64];
+} trace_request_t;
+
+#ifdef __cplusplus
+    #define EXPORT_C extern "C"
+#else
+    #define EXPORT_C
+#endif
+
+#ifdef CONFIG_TRACE
+EXPORT_C void trace_init(void);
+EXPORT_C void trace_record(uint8_t type, uint8_t arg, const void *data, uint8_t len);
+EXPORT_C bool trace_request(const trace_request_t *request);
+#else
+/* Recorder disabled: calls compile to nothing */
+static inline void trace_init(void) {}
+static inline void trace_record(uint8_t type, uint8_t arg, const void *data, uint8_t len) {}
+static inline bool trace_request(const trace_request_t *request) { return false; }
+#endif
+
+#endif /* MAIN_TRACE_H_ */
@@ -23,6 +23,7 @@
 #include "esp_log.h"
 
 #include "Uart.h"
+#include "Settings.h"
 
 
 /**
@@ -49,7 +50,7 @@ Uart::Uart(int baud_rate, uart_word_length_t data_bits,
 	uart_config.rx_flow_ctrl_thresh = 122;
 	uart_config.source_clk = UART_SCLK_APB;
 
-	ESP_ERROR_CHECK(uart_driver_install((uart_port_t)UART_PORT_NUM, BUFFER_SIZE * 2, 0, 0, NULL, ESP_INTR_FLAG_IRAM));
+	ESP_ERROR_CHECK(uart_driver_install((uart_port_t)UART_PORT_NUM, setting_get(SETTING_UART_BUFFER) * 2, 0, 0, NULL, ESP_INTR_FLAG_IRAM));
 	ESP_ERROR_CHECK(uart_param_config((uart_port_t)UART_PORT_NUM, &uart_config));
 	ESP_ERROR_CHECK(uart_set_pin((uart_port_t)UART_PORT_NUM, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
@@ -30,7 +30,7 @@ protected:
 	void flush();
 
 private:
-	enum {UART_PORT_NUM = 2, RXD_PIN = 16, TXD_PIN = 17, BUFFER_SIZE = 1024};
+	enum {UART_PORT_NUM = 2, RXD_PIN = 16, TXD_PIN = 17};
 
 };
 
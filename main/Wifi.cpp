@@ -22,16 +22,21 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#ifdef CONFIG_LOCK_NET_OPENETH
+#include "esp_eth.h"
+#endif
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
 
 #include "Wifi.h"
+#include "StaticAlloc.h"
 
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
+STATIC_ONLY(static StaticEventGroup_t wifi_event_group_storage;)
 
 /* Number of retries */
 static int s_retry_num;
@@ -66,6 +71,52 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
 	}
 }
 
+#ifdef CONFIG_LOCK_NET_OPENETH
+/*
+ * @brief  Ethernet event handler of the QEMU network.
+ * @param See esp-idf
+ *
+ * @retval None.
+ */
+static void eth_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data){
+
+	const char *TAG = "Wifi::eth_event_handler";
+
+	ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+	ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+	xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+}
+
+/*
+ * @brief  Start the OpenCores Ethernet emulated by QEMU instead of WiFi
+ *         and wait for an address.
+ * @param	None
+ *
+ * @retval None.
+ */
+static void openeth_init(void){
+
+	esp_netif_config_t netif_config = ESP_NETIF_DEFAULT_ETH();
+	esp_netif_t *netif = esp_netif_new(&netif_config);
+
+	eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
+	eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+	phy_config.autonego_timeout_ms = 100;
+
+	esp_eth_mac_t *mac = esp_eth_mac_new_openeth(&mac_config);
+	esp_eth_phy_t *phy = esp_eth_phy_new_dp83848(&phy_config);
+	esp_eth_config_t config = ETH_DEFAULT_CONFIG(mac, phy);
+	esp_eth_handle_t eth_handle = NULL;
+
+	ESP_ERROR_CHECK(esp_eth_driver_install(&config, &eth_handle));
+	ESP_ERROR_CHECK(esp_netif_attach(netif, esp_eth_new_netif_glue(eth_handle)));
+	ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &eth_event_handler, NULL));
+	ESP_ERROR_CHECK(esp_eth_start(eth_handle));
+
+	xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+}
+#endif
+
 /*
  * @brief  Wifi initialization.
  * @param	None
@@ -78,11 +129,18 @@ void Wifi::Init(void){
 
 	s_retry_num = 0;
 
-	s_wifi_event_group = xEventGroupCreate();
+	s_wifi_event_group = RTOS_EVENT_GROUP(&wifi_event_group_storage);
 
 	ESP_ERROR_CHECK(esp_netif_init());
 
 	ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+#ifdef CONFIG_LOCK_NET_OPENETH
+	/* Emulated image: no radio, Ethernet keeps the network stack in use */
+	openeth_init();
+	return;
+#endif
+
 	esp_netif_create_default_wifi_sta();
 
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -30,15 +30,58 @@
 #include "Mqtt.h"
 
 #include "Rdm6300.h"
+#include "Time.h"
 #include "Tags.h"
 #include "Door.h"
+#include "DenyLimiter.h"
+#include "AuthCache.h"
+#include "AuditLog.h"
+#include "Metrics.h"
+#include "Settings.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "JsonWriter.h"
+#include "TaskPlan.h"
+#include "StaticAlloc.h"
+
+
+/* Objects shared by the door tasks */
+typedef struct {
+	Door *door;
+	AuditLog *audit;
+} door_ctx_t;
 
+/**
+ * @brief Publish a tag event: {"tag": n}, with the number of suppressed
+ * reports when not zero.
+ *
+ * @param topic Topic name.
+ * @param tag Tag number.
+ * @param suppressed Reports suppressed by the deny limiter.
+ * @param event_us Time::Now() of the read.
+ */
+static void publish_tag(const char *topic, uint32_t tag, uint32_t suppressed, int64_t event_us){
+
+	char payload[72];
+	json_writer_t json;
+
+	json_init(&json, payload, sizeof(payload));
+	json_object_begin(&json);
+	json_kv_ts(&json, time_wall_ms(event_us));
+	json_kv_uint(&json, "tag", tag);
+	if (suppressed)
+		json_kv_uint(&json, "suppressed", suppressed);
+	json_object_end(&json);
 
+	if (json_finish(&json))
+		mqtt5_publish(topic, payload);
+}
 
 static void door_button_task(void* arg)
 {
 
-	Door *my_door = (Door *)arg;
+	door_ctx_t *ctx = (door_ctx_t *)arg;
+	Door *my_door = ctx->door;
 
 	gpio_reset_pin(GPIO_NUM_23);
 	/* Set the GPIO as a push/pull output */
@@ -47,35 +90,114 @@ static void door_button_task(void* arg)
 	gpio_pullup_en(GPIO_NUM_23);
 
 	int level = 0;
+	int traced_level = -1;
+	int64_t sampled_us;
 
 	TickType_t currentTime;
 	TickType_t openedTime = 0;
 
     for(;;) {
     	level = gpio_get_level(GPIO_NUM_23);
-    	vTaskDelay(700 /  portTICK_PERIOD_MS);
+    	sampled_us = Time::Now();
+    	if (level != traced_level){
+    		trace_record(TRACE_BUTTON, level, NULL, 0);
+    		traced_level = level;
+    	}
+    	vTaskDelay(pdMS_TO_TICKS(setting_get(SETTING_BUTTON_POLL_MS)));
 
     	/* Get the time in MS. */
 		currentTime = pdTICKS_TO_MS( xTaskGetTickCount() );
 
     	if (level){
 
-    		/* Re open door after 10s */
-    		if (currentTime > openedTime + 10000){
+    		/* Re open door after the guard time */
+    		if (currentTime > openedTime + setting_get(SETTING_BUTTON_GUARD_MS)){
     			ESP_LOGI("door_button_task::", "Open door for button");
     			my_door->open();
     			openedTime = currentTime;
+    			ctx->audit->record(0, CONFIG_DOOR_ID, AuditLog::BUTTON, sampled_us);
+
+    			char payload[40];
+    			json_writer_t json;
 
-    			char *string = "{open: 1}";
+    			json_init(&json, payload, sizeof(payload));
+    			json_object_begin(&json);
+    			json_kv_ts(&json, time_wall_ms(sampled_us));
+    			json_kv_uint(&json, "open", 1);
+    			json_object_end(&json);
 
-    			//mqtt5_publish("lpae/button_log",string);
-				mqtt5_publish("v1/devices/me/telemetry",string);
+    			//mqtt5_publish("lpae/button_log",payload);
+    			if (json_finish(&json))
+    				mqtt5_publish("v1/devices/me/telemetry",payload);
     		}
     	}
     }
 }
 
 
+#ifdef CONFIG_REMOTE_UNLOCK
+/**
+ * @brief Remote unlock task. Runs above the RFID loop so a network unlock
+ * reaches the strike without waiting for tag processing.
+ *
+ * @param arg Door tasks context.
+ */
+static void door_unlock_task(void* arg)
+{
+	door_ctx_t *ctx = (door_ctx_t *)arg;
+	unlock_cmd_t cmd;
+
+	for(;;) {
+		if (get_unlock_command(&cmd, portMAX_DELAY) != 0)
+			continue;
+
+		int64_t actuated_us = ctx->door->open();
+		mqtt5_unlock_ack(&cmd, actuated_us);
+		metric_inc(METRIC_UNLOCKS);
+		ctx->audit->record(0, CONFIG_DOOR_ID, AuditLog::UNLOCK, actuated_us < 0 ? cmd.received_us : actuated_us);
+	}
+}
+#endif
+
+#ifdef CONFIG_REMOTE_AUTH
+/**
+ * @brief Authorize a tag not stored locally. Cached answers are used
+ * first, otherwise the backend is asked with a tight timeout.
+ * 
+ * @param cache Cache of remote answers.
+ * @param tag Tag number.
+ * @param door Door to open.
+ * @param now_ms Current time in ms.
+ * @return true Backend granted access to the door.
+ * @return false Denied, timeout or disconnected.
+ */
+static bool remote_authorize(AuthCache *cache, uint32_t tag, Door *door, uint32_t now_ms){
+
+	uint8_t doors = 0;
+	uint32_t ttl_s = 0;
+
+	if (cache->get(tag, now_ms, &doors)){
+		DLOGD(MAIN, DLOG_MAIN_AUTH_CACHED, tag, doors);
+		return doors & door->mask();
+	}
+
+	if (mqtt5_auth_request(tag, CONFIG_DOOR_ID, CONFIG_REMOTE_AUTH_TIMEOUT_MS, &doors, &ttl_s) != 0){
+		/* No answer: deny without caching */
+		DLOGW(MAIN, DLOG_MAIN_AUTH_TIMEOUT, tag);
+		metric_inc(METRIC_AUTH_TIMEOUTS);
+		return false;
+	}
+
+	if (ttl_s == 0)
+		ttl_s = doors ? CONFIG_REMOTE_AUTH_GRANT_TTL_S : CONFIG_REMOTE_AUTH_DENY_TTL_S;
+
+	cache->put(tag, doors, ttl_s * 1000, now_ms);
+	DLOGI(MAIN, DLOG_MAIN_AUTH_REMOTE, tag, doors);
+
+	return doors & door->mask();
+}
+#endif
+
 /**
  * @brief Main function (main FreeRTOS thread). Initialize hardware and runs the main loop.
  * 
@@ -84,6 +206,13 @@ static void door_button_task(void* arg)
 
 extern "C" void app_main(void)
 {
+	/* Deferred logger first: every module may record from now on */
+	dlog_init();
+	/* Field trace recorder, when enabled */
+	trace_init();
+	/* Wall clock from RTC memory, before any event is stamped */
+	Time::Restore();
+
 	/* Initialize NVS */
 	esp_err_t ret = nvs_flash_init();
 	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -92,40 +221,128 @@ extern "C" void app_main(void)
 	}
 	ESP_ERROR_CHECK(ret);
 
+	/* Runtime settings before any module reads them */
+	settings_init();
+
 	/* Initialize WiFi and MQTT5*/
 	Wifi::Init();
 	mqtt5_init();
 
+	/* Wall time for access schedules and event timestamps */
+	Time::SyncInit();
+
+	/* Periodic metrics snapshots */
+	metrics_init();
+
+	/* Long lived objects are static: they grow with their Kconfig sizes
+	 * (Tags with TAGS_CAPACITY, AuditLog with its sector index and queue) and the
+	 * main task stack only holds the loop locals, see sdkconfig.defaults */
 	/* RFID storage class */
-	Tags tags_storage;
+	static Tags tags_storage;
 	/* RFID sensor class */
-	Rdm6300 tag_sensor(9600,UART_DATA_8_BITS,UART_PARITY_DISABLE,UART_STOP_BITS_1, UART_HW_FLOWCTRL_DISABLE);
+	static Rdm6300 tag_sensor(9600,UART_DATA_8_BITS,UART_PARITY_DISABLE,UART_STOP_BITS_1, UART_HW_FLOWCTRL_DISABLE);
 	/* Door */
-	Door my_door;
-
-	xTaskCreate(door_button_task, "door_button_task", 2048, (void *)&my_door, 10, NULL);
+	static Door my_door;
+	/* Rate limit of denied reads */
+	static DenyLimiter deny_limiter;
+#ifdef CONFIG_REMOTE_AUTH
+	/* Answers of remote authorization */
+	static AuthCache auth_cache;
+#endif
+	/* Local history of access events */
+	static AuditLog audit_log;
+
+	/* Shared with the door tasks */
+	static door_ctx_t door_ctx = {&my_door, &audit_log};
+
+	RTOS_TASK(door_button_task, "door_button_task", 2048, (void *)&door_ctx,
+			TASK_BUTTON_PRIORITY, NULL, TASK_BUTTON_CORE);
+#ifdef CONFIG_REMOTE_UNLOCK
+	RTOS_TASK(door_unlock_task, "door_unlock_task", 3072, (void *)&door_ctx,
+			TASK_UNLOCK_PRIORITY, NULL, TASK_UNLOCK_CORE);
+#endif
+
+	/* Access path runs above networking tasks of this core */
+	vTaskPrioritySet(NULL, TASK_MAIN_PRIORITY);
 
 	while (1){
 		/* Wait for a new tag */
 		uint32_t tag = tag_sensor.WaitAndRead();
+		int64_t event_us = tag_sensor.ReadTime();
+		uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+
+		/* Invalid frame */
+		if (tag == 0 || tag == (uint32_t)-1)
+			continue;
+
+		/* Reader locked by too many denies: ignore reads */
+		if (deny_limiter.locked(now_ms))
+			continue;
+
+		/* Check if a read tag is in permissive list and may open this door */
+		Tags::access_t access;
+		bool granted = false;
+		AuditLog::Outcome outcome = AuditLog::DENIED;
+		int32_t index = tags_storage.search(tag, &access);
+
+		if (index != -1){
+			if (!(access.doors & my_door.mask())){
+				DLOGI(MAIN, DLOG_MAIN_DOOR, tag);
+				outcome = AuditLog::DENIED_DOOR;
+			}
+			else if (!tags_storage.allowed_now(&access)){
+				DLOGI(MAIN, DLOG_MAIN_SCHEDULE, tag);
+				outcome = AuditLog::DENIED_SCHEDULE;
+			}
+			else {
+				granted = true;
+				outcome = AuditLog::GRANTED;
+			}
+		}
+#ifdef CONFIG_REMOTE_AUTH
+		else if (remote_authorize(&auth_cache, tag, &my_door, now_ms)){
+			granted = true;
+			outcome = AuditLog::REMOTE_GRANTED;
+		}
+#endif
 
-		char string[64];
-		snprintf(string,64,"%ld",tag);
+		audit_log.record(tag, CONFIG_DOOR_ID, outcome, event_us);
 
-		/* Check if a read tag is in permissive list */
-		if ((tag != 0) && (tags_storage.search(tag) != -1)) {
-			ESP_LOGI("Main::", "Open door for: %lu", tag);
+		if (granted) {
+			DLOGI(MAIN, DLOG_MAIN_OPEN, tag);
+			metric_inc(METRIC_GRANTS);
 			my_door.open();
 
-			snprintf(string,64,"{tag: %ld}",tag);
-
-			//mqtt5_publish("lpae/tag_open",string);
-			mqtt5_publish("v1/devices/me/telemetry",string);
+			//publish_tag("lpae/tag_open", tag, 0, event_us);
+			publish_tag("v1/devices/me/telemetry", tag, 0, event_us);
 		}
 		else{
-			mqtt5_publish("lpae/tag_denied",string);
-			//mqtt5_publish("v1/devices/me/telemetry",string);
-
+			DLOGI(MAIN, DLOG_MAIN_DENIED, tag);
+			metric_inc(METRIC_DENIES);
+			DenyLimiter::Verdict verdict = deny_limiter.denied(tag, now_ms);
+
+			/* Aggregated report of a tag leaving the deny table */
+			if (verdict.evicted_tag)
+				publish_tag("lpae/tag_denied", verdict.evicted_tag, verdict.evicted_suppressed, event_us);
+
+			if (verdict.report){
+				publish_tag("lpae/tag_denied", tag, verdict.suppressed, event_us);
+				//publish_tag("v1/devices/me/telemetry", tag, verdict.suppressed, event_us);
+			}
+
+			if (verdict.lockout){
+				char payload[56];
+				json_writer_t json;
+
+				DLOGW(MAIN, DLOG_MAIN_LOCKOUT, CONFIG_DENY_LOCKOUT_MS);
+				json_init(&json, payload, sizeof(payload));
+				json_object_begin(&json);
+				json_kv_ts(&json, time_wall_ms(event_us));
+				json_kv_uint(&json, "lockout_ms", CONFIG_DENY_LOCKOUT_MS);
+				json_object_end(&json);
+				if (json_finish(&json))
+					mqtt5_publish("lpae/reader_lockout", payload);
+			}
 		}
 	}
 }
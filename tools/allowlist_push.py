@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Replace the static allowlist of a running lock over MQTT.
+
+Sends "begin <size> <crc32>" to lpae/dev/<device id>/allowlist, the image
+in chunks of <offset:u32 little endian><bytes> to .../allowlist/data and
+"commit" at the end, each one answered on the MQTT5 response topic with
+{"active": slot, "count": n, "generation": g, "slot": slot, "written": n
+[, "error": "..."]}. The lock writes its inactive image slot meanwhile and
+keeps using the old list until the commit is verified. The image must be
+newer than the active one. Build the image with tools/mphf_build.py:
+
+    tools/mphf_build.py allowlist.csv allowlist.bin
+    tools/allowlist_push.py --broker broker.local 24:0a:c4:00:00:01 allowlist.bin
+
+Needs paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import json
+import os
+import queue
+import struct
+import sys
+import zlib
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+
+MAGIC = 0x4648504D        # "MPHF", see main/StaticAllowlist.h
+VERSION = 2
+HEADER_SIZE = 32
+GENERATION_OFFSET = 24
+SLOT_SIZE = 0x40000       # see tools/mphf_build.py
+RETRIES = 5
+
+
+class Lock:
+    """Request and answer exchange with one lock."""
+
+    def __init__(self, args):
+        self.prefix = "lpae/dev/%s/" % args.device
+        self.timeout = args.timeout
+        self.correlation = os.urandom(8)
+        self.response_topic = "lpae/allowlist_push/%s" % self.correlation.hex()
+        self.replies = queue.Queue()
+        subscribed = queue.Queue()
+
+        self.client = mqtt.Client(protocol=mqtt.MQTTv5)
+        if args.user:
+            self.client.username_pw_set(args.user, args.password)
+        self.client.on_connect = lambda client, *a, **k: client.subscribe(self.response_topic, qos=1)
+        self.client.on_subscribe = lambda *a, **k: subscribed.put(True)
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        self.client.loop_start()
+        try:
+            subscribed.get(timeout=self.timeout)
+        except queue.Empty:
+            sys.exit("broker did not confirm the subscription")
+
+    def on_message(self, client, userdata, message):
+        props = getattr(message, "properties", None)
+        if props is not None and getattr(props, "CorrelationData", self.correlation) != self.correlation:
+            return
+        try:
+            self.replies.put(json.loads(message.payload))
+        except ValueError:
+            pass
+
+    def request(self, command, payload):
+        """Publish a command and wait for its answer, None on timeout."""
+        properties = Properties(PacketTypes.PUBLISH)
+        properties.ResponseTopic = self.response_topic
+        properties.CorrelationData = self.correlation
+        self.client.publish(self.prefix + command, payload, qos=1, properties=properties)
+        try:
+            return self.replies.get(timeout=self.timeout)
+        except queue.Empty:
+            return None
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def push(lock, image, chunk):
+    reply = lock.request("allowlist", "begin %d %08x" % (len(image), zlib.crc32(image)))
+    if reply is None or "error" in reply or "busy" in reply:
+        sys.exit("begin refused: %s" % reply)
+    generation = struct.unpack_from("<I", image, GENERATION_OFFSET)[0]
+    if reply["active"] >= 0 and generation <= reply.get("generation", 0):
+        lock.request("allowlist", "abort")
+        sys.exit("image generation %d is not newer than the active %d" % (generation, reply["generation"]))
+    print("writing slot %s, active slot %s with %d tags" % ("AB"[reply["slot"]], reply["active"], reply["count"]))
+
+    offset = 0
+    retries = 0
+    while offset < len(image):
+        data = image[offset:offset + chunk]
+        reply = lock.request("allowlist/data", struct.pack("<I", offset) + data)
+
+        if reply is not None and "error" not in reply and "busy" not in reply:
+            offset = reply["written"]
+            retries = 0
+            continue
+
+        retries += 1
+        if retries > RETRIES:
+            sys.exit("chunk at %d failed: %s" % (offset, reply))
+        # Lost or duplicated chunk: resume where the lock stands
+        if reply and reply.get("error") == "offset" and "written" in reply:
+            offset = reply["written"]
+        elif reply and reply.get("error") not in (None, "offset"):
+            sys.exit("chunk at %d failed: %s" % (offset, reply))
+
+    reply = lock.request("allowlist", "commit")
+    if reply is None or "error" in reply:
+        sys.exit("commit failed, the lock keeps its previous list: %s" % reply)
+    print("active slot %s: %d tags" % ("AB"[reply["active"]], reply["count"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("device", help="device id, as in lpae/dev/<device id>/")
+    parser.add_argument("image", help="image built by tools/mphf_build.py")
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--chunk", type=int, default=512, help="bytes per message, up to ALLOWLIST_CHUNK_BYTES")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds to wait for each answer")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    if len(image) < HEADER_SIZE or struct.unpack_from("<IH", image) != (MAGIC, VERSION):
+        sys.exit("not an allowlist image of version %d" % VERSION)
+    if len(image) > SLOT_SIZE:
+        sys.exit("image of %d bytes does not fit an image slot" % len(image))
+
+    lock = Lock(args)
+    try:
+        push(lock, image, args.chunk)
+    finally:
+        lock.close()
+
+
+if __name__ == "__main__":
+    main()
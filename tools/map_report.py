@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Memory footprint of the application from the link map file.
+
+Reads the GNU ld map written by the ESP-IDF build (build/iot_lock.map, linked
+with --cref) and sums the input sections of each object of a component
+(libmain.a by default) by memory: DRAM data and bss, IRAM, flash code and
+flash rodata. The largest sections are listed next: with STATIC_ALLOCATION
+task stacks, TCBs and queue storage show up here instead of in the heap.
+
+    tools/map_report.py build/iot_lock.map
+    tools/map_report.py --check-static build/iot_lock.map
+
+--check-static fails when an object of the component references a FreeRTOS
+function that creates a task, queue, semaphore, timer or event group on the
+heap. The build runs it on STATIC_ALLOCATION images, see CMakeLists.txt.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# Output section prefix: memory column
+MEMORIES = (
+    (".dram0.bss", "bss"),
+    (".noinit", "bss"),
+    (".bss", "bss"),
+    (".dram0.data", "data"),
+    (".data", "data"),
+    (".iram0", "iram"),
+    (".flash.text", "code"),
+    (".text", "code"),
+    (".flash.rodata", "rodata"),
+    (".flash.appdesc", "rodata"),
+    (".rodata", "rodata"),
+    (".rtc", "rtc"),
+)
+COLUMNS = ("data", "bss", "iram", "code", "rodata", "rtc")
+HEADINGS = ("DRAM data", "DRAM bss", "IRAM", "flash code", "flash rodata", "RTC")
+
+# Heap creation functions. xTaskCreate, xQueueCreate and xSemaphoreCreate*
+# are macros or inline functions over these
+HEAP_CREATE = (
+    "xTaskCreate",
+    "xTaskCreatePinnedToCore",
+    "xQueueGenericCreate",
+    "xQueueCreateMutex",
+    "xQueueCreateCountingSemaphore",
+    "xTimerCreate",
+    "xEventGroupCreate",
+    "xStreamBufferGenericCreate",
+)
+
+SECTION = re.compile(r"^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$")
+OBJECT = re.compile(r"([^/\s]+\.a)\(([^)]+)\)$|([^/\s]+\.o(?:bj)?)$")
+
+
+def memory_of(output_section):
+    for prefix, memory in MEMORIES:
+        if output_section.startswith(prefix):
+            return memory
+    return None
+
+
+def object_of(path):
+    """Archive and member of an input file, ("", file) for plain objects."""
+    match = OBJECT.search(path.strip())
+    if not match:
+        return None, None
+    if match.group(1):
+        return match.group(1), match.group(2)
+    return "", match.group(3)
+
+
+def parse(path):
+    """Input sections (memory, archive, object, name, size) and cross
+    references {symbol: [files, definition first]}."""
+    sections = []
+    refs = {}
+    output = None
+    pending = None
+    symbol = None
+    in_map = False
+    in_cref = False
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+
+            if line.startswith("Linker script and memory map"):
+                in_map, in_cref = True, False
+                continue
+            if line.startswith("Cross Reference Table"):
+                in_map, in_cref = False, True
+                continue
+
+            if in_cref:
+                if not line.strip() or line.startswith("Symbol "):
+                    continue
+                if not line[0].isspace():
+                    fields = line.split(None, 1)
+                    symbol = fields[0]
+                    refs[symbol] = [fields[1].strip()] if len(fields) > 1 else []
+                elif symbol:
+                    refs[symbol].append(line.strip())
+                continue
+
+            if not in_map:
+                continue
+
+            # Output section: name at column 0
+            if line.startswith("."):
+                output = line.split()[0]
+                pending = None
+                continue
+
+            # Input section, its address and size on the next line when
+            # the name is long
+            match = SECTION.match(line)
+            if match and pending:
+                name = pending
+            elif line.startswith(" .") or line.startswith(" COMMON"):
+                fields = line.split(None, 1)
+                if len(fields) == 1:
+                    pending = fields[0]
+                    continue
+                match = SECTION.match(" " + fields[1])
+                name = fields[0]
+            else:
+                pending = None
+                continue
+            pending = None
+
+            memory = memory_of(output or "")
+            if not match or memory is None:
+                continue
+            size = int(match.group(2), 16)
+            archive, member = object_of(match.group(3))
+            if member and size:
+                sections.append((memory, archive, member, name, size, output))
+
+    return sections, refs
+
+
+def report(sections, component, top):
+    totals = {}
+    for memory, archive, member, name, size, output in sections:
+        if archive != component:
+            continue
+        row = totals.setdefault(member, dict.fromkeys(COLUMNS, 0))
+        row[memory] += size
+
+    if not totals:
+        sys.exit("no sections of %s in the map" % component)
+
+    width = max(len(m) for m in totals) + 2
+    print("%-*s" % (width, component) + "".join("%13s" % h for h in HEADINGS))
+    for member in sorted(totals):
+        print("%-*s" % (width, member) + "".join("%13d" % totals[member][c] for c in COLUMNS))
+    print("%-*s" % (width, "total") + "".join("%13d" % sum(r[c] for r in totals.values()) for c in COLUMNS))
+
+    if top:
+        print("\nLargest sections of %s:" % component)
+        largest = sorted((s for s in sections if s[1] == component), key=lambda s: -s[4])[:top]
+        for memory, archive, member, name, size, output in largest:
+            print("%8d  %-14s %-22s %s" % (size, output, member, name))
+
+
+def check_static(refs, component):
+    """Objects of the component referencing a heap creation function."""
+    found = []
+    for symbol in HEAP_CREATE:
+        for path in refs.get(symbol, [])[1:]:
+            archive, member = object_of(path)
+            if archive == component:
+                found.append((member, symbol))
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="link map file, build/<project>.map")
+    parser.add_argument("--component", default="libmain.a", help="archive of the application objects")
+    parser.add_argument("--top", type=int, default=15, help="largest sections listed, 0: none")
+    parser.add_argument("--check-static", action="store_true",
+                        help="only check for heap created RTOS objects")
+    args = parser.parse_args()
+
+    sections, refs = parse(args.map)
+
+    if args.check_static:
+        if not refs:
+            sys.exit("%s: no cross reference table, link with --cref" % args.map)
+        found = check_static(refs, args.component)
+        for member, symbol in found:
+            print("%s: %s references %s" % (os.path.basename(args.map), member, symbol), file=sys.stderr)
+        if found:
+            sys.exit("STATIC_ALLOCATION: %d heap creation references in %s" % (len(found), args.component))
+        print("STATIC_ALLOCATION: no heap creation references in %s" % args.component)
+        return
+
+    report(sections, args.component, args.top)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Compile a static allowlist into the "allowlist" partition image.
+
+The table is a perfect hash built with hash and displace (CHD/PTHash): tags
+are split in buckets of about BUCKET_SIZE keys and each bucket gets a 16 bit
+pilot that moves all its keys to free slots. The lock finds a tag with one
+pilot read and one tag compare, see main/StaticAllowlist.h for the layout.
+
+Input: one tag per line, "tag[,doors]". Doors is the door permission
+bitmask, 255 when omitted. Lines starting with # are ignored.
+
+    tools/mphf_build.py allowlist.csv allowlist.bin
+    parttool.py write_partition --partition-name allowlist --input allowlist.bin
+
+The partition holds two image slots of SLOT_SIZE bytes. parttool.py writes
+slot A; tools/allowlist_push.py replaces the list of a running lock through
+the inactive slot.
+
+Each image carries a generation, the build time in seconds by default. A
+lock only accepts an image newer than its active one, and never falls back
+to an image older than the one it activated last.
+"""
+
+import argparse
+import random
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x4648504D        # "MPHF"
+VERSION = 2
+HEADER = struct.Struct("<IHHIIIIII")
+BUCKET_SIZE = 4
+MAX_PILOT = 0xFFFF
+MASK = 0xFFFFFFFF
+SLOT_SIZE = 0x40000       # half of the "allowlist" partition, see partitions.csv
+
+
+def mix32(x):
+    """32 bit finalizer, must match mix32() of main/StaticAllowlist.cpp."""
+    x &= MASK
+    x ^= x >> 16
+    x = (x * 0x7FEB352D) & MASK
+    x ^= x >> 15
+    x = (x * 0x846CA68B) & MASK
+    x ^= x >> 16
+    return x
+
+
+def read_allowlist(path):
+    entries = {}
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            fields = [field.strip() for field in line.split(",")]
+            tag = int(fields[0], 0)
+            doors = int(fields[1], 0) if len(fields) > 1 and fields[1] else 0xFF
+            if not 0 < tag <= MASK or not 0 <= doors <= 0xFF:
+                sys.exit("%s:%d: invalid entry" % (path, number))
+            entries[tag] = doors
+    return entries
+
+
+def build(tags, load, seed):
+    """Find the pilots of all buckets. Returns None when a bucket has no pilot."""
+    slots = max(1, int(len(tags) / load + 0.5))
+    buckets = max(1, (len(tags) + BUCKET_SIZE - 1) // BUCKET_SIZE)
+
+    members = [[] for _ in range(buckets)]
+    for tag in tags:
+        h1 = mix32(tag ^ seed)
+        members[h1 % buckets].append((tag, mix32(h1 ^ 0x9E3779B9)))
+
+    pilots = [0] * buckets
+    table = [0] * slots
+    pilot_hash = [mix32(p) for p in range(MAX_PILOT + 1)]
+
+    # Largest buckets first, while most slots are free
+    for b in sorted(range(buckets), key=lambda b: -len(members[b])):
+        keys = members[b]
+        if not keys:
+            continue
+        for pilot in range(MAX_PILOT + 1):
+            ph = pilot_hash[pilot]
+            positions = [(h2 ^ ph) % slots for _, h2 in keys]
+            if len(set(positions)) == len(positions) and not any(table[p] for p in positions):
+                break
+        else:
+            return None
+        pilots[b] = pilot
+        for (tag, _), p in zip(keys, positions):
+            table[p] = tag
+
+    return slots, pilots, table
+
+
+def pack(entries, slots, pilots, table, seed, generation):
+    body = struct.pack("<%dH" % len(pilots), *pilots)
+    # Tags are 32 bit aligned
+    body += b"\0" * (-(HEADER.size + len(body)) % 4)
+    body += struct.pack("<%dI" % slots, *table)
+    body += bytes(entries[tag] if tag else 0 for tag in table)
+    # The CRC covers the header fields before it, then the tables
+    fields = HEADER.pack(MAGIC, VERSION, 0, len(entries), len(pilots), slots, seed, generation, 0)[:-4]
+    return fields + struct.pack("<I", zlib.crc32(body, zlib.crc32(fields))) + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="allowlist, one tag[,doors] per line")
+    parser.add_argument("output", help="partition image")
+    parser.add_argument("--load", type=float, default=0.99, help="keys per slot, 1.0: minimal (default 0.99)")
+    parser.add_argument("--size", type=lambda s: int(s, 0), default=SLOT_SIZE,
+                        help="image slot size, half of the partition, fails when the image is larger"
+                             " (default 0x%X)" % SLOT_SIZE)
+    parser.add_argument("--generation", type=int, default=int(time.time()),
+                        help="image generation, larger is newer (default: build time in seconds)")
+    args = parser.parse_args()
+
+    if not 0.5 <= args.load <= 1.0:
+        sys.exit("load must be 0.5 to 1.0")
+    if not 0 <= args.generation <= MASK:
+        sys.exit("generation must fit 32 bits")
+
+    entries = read_allowlist(args.input)
+    if not entries:
+        sys.exit("empty allowlist")
+
+    start = time.perf_counter()
+    rng = random.Random(len(entries))
+    for attempt in range(16):
+        seed = rng.getrandbits(32)
+        result = build(list(entries), args.load, seed)
+        if result:
+            break
+    else:
+        sys.exit("no perfect hash found, try a lower --load")
+    elapsed = time.perf_counter() - start
+
+    image = pack(entries, *result, seed, args.generation)
+    if args.size and len(image) > args.size:
+        sys.exit("image of %d bytes does not fit an image slot" % len(image))
+
+    with open(args.output, "wb") as f:
+        f.write(image)
+
+    print("%d tags, %d slots, %d buckets, seed attempts %d, %.2f s, %d bytes (%.2f bytes per tag), generation %d" % (
+        len(entries), result[0], len(result[1]), attempt + 1, elapsed, len(image), len(image) / len(entries),
+        args.generation))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Capture the PUBLISH packets of lock telemetry on the wire.
+
+Publishes the same telemetry message several times with the publish
+properties of a firmware profile and records every byte the client sends.
+The client connects through a local TCP relay: to a broker with --broker,
+otherwise the relay answers CONNACK itself with a topic alias maximum of
+--aliases. Profiles:
+
+    before  every message carries payload format, expiry, response topic,
+            correlation data and three user properties, full topic
+    after   payload format and a topic alias: the first message sends the
+            full topic, next ones an empty topic
+
+    tools/mqtt_wire.py before after
+    tools/mqtt_wire.py --broker localhost after
+
+Needs paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+
+PUBLISH = 3
+TOPIC = "v1/devices/me/telemetry"
+PAYLOAD = "{tag: 1234567}"
+
+
+def properties_of(profile):
+    properties = Properties(PacketTypes.PUBLISH)
+    properties.PayloadFormatIndicator = 1
+    if profile == "before":
+        properties.MessageExpiryInterval = 1000
+        properties.ResponseTopic = "/topic/test/response"
+        properties.CorrelationData = b"123456"
+        properties.UserProperty = [("board", "esp32"), ("u", "user"), ("p", "password")]
+    else:
+        properties.TopicAlias = 1
+    return properties
+
+
+def remaining_length(data, pos):
+    value, shift = 0, 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def packets(data):
+    """Split a client byte stream in (type, packet bytes, body offset)."""
+    pos = 0
+    while pos < len(data):
+        length, body = remaining_length(data, pos + 1)
+        yield data[pos] >> 4, data[pos:body + length], body - pos
+        pos = body + length
+
+
+def describe(packet, body):
+    topic_len = int.from_bytes(packet[body:body + 2], "big")
+    pos = body + 2 + topic_len
+    if (packet[0] >> 1) & 3:
+        pos += 2
+    properties_len, pos = remaining_length(packet, pos)
+    return topic_len, properties_len, len(packet) - pos - properties_len
+
+
+class Relay(threading.Thread):
+    """Accept one client, forward to the broker or answer CONNACK, record
+    what the client sends."""
+
+    def __init__(self, args):
+        super().__init__(daemon=True)
+        self.args = args
+        self.sent = bytearray()
+        self.server = socket.socket()
+        self.server.bind(("127.0.0.1", 0))
+        self.server.listen(1)
+        self.port = self.server.getsockname()[1]
+
+    def run(self):
+        client, _ = self.server.accept()
+        if self.args.broker:
+            broker = socket.create_connection((self.args.broker, self.args.port))
+            threading.Thread(target=self.pump, args=(broker, client), daemon=True).start()
+        else:
+            broker = None
+        connack = False
+        while True:
+            data = client.recv(4096)
+            if not data:
+                break
+            self.sent += data
+            if broker:
+                broker.sendall(data)
+            elif not connack:
+                # Success, no session, Topic Alias Maximum
+                client.sendall(bytes([0x20, 6, 0, 0, 3, 0x22]) + self.args.aliases.to_bytes(2, "big"))
+                connack = True
+
+    @staticmethod
+    def pump(source, destination):
+        while True:
+            data = source.recv(4096)
+            if not data:
+                break
+            destination.sendall(data)
+
+
+def capture(args, profile):
+    relay = Relay(args)
+    relay.start()
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id="mqtt_wire", protocol=mqtt.MQTTv5)
+    client.connect("127.0.0.1", relay.port)
+    client.loop_start()
+    deadline = time.time() + 5
+    while not client.is_connected():
+        if time.time() > deadline:
+            sys.exit("%s: not connected" % profile)
+        time.sleep(0.01)
+
+    for n in range(args.count):
+        topic = TOPIC if profile == "before" or n == 0 else ""
+        client.publish(topic, PAYLOAD, qos=0, properties=properties_of(profile)).wait_for_publish()
+
+    time.sleep(0.2)
+    client.disconnect()
+    client.loop_stop()
+    time.sleep(0.1)
+
+    return [(packet, body) for kind, packet, body in packets(bytes(relay.sent)) if kind == PUBLISH]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("profile", nargs="+", choices=("before", "after"))
+    parser.add_argument("--broker", help="forward to this broker instead of answering locally")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--aliases", type=int, default=10, help="topic alias maximum of the local CONNACK")
+    parser.add_argument("--count", type=int, default=3, help="messages per profile")
+    parser.add_argument("--hex", action="store_true", help="dump every packet")
+    args = parser.parse_args()
+
+    print("%-7s %3s %6s %5s %10s %7s" % ("profile", "msg", "packet", "topic", "properties", "payload"))
+    for profile in args.profile:
+        for n, (packet, body) in enumerate(capture(args, profile)):
+            topic_len, properties_len, payload_len = describe(packet, body)
+            print("%-7s %3d %6d %5d %10d %7d" % (profile, n, len(packet), topic_len, properties_len, payload_len))
+            if args.hex:
+                print("        " + packet.hex(" "))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+# Build the emulated soak image and merge it into a 4 MB QEMU flash file.
+#
+#   tools/soak/build_image.sh release|profile
+#
+# Prints the path of the flash file. Needs an exported ESP-IDF environment.
+
+set -e
+
+variant=${1:-release}
+root=$(cd "$(dirname "$0")/../.." && pwd)
+soak=$root/tools/soak
+build=$root/build_qemu_$variant
+
+case "$variant" in
+release)
+	defaults="$root/sdkconfig.defaults;$soak/sdkconfig.qemu" ;;
+profile)
+	defaults="$root/sdkconfig.defaults;$soak/sdkconfig.qemu;$soak/sdkconfig.qemu.profile" ;;
+*)
+	echo "usage: $0 release|profile" >&2
+	exit 1 ;;
+esac
+
+idf.py -C "$root" -B "$build" -D SDKCONFIG="$build/sdkconfig" -D SDKCONFIG_DEFAULTS="$defaults" build >&2
+(cd "$build" && esptool.py --chip esp32 merge_bin --fill-flash-size 4MB -o flash.bin @flash_args >&2)
+
+echo "$build/flash.bin"
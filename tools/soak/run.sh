@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+# Soak both the release and the profiling image, one after the other.
+#
+#   tools/soak/run.sh [hours] [soak.py options]
+#
+# Results go to soak_results/<variant>/. Fails when any run fails.
+
+set -e
+
+hours=${1:-4}
+[ $# -gt 0 ] && shift
+root=$(cd "$(dirname "$0")/../.." && pwd)
+status=0
+
+for variant in release profile; do
+	image=$("$root/tools/soak/build_image.sh" "$variant")
+	trace=""
+	[ "$variant" = profile ] && trace="--trace"
+	"$root/tools/soak/soak.py" --image "$image" --hours "$hours" \
+		--out "$root/soak_results/$variant" $trace "$@" || status=1
+done
+
+exit $status
@@ -0,0 +1,10 @@
+# Profiling variant of the soak image, layered over sdkconfig.qemu: field
+# trace recorder, debug level deferred logs, run time statistics and heap
+# poisoning so corruption shows up as a crash instead of a slow drift.
+CONFIG_TRACE=y
+CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS=y
+CONFIG_HEAP_POISONING_LIGHT=y
+CONFIG_DLOG_LEVEL_MAIN=4
+CONFIG_DLOG_LEVEL_RDM6300=4
+CONFIG_DLOG_LEVEL_TAGS=4
+CONFIG_DLOG_LEVEL_MQTT=4
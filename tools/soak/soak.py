@@ -0,0 +1,458 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Whole firmware soak and latency test on Espressif QEMU.
+
+Boots a flash image built by tools/soak/build_image.sh in qemu-system-xtensa
+with a local mosquitto broker, then for --hours:
+
+  - writes RDM6300 frames to the emulated UART2 (a TCP socket), mostly of
+    provisioned tags, and times each one until its {"tag": n} telemetry
+    arrives: end to end grant latency, frame write to broker delivery;
+  - every --storm-period, toggles a burst of extra tags in and out of the
+    tag store through add_tag;
+  - every --flood-period, sends a burst of correlated config requests and
+    metrics requests, counting the replies;
+  - every --reconnect-period, restarts the broker and times the reconnect;
+  - records each metrics snapshot (heap, heap_min, stack_min, counters) and
+    each task stack report.
+
+Results in --out: latency.csv, metrics.csv, stacks.csv, events.csv,
+uart0.log and summary.json. Exits 1 when a check fails: lost grants, a
+reboot, heap leaking faster than --max-heap-leak, p99 latency of the last
+hour above --max-creep times the first hour, or a stack below
+--min-stack bytes.
+
+    tools/soak/soak.py --image build_qemu_release/flash.bin --hours 4
+
+Needs qemu-system-xtensa (Espressif fork), mosquitto and paho-mqtt.
+"""
+
+import argparse
+import csv
+import json
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+
+# Tags granted by the soak and tags only toggled by the storms
+SOAK_TAGS = range(0x5A0000, 0x5A0020)
+STORM_TAGS = range(0x5B0000, 0x5B0040)
+UNKNOWN_TAGS = range(0x5C0000, 0x5C1000)
+
+REPLY_TOPIC = "lpae/soak/reply"
+FIELD = re.compile(r'"?(\w+)"?\s*:\s*(\[\s*\d+\s*,\s*\d+\s*\]|\d+)')
+TELEMETRY_TAG = re.compile(r'^\{\s*(?:"?ts"?\s*:\s*\d+\s*,\s*)?"?tag"?\s*:\s*(\d+)\s*\}$')
+
+# Warm up not used for the heap trend: pools and caches filling
+WARMUP_S = 600
+
+
+def frame(tag, version=0x01):
+    """RDM6300 frame: STX, 10 hex digits, XOR checksum of their bytes, ETX."""
+    text = "%02X%08X" % (version, tag)
+    checksum = 0
+    for i in range(0, 10, 2):
+        checksum ^= int(text[i:i + 2], 16)
+    return b"\x02" + ("%s%02X" % (text, checksum)).encode() + b"\x03"
+
+
+def fields(text):
+    """Values of a snapshot like {"up":10,"heap":1234,"grants":[3,1]}."""
+    values = {}
+    for key, value in FIELD.findall(text):
+        values[key] = int(value.strip("[]").split(",")[0]) if value.startswith("[") else int(value)
+    return values
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(p / 100.0 * len(ordered)))]
+
+
+def slope_per_hour(samples):
+    """Least squares slope of (seconds, value) samples, per hour."""
+    if len(samples) < 3:
+        return 0.0
+    n = float(len(samples))
+    mean_t = sum(t for t, _ in samples) / n
+    mean_v = sum(v for _, v in samples) / n
+    den = sum((t - mean_t) ** 2 for t, _ in samples)
+    if not den:
+        return 0.0
+    return sum((t - mean_t) * (v - mean_v) for t, v in samples) / den * 3600
+
+
+class Broker:
+    """Local mosquitto, restartable to force reconnects."""
+
+    def __init__(self, binary, port, workdir):
+        self.binary = binary
+        self.port = port
+        self.conf = os.path.join(workdir, "mosquitto.conf")
+        with open(self.conf, "w") as f:
+            f.write("listener %d 127.0.0.1\nallow_anonymous true\nmax_queued_messages 10000\n" % port)
+        self.process = None
+
+    def start(self):
+        self.process = subprocess.Popen([self.binary, "-c", self.conf],
+                                        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for _ in range(50):
+            try:
+                socket.create_connection(("127.0.0.1", self.port), 0.2).close()
+                return
+            except OSError:
+                time.sleep(0.1)
+        sys.exit("mosquitto did not start")
+
+    def stop(self):
+        if self.process:
+            self.process.terminate()
+            self.process.wait()
+            self.process = None
+
+
+class Lock:
+    """Firmware under QEMU: UART2 socket and MQTT view of the device."""
+
+    def __init__(self, args, out):
+        self.args = args
+        self.out = out
+        self.lock = threading.Lock()
+        self.device = None
+        self.pending = {}           # tag: [write time, ...]
+        self.latency = []           # (elapsed s, tag, ms)
+        self.replies = set()
+        self.uptime = None
+        self.reboots = 0
+        self.metrics = []           # (elapsed s, fields)
+        self.stacks = {}            # task: min free bytes
+        self.stack_rows = []
+        self.start = time.monotonic()
+        self.connected = threading.Event()
+        self.snapshot = threading.Event()
+
+        self.client = mqtt.Client(client_id="soak", protocol=mqtt.MQTTv5)
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+
+    def elapsed(self):
+        return time.monotonic() - self.start
+
+    # MQTT side
+
+    def on_connect(self, client, userdata, flags, reason, properties=None):
+        client.subscribe([("lpae/dev/+/metrics", 0), ("lpae/dev/+/stacks", 0),
+                          ("v1/devices/me/telemetry", 1), (REPLY_TOPIC, 1)])
+        self.connected.set()
+
+    def on_message(self, client, userdata, message):
+        now = time.monotonic()
+        text = message.payload.decode(errors="replace")
+        topic = message.topic
+
+        with self.lock:
+            if topic == "v1/devices/me/telemetry":
+                match = TELEMETRY_TAG.match(text.strip())
+                if match and self.pending.get(int(match.group(1))):
+                    tag = int(match.group(1))
+                    sent = self.pending[tag].pop(0)
+                    self.latency.append((sent - self.start, tag, (now - sent) * 1000))
+            elif topic == REPLY_TOPIC:
+                props = getattr(message, "properties", None)
+                correlation = getattr(props, "CorrelationData", None)
+                if correlation:
+                    self.replies.add(bytes(correlation))
+            elif topic.endswith("/metrics") and "up" in fields(text):
+                self.device = self.device or topic.split("/")[2]
+                values = fields(text)
+                if self.uptime is not None and values.get("up", 0) < self.uptime:
+                    self.reboots += 1
+                self.uptime = values.get("up", 0)
+                self.metrics.append((now - self.start, values))
+                self.snapshot.set()
+            elif topic.endswith("/stacks"):
+                for task, free in fields(text).items():
+                    self.stacks[task] = min(free, self.stacks.get(task, free))
+                    self.stack_rows.append((round(now - self.start, 1), task, free))
+
+    def publish(self, command, payload, correlation=None):
+        properties = None
+        if correlation is not None:
+            properties = Properties(PacketTypes.PUBLISH)
+            properties.ResponseTopic = REPLY_TOPIC
+            properties.CorrelationData = correlation
+        self.client.publish("lpae/dev/%s/%s" % (self.device, command), payload, qos=1, properties=properties)
+
+    def connect(self):
+        self.client.connect("127.0.0.1", self.args.port)
+        self.client.loop_start()
+
+    # UART side
+
+    def open_uart(self):
+        for _ in range(100):
+            try:
+                self.uart = socket.create_connection(("127.0.0.1", self.args.uart_port), 1)
+                return
+            except OSError:
+                time.sleep(0.1)
+        sys.exit("QEMU UART2 socket did not open")
+
+    def read_tag(self, tag, expect_grant):
+        now = time.monotonic()
+        if expect_grant:
+            with self.lock:
+                self.pending.setdefault(tag, []).append(now)
+        self.uart.sendall(frame(tag))
+
+
+def run_qemu(args, out):
+    command = [args.qemu, "-machine", "esp32", "-display", "none", "-monitor", "none",
+               "-drive", "file=%s,if=mtd,format=raw" % args.image,
+               "-nic", "user,model=open_eth",
+               "-global", "driver=timer.esp32.timg,property=wdt_disable,value=true",
+               "-serial", "file:%s" % os.path.join(out, "uart0.log"),
+               "-serial", "null",
+               "-serial", "tcp:127.0.0.1:%d,server=on,wait=off" % args.uart_port]
+    return subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def ping(lock, timeout):
+    """Time until a config request is answered, None on timeout."""
+    correlation = os.urandom(8)
+    start = time.monotonic()
+    while time.monotonic() - start < timeout:
+        lock.publish("config", "", correlation)
+        time.sleep(1)
+        with lock.lock:
+            if correlation in lock.replies:
+                return time.monotonic() - start
+    return None
+
+
+def storm(lock, events):
+    """Toggle the storm tags in, then out again."""
+    for _ in range(2):
+        for tag in STORM_TAGS:
+            lock.publish("add_tag", str(tag))
+    events.append((round(lock.elapsed(), 1), "storm", 2 * len(STORM_TAGS)))
+
+
+def flood(lock, events, count):
+    """Burst of correlated config requests and metrics requests."""
+    sent = [os.urandom(8) for _ in range(count)]
+    for correlation in sent:
+        lock.publish("config", "", correlation)
+        lock.publish("metrics", "")
+    time.sleep(10)
+    with lock.lock:
+        answered = sum(1 for c in sent if c in lock.replies)
+    events.append((round(lock.elapsed(), 1), "flood", "%d/%d" % (answered, count)))
+    return count, answered
+
+
+def crashes(path):
+    try:
+        with open(path, errors="replace") as f:
+            text = f.read()
+    except OSError:
+        return 0
+    return len(re.findall(r"Guru Meditation|abort\(\) was called|Stack canary watchpoint", text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--image", required=True, help="merged flash image")
+    parser.add_argument("--hours", type=float, default=4)
+    parser.add_argument("--out", default="soak_results")
+    parser.add_argument("--qemu", default="qemu-system-xtensa")
+    parser.add_argument("--mosquitto", default=shutil.which("mosquitto") or "/usr/sbin/mosquitto")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--uart-port", type=int, default=5555)
+    parser.add_argument("--read-period", type=float, default=3.0, help="s between reads, above RDM_IDLE_MS")
+    parser.add_argument("--unknown-ratio", type=float, default=0.1)
+    parser.add_argument("--storm-period", type=float, default=300)
+    parser.add_argument("--flood-period", type=float, default=600)
+    parser.add_argument("--flood-count", type=int, default=200)
+    parser.add_argument("--reconnect-period", type=float, default=900)
+    parser.add_argument("--grant-timeout", type=float, default=5.0)
+    parser.add_argument("--max-loss", type=float, default=0.001, help="lost grant ratio")
+    parser.add_argument("--max-heap-leak", type=float, default=512, help="bytes per hour")
+    parser.add_argument("--max-creep", type=float, default=1.5, help="last/first hour p99")
+    parser.add_argument("--min-stack", type=int, default=256, help="bytes")
+    parser.add_argument("--trace", action="store_true", help="download the field trace at the end")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    workdir = tempfile.mkdtemp(prefix="soak")
+    broker = Broker(args.mosquitto, args.port, workdir)
+    broker.start()
+
+    qemu = run_qemu(args, args.out)
+    lock = Lock(args, args.out)
+    lock.connect()
+    lock.open_uart()
+
+    events = []
+    reconnects = []
+    floods = [0, 0]
+
+    try:
+        # Device id comes with the first snapshot
+        if not lock.snapshot.wait(180):
+            sys.exit("no metrics snapshot from the lock: boot failed?")
+        events.append((round(lock.elapsed(), 1), "boot", lock.device))
+
+        for tag in SOAK_TAGS:
+            lock.publish("add_tag", "%d,0" % tag)
+        time.sleep(5)
+
+        end = time.monotonic() + args.hours * 3600
+        next_storm = time.monotonic() + args.storm_period
+        next_flood = time.monotonic() + args.flood_period
+        next_reconnect = time.monotonic() + args.reconnect_period
+
+        while time.monotonic() < end and qemu.poll() is None:
+            now = time.monotonic()
+
+            if now >= next_reconnect:
+                # Reads in flight would be lost with the broker: settle first
+                time.sleep(args.grant_timeout)
+                broker.stop()
+                time.sleep(5)
+                broker.start()
+                elapsed = ping(lock, 120)
+                reconnects.append(elapsed)
+                events.append((round(lock.elapsed(), 1), "reconnect", elapsed))
+                next_reconnect = time.monotonic() + args.reconnect_period
+                continue
+
+            if now >= next_storm:
+                storm(lock, events)
+                next_storm = now + args.storm_period
+
+            if now >= next_flood:
+                sent, answered = flood(lock, events, args.flood_count)
+                floods[0] += sent
+                floods[1] += answered
+                next_flood = time.monotonic() + args.flood_period
+
+            if random.random() < args.unknown_ratio:
+                lock.read_tag(random.choice(UNKNOWN_TAGS), False)
+            else:
+                lock.read_tag(random.choice(SOAK_TAGS), True)
+            time.sleep(args.read_period)
+
+        time.sleep(args.grant_timeout)
+        if args.trace:
+            subprocess.call([sys.executable, os.path.join(os.path.dirname(__file__), "..", "trace_fetch.py"),
+                             "--broker", "127.0.0.1", "--port", str(args.port), lock.device,
+                             os.path.join(args.out, "field.trc")])
+    finally:
+        lock.client.loop_stop()
+        qemu.terminate()
+        qemu.wait()
+        broker.stop()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    summary = report(args, lock, events, reconnects, floods)
+    print(json.dumps(summary, indent=2))
+    sys.exit(0 if not summary["failures"] else 1)
+
+
+def report(args, lock, events, reconnects, floods):
+    out = args.out
+    now = time.monotonic()
+
+    with lock.lock:
+        lost = sum(1 for times in lock.pending.values() for t in times if now - t > args.grant_timeout)
+        latency = list(lock.latency)
+        metrics = list(lock.metrics)
+
+    with open(os.path.join(out, "latency.csv"), "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["t_s", "tag", "ms"])
+        writer.writerows((round(t, 1), tag, round(ms, 2)) for t, tag, ms in latency)
+
+    keys = sorted({key for _, values in metrics for key in values})
+    with open(os.path.join(out, "metrics.csv"), "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["t_s"] + keys)
+        writer.writerows([round(t, 1)] + [values.get(key, "") for key in keys] for t, values in metrics)
+
+    with open(os.path.join(out, "stacks.csv"), "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["t_s", "task", "free_bytes"])
+        writer.writerows(lock.stack_rows)
+
+    with open(os.path.join(out, "events.csv"), "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["t_s", "event", "value"])
+        writer.writerows(events)
+
+    ms = [m for _, _, m in latency]
+    first = [m for t, _, m in latency if t < 3600]
+    last_start = latency[-1][0] - 3600 if latency else 0
+    last = [m for t, _, m in latency if t >= max(last_start, 3600)]
+    heap = [(t, v["heap"]) for t, v in metrics if "heap" in v and t > WARMUP_S]
+    heap_slope = slope_per_hour(heap)
+    expected = len(latency) + lost
+
+    summary = {
+        "image": args.image,
+        "hours": round(lock.elapsed() / 3600, 2),
+        "device": lock.device,
+        "grants": {"sent": expected, "received": len(latency), "lost": lost},
+        "latency_ms": {"p50": percentile(ms, 50), "p90": percentile(ms, 90), "p99": percentile(ms, 99),
+                       "max": max(ms) if ms else None,
+                       "p99_first_hour": percentile(first, 99), "p99_last_hour": percentile(last, 99)},
+        "heap": {"first": heap[0][1] if heap else None, "last": heap[-1][1] if heap else None,
+                 "slope_per_hour": round(heap_slope, 1),
+                 "min_ever": min((v.get("heap_min", 0) for _, v in metrics), default=None)},
+        "stacks_min_bytes": lock.stacks,
+        "flood_replies": {"sent": floods[0], "answered": floods[1]},
+        "reconnect_s": [round(r, 1) if r is not None else None for r in reconnects],
+        "reboots": lock.reboots + crashes(os.path.join(out, "uart0.log")),
+        "failures": [],
+    }
+
+    failures = summary["failures"]
+    if expected and lost / float(expected) > args.max_loss:
+        failures.append("lost %d of %d grants" % (lost, expected))
+    if summary["reboots"]:
+        failures.append("%d reboots or crashes" % summary["reboots"])
+    if heap_slope < -args.max_heap_leak:
+        failures.append("heap falls %.0f bytes per hour" % -heap_slope)
+    if first and last and len(last) >= 100 and percentile(last, 99) > args.max_creep * percentile(first, 99):
+        failures.append("p99 latency crept from %.1f to %.1f ms" % (percentile(first, 99), percentile(last, 99)))
+    for task, free in lock.stacks.items():
+        if free < args.min_stack:
+            failures.append("task %s stack down to %d bytes" % (task, free))
+    if None in reconnects:
+        failures.append("no reconnect after a broker restart")
+
+    with open(os.path.join(out, "summary.json"), "w") as f:
+        json.dump(summary, f, indent=2)
+
+    return summary
+
+
+if __name__ == "__main__":
+    main()
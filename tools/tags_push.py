@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Replace the whole tag table of a running lock over MQTT.
+
+Reads a CSV of "tag[,schedule[,expiry[,doors]]]" lines, as the add_tag
+command, and sends "begin <size> <crc32>" to lpae/dev/<device id>/tags,
+the records in chunks of <offset:u32 little endian><records> to
+.../tags/data and "commit" at the end, each one answered on the MQTT5
+response topic with {"active": set, "count": n[, "written": n]
+[, "error": "..."]}. A record is tag u32, expiry u32, schedule u8 and
+doors u8, little endian. The lock stages the table in its inactive NVS
+block set and keeps using the old one until the commit is verified:
+
+    tools/tags_push.py --broker broker.local 24:0a:c4:00:00:01 tags.csv
+
+Tags missing from the file are revoked. Needs paho-mqtt (pip install
+paho-mqtt).
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import zlib
+
+from allowlist_push import Lock, RETRIES
+
+RECORD = struct.Struct("<IIBB")
+SCHEDULES = 16            # SCHEDULE_MAX_IDS, see main/Schedule.h
+
+
+def read_table(path):
+    """Records of a CSV file, refused on duplicate or invalid tags."""
+    table = bytearray()
+    seen = set()
+    with open(path, newline="") as f:
+        for line, row in enumerate(csv.reader(f), 1):
+            if not row or row[0].startswith("#"):
+                continue
+            try:
+                tag = int(row[0], 0)
+                schedule = int(row[1], 0) if len(row) > 1 and row[1] else 0
+                expiry = int(row[2], 0) if len(row) > 2 and row[2] else 0
+                doors = int(row[3], 0) if len(row) > 3 and row[3] else 0xff
+            except ValueError:
+                sys.exit("%s:%d: not a number" % (path, line))
+            if not 0 < tag < 1 << 32 or tag in seen:
+                sys.exit("%s:%d: tag %d invalid or repeated" % (path, line, tag))
+            if not 0 <= schedule < SCHEDULES or not 0 <= expiry < 1 << 32 or not 0 <= doors <= 0xff:
+                sys.exit("%s:%d: schedule, expiry or doors out of range" % (path, line))
+            seen.add(tag)
+            table += RECORD.pack(tag, expiry, schedule, doors)
+    return bytes(table)
+
+
+def push(lock, table, chunk):
+    reply = lock.request("tags", "begin %d %08x" % (len(table), zlib.crc32(table)))
+    if reply is None or "error" in reply or "busy" in reply:
+        sys.exit("begin refused: %s" % reply)
+    print("writing set %d, active set %d with %d tags" % (reply["active"] ^ 1, reply["active"], reply["count"]))
+
+    offset = 0
+    retries = 0
+    while offset < len(table):
+        data = table[offset:offset + chunk]
+        reply = lock.request("tags/data", struct.pack("<I", offset) + data)
+
+        if reply is not None and "error" not in reply and "busy" not in reply:
+            offset = reply["written"]
+            retries = 0
+            continue
+
+        retries += 1
+        if retries > RETRIES:
+            sys.exit("chunk at %d failed: %s" % (offset, reply))
+        # Lost or duplicated chunk: resume where the lock stands
+        if reply and reply.get("error") == "offset" and "written" in reply:
+            offset = reply["written"]
+        elif reply and reply.get("error") not in (None, "offset"):
+            sys.exit("chunk at %d failed: %s" % (offset, reply))
+
+    reply = lock.request("tags", "commit")
+    if reply is None or "error" in reply:
+        sys.exit("commit failed, the lock keeps its previous table: %s" % reply)
+    print("active set %d: %d tags" % (reply["active"], reply["count"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("device", help="device id, as in lpae/dev/<device id>/")
+    parser.add_argument("table", help="CSV of tag[,schedule[,expiry[,doors]]]")
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--chunk", type=int, default=500, help="bytes per message, up to TAGS_REPLACE_CHUNK_BYTES")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds to wait for each answer")
+    args = parser.parse_args()
+
+    table = read_table(args.table)
+    chunk = args.chunk - args.chunk % RECORD.size
+    if chunk <= 0:
+        sys.exit("chunk smaller than a record")
+
+    lock = Lock(args)
+    try:
+        push(lock, table, chunk)
+    finally:
+        lock.close()
+
+
+if __name__ == "__main__":
+    main()
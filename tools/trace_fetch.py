@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Renan Augusto Starke
+#
+# This file is part of project "IoT Lock".
+#
+"""Download the field trace of a lock over MQTT.
+
+Publishes "dump" (or "clear") to lpae/dev/<device id>/trace with an MQTT5
+response topic, collects the {"seq": n, "data": "<base64>"} chunks until
+{"done": n} and writes the decoded bytes as a trace file. Replay it with the
+host harness, see host/CMakeLists.txt:
+
+    tools/trace_fetch.py --broker broker.local 24:0a:c4:00:00:01 field.trc
+    build_host/trace_replay field.trc
+
+Needs paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import base64
+import os
+import re
+import struct
+import sys
+import threading
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+
+MAGIC = 0x31435254        # "TRC1", see main/Trace.h
+HEADER = struct.Struct("<IHHqqII")
+WRAPPED = 1
+
+SEQ = re.compile(r'"?seq"?\s*:\s*(\d+)')
+DATA = re.compile(r'"?data"?\s*:\s*"([A-Za-z0-9+/=]*)"')
+DONE = re.compile(r'"?done"?\s*:\s*(\d+)')
+TRUNCATED = re.compile(r'"?truncated"?\s*:\s*(1|true)')
+
+
+def fetch(args):
+    chunks = {}
+    result = {}
+    finished = threading.Event()
+    correlation = os.urandom(8)
+    response_topic = "lpae/trace_fetch/%s" % correlation.hex()
+
+    def on_connect(client, userdata, flags, reason, properties=None):
+        client.subscribe(response_topic, qos=1)
+
+    def on_subscribe(client, userdata, mid, reason, properties=None):
+        properties = Properties(PacketTypes.PUBLISH)
+        properties.ResponseTopic = response_topic
+        properties.CorrelationData = correlation
+        client.publish("lpae/dev/%s/trace" % args.device, args.command, qos=1, properties=properties)
+
+    def on_message(client, userdata, message):
+        props = getattr(message, "properties", None)
+        if props is not None and getattr(props, "CorrelationData", correlation) != correlation:
+            return
+        text = message.payload.decode(errors="replace")
+
+        done = DONE.search(text)
+        if done or "cleared" in text or "error" in text:
+            result["text"] = text
+            result["done"] = int(done.group(1)) if done else None
+            result["truncated"] = bool(TRUNCATED.search(text))
+            finished.set()
+            return
+
+        seq, data = SEQ.search(text), DATA.search(text)
+        if seq and data:
+            chunks[int(seq.group(1))] = base64.b64decode(data.group(1))
+
+    client = mqtt.Client(protocol=mqtt.MQTTv5)
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.on_connect = on_connect
+    client.on_subscribe = on_subscribe
+    client.on_message = on_message
+    client.connect(args.broker, args.port)
+    client.loop_start()
+
+    if not finished.wait(args.timeout):
+        client.loop_stop()
+        sys.exit("timeout: %d chunks received" % len(chunks))
+    client.loop_stop()
+    client.disconnect()
+
+    return chunks, result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("device", help="device id, as in lpae/dev/<device id>/")
+    parser.add_argument("output", nargs="?", help="trace file (dump only)")
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--clear", dest="command", action="store_const", const="clear", default="dump",
+                        help="clear the trace instead of downloading it")
+    parser.add_argument("--timeout", type=float, default=60)
+    args = parser.parse_args()
+
+    if args.command == "dump" and not args.output:
+        parser.error("output file required")
+
+    chunks, result = fetch(args)
+
+    if args.command == "clear" or result["done"] is None:
+        print(result["text"])
+        return
+
+    missing = [seq for seq in range(len(chunks)) if seq not in chunks]
+    if missing or max(chunks, default=-1) != len(chunks) - 1:
+        sys.exit("missing chunks: %s" % missing)
+
+    trace = b"".join(chunks[seq] for seq in range(len(chunks)))
+    if len(trace) != result["done"]:
+        sys.exit("received %d bytes, device sent %d" % (len(trace), result["done"]))
+    if len(trace) < HEADER.size or HEADER.unpack_from(trace)[0] != MAGIC:
+        sys.exit("not a trace file")
+
+    with open(args.output, "wb") as f:
+        f.write(trace)
+
+    flags = HEADER.unpack_from(trace)[2]
+    print("%s: %d bytes%s%s" % (args.output, len(trace),
+                                ", wrapped" if flags & WRAPPED else "",
+                                ", truncated: recording overtook the download" if result["truncated"] else ""))
+
+
+if __name__ == "__main__":
+    main()